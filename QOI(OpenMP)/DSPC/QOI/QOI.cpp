@@ -413,6 +413,9 @@
 #include <omp.h>
 #include <vector>
 #include <map>
+#include <atomic>
+#include <thread>
+#include <algorithm>
 
 // ... (keep all the includes and utility functions)
 #define STB_IMAGE_IMPLEMENTATION
@@ -435,7 +438,7 @@ std::string format_duration(double milliseconds) {
     return oss.str();
 }
 
-std::string format_size(int size) {
+std::string format_size(size_t size) {
     if (size < 1024) return std::to_string(size) + " B";
     if (size < 1024 * 1024) return std::to_string(size / 1024) + " KB";
     return std::to_string(size / (1024 * 1024)) + " MB";
@@ -445,6 +448,29 @@ double calculate_speedup(double sequential_time, double parallel_time) {
     return sequential_time / parallel_time;
 }
 
+// Names of the PNG and JPEG files in dir, or of the .qoi files if qoi is set
+std::vector<std::string> list_images(const char* dir, bool qoi = false) {
+    WIN32_FIND_DATAA findData;
+    char search_path[MAX_PATH];
+    std::vector<std::string> files;
+
+    sprintf_s(search_path, "%s\\*.*", dir);
+    HANDLE hFind = FindFirstFileA(search_path, &findData);
+    if (hFind != INVALID_HANDLE_VALUE) {
+        do {
+            if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+                char* ext = strrchr(findData.cFileName, '.');
+                if (ext && (qoi ? _stricmp(ext, ".qoi") == 0 :
+                    _stricmp(ext, ".png") == 0 || _stricmp(ext, ".jpg") == 0 || _stricmp(ext, ".jpeg") == 0)) {
+                    files.push_back(findData.cFileName);
+                }
+            }
+        } while (FindNextFileA(hFind, &findData));
+        FindClose(hFind);
+    }
+    return files;
+}
+
 struct ProcessingResult {
     std::string filename;
     double processing_time;  // in milliseconds
@@ -492,7 +518,7 @@ ProcessingResult encode_file(const std::string& input_path, const std::string& o
     };
 
     int64_t start_time = get_time_ns();
-    int encoded_size;
+    size_t encoded_size;
     void* encoded_data = is_parallel ?
         qoi_encode_parallel_block_simple(data, &desc, &encoded_size, num_threads) :
         qoi_encode_modify(data, &desc, &encoded_size);
@@ -530,19 +556,14 @@ ProcessingResult decode_file(const std::string& input_path, const std::string& o
     result.filename = input_path.substr(input_path.find_last_of("/\\") + 1);
     result.output_path = output_path;
 
-    FILE* f = fopen(input_path.c_str(), "rb");
-    if (!f) {
+    // Map the file with all pages faulted in, so only decoding is timed
+    size_t file_size;
+    const void* raw_data = qoi_map_file(input_path.c_str(), &file_size, QOI_MAP_POPULATE);
+    if (!raw_data) {
         printf("Failed to open QOI file: %s\n", input_path.c_str());
         return result;
     }
 
-    fseek(f, 0, SEEK_END);
-    int file_size = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    void* raw_data = malloc(file_size);
-    fread(raw_data, 1, file_size, f);
-    fclose(f);
-
     int64_t start_time = get_time_ns();
     qoi_desc desc;
     void* decoded_data = is_parallel ?
@@ -555,7 +576,7 @@ ProcessingResult decode_file(const std::string& input_path, const std::string& o
             desc.channels, decoded_data, desc.width * desc.channels);
         free(decoded_data);
     }
-    free(raw_data);
+    qoi_unmap_file(raw_data, file_size);
     result.width = desc.width;
     result.height = desc.height;
     result.channels = desc.channels;
@@ -630,9 +651,1174 @@ void save_performance_data(const std::string& output_file,
     printf("\nPerformance data saved to: %s\n", output_file.c_str());
 }
 
+// Synthesize a width x height RGBA image in memory and time block encode/decode on it.
+// stb_image cannot load images past 2 GB, so this is how the >4 GB path is exercised.
+void benchmark_large_image(size_t width, size_t height, const std::vector<int>& thread_counts) {
+    size_t raw_size = width * height * 4;
+    unsigned char* data = (unsigned char*)malloc(raw_size);
+    if (!data) {
+        printf("Failed to allocate %s for a %zux%zu image\n", format_size(raw_size).c_str(), width, height);
+        return;
+    }
+
+    // Gradients with flat bands and a little noise, so every op type shows up
+    #pragma omp parallel for schedule(static)
+    for (long long y = 0; y < (long long)height; y++) {
+        unsigned char* row = data + (size_t)y * width * 4;
+        unsigned int seed = (unsigned int)y * 2654435761u;
+        for (size_t x = 0; x < width; x++) {
+            seed = seed * 1103515245u + 12345u;
+            bool flat = ((x >> 8) & 3) == 0;
+            row[x * 4 + 0] = flat ? 40 : (unsigned char)(x + (seed >> 30));
+            row[x * 4 + 1] = flat ? 40 : (unsigned char)(y + (x >> 4));
+            row[x * 4 + 2] = flat ? 40 : (unsigned char)((x ^ (size_t)y) >> 3);
+            row[x * 4 + 3] = 255;
+        }
+    }
+
+    qoi_desc desc = { (unsigned int)width, (unsigned int)height, 4, QOI_SRGB };
+    double raw_mb = raw_size / (1024.0 * 1024.0);
+
+    printf("\n+=========================================================================+\n");
+    printf("| LARGE IMAGE: %zux%zu RGBA (%s)\n", width, height, format_size(raw_size).c_str());
+    printf("+----------+-------------+-------------+-------------+-------------+--------+\n");
+    printf("| Threads  | Encode      | Encode MB/s | Decode      | Decode MB/s | Match  |\n");
+    printf("+----------+-------------+-------------+-------------+-------------+--------+\n");
+
+    for (size_t t = 0; t < thread_counts.size(); t++) {
+        size_t encoded_size;
+        int64_t start_time = get_time_ns();
+        void* encoded_data = qoi_encode_parallel_block_simple(data, &desc, &encoded_size, thread_counts[t]);
+        double encode_ms = (get_time_ns() - start_time) / 1e6;
+        if (!encoded_data) {
+            printf("| %-8d | encode failed                                                 |\n", thread_counts[t]);
+            continue;
+        }
+
+        qoi_desc decoded_desc;
+        start_time = get_time_ns();
+        void* decoded_data = qoi_decode_parallel_block_simple(encoded_data, encoded_size, &decoded_desc, 0, thread_counts[t]);
+        double decode_ms = (get_time_ns() - start_time) / 1e6;
+        free(encoded_data);
+
+        bool match = decoded_data && memcmp(decoded_data, data, raw_size) == 0;
+        free(decoded_data);
+
+        printf("| %-8d | %8.2f ms | %11.1f | %8.2f ms | %11.1f | %-6s |\n",
+            thread_counts[t], encode_ms, raw_mb / (encode_ms / 1e3),
+            decode_ms, raw_mb / (decode_ms / 1e3), match ? "yes" : "NO");
+    }
+    printf("+----------+-------------+-------------+-------------+-------------+--------+\n\n");
+
+    free(data);
+}
+
+// Time decoding rows y0..y1-1 of a block-parallel QOI file against decoding the whole image.
+void benchmark_rows(const char* input_path, unsigned int y0, unsigned int y1, const std::vector<int>& thread_counts) {
+    // Map the file with all pages faulted in, so only decoding is timed
+    size_t file_size;
+    const void* raw_data = qoi_map_file(input_path, &file_size, QOI_MAP_POPULATE);
+    if (!raw_data) {
+        printf("Failed to open QOI file: %s\n", input_path);
+        return;
+    }
+
+    printf("\n+=========================================================================+\n");
+    printf("| ROWS %u-%u of %s\n", y0, y1 - 1, input_path);
+    printf("+----------+-------------+-------------+----------+--------+\n");
+    printf("| Threads  | Full decode | Rows decode | Speedup  | Match  |\n");
+    printf("+----------+-------------+-------------+----------+--------+\n");
+
+    for (size_t t = 0; t < thread_counts.size(); t++) {
+        qoi_desc desc;
+        int64_t start_time = get_time_ns();
+        unsigned char* full = (unsigned char*)qoi_decode_parallel_block_simple(raw_data, file_size, &desc, 0, thread_counts[t]);
+        double full_ms = (get_time_ns() - start_time) / 1e6;
+
+        start_time = get_time_ns();
+        unsigned char* rows = (unsigned char*)qoi_decode_rows(raw_data, file_size, y0, y1, &desc, 0, thread_counts[t]);
+        double rows_ms = (get_time_ns() - start_time) / 1e6;
+
+        if (!full || !rows) {
+            printf("| %-8d | decode failed (not a block-parallel file or bad rows)  |\n", thread_counts[t]);
+            free(full);
+            free(rows);
+            continue;
+        }
+
+        size_t row_len = (size_t)desc.width * desc.channels;
+        bool match = memcmp(rows, full + (size_t)y0 * row_len, (size_t)(y1 - y0) * row_len) == 0;
+        free(full);
+        free(rows);
+
+        printf("| %-8d | %8.2f ms | %8.2f ms | %7.2fx | %-6s |\n",
+            thread_counts[t], full_ms, rows_ms, calculate_speedup(full_ms, rows_ms), match ? "yes" : "NO");
+    }
+    printf("+----------+-------------+-------------+----------+--------+\n\n");
+
+    qoi_unmap_file(raw_data, file_size);
+}
+
+// Time decoding a block-parallel QOI file straight into a 1/factor thumbnail and save it as PNG.
+void benchmark_thumbnail(const char* input_path, const char* output_path, int factor, const std::vector<int>& thread_counts) {
+    // Map the file with all pages faulted in, so only decoding is timed
+    size_t file_size;
+    const void* raw_data = qoi_map_file(input_path, &file_size, QOI_MAP_POPULATE);
+    if (!raw_data) {
+        printf("Failed to open QOI file: %s\n", input_path);
+        return;
+    }
+
+    printf("\n+=========================================================================+\n");
+    printf("| THUMBNAIL 1/%d of %s\n", factor, input_path);
+    printf("+----------+-------------+-------------+----------+\n");
+    printf("| Threads  | Full decode | Thumbnail   | Speedup  |\n");
+    printf("+----------+-------------+-------------+----------+\n");
+
+    for (size_t t = 0; t < thread_counts.size(); t++) {
+        qoi_desc desc;
+        int64_t start_time = get_time_ns();
+        void* full = qoi_decode_parallel_block_simple(raw_data, file_size, &desc, 0, thread_counts[t]);
+        double full_ms = (get_time_ns() - start_time) / 1e6;
+        bool full_ok = full != NULL;
+        free(full);
+
+        start_time = get_time_ns();
+        void* thumb = qoi_decode_thumbnail(raw_data, file_size, &desc, 0, factor, thread_counts[t]);
+        double thumb_ms = (get_time_ns() - start_time) / 1e6;
+
+        if (!full_ok || !thumb) {
+            printf("| %-8d | decode failed (not a block-parallel file?)  |\n", thread_counts[t]);
+            free(thumb);
+            continue;
+        }
+
+        if (t == 0) {
+            stbi_write_png(output_path, desc.width, desc.height,
+                desc.channels, thumb, desc.width * desc.channels);
+        }
+        free(thumb);
+
+        printf("| %-8d | %8.2f ms | %8.2f ms | %7.2fx |\n",
+            thread_counts[t], full_ms, thumb_ms, calculate_speedup(full_ms, thumb_ms));
+    }
+    printf("+----------+-------------+-------------+----------+\n\n");
+
+    qoi_unmap_file(raw_data, file_size);
+}
+
+// Compare encoding a whole block-parallel image in memory and writing it with one fwrite
+// against qoi_write_parallel_block, which writes each block while later ones still encode.
+void benchmark_write(const char* input_dir, const char* output_dir, const std::vector<int>& thread_counts) {
+    std::vector<std::string> input_files = list_images(input_dir);
+
+    printf("\n+=========================================================================+\n");
+    printf("| WRITE: encode + fwrite against qoi_write_parallel_block\n");
+    printf("+----------------------+----------+-------------+-------------+----------+------------+-------+\n");
+    printf("| Image                | Threads  | Buffered    | Streamed    | Speedup  | Buffer     | Match |\n");
+    printf("+----------------------+----------+-------------+-------------+----------+------------+-------+\n");
+
+    for (const auto& filename : input_files) {
+        char input_path[MAX_PATH];
+        char buffered_path[MAX_PATH];
+        char streamed_path[MAX_PATH];
+        sprintf_s(input_path, "%s\\%s", input_dir, filename.c_str());
+        sprintf_s(buffered_path, "%s\\buf_%s.qoi", output_dir, filename.c_str());
+        sprintf_s(streamed_path, "%s\\str_%s.qoi", output_dir, filename.c_str());
+
+        int width, height, channels;
+        unsigned char* data = stbi_load(input_path, &width, &height, &channels, 0);
+        if (!data) {
+            printf("Failed to load image: %s\n", input_path);
+            continue;
+        }
+        qoi_desc desc = { (unsigned int)width, (unsigned int)height, channels, QOI_SRGB };
+
+        for (size_t t = 0; t < thread_counts.size(); t++) {
+            int64_t start_time = get_time_ns();
+            size_t encoded_size = 0;
+            void* encoded_data = qoi_encode_parallel_block_simple(data, &desc, &encoded_size, thread_counts[t]);
+            if (encoded_data) {
+                FILE* f = fopen(buffered_path, "wb");
+                if (f) {
+                    fwrite(encoded_data, 1, encoded_size, f);
+                    fclose(f);
+                }
+                free(encoded_data);
+            }
+            double buffered_ms = (get_time_ns() - start_time) / 1e6;
+
+            start_time = get_time_ns();
+            size_t written = qoi_write_parallel_block(streamed_path, data, &desc, thread_counts[t]);
+            double streamed_ms = (get_time_ns() - start_time) / 1e6;
+
+            size_t buffered_size, streamed_size;
+            const void* buffered = qoi_map_file(buffered_path, &buffered_size, 0);
+            const void* streamed = qoi_map_file(streamed_path, &streamed_size, 0);
+            bool match = buffered && streamed && written == encoded_size && buffered_size == streamed_size &&
+                memcmp(buffered, streamed, buffered_size) == 0;
+            qoi_unmap_file(buffered, buffered_size);
+            qoi_unmap_file(streamed, streamed_size);
+
+            // The buffered path holds the whole worst-case encoded image in memory
+            printf("| %-20.20s | %-8d | %8.2f ms | %8.2f ms | %7.2fx | %10s | %-5s |\n",
+                filename.c_str(), thread_counts[t], buffered_ms, streamed_ms,
+                calculate_speedup(buffered_ms, streamed_ms),
+                format_size(qoi_max_encoded_size_block(&desc)).c_str(), match ? "yes" : "NO");
+        }
+        stbi_image_free(data);
+    }
+    printf("+----------------------+----------+-------------+-------------+----------+------------+-------+\n\n");
+}
+
+// Compare qoi_encode with qoi_encode_parallel_fmt_into, whose output is a standard QOI
+// stream, and check that qoi_decode reads it back. The output of the last thread count is
+// saved, so it can be opened with any QOI viewer.
+void benchmark_standard(const char* input_dir, const char* output_dir, const std::vector<int>& thread_counts) {
+    std::vector<std::string> input_files = list_images(input_dir);
+
+    printf("\n+=========================================================================+\n");
+    printf("| STANDARD QOI: qoi_encode against qoi_encode_parallel_fmt_into\n");
+    printf("+----------------------+----------+-------------+-------------+----------+----------+-------+\n");
+    printf("| Image                | Threads  | qoi_encode  | Parallel    | Speedup  | Size     | Match |\n");
+    printf("+----------------------+----------+-------------+-------------+----------+----------+-------+\n");
+
+    for (const auto& filename : input_files) {
+        char input_path[MAX_PATH];
+        char output_path[MAX_PATH];
+        sprintf_s(input_path, "%s\\%s", input_dir, filename.c_str());
+        sprintf_s(output_path, "%s\\std_%.*s.qoi", output_dir,
+            (int)filename.find_last_of('.'), filename.c_str());
+
+        int width, height, channels;
+        unsigned char* data = stbi_load(input_path, &width, &height, &channels, 0);
+        if (!data) {
+            printf("Failed to load image: %s\n", input_path);
+            continue;
+        }
+        qoi_desc desc = { (unsigned int)width, (unsigned int)height, channels, QOI_SRGB };
+        size_t raw_size = (size_t)width * height * channels;
+
+        int64_t start_time = get_time_ns();
+        size_t serial_size;
+        void* serial_data = qoi_encode(data, &desc, &serial_size);
+        double serial_ms = (get_time_ns() - start_time) / 1e6;
+        free(serial_data);
+
+        size_t max_size = qoi_max_encoded_size(&desc);
+        void* encoded_data = malloc(max_size);
+        for (size_t t = 0; encoded_data && t < thread_counts.size(); t++) {
+            start_time = get_time_ns();
+            size_t encoded_size = qoi_encode_parallel_fmt_into(data, 0, 0, &desc, encoded_data, max_size, thread_counts[t]);
+            double parallel_ms = (get_time_ns() - start_time) / 1e6;
+
+            qoi_desc decoded_desc;
+            void* decoded_data = encoded_size ? qoi_decode(encoded_data, encoded_size, &decoded_desc, 0) : NULL;
+            bool match = decoded_data && memcmp(decoded_data, data, raw_size) == 0;
+            free(decoded_data);
+
+            if (t == thread_counts.size() - 1 && encoded_size) {
+                FILE* f = fopen(output_path, "wb");
+                if (f) {
+                    fwrite(encoded_data, 1, encoded_size, f);
+                    fclose(f);
+                }
+            }
+
+            // Size relative to qoi_encode: strips lose the index entries of the strips before them
+            printf("| %-20.20s | %-8d | %8.2f ms | %8.2f ms | %7.2fx | %+7.3f%% | %-5s |\n",
+                filename.c_str(), thread_counts[t], serial_ms, parallel_ms,
+                calculate_speedup(serial_ms, parallel_ms),
+                100.0 * ((double)encoded_size - serial_size) / serial_size, match ? "yes" : "NO");
+        }
+        free(encoded_data);
+        stbi_image_free(data);
+    }
+    printf("+----------------------+----------+-------------+-------------+----------+----------+-------+\n\n");
+}
+
+// Compare qoi_decode_into_fmt with qoi_decode_parallel_fmt_into on standard QOI streams from
+// qoi_encode. The totals over all images give the speedup for every thread count.
+void benchmark_decode_standard(const char* input_dir, const std::vector<int>& thread_counts) {
+    std::vector<std::string> input_files = list_images(input_dir);
+
+    printf("\n+=========================================================================+\n");
+    printf("| STANDARD QOI: qoi_decode_into_fmt against qoi_decode_parallel_fmt_into\n");
+    printf("+----------------------+----------+-------------+-------------+----------+-------+\n");
+    printf("| Image                | Threads  | Serial      | Parallel    | Speedup  | Match |\n");
+    printf("+----------------------+----------+-------------+-------------+----------+-------+\n");
+
+    double serial_total = 0;
+    std::vector<double> parallel_total(thread_counts.size(), 0.0);
+
+    for (const auto& filename : input_files) {
+        char input_path[MAX_PATH];
+        sprintf_s(input_path, "%s\\%s", input_dir, filename.c_str());
+
+        int width, height, channels;
+        unsigned char* data = stbi_load(input_path, &width, &height, &channels, 0);
+        if (!data) {
+            printf("Failed to load image: %s\n", input_path);
+            continue;
+        }
+        qoi_desc desc = { (unsigned int)width, (unsigned int)height, channels, QOI_SRGB };
+        size_t raw_size = (size_t)width * height * channels;
+
+        size_t encoded_size;
+        void* encoded_data = qoi_encode(data, &desc, &encoded_size);
+        unsigned char* decoded_data = encoded_data ? (unsigned char*)malloc(raw_size) : NULL;
+        if (!decoded_data) {
+            printf("Failed to encode image: %s\n", input_path);
+            free(encoded_data);
+            stbi_image_free(data);
+            continue;
+        }
+
+        // Both decode into the same buffer, so neither pays for touching fresh pages
+        qoi_desc decoded_desc;
+        memset(decoded_data, 0, raw_size);
+        int64_t start_time = get_time_ns();
+        qoi_decode_into_fmt(encoded_data, encoded_size, &decoded_desc, decoded_data, 0, raw_size, channels);
+        double serial_ms = (get_time_ns() - start_time) / 1e6;
+        serial_total += serial_ms;
+
+        for (size_t t = 0; t < thread_counts.size(); t++) {
+            memset(decoded_data, 0, raw_size);
+            start_time = get_time_ns();
+            size_t decoded_size = qoi_decode_parallel_fmt_into(encoded_data, encoded_size, &decoded_desc,
+                decoded_data, raw_size, channels, thread_counts[t]);
+            double parallel_ms = (get_time_ns() - start_time) / 1e6;
+            parallel_total[t] += parallel_ms;
+
+            bool match = decoded_size == raw_size && memcmp(decoded_data, data, raw_size) == 0;
+            printf("| %-20.20s | %-8d | %8.2f ms | %8.2f ms | %7.2fx | %-5s |\n",
+                filename.c_str(), thread_counts[t], serial_ms, parallel_ms,
+                calculate_speedup(serial_ms, parallel_ms), match ? "yes" : "NO");
+        }
+        free(decoded_data);
+        free(encoded_data);
+        stbi_image_free(data);
+    }
+    printf("+----------------------+----------+-------------+-------------+----------+-------+\n");
+    for (size_t t = 0; t < thread_counts.size(); t++) {
+        printf("| %-20s | %-8d | %8.2f ms | %8.2f ms | %7.2fx |       |\n",
+            "Total", thread_counts[t], serial_total, parallel_total[t],
+            calculate_speedup(serial_total, parallel_total[t]));
+    }
+    printf("+----------------------+----------+-------------+-------------+----------+-------+\n\n");
+}
+
+// Write every image as a standard QOI file with its seek index (.qoix) beside it, then
+// compare qoi_decode_into_fmt with decoding the whole file, and a quarter of its rows
+// from the middle, from the checkpoints of the index.
+void benchmark_seek(const char* input_dir, const char* output_dir, const std::vector<int>& thread_counts) {
+    std::vector<std::string> input_files = list_images(input_dir);
+
+    printf("\n+=========================================================================+\n");
+    printf("| SEEK INDEX: qoi_decode_into_fmt against qoi_decode_rows_indexed_into\n");
+    printf("+----------------------+----------+-------------+-------------+-------------+----------+-------------+-------+\n");
+    printf("| Image                | Threads  | Index build | Serial      | Indexed     | Speedup  | 1/4 rows    | Match |\n");
+    printf("+----------------------+----------+-------------+-------------+-------------+----------+-------------+-------+\n");
+
+    for (const auto& filename : input_files) {
+        char input_path[MAX_PATH];
+        char output_path[MAX_PATH];
+        char index_path[MAX_PATH];
+        sprintf_s(input_path, "%s\\%s", input_dir, filename.c_str());
+        sprintf_s(output_path, "%s\\std_%.*s.qoi", output_dir,
+            (int)filename.find_last_of('.'), filename.c_str());
+        sprintf_s(index_path, "%sx", output_path);
+
+        int width, height, channels;
+        unsigned char* data = stbi_load(input_path, &width, &height, &channels, 0);
+        if (!data) {
+            printf("Failed to load image: %s\n", input_path);
+            continue;
+        }
+        qoi_desc desc = { (unsigned int)width, (unsigned int)height, channels, QOI_SRGB };
+        size_t raw_size = (size_t)width * height * channels;
+        size_t row_len = (size_t)width * channels;
+
+        int64_t start_time = get_time_ns();
+        size_t index_written = qoi_write(output_path, data, &desc) ? qoi_write_seek_index(output_path, index_path, 0) : 0;
+        double build_ms = (get_time_ns() - start_time) / 1e6;
+
+        size_t encoded_size = 0, index_size = 0;
+        const void* encoded_data = index_written ? qoi_map_file(output_path, &encoded_size, QOI_MAP_POPULATE) : NULL;
+        const void* index_data = encoded_data ? qoi_map_file(index_path, &index_size, QOI_MAP_POPULATE) : NULL;
+        unsigned char* decoded_data = index_data ? (unsigned char*)malloc(raw_size) : NULL;
+        if (!decoded_data) {
+            printf("Failed to write or map the QOI file and index of: %s\n", input_path);
+            if (index_data) {
+                qoi_unmap_file(index_data, index_size);
+            }
+            if (encoded_data) {
+                qoi_unmap_file(encoded_data, encoded_size);
+            }
+            stbi_image_free(data);
+            continue;
+        }
+
+        // Both decode into the same buffer, so neither pays for touching fresh pages
+        qoi_desc decoded_desc;
+        memset(decoded_data, 0, raw_size);
+        start_time = get_time_ns();
+        qoi_decode_into_fmt(encoded_data, encoded_size, &decoded_desc, decoded_data, 0, raw_size, channels);
+        double serial_ms = (get_time_ns() - start_time) / 1e6;
+
+        unsigned int y0 = (unsigned int)height * 3 / 8;
+        unsigned int y1 = y0 + ((unsigned int)height + 3) / 4;
+        for (size_t t = 0; t < thread_counts.size(); t++) {
+            memset(decoded_data, 0, raw_size);
+            start_time = get_time_ns();
+            size_t decoded_size = qoi_decode_rows_indexed_into(encoded_data, encoded_size, index_data, index_size,
+                0, height, &decoded_desc, decoded_data, 0, raw_size, channels, thread_counts[t]);
+            double indexed_ms = (get_time_ns() - start_time) / 1e6;
+            bool match = decoded_size == raw_size && memcmp(decoded_data, data, raw_size) == 0;
+
+            memset(decoded_data, 0, raw_size);
+            start_time = get_time_ns();
+            decoded_size = qoi_decode_rows_indexed_into(encoded_data, encoded_size, index_data, index_size,
+                y0, y1, &decoded_desc, decoded_data, 0, raw_size, channels, thread_counts[t]);
+            double rows_ms = (get_time_ns() - start_time) / 1e6;
+            match = match && decoded_size == (y1 - y0) * row_len &&
+                memcmp(decoded_data, data + y0 * row_len, decoded_size) == 0;
+
+            printf("| %-20.20s | %-8d | %8.2f ms | %8.2f ms | %8.2f ms | %7.2fx | %8.2f ms | %-5s |\n",
+                filename.c_str(), thread_counts[t], build_ms, serial_ms, indexed_ms,
+                calculate_speedup(serial_ms, indexed_ms), rows_ms, match ? "yes" : "NO");
+        }
+        free(decoded_data);
+        qoi_unmap_file(index_data, index_size);
+        qoi_unmap_file(encoded_data, encoded_size);
+        stbi_image_free(data);
+    }
+    printf("+----------------------+----------+-------------+-------------+-------------+----------+-------------+-------+\n\n");
+}
+
+// Encode and decode every image in the block container at a range of fixed block heights and
+// at the height qoi_block_height picks (auto), and print the totals over all images. Smaller
+// blocks give the threads more work to balance, larger ones lose less of the index and run.
+void benchmark_block_height(const char* input_dir, const std::vector<int>& thread_counts) {
+    std::vector<std::string> input_files = list_images(input_dir);
+
+    // Load everything up front so the sweep times only the codec
+    struct Image {
+        unsigned char* data;
+        qoi_desc desc;
+    };
+    std::vector<Image> images;
+    size_t serial_size = 0;
+    for (const auto& filename : input_files) {
+        char input_path[MAX_PATH];
+        sprintf_s(input_path, "%s\\%s", input_dir, filename.c_str());
+
+        int width, height, channels;
+        unsigned char* data = stbi_load(input_path, &width, &height, &channels, 0);
+        if (!data) {
+            printf("Failed to load image: %s\n", input_path);
+            continue;
+        }
+        Image image = { data, { (unsigned int)width, (unsigned int)height, (unsigned char)channels, QOI_SRGB } };
+        size_t encoded_size;
+        void* encoded_data = qoi_encode(data, &image.desc, &encoded_size);
+        if (!encoded_data) {
+            printf("Failed to encode image: %s\n", input_path);
+            stbi_image_free(data);
+            continue;
+        }
+        free(encoded_data);
+        serial_size += encoded_size;
+        images.push_back(image);
+    }
+
+    printf("\n+=========================================================================+\n");
+    printf("| BLOCK HEIGHT: %zu images, %zu bytes from qoi_encode\n", images.size(), serial_size);
+    printf("+----------+----------+-------------+-------------+--------------+----------+-------+\n");
+    printf("| Rows     | Threads  | Encode      | Decode      | Size         | vs QOI   | Match |\n");
+    printf("+----------+----------+-------------+-------------+--------------+----------+-------+\n");
+
+    const int heights[] = { 8, 16, 32, 64, 128, 256, 512, 0 };
+    for (int h = 0; h < (int)(sizeof(heights) / sizeof(heights[0])); h++) {
+        for (size_t t = 0; t < thread_counts.size(); t++) {
+            double encode_ms = 0, decode_ms = 0;
+            size_t total_size = 0;
+            bool match = true;
+            for (const auto& image : images) {
+                size_t raw_size = (size_t)image.desc.width * image.desc.height * image.desc.channels;
+                size_t max_size = qoi_max_encoded_size_block(&image.desc);
+                void* encoded_data = malloc(max_size);
+                unsigned char* decoded_data = (unsigned char*)malloc(raw_size);
+                if (!encoded_data || !decoded_data) {
+                    free(encoded_data);
+                    free(decoded_data);
+                    match = false;
+                    continue;
+                }
+
+                int64_t start_time = get_time_ns();
+                size_t encoded_size = qoi_encode_parallel_block_height_into(image.data, 0, 0, &image.desc,
+                    encoded_data, max_size, heights[h], thread_counts[t]);
+                encode_ms += (get_time_ns() - start_time) / 1e6;
+                total_size += encoded_size;
+
+                qoi_desc decoded_desc;
+                start_time = get_time_ns();
+                size_t decoded_size = encoded_size ? qoi_decode_parallel_block_fmt_into(encoded_data, encoded_size,
+                    &decoded_desc, decoded_data, 0, raw_size, image.desc.channels, thread_counts[t]) : 0;
+                decode_ms += (get_time_ns() - start_time) / 1e6;
+
+                match = match && decoded_size == raw_size && memcmp(decoded_data, image.data, raw_size) == 0;
+                free(decoded_data);
+                free(encoded_data);
+            }
+
+            char rows[16];
+            if (heights[h]) sprintf_s(rows, "%d", heights[h]);
+            else sprintf_s(rows, "auto");
+            printf("| %-8s | %-8d | %8.2f ms | %8.2f ms | %12zu | %+7.3f%% | %-5s |\n",
+                rows, thread_counts[t], encode_ms, decode_ms, total_size,
+                serial_size ? 100.0 * ((double)total_size - serial_size) / serial_size : 0.0, match ? "yes" : "NO");
+        }
+    }
+    printf("+----------+----------+-------------+-------------+--------------+----------+-------+\n\n");
+
+    for (const auto& image : images) {
+        stbi_image_free(image.data);
+    }
+}
+
+// Encode every image both as row strips and as tiles, and time decoding a 512x512 viewport
+// from the middle of each with qoi_decode_rect_into: the strips decode their full width,
+// the tiles only the ones the viewport touches.
+void benchmark_tiles(const char* input_dir, const char* output_dir, const std::vector<int>& thread_counts) {
+    std::vector<std::string> input_files = list_images(input_dir);
+
+    printf("\n+=========================================================================+\n");
+    printf("| VIEWPORT 512x512: row strips against %dx%d tiles\n", QOI_TILE_SIZE, QOI_TILE_SIZE);
+    printf("+----------------------+----------+-------------+-------------+----------+----------+-------+\n");
+    printf("| Image                | Threads  | Strips      | Tiles       | Speedup  | Size     | Match |\n");
+    printf("+----------------------+----------+-------------+-------------+----------+----------+-------+\n");
+
+    for (const auto& filename : input_files) {
+        char input_path[MAX_PATH];
+        char output_path[MAX_PATH];
+        sprintf_s(input_path, "%s\\%s", input_dir, filename.c_str());
+        sprintf_s(output_path, "%s\\tile_%.*s.qoi", output_dir,
+            (int)filename.find_last_of('.'), filename.c_str());
+
+        int width, height, channels;
+        unsigned char* data = stbi_load(input_path, &width, &height, &channels, 0);
+        if (!data) {
+            printf("Failed to load image: %s\n", input_path);
+            continue;
+        }
+        qoi_desc desc = { (unsigned int)width, (unsigned int)height, (unsigned char)channels, QOI_SRGB };
+
+        size_t strips_size, tiles_size;
+        void* strips = qoi_encode_parallel_block_simple(data, &desc, &strips_size, thread_counts.back());
+        void* tiles = qoi_encode_tiled(data, &desc, 0, 0, &tiles_size, thread_counts.back());
+        if (!strips || !tiles) {
+            printf("Failed to encode image: %s\n", input_path);
+            free(strips);
+            free(tiles);
+            stbi_image_free(data);
+            continue;
+        }
+
+        FILE* f = fopen(output_path, "wb");
+        if (f) {
+            fwrite(tiles, 1, tiles_size, f);
+            fclose(f);
+        }
+
+        // The viewport is centred, and clipped to images smaller than it
+        unsigned int x0 = width > 512 ? (width - 512) / 2 : 0;
+        unsigned int y0 = height > 512 ? (height - 512) / 2 : 0;
+        unsigned int x1 = min(x0 + 512, (unsigned int)width);
+        unsigned int y1 = min(y0 + 512, (unsigned int)height);
+        size_t rect_size = (size_t)(x1 - x0) * (y1 - y0) * channels;
+        unsigned char* strips_rect = (unsigned char*)malloc(rect_size);
+        unsigned char* tiles_rect = (unsigned char*)malloc(rect_size);
+
+        for (size_t t = 0; strips_rect && tiles_rect && t < thread_counts.size(); t++) {
+            qoi_desc decoded_desc;
+            int64_t start_time = get_time_ns();
+            size_t strips_len = qoi_decode_rect_into(strips, strips_size, x0, y0, x1, y1, &decoded_desc,
+                strips_rect, 0, rect_size, 0, thread_counts[t]);
+            double strips_ms = (get_time_ns() - start_time) / 1e6;
+
+            start_time = get_time_ns();
+            size_t tiles_len = qoi_decode_rect_into(tiles, tiles_size, x0, y0, x1, y1, &decoded_desc,
+                tiles_rect, 0, rect_size, 0, thread_counts[t]);
+            double tiles_ms = (get_time_ns() - start_time) / 1e6;
+
+            bool match = strips_len == rect_size && tiles_len == rect_size;
+            for (unsigned int y = y0; match && y < y1; y++) {
+                match = memcmp(tiles_rect + (size_t)(y - y0) * (x1 - x0) * channels,
+                    data + ((size_t)y * width + x0) * channels, (size_t)(x1 - x0) * channels) == 0;
+            }
+            match = match && memcmp(strips_rect, tiles_rect, rect_size) == 0;
+
+            // Size of the tiles relative to the strips: every tile starts with a fresh index
+            printf("| %-20.20s | %-8d | %8.2f ms | %8.2f ms | %7.2fx | %+7.3f%% | %-5s |\n",
+                filename.c_str(), thread_counts[t], strips_ms, tiles_ms,
+                calculate_speedup(strips_ms, tiles_ms),
+                100.0 * ((double)tiles_size - strips_size) / strips_size, match ? "yes" : "NO");
+        }
+        free(strips_rect);
+        free(tiles_rect);
+        free(strips);
+        free(tiles);
+        stbi_image_free(data);
+    }
+    printf("+----------------------+----------+-------------+-------------+----------+----------+-------+\n\n");
+}
+
+// Encode and decode all images in the block format once with a call per image, each opening
+// its own parallel region, and once through a qoi_pool_t, which schedules the blocks of all
+// images in one. Small images gain the most.
+void benchmark_pool(const char* input_dir, const std::vector<int>& thread_counts) {
+    std::vector<std::string> input_files = list_images(input_dir);
+
+    // Load everything up front, with room for the encoded and decoded copies
+    struct Image {
+        unsigned char* data;
+        qoi_desc desc;
+        size_t raw_size;
+        size_t max_size;
+        unsigned char* encoded;
+        unsigned char* decoded;
+        size_t encoded_size;
+        size_t decoded_size;
+    };
+    std::vector<Image> images;
+    for (const auto& filename : input_files) {
+        char input_path[MAX_PATH];
+        sprintf_s(input_path, "%s\\%s", input_dir, filename.c_str());
+
+        int width, height, channels;
+        unsigned char* data = stbi_load(input_path, &width, &height, &channels, 0);
+        if (!data) {
+            printf("Failed to load image: %s\n", input_path);
+            continue;
+        }
+        Image image = { data, { (unsigned int)width, (unsigned int)height, (unsigned char)channels, QOI_SRGB } };
+        image.raw_size = (size_t)width * height * channels;
+        image.max_size = qoi_max_encoded_size_block(&image.desc);
+        image.encoded = (unsigned char*)malloc(image.max_size);
+        image.decoded = (unsigned char*)malloc(image.raw_size);
+        if (!image.encoded || !image.decoded) {
+            printf("Out of memory for image: %s\n", input_path);
+            free(image.encoded);
+            free(image.decoded);
+            stbi_image_free(data);
+            continue;
+        }
+        images.push_back(image);
+    }
+
+    printf("\n+=========================================================================+\n");
+    printf("| POOL: %zu images, a parallel region per image against one qoi_pool_run\n", images.size());
+    printf("+----------+-------------+-------------+-------------+-------------+----------+-------+\n");
+    printf("| Threads  | Encode each | Encode pool | Decode each | Decode pool | Speedup  | Match |\n");
+    printf("+----------+-------------+-------------+-------------+-------------+----------+-------+\n");
+
+    for (size_t t = 0; t < thread_counts.size(); t++) {
+        qoi_pool_t* pool = qoi_pool_create(thread_counts[t]);
+        if (!pool) {
+            printf("| %-8d | failed to create the pool\n", thread_counts[t]);
+            continue;
+        }
+        bool match = true;
+
+        int64_t start_time = get_time_ns();
+        for (auto& image : images) {
+            image.encoded_size = qoi_encode_parallel_block_fmt_into(image.data, 0, 0, &image.desc,
+                image.encoded, image.max_size, thread_counts[t]);
+        }
+        double encode_each_ms = (get_time_ns() - start_time) / 1e6;
+
+        start_time = get_time_ns();
+        for (auto& image : images) {
+            qoi_desc decoded_desc;
+            image.decoded_size = qoi_decode_parallel_block_fmt_into(image.encoded, image.encoded_size,
+                &decoded_desc, image.decoded, 0, image.raw_size, 0, thread_counts[t]);
+        }
+        double decode_each_ms = (get_time_ns() - start_time) / 1e6;
+
+        // The pool picks the block height for its own thread count as well, so both write the same
+        start_time = get_time_ns();
+        for (auto& image : images) {
+            qoi_pool_add_encode(pool, image.data, 0, 0, &image.desc, image.encoded, image.max_size, &image.encoded_size);
+        }
+        qoi_pool_run(pool);
+        double encode_pool_ms = (get_time_ns() - start_time) / 1e6;
+
+        for (auto& image : images) {
+            memset(image.decoded, 0, image.raw_size);
+        }
+        start_time = get_time_ns();
+        for (auto& image : images) {
+            qoi_desc decoded_desc;
+            if (!image.encoded_size || !qoi_pool_add_decode(pool, image.encoded, image.encoded_size, &decoded_desc,
+                image.decoded, 0, image.raw_size, 0, &image.decoded_size)) {
+                image.decoded_size = 0;
+            }
+        }
+        qoi_pool_run(pool);
+        double decode_pool_ms = (get_time_ns() - start_time) / 1e6;
+
+        for (const auto& image : images) {
+            match = match && image.decoded_size == image.raw_size && memcmp(image.decoded, image.data, image.raw_size) == 0;
+        }
+        qoi_pool_destroy(pool);
+
+        printf("| %-8d | %8.2f ms | %8.2f ms | %8.2f ms | %8.2f ms | %7.2fx | %-5s |\n",
+            thread_counts[t], encode_each_ms, encode_pool_ms, decode_each_ms, decode_pool_ms,
+            calculate_speedup(encode_each_ms + decode_each_ms, encode_pool_ms + decode_pool_ms), match ? "yes" : "NO");
+    }
+    printf("+----------+-------------+-------------+-------------+-------------+----------+-------+\n\n");
+
+    for (const auto& image : images) {
+        free(image.encoded);
+        free(image.decoded);
+        stbi_image_free(image.data);
+    }
+}
+
+// Encode and decode all images one at a time, each on all threads, and as one batch with
+// qoi_encode_batch and qoi_decode_batch, which also share the threads across images. The
+// batch output is written to the output folder.
+void benchmark_batch(const char* input_dir, const char* output_dir, const std::vector<int>& thread_counts) {
+    std::vector<std::string> input_files = list_images(input_dir);
+
+    std::vector<std::string> names;
+    std::vector<qoi_batch_item_t> items;
+    size_t raw_bytes = 0;
+    for (const auto& filename : input_files) {
+        char input_path[MAX_PATH];
+        sprintf_s(input_path, "%s\\%s", input_dir, filename.c_str());
+
+        int width, height, channels;
+        unsigned char* data = stbi_load(input_path, &width, &height, &channels, 0);
+        if (!data) {
+            printf("Failed to load image: %s\n", input_path);
+            continue;
+        }
+        qoi_batch_item_t item = {};
+        item.data = data;
+        item.desc = { (unsigned int)width, (unsigned int)height, (unsigned char)channels, QOI_SRGB };
+        items.push_back(item);
+        names.push_back(filename);
+        raw_bytes += (size_t)width * height * channels;
+    }
+    int count = (int)items.size();
+    double raw_mb = raw_bytes / (1024.0 * 1024.0);
+
+    printf("\n+=========================================================================+\n");
+    printf("| BATCH: %d images, %.1f MB, one at a time against qoi_encode_batch / qoi_decode_batch\n", count, raw_mb);
+    printf("+----------+--------+-------------+------------+-------------+------------+-------------+-------+\n");
+    printf("| Threads  | Mode   | One by one  | Images/s   | Batch       | Images/s   | Batch MB/s  | Match |\n");
+    printf("+----------+--------+-------------+------------+-------------+------------+-------------+-------+\n");
+
+    for (size_t t = 0; t < thread_counts.size(); t++) {
+        // One at a time, as the encode and decode modes do
+        std::vector<void*> encoded(count);
+        std::vector<size_t> encoded_size(count);
+        int64_t start_time = get_time_ns();
+        for (int i = 0; i < count; i++) {
+            encoded[i] = qoi_encode_parallel_block_simple(items[i].data, &items[i].desc, &encoded_size[i], thread_counts[t]);
+        }
+        double encode_each_ms = (get_time_ns() - start_time) / 1e6;
+
+        start_time = get_time_ns();
+        for (int i = 0; i < count; i++) {
+            qoi_desc decoded_desc;
+            free(encoded[i] ? qoi_decode_parallel_block_simple(encoded[i], encoded_size[i], &decoded_desc, 0, thread_counts[t]) : NULL);
+        }
+        double decode_each_ms = (get_time_ns() - start_time) / 1e6;
+        for (int i = 0; i < count; i++) {
+            free(encoded[i]);
+        }
+
+        qoi_batch_stats_t encode_stats, decode_stats;
+        qoi_encode_batch(items.data(), count, thread_counts[t], &encode_stats);
+
+        std::vector<qoi_batch_item_t> decode_items(count);
+        for (int i = 0; i < count; i++) {
+            decode_items[i] = {};
+            decode_items[i].data = items[i].result;
+            decode_items[i].size = items[i].result_len;
+        }
+        qoi_decode_batch(decode_items.data(), count, thread_counts[t], &decode_stats);
+
+        bool match = encode_stats.images == count && decode_stats.images == count;
+        for (int i = 0; match && i < count; i++) {
+            match = memcmp(decode_items[i].result, items[i].data,
+                (size_t)items[i].desc.width * items[i].desc.height * items[i].desc.channels) == 0;
+        }
+
+        if (t == thread_counts.size() - 1) {
+            for (int i = 0; i < count; i++) {
+                char output_path[MAX_PATH];
+                sprintf_s(output_path, "%s\\batch_%.*s.qoi", output_dir,
+                    (int)names[i].find_last_of('.'), names[i].c_str());
+                FILE* f = items[i].result ? fopen(output_path, "wb") : NULL;
+                if (f) {
+                    fwrite(items[i].result, 1, items[i].result_len, f);
+                    fclose(f);
+                }
+            }
+        }
+
+        for (int i = 0; i < count; i++) {
+            free(items[i].result);
+            free(decode_items[i].result);
+        }
+
+        printf("| %-8d | %-6s | %8.2f ms | %10.1f | %8.2f ms | %10.1f | %11.1f | %-5s |\n",
+            thread_counts[t], "encode", encode_each_ms, count / (encode_each_ms / 1e3),
+            encode_stats.seconds * 1e3, encode_stats.images_per_sec, encode_stats.mb_per_sec, match ? "yes" : "NO");
+        printf("| %-8d | %-6s | %8.2f ms | %10.1f | %8.2f ms | %10.1f | %11.1f | %-5s |\n",
+            thread_counts[t], "decode", decode_each_ms, count / (decode_each_ms / 1e3),
+            decode_stats.seconds * 1e3, decode_stats.images_per_sec, decode_stats.mb_per_sec, match ? "yes" : "NO");
+    }
+    printf("+----------+--------+-------------+------------+-------------+------------+-------------+-------+\n\n");
+
+    for (const auto& item : items) {
+        stbi_image_free((void*)item.data);
+    }
+}
+
+// One image on its way through the pipeline modes
+struct PipelineItem {
+    std::string input_path;
+    std::string output_path;
+    void* input;            // stbi_load() pixels, or the mapped QOI file
+    size_t input_size;
+    void* output;           // encoded QOI data, or decoded pixels
+    size_t output_size;
+    size_t charged;         // bytes of this image counted against the budget
+    qoi_desc desc;
+};
+
+// Single-producer single-consumer ring between two pipeline stages. The producer only
+// moves tail and the consumer only moves head, so neither side takes a lock.
+struct PipelineQueue {
+    static const size_t capacity = 16;
+    PipelineItem* items[capacity];
+    std::atomic<size_t> head{ 0 };
+    std::atomic<size_t> tail{ 0 };
+
+    void push(PipelineItem* item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        while (t - head.load(std::memory_order_acquire) == capacity) {
+            std::this_thread::yield();
+        }
+        items[t % capacity] = item;
+        tail.store(t + 1, std::memory_order_release);
+    }
+
+    // NULL marks the end of the stream
+    PipelineItem* pop() {
+        size_t h = head.load(std::memory_order_relaxed);
+        while (tail.load(std::memory_order_acquire) == h) {
+            std::this_thread::yield();
+        }
+        PipelineItem* item = items[h % capacity];
+        head.store(h + 1, std::memory_order_release);
+        return item;
+    }
+};
+
+struct PipelineTimes {
+    double load_ms;
+    double process_ms;
+    double store_ms;
+    double wall_ms;
+    int failed;
+};
+
+// Loaded but not yet written images may hold at most this many bytes, unless a single
+// image is larger on its own
+static const size_t pipeline_budget = (size_t)256 << 20;
+
+// Bytes the image will take once loaded, known before it is read
+static size_t pipeline_input_size(const PipelineItem* item, bool decode) {
+    if (decode) {
+        return get_file_size(item->input_path.c_str());
+    }
+    int width, height, channels;
+    if (!stbi_info(item->input_path.c_str(), &width, &height, &channels)) {
+        return 0;
+    }
+    return (size_t)width * height * channels;
+}
+
+static void pipeline_load(PipelineItem* item, bool decode) {
+    item->output = NULL;
+    item->output_size = 0;
+    if (decode) {
+        // Fault all pages in here, so the decoder does not wait on the disk
+        item->input = (void*)qoi_map_file(item->input_path.c_str(), &item->input_size, QOI_MAP_POPULATE);
+        return;
+    }
+    int width, height, channels;
+    item->input = stbi_load(item->input_path.c_str(), &width, &height, &channels, 0);
+    if (item->input) {
+        item->desc = { (unsigned int)width, (unsigned int)height, (unsigned char)channels, QOI_SRGB };
+        item->input_size = (size_t)width * height * channels;
+    }
+}
+
+static void pipeline_process(PipelineItem* item, bool decode, int num_threads) {
+    if (!item->input) {
+        return;
+    }
+    if (decode) {
+        item->output = qoi_decode_parallel_block_simple(item->input, item->input_size, &item->desc, 0, num_threads);
+        if (item->output) {
+            item->output_size = (size_t)item->desc.width * item->desc.height * item->desc.channels;
+        }
+        qoi_unmap_file(item->input, item->input_size);
+    }
+    else {
+        item->output = qoi_encode_parallel_block_simple(item->input, &item->desc, &item->output_size, num_threads);
+        stbi_image_free(item->input);
+    }
+    item->input = NULL;
+}
+
+static bool pipeline_store(PipelineItem* item, bool decode) {
+    if (!item->output) {
+        return false;
+    }
+    bool ok;
+    if (decode) {
+        ok = stbi_write_png(item->output_path.c_str(), item->desc.width, item->desc.height,
+            item->desc.channels, item->output, item->desc.width * item->desc.channels) != 0;
+    }
+    else {
+        FILE* f = fopen(item->output_path.c_str(), "wb");
+        ok = f && fwrite(item->output, 1, item->output_size, f) == item->output_size;
+        if (f) {
+            fclose(f);
+        }
+    }
+    free(item->output);
+    item->output = NULL;
+    return ok;
+}
+
+// Load, encode (or decode) and write every item, either one stage after another on this
+// thread or with the reader and the writer on threads of their own, handing the images
+// over through two PipelineQueues. The codec stays on this thread, so its OpenMP team is
+// the same in both cases. Each stage adds up only the time it spends working.
+PipelineTimes run_pipeline(std::vector<PipelineItem>& items, bool decode, int num_threads, bool overlapped) {
+    PipelineTimes times = {};
+    int64_t start_time = get_time_ns();
+
+    if (!overlapped) {
+        for (auto& item : items) {
+            int64_t t0 = get_time_ns();
+            pipeline_load(&item, decode);
+            int64_t t1 = get_time_ns();
+            pipeline_process(&item, decode, num_threads);
+            int64_t t2 = get_time_ns();
+            times.failed += !pipeline_store(&item, decode);
+            times.load_ms += (t1 - t0) / 1e6;
+            times.process_ms += (t2 - t1) / 1e6;
+            times.store_ms += (get_time_ns() - t2) / 1e6;
+        }
+        times.wall_ms = (get_time_ns() - start_time) / 1e6;
+        return times;
+    }
+
+    PipelineQueue loaded, processed;
+    std::atomic<size_t> in_flight{ 0 };
+
+    std::thread reader([&]() {
+        for (auto& item : items) {
+            // Wait for the writer to free enough of the budget
+            item.charged = pipeline_input_size(&item, decode);
+            while (in_flight.load() != 0 && in_flight.load() + item.charged > pipeline_budget) {
+                std::this_thread::yield();
+            }
+            in_flight += item.charged;
+
+            int64_t t0 = get_time_ns();
+            pipeline_load(&item, decode);
+            times.load_ms += (get_time_ns() - t0) / 1e6;
+            loaded.push(&item);
+        }
+        loaded.push(NULL);
+    });
+
+    std::thread writer([&]() {
+        while (PipelineItem* item = processed.pop()) {
+            int64_t t0 = get_time_ns();
+            times.failed += !pipeline_store(item, decode);
+            times.store_ms += (get_time_ns() - t0) / 1e6;
+            in_flight -= item->charged;
+        }
+    });
+
+    while (PipelineItem* item = loaded.pop()) {
+        int64_t t0 = get_time_ns();
+        pipeline_process(item, decode, num_threads);
+        times.process_ms += (get_time_ns() - t0) / 1e6;
+
+        // The input is gone and the output waits for the writer
+        in_flight += item->output_size;
+        in_flight -= item->charged;
+        item->charged = item->output_size;
+        processed.push(item);
+    }
+    processed.push(NULL);
+
+    reader.join();
+    writer.join();
+    times.wall_ms = (get_time_ns() - start_time) / 1e6;
+    return times;
+}
+
+// Run a folder through load, encode and write (decode: map, decode and stbi_write_png) one
+// stage after another and then overlapped. The stage times come from the first run, so
+// the pipelined wall time can be set against the slowest stage on its own.
+void benchmark_pipeline(const char* input_dir, const char* output_dir, bool decode, const std::vector<int>& thread_counts) {
+    std::vector<PipelineItem> items;
+    for (const auto& filename : list_images(input_dir, decode)) {
+        char input_path[MAX_PATH];
+        char output_path[MAX_PATH];
+        sprintf_s(input_path, "%s\\%s", input_dir, filename.c_str());
+        sprintf_s(output_path, decode ? "%s\\pipe_%.*s.png" : "%s\\pipe_%.*s.qoi", output_dir,
+            (int)filename.find_last_of('.'), filename.c_str());
+        PipelineItem item = {};
+        item.input_path = input_path;
+        item.output_path = output_path;
+        items.push_back(item);
+    }
+
+    printf("\n+=========================================================================+\n");
+    printf("| PIPELINE %s: %zu images, one stage after another against overlapped stages\n",
+        decode ? "DECODE" : "ENCODE", items.size());
+    printf("+----------+-------------+-------------+-------------+-------------+-------------+--------+\n");
+    printf("| Threads  | Load        | %-11s | Write       | One by one  | Pipelined   | Failed |\n", decode ? "Decode" : "Encode");
+    printf("+----------+-------------+-------------+-------------+-------------+-------------+--------+\n");
+
+    for (size_t t = 0; t < thread_counts.size(); t++) {
+        PipelineTimes serial = run_pipeline(items, decode, thread_counts[t], false);
+        PipelineTimes overlapped = run_pipeline(items, decode, thread_counts[t], true);
+        printf("| %-8d | %8.2f ms | %8.2f ms | %8.2f ms | %8.2f ms | %8.2f ms | %6d |\n",
+            thread_counts[t], serial.load_ms, serial.process_ms, serial.store_ms,
+            serial.wall_ms, overlapped.wall_ms, serial.failed + overlapped.failed);
+    }
+    printf("+----------+-------------+-------------+-------------+-------------+-------------+--------+\n\n");
+}
+
+// Decode every image with qoi_decode_parallel_block_simple and with
+// qoi_decode_parallel_block_numa, best of 5 runs each. Both allocate a fresh buffer per
+// call, so the times include faulting in its pages, which the NUMA decoder places on the
+// nodes of the threads that write them. On a single node both take the same path.
+void benchmark_numa(const char* input_dir, const std::vector<int>& thread_counts) {
+    std::vector<std::string> input_files = list_images(input_dir);
+
+    // Load and encode everything up front so only the decoders are timed
+    struct Image {
+        unsigned char* data;
+        qoi_desc desc;
+        void* encoded;
+        size_t encoded_size;
+    };
+    std::vector<Image> images;
+    size_t raw_bytes = 0;
+    int max_threads = *std::max_element(thread_counts.begin(), thread_counts.end());
+    for (const auto& filename : input_files) {
+        char input_path[MAX_PATH];
+        sprintf_s(input_path, "%s\\%s", input_dir, filename.c_str());
+
+        int width, height, channels;
+        unsigned char* data = stbi_load(input_path, &width, &height, &channels, 0);
+        if (!data) {
+            printf("Failed to load image: %s\n", input_path);
+            continue;
+        }
+        Image image = { data, { (unsigned int)width, (unsigned int)height, (unsigned char)channels, QOI_SRGB } };
+        image.encoded = qoi_encode_parallel_block_simple(data, &image.desc, &image.encoded_size, max_threads);
+        if (!image.encoded) {
+            printf("Failed to encode image: %s\n", input_path);
+            stbi_image_free(data);
+            continue;
+        }
+        raw_bytes += (size_t)width * height * channels;
+        images.push_back(image);
+    }
+    double raw_mb = raw_bytes / (1024.0 * 1024.0);
+
+    printf("\n+=========================================================================+\n");
+    printf("| NUMA: %zu images, %.1f MB, %d node(s)\n", images.size(), raw_mb, qoi_numa_nodes());
+    printf("+----------+-------------+------------+-------------+------------+----------+-------+\n");
+    printf("| Threads  | Dynamic     | MB/s       | NUMA        | MB/s       | Speedup  | Match |\n");
+    printf("+----------+-------------+------------+-------------+------------+----------+-------+\n");
+
+    for (size_t t = 0; t < thread_counts.size(); t++) {
+        double simple_ms = 0, numa_ms = 0;
+        bool match = true;
+        for (const auto& image : images) {
+            size_t raw_size = (size_t)image.desc.width * image.desc.height * image.desc.channels;
+            double best_simple = 0, best_numa = 0;
+            for (int run = 0; run < 5; run++) {
+                qoi_desc desc;
+                int64_t start_time = get_time_ns();
+                void* simple = qoi_decode_parallel_block_simple(image.encoded, image.encoded_size, &desc, 0, thread_counts[t]);
+                double ms = (get_time_ns() - start_time) / 1e6;
+                best_simple = run == 0 || ms < best_simple ? ms : best_simple;
+
+                start_time = get_time_ns();
+                void* numa = qoi_decode_parallel_block_numa(image.encoded, image.encoded_size, &desc, 0, thread_counts[t]);
+                ms = (get_time_ns() - start_time) / 1e6;
+                best_numa = run == 0 || ms < best_numa ? ms : best_numa;
+
+                match = match && simple && numa && memcmp(simple, image.data, raw_size) == 0 &&
+                    memcmp(numa, image.data, raw_size) == 0;
+                free(simple);
+                free(numa);
+            }
+            simple_ms += best_simple;
+            numa_ms += best_numa;
+        }
+
+        printf("| %-8d | %8.2f ms | %10.1f | %8.2f ms | %10.1f | %6.2fx  | %-5s |\n",
+            thread_counts[t], simple_ms, raw_mb / (simple_ms / 1e3), numa_ms, raw_mb / (numa_ms / 1e3),
+            calculate_speedup(simple_ms, numa_ms), match ? "yes" : "NO");
+    }
+    printf("+----------+-------------+------------+-------------+------------+----------+-------+\n\n");
+
+    for (const auto& image : images) {
+        free(image.encoded);
+        stbi_image_free(image.data);
+    }
+}
+
 int main(int argc, char* argv[]){
     if (argc < 5) {
         printf("Usage: %s <mode> <input_dir> <output_dir> <thread_counts...>\n", argv[0]);
+        printf("       %s large <width> <height> <thread_counts...>\n", argv[0]);
+        printf("       %s rows <file.qoi> <y0> <y1> <thread_counts...>\n", argv[0]);
+        printf("       %s thumb <file.qoi> <output.png> <2|4|8> <thread_counts...>\n", argv[0]);
+        printf("       %s write <input_dir> <output_dir> <thread_counts...>\n", argv[0]);
+        printf("       %s standard <input_dir> <output_dir> <thread_counts...>\n", argv[0]);
+        printf("       %s decodestd <input_dir> <output_dir> <thread_counts...>\n", argv[0]);
+        printf("       %s seek <input_dir> <output_dir> <thread_counts...>\n", argv[0]);
+        printf("       %s qoix <file.qoi> <output.qoix> <rows>\n", argv[0]);
+        printf("       %s blocks <input_dir> <output_dir> <thread_counts...>\n", argv[0]);
+        printf("       %s tiles <input_dir> <output_dir> <thread_counts...>\n", argv[0]);
+        printf("       %s pool <input_dir> <output_dir> <thread_counts...>\n", argv[0]);
+        printf("       %s batch <input_dir> <output_dir> <thread_counts...>\n", argv[0]);
+        printf("       %s pipeline <input_dir> <output_dir> <thread_counts...>\n", argv[0]);
+        printf("       %s pipedecode <input_dir> <output_dir> <thread_counts...>\n", argv[0]);
+        printf("       %s numa <input_dir> <output_dir> <thread_counts...>\n", argv[0]);
         printf("Example: %s encode ./input ./output 2 4 8\n", argv[0]);
         return 1;
     }
@@ -647,8 +1833,96 @@ int main(int argc, char* argv[]){
         thread_counts.push_back(atoi(argv[i]));
     }
 
+    if (strcmp(mode, "large") == 0) {
+        benchmark_large_image(strtoull(argv[2], NULL, 10), strtoull(argv[3], NULL, 10), thread_counts);
+        return 0;
+    }
+
+    if (strcmp(mode, "rows") == 0) {
+        if (argc < 6) {
+            printf("Usage: %s rows <file.qoi> <y0> <y1> <thread_counts...>\n", argv[0]);
+            return 1;
+        }
+        // Thread counts start at argv[4], so only <y1> has to go
+        thread_counts.erase(thread_counts.begin());
+        benchmark_rows(argv[2], (unsigned int)strtoul(argv[3], NULL, 10), (unsigned int)strtoul(argv[4], NULL, 10), thread_counts);
+        return 0;
+    }
+
+    if (strcmp(mode, "qoix") == 0) {
+        // Build the seek index of a standard QOI file, one checkpoint every <rows> rows
+        size_t index_size = qoi_write_seek_index(argv[2], argv[3], (unsigned int)strtoul(argv[4], NULL, 10));
+        if (!index_size) {
+            printf("Failed to build the seek index of: %s\n", argv[2]);
+            return 1;
+        }
+        printf("Wrote %s (%zu bytes)\n", argv[3], index_size);
+        return 0;
+    }
+
+    if (strcmp(mode, "thumb") == 0) {
+        if (argc < 6) {
+            printf("Usage: %s thumb <file.qoi> <output.png> <2|4|8> <thread_counts...>\n", argv[0]);
+            return 1;
+        }
+        // Thread counts start at argv[4], so only the factor has to go
+        thread_counts.erase(thread_counts.begin());
+        benchmark_thumbnail(argv[2], argv[3], atoi(argv[4]), thread_counts);
+        return 0;
+    }
+
     CreateDirectoryA(output_dir, NULL);
 
+    if (strcmp(mode, "write") == 0) {
+        benchmark_write(input_dir, output_dir, thread_counts);
+        return 0;
+    }
+
+    if (strcmp(mode, "standard") == 0) {
+        benchmark_standard(input_dir, output_dir, thread_counts);
+        return 0;
+    }
+
+    if (strcmp(mode, "decodestd") == 0) {
+        benchmark_decode_standard(input_dir, thread_counts);
+        return 0;
+    }
+
+    if (strcmp(mode, "seek") == 0) {
+        benchmark_seek(input_dir, output_dir, thread_counts);
+        return 0;
+    }
+
+    if (strcmp(mode, "blocks") == 0) {
+        benchmark_block_height(input_dir, thread_counts);
+        return 0;
+    }
+
+    if (strcmp(mode, "tiles") == 0) {
+        benchmark_tiles(input_dir, output_dir, thread_counts);
+        return 0;
+    }
+
+    if (strcmp(mode, "pool") == 0) {
+        benchmark_pool(input_dir, thread_counts);
+        return 0;
+    }
+
+    if (strcmp(mode, "batch") == 0) {
+        benchmark_batch(input_dir, output_dir, thread_counts);
+        return 0;
+    }
+
+    if (strcmp(mode, "pipeline") == 0 || strcmp(mode, "pipedecode") == 0) {
+        benchmark_pipeline(input_dir, output_dir, strcmp(mode, "pipedecode") == 0, thread_counts);
+        return 0;
+    }
+
+    if (strcmp(mode, "numa") == 0) {
+        benchmark_numa(input_dir, thread_counts);
+        return 0;
+    }
+
     std::vector<std::vector<ProcessingResult>> parallel_encode_results_multi;
     std::vector<std::vector<ProcessingResult>> parallel_decode_results_multi;
     std::vector<ProcessingResult> sequential_encode_results;
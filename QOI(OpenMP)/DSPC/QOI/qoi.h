@@ -45,14 +45,16 @@ This library provides the following functions;
 - qoi_decode  -- decode the raw bytes of a QOI image from memory
 - qoi_write   -- encode and write a QOI file
 - qoi_encode  -- encode an rgba buffer into a QOI image in memory
+- qoi_encode_lean -- like qoi_encode, but grows an exactly sized result
 
 See the function declaration below for the signature and more information.
 
 If you don't want/need the qoi_read and qoi_write functions, you can define
 QOI_NO_STDIO before including this library.
 
-This library uses malloc() and free(). To supply your own malloc implementation
-you can define QOI_MALLOC and QOI_FREE before including this library.
+This library uses malloc(), realloc() and free(). To supply your own malloc
+implementation you can define QOI_MALLOC, QOI_REALLOC and QOI_FREE before
+including this library.
 
 This library uses memset() to zero-initialize the index. To supply your own
 implementation you can define QOI_ZEROARR before including this library.
@@ -216,6 +218,8 @@ Header - Public functions */
 
 #define _CRT_SECURE_NO_WARNINGS
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -242,6 +246,24 @@ extern "C" {
 		unsigned char colorspace;
 	} qoi_desc;
 
+
+	/* Memory layouts of raw pixels for the _fmt functions. The swizzle is done
+	per pixel inside the encode and decode loops, so no separate pass over the
+	image is needed. QOI_FMT_RGB and QOI_FMT_RGBA equal the channel counts 3
+	and 4, so a channel count is also a valid format.
+
+	QOI_FMT_RGBA_PREMUL (RGBA with the colors multiplied by alpha) can only be
+	decoded to, since undoing the multiplication on encode would be lossy. */
+
+#define QOI_FMT_RGB         3
+#define QOI_FMT_RGBA        4
+#define QOI_FMT_BGR         5
+#define QOI_FMT_BGRA        6
+#define QOI_FMT_ARGB        7
+#define QOI_FMT_RGBA_PREMUL 8
+
+#define QOI_FMT_CHANNELS(fmt) ((fmt) == QOI_FMT_RGB || (fmt) == QOI_FMT_BGR ? 3 : 4)
+
 #ifndef QOI_NO_STDIO
 
 	/* Encode raw RGB or RGBA pixels into a QOI image and write it to the file
@@ -251,7 +273,7 @@ extern "C" {
 	The function returns 0 on failure (invalid parameters, or fopen or malloc
 	failed) or the number of bytes written on success. */
 
-	int qoi_write(const char* filename, const void* data, const qoi_desc* desc);
+	size_t qoi_write(const char* filename, const void* data, const qoi_desc* desc);
 
 
 	/* Read and decode a QOI image from the file system. If channels is 0, the
@@ -266,6 +288,51 @@ extern "C" {
 
 	void* qoi_read(const char* filename, qoi_desc* desc, int channels);
 
+
+	/* Map a whole file read-only into memory, so it can be decoded in place
+	without copying it into a buffer first; qoi_read does this itself. flags is
+	a combination of QOI_MAP_SEQUENTIAL, to hint that the file is read front to
+	back, and QOI_MAP_POPULATE, to fault in all pages up front instead of one
+	at a time during decoding.
+
+	qoi_map_file returns NULL on failure (no such file, empty file, or the
+	file cannot be mapped, e.g. a pipe, or QOI_NO_MMAP is defined) or the
+	mapped data, whose size is stored in *size. The mapping must be released
+	with qoi_unmap_file. */
+
+	#define QOI_MAP_SEQUENTIAL 1
+	#define QOI_MAP_POPULATE   2
+
+	const void* qoi_map_file(const char* filename, size_t* size, int flags);
+
+	void qoi_unmap_file(const void* data, size_t size);
+
+
+	/* Read and decode an image in the block-parallel format written by
+	qoi_encode_parallel_block_simple from the file system, decoding straight
+	from a mapping of the file like qoi_read. Behaves like
+	qoi_decode_parallel_block_simple otherwise. */
+
+	void* qoi_read_parallel_block(const char* filename, qoi_desc* desc, int channels, int num_threads);
+
+
+	/* Encode raw RGB or RGBA pixels in the block-parallel format and write it
+	to the file system, like qoi_write. Every block is written to the file as
+	soon as it and all blocks before it are encoded, while later blocks are
+	still encoding, so only about one block per thread is held in memory
+	instead of the whole encoded image. The offset table is filled in at the
+	end. Returns 0 on failure or the number of bytes written. */
+
+	size_t qoi_write_parallel_block(const char* filename, const void* data, const qoi_desc* desc, int num_threads);
+
+
+	/* Build the seek index of the standard QOI file filename, reading it once
+	a piece at a time, and write it to index_filename, e.g. the same name with
+	an x appended. rows is as for qoi_seek_index_build. Returns 0 on failure
+	or the number of bytes written. */
+
+	size_t qoi_write_seek_index(const char* filename, const char* index_filename, unsigned int rows);
+
 #endif /* QOI_NO_STDIO */
 
 
@@ -277,7 +344,7 @@ extern "C" {
 
 	The returned qoi data should be free()d after use. */
 
-	void* qoi_encode(const void* data, const qoi_desc* desc, int* out_len);
+	void* qoi_encode(const void* data, const qoi_desc* desc, size_t* out_len);
 
 
 	/* Decode a QOI image from memory.
@@ -288,11 +355,445 @@ extern "C" {
 
 	The returned pixel data should be free()d after use. */
 
-	void* qoi_decode(const void* data, int size, qoi_desc* desc, int channels);
+	void* qoi_decode(const void* data, size_t size, qoi_desc* desc, int channels);
+
+
+	/* Encode raw RGB or RGBA pixels into a QOI image in memory, like qoi_encode,
+	but without allocating the worst case up front. The image is encoded in
+	slices of QOI_LEAN_SLICE pixels into a buffer that starts at a quarter of
+	the raw size and grows by half when needed; it is shrunk to the encoded
+	size at the end. This trades a few reallocs for a much smaller peak
+	footprint on large images.
+
+	Arguments and return value are the same as for qoi_encode. */
+
+	void* qoi_encode_lean(const void* data, const qoi_desc* desc, size_t* out_len);
+
+
+	/* Return the worst-case size in bytes of the QOI image qoi_encode would
+	produce for the given qoi_desc, or 0 if the description is invalid. */
+
+	size_t qoi_max_encoded_size(const qoi_desc* desc);
+
+
+	/* Encode raw RGB or RGBA pixels into a caller-supplied buffer instead of a
+	freshly malloc()ed one. out_cap must be at least qoi_max_encoded_size(desc),
+	so one buffer of the largest expected size can be reused for many images.
+
+	The function returns 0 on failure (invalid parameters or out_cap too small)
+	or the size in bytes of the encoded data on success. */
+
+	size_t qoi_encode_into(const void* data, const qoi_desc* desc, void* out, size_t out_cap);
+
+
+	/* Decode a QOI image from memory into a caller-supplied pixel buffer of
+	pixels_cap bytes, which must hold width * height * channels bytes.
+
+	The function returns 0 on failure (invalid data or pixels_cap too small) or
+	the number of pixel bytes written on success. Whenever the header is valid,
+	the qoi_desc struct is filled, even if pixels_cap was too small, so the
+	caller can grow the buffer and try again. */
+
+	size_t qoi_decode_into(const void* data, size_t size, qoi_desc* desc, void* pixels, size_t pixels_cap, int channels);
+
+
+	/* Variants of the functions above for pixels that are not densely packed,
+	e.g. framebuffers, padded surfaces or a sub-rectangle of a larger image.
+	stride is the distance in bytes from the start of one row to the start of
+	the next; it must be at least width * channels, or 0 for densely packed
+	rows. The padding between rows is neither read nor written.
+
+	For qoi_decode_into_stride, pixels_cap must be at least
+	(height - 1) * stride + width * channels; that number of bytes is returned
+	on success. */
+
+	void* qoi_encode_stride(const void* data, size_t stride, const qoi_desc* desc, size_t* out_len);
+
+	size_t qoi_encode_into_stride(const void* data, size_t stride, const qoi_desc* desc, void* out, size_t out_cap);
+
+	size_t qoi_decode_into_stride(const void* data, size_t size, qoi_desc* desc, void* pixels, size_t stride, size_t pixels_cap, int channels);
+
+
+	/* Variants of the strided functions above that read or write pixels laid out
+	as one of the QOI_FMT_* formats, e.g. QOI_FMT_BGRA. For encoding, the
+	format must have desc->channels channels; 0 means RGB or RGBA as given by
+	desc->channels. For decoding, 0 means the channel count from the file
+	header. qoi_decode_fmt allocates a densely packed buffer. */
+
+	void* qoi_encode_fmt(const void* data, size_t stride, int fmt, const qoi_desc* desc, size_t* out_len);
+
+	size_t qoi_encode_into_fmt(const void* data, size_t stride, int fmt, const qoi_desc* desc, void* out, size_t out_cap);
+
+	void* qoi_decode_fmt(const void* data, size_t size, qoi_desc* desc, int fmt);
+
+	size_t qoi_decode_into_fmt(const void* data, size_t size, qoi_desc* desc, void* pixels, size_t stride, size_t pixels_cap, int fmt);
+
+
+	/* Push-style streaming encoder, for images that arrive a few rows at a time,
+	e.g. scanlines from a camera or renderer. qoi_encoder_begin writes the
+	header, every qoi_encoder_push_rows call encodes the next n rows (stride
+	and fmt as for qoi_encode_into_fmt) and qoi_encoder_finish ends the image
+	once all desc->height rows have been pushed. The index, previous pixel and
+	pending run are kept in the qoi_encoder_t between calls, so the output is
+	byte for byte the same as qoi_encode's.
+
+	The encoded bytes go to buf, which must hold at least QOI_STREAM_BUF_MIN
+	bytes. If write is NULL, buf receives the whole image, and pushing or
+	finishing fails only once the image does not fit into buf_cap bytes;
+	qoi_max_encoded_size(desc) bytes are always enough. Otherwise buf is only a staging area that is handed to
+	write(user, buf, len) whenever it fills up and at the end; write returns 0
+	to abort encoding. Either way memory stays at buf_cap plus the rows the
+	caller holds.
+
+	qoi_encoder_begin and qoi_encoder_push_rows return 1 on success and 0 on
+	failure; after a failure every further call fails. qoi_encoder_finish
+	returns the size in bytes of the encoded image, or 0 on failure. The
+	fields of qoi_encoder_t are private. */
+
+	#define QOI_STREAM_BUF_MIN 64
+
+	typedef int (*qoi_write_func)(void* user, const void* data, size_t len);
+
+	typedef struct {
+		qoi_desc desc;
+		int fmt;
+		int failed;
+		unsigned int rows_left;
+		unsigned char* buf;
+		size_t buf_cap;
+		size_t buf_len;
+		size_t written;
+		qoi_write_func write;
+		void* user;
+		unsigned int index[64];
+		unsigned int px_prev;
+		int run;
+	} qoi_encoder_t;
+
+	int qoi_encoder_begin(qoi_encoder_t* enc, const qoi_desc* desc, int fmt, void* buf, size_t buf_cap, qoi_write_func write, void* user);
+
+	int qoi_encoder_push_rows(qoi_encoder_t* enc, const void* rows, size_t stride, unsigned int n);
+
+	size_t qoi_encoder_finish(qoi_encoder_t* enc);
+
+
+	/* Pull-style streaming decoder, for QOI data that arrives in fragments of
+	any size, e.g. from a socket or pipe. After qoi_decoder_begin, call
+	qoi_decoder_pull_row with the input at hand: it consumes bytes from *data,
+	advancing *data and decreasing *size, until the next row is complete, and
+	returns it as soon as it is, without waiting for the rest of the image.
+	A chunk cut off at the end of a fragment is held back until the next one.
+
+	qoi_decoder_pull_row returns
+	  QOI_STREAM_ROW   a row was decoded; *row points to width * channels
+	                   bytes in the format fmt (0 = channels from the file),
+	                   valid until the next call. Unused input is left in
+	                   *data and *size for the next call.
+	  QOI_STREAM_MORE  all of the input was used up; call again with more.
+	  QOI_STREAM_DONE  all rows have been returned.
+	  QOI_STREAM_ERROR the header is invalid or malloc failed.
+
+	desc is filled in as soon as the header has been read. qoi_decoder_end
+	frees the row buffer. The other fields of qoi_decoder_t are private. */
+
+	#define QOI_STREAM_ERROR -1
+	#define QOI_STREAM_MORE   0
+	#define QOI_STREAM_ROW    1
+	#define QOI_STREAM_DONE   2
+
+	typedef struct {
+		qoi_desc desc;
+		int fmt;
+		int failed;
+		unsigned int rows_left;
+		unsigned char* row;
+		size_t row_len;
+		size_t px_pos;
+		unsigned char carry[14]; /* the header, then the start of a cut off chunk */
+		size_t carry_len;
+		unsigned int index[64];
+		unsigned int px;
+		int run;
+	} qoi_decoder_t;
+
+	int qoi_decoder_begin(qoi_decoder_t* dec, int fmt);
+
+	int qoi_decoder_pull_row(qoi_decoder_t* dec, const void** data, size_t* size, const void** row);
+
+	void qoi_decoder_end(qoi_decoder_t* dec);
+
+
+	/* The same for the block-parallel format written by
+	qoi_encode_parallel_block_simple: qoi_max_encoded_size_block also counts
+	the block count and offset table, and the _into variants take the same
+	arguments as above plus the number of OpenMP threads to use. */
+
+	size_t qoi_max_encoded_size_block(const qoi_desc* desc);
+
+	size_t qoi_encode_parallel_block_simple_into(const void* data, const qoi_desc* desc, void* out, size_t out_cap, int num_threads);
+
+	size_t qoi_decode_parallel_block_simple_into(const void* data, size_t size, qoi_desc* desc, void* pixels, size_t pixels_cap, int channels, int num_threads);
+
+	size_t qoi_encode_parallel_block_stride_into(const void* data, size_t stride, const qoi_desc* desc, void* out, size_t out_cap, int num_threads);
+
+	size_t qoi_decode_parallel_block_stride_into(const void* data, size_t size, qoi_desc* desc, void* pixels, size_t stride, size_t pixels_cap, int channels, int num_threads);
+
+	size_t qoi_encode_parallel_block_fmt_into(const void* data, size_t stride, int fmt, const qoi_desc* desc, void* out, size_t out_cap, int num_threads);
+
+	size_t qoi_decode_parallel_block_fmt_into(const void* data, size_t size, qoi_desc* desc, void* pixels, size_t stride, size_t pixels_cap, int fmt, int num_threads);
+
+
+	/* Blocks of the block-parallel format are a multiple of
+	QOI_BLOCK_HEIGHT_MIN rows tall, and the height is stored in the
+	container, so the decoders follow whatever the encoder chose. Smaller
+	blocks give more parallelism and better load balance, bigger ones
+	compress better, as every block starts with a fresh index.
+
+	qoi_block_height returns the height the encoders choose for desc on
+	num_threads threads: about four blocks per thread, but no fewer than
+	QOI_BLOCK_PIXELS_MIN and no more than QOI_BLOCK_PIXELS_MAX pixels per
+	block where the image allows it. It returns 0 if desc is invalid.
+	qoi_encode_parallel_block_height_into is
+	qoi_encode_parallel_block_fmt_into with the block height given: 0 to
+	choose it the same way, anything else is rounded up to a multiple of
+	QOI_BLOCK_HEIGHT_MIN. */
+
+	#define QOI_BLOCK_HEIGHT_MIN 8
+	#define QOI_BLOCK_PIXELS_MIN (1 << 14)
+	#define QOI_BLOCK_PIXELS_MAX (1 << 20)
+
+	int qoi_block_height(const qoi_desc* desc, int num_threads);
+
+	size_t qoi_encode_parallel_block_height_into(const void* data, size_t stride, int fmt, const qoi_desc* desc, void* out, size_t out_cap, int block_height, int num_threads);
+
+
+	/* Decode only rows y0 to y1 - 1 of a block-parallel image, e.g. the visible
+	strip of a very tall scan. The offset table is used to seek straight to the
+	blocks covering those rows, which are decoded in parallel; the rest of the
+	image is not touched.
+
+	qoi_decode_rows returns densely packed rows like qoi_decode, or NULL on
+	failure. qoi_decode_rows_into writes them to a caller-supplied buffer like
+	qoi_decode_parallel_block_fmt_into, with row y0 at the start of pixels, and
+	returns (y1 - y0 - 1) * stride + width * channels, or 0 on failure. In both
+	cases the qoi_desc struct describes the whole image, not just the rows. */
+
+	void* qoi_decode_rows(const void* data, size_t size, unsigned int y0, unsigned int y1, qoi_desc* desc, int channels, int num_threads);
+
+	size_t qoi_decode_rows_into(const void* data, size_t size, unsigned int y0, unsigned int y1, qoi_desc* desc, void* pixels, size_t stride, size_t pixels_cap, int fmt, int num_threads);
+
+
+	/* Decode a block-parallel image straight into a thumbnail of 1/factor its
+	width and height, where factor is 2, 4 or 8. Every factor x factor box of
+	source pixels is averaged into one output pixel as the rows are decoded,
+	so the full-size image is never written out. Blocks are reduced in
+	parallel.
+
+	Whenever the header is valid, the qoi_desc struct is filled with the size
+	of the thumbnail, i.e. the image size divided by factor and rounded up,
+	so a buffer can be sized for qoi_decode_thumbnail_into. Otherwise the
+	functions behave like qoi_decode_parallel_block_simple and
+	qoi_decode_parallel_block_fmt_into. */
+
+	void* qoi_decode_thumbnail(const void* data, size_t size, qoi_desc* desc, int channels, int factor, int num_threads);
+
+	size_t qoi_decode_thumbnail_into(const void* data, size_t size, qoi_desc* desc, void* pixels, size_t stride, size_t pixels_cap, int fmt, int factor, int num_threads);
+
+
+	/* Block-parallel decode for machines with more than one NUMA node, where
+	the pages of a buffer come from the node of the thread that first writes
+	them. Each node owns one band of blocks, decoded by threads bound to that
+	node, so the rows of a fresh buffer end up next to the cores that wrote
+	them, and a later parallel pass over the same bands stays local. Threads
+	that finish their band help with the bands of other nodes.
+
+	qoi_numa_nodes returns the number of nodes with processors. Binding is
+	only done on Windows; with one node, or elsewhere, the functions do the
+	same as qoi_decode_parallel_block_simple and
+	qoi_decode_parallel_block_fmt_into. qoi_decode_parallel_block_numa_into
+	only places pages that the caller has not touched yet. */
+
+	int qoi_numa_nodes(void);
+
+	void* qoi_decode_parallel_block_numa(const void* data, size_t size, qoi_desc* desc, int channels, int num_threads);
+
+	size_t qoi_decode_parallel_block_numa_into(const void* data, size_t size, qoi_desc* desc, void* pixels, size_t stride, size_t pixels_cap, int fmt, int num_threads);
+
+
+	/* Tiled variant of the block-parallel format, for images far wider than
+	any view of them, e.g. panoramas and maps. The image is cut into tiles of
+	tile_width x tile_height pixels, each encoded on its own like a block, and
+	the offset table holds one entry per tile, row by row. Both sizes are
+	rounded up to a multiple of QOI_BLOCK_HEIGHT_MIN; 0 selects QOI_TILE_SIZE.
+
+	qoi_max_encoded_size_tiled is the worst-case size for those tile sizes,
+	or 0 if desc is invalid. qoi_encode_tiled_into takes the arguments of
+	qoi_encode_parallel_block_fmt_into plus the tile size, encodes the tiles
+	on num_threads OpenMP threads and returns the size of the image, or 0 on
+	failure. qoi_encode_tiled returns it in a new buffer like
+	qoi_encode_parallel_block_simple.
+
+	qoi_decode_rect decodes only the pixels x0 to x1 - 1 of rows y0 to
+	y1 - 1, touching just the tiles that intersect them, and
+	qoi_decode_rect_into writes them to a caller-supplied buffer like
+	qoi_decode_rows_into, returning (y1 - y0 - 1) * stride + (x1 - x0) *
+	channels. Block-parallel images are read as a single column of tiles. */
+
+	#define QOI_TILE_SIZE 256
+
+	size_t qoi_max_encoded_size_tiled(const qoi_desc* desc, int tile_width, int tile_height);
+
+	size_t qoi_encode_tiled_into(const void* data, size_t stride, int fmt, const qoi_desc* desc, void* out, size_t out_cap, int tile_width, int tile_height, int num_threads);
+
+	void* qoi_encode_tiled(const void* data, const qoi_desc* desc, int tile_width, int tile_height, size_t* out_len, int num_threads);
+
+	void* qoi_decode_rect(const void* data, size_t size, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, qoi_desc* desc, int channels, int num_threads);
+
+	size_t qoi_decode_rect_into(const void* data, size_t size, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, qoi_desc* desc, void* pixels, size_t stride, size_t pixels_cap, int fmt, int num_threads);
+
+
+	/* Thread pool for encoding and decoding many block-parallel images at
+	once, e.g. a directory of small pictures, where a parallel region per
+	image would cost as much as the image itself. The pool keeps its workers'
+	task queues and encode arenas from one run to the next.
+
+	qoi_pool_add_encode and qoi_pool_add_decode queue an image with the
+	arguments of qoi_encode_parallel_block_fmt_into and
+	qoi_decode_parallel_block_fmt_into. Unlike that function, the pool also
+	decodes tiled images, as qoi_decode_rect does. The header is checked,
+	and for decoding desc filled in, right away, and they return 0 if it is
+	invalid. qoi_pool_run then encodes and decodes every
+	queued image in a single parallel region on the pool's num_threads OpenMP
+	threads: each worker starts with the blocks that make up an even share of
+	the pixels of all images, in the order they were queued, and once it runs
+	out steals blocks from the others. When it returns,
+	*out_len of every image holds its size as the _into functions would
+	return it, or 0 on failure, and the queue is empty. qoi_pool_run returns
+	1 if all images succeeded.
+
+	A pool must only be used from one thread at a time. num_threads 0 uses
+	the default number of OpenMP threads. qoi_pool_destroy frees the pool. */
+
+	typedef struct qoi_pool_t qoi_pool_t;
+
+	qoi_pool_t* qoi_pool_create(int num_threads);
+
+	int qoi_pool_add_encode(qoi_pool_t* pool, const void* data, size_t stride, int fmt, const qoi_desc* desc, void* out, size_t out_cap, size_t* out_len);
+
+	int qoi_pool_add_decode(qoi_pool_t* pool, const void* data, size_t size, qoi_desc* desc, void* pixels, size_t stride, size_t pixels_cap, int fmt, size_t* out_len);
+
+	int qoi_pool_run(qoi_pool_t* pool);
+
+	void qoi_pool_destroy(qoi_pool_t* pool);
+
+
+	/* Encode or decode a whole batch of images in the block-parallel format,
+	e.g. a folder of thumbnails, on num_threads OpenMP threads (0 for the
+	default). The images go through a qoi_pool_t largest first, so the
+	threads share out both the images and the blocks of the large ones, and
+	no large image is left for last.
+
+	For qoi_encode_batch, data and desc of every item describe its pixels.
+	For qoi_decode_batch, data and size hold the encoded image, channels the
+	number of channels to decode to (0 for those of the file), and desc is
+	filled in. Either way result receives the output, to be free()d after
+	use, and result_len its size, or NULL and 0 if the item failed.
+
+	Both return the number of items that succeeded. If stats is not NULL it
+	receives the totals of those: the pixel bytes and encoded bytes, the wall
+	time of the batch and the throughput in images and pixel MB (2^20 bytes)
+	per second. */
+
+	typedef struct {
+		const void* data;
+		size_t size;
+		qoi_desc desc;
+		int channels;
+		void* result;
+		size_t result_len;
+	} qoi_batch_item_t;
+
+	typedef struct {
+		int images;
+		size_t raw_bytes;
+		size_t encoded_bytes;
+		double seconds;
+		double images_per_sec;
+		double mb_per_sec;
+	} qoi_batch_stats_t;
+
+	int qoi_encode_batch(qoi_batch_item_t* items, int count, int num_threads, qoi_batch_stats_t* stats);
+
+	int qoi_decode_batch(qoi_batch_item_t* items, int count, int num_threads, qoi_batch_stats_t* stats);
+
+
+	/* Decode a QOI image from memory, like qoi_decode, but dispatch every chunk
+	through a 256-entry table indexed by its first byte instead of a chain of
+	tag compares. The table holds the opcode, the precomputed DIFF deltas, LUMA
+	green biases, index positions and run lengths.
+
+	Arguments, return value and output are the same as for qoi_decode. */
+
+	void* qoi_decode_table(const void* data, size_t size, qoi_desc* desc, int channels);
+
+	/* Encode raw pixels into a standard QOI stream on several OpenMP threads.
+	Unlike qoi_encode_parallel_block_simple the output is a plain QOI image
+	that any QOI decoder reads: the image is cut into strips of 64 rows, each
+	encoded on its own from the true previous pixel, and the strips are joined
+	in order. QOI_OP_INDEX is only used for index entries written within the
+	same strip, so the output is slightly larger than that of qoi_encode.
+
+	qoi_encode_parallel takes the arguments of qoi_encode and uses the default
+	number of OpenMP threads; qoi_encode_parallel_fmt_into takes those of
+	qoi_encode_into_fmt plus the number of threads to use. */
 
-	void* qoi_encode_parallel(const void* data, const qoi_desc* desc, int* out_len);
+	void* qoi_encode_parallel(const void* data, const qoi_desc* desc, size_t* out_len);
 
-	void* qoi_decode_parallel(const void* data, int size, qoi_desc* desc, int channels);
+	size_t qoi_encode_parallel_fmt_into(const void* data, size_t stride, int fmt, const qoi_desc* desc, void* out, size_t out_cap, int num_threads);
+
+	/* Decode a standard QOI stream, e.g. from another encoder, on several
+	OpenMP threads. The chunk stream is cut into byte segments; a pre-scan of
+	the chunk tags finds where each segment's chunks start and how many pixels
+	come before them. Every segment is then decoded from a start state
+	recovered by decoding the tail of the segment before it, and a check in
+	order of the parts of that state it used makes sure the output matches
+	qoi_decode exactly: a segment whose guess was wrong is decoded again.
+
+	qoi_decode_parallel takes the arguments of qoi_decode and uses the default
+	number of OpenMP threads; qoi_decode_parallel_fmt_into takes those of
+	qoi_decode_into_fmt, except that rows are always densely packed, plus the
+	number of threads to use. Small images are decoded on one thread. */
+
+	void* qoi_decode_parallel(const void* data, size_t size, qoi_desc* desc, int channels);
+
+	size_t qoi_decode_parallel_fmt_into(const void* data, size_t size, qoi_desc* desc, void* pixels, size_t pixels_cap, int fmt, int num_threads);
+
+
+	/* Seek index for standard QOI files, kept in a sidecar file (.qoix) next
+	to the image so the bitstream itself stays untouched. In front of every
+	rows-th row it holds a checkpoint of the decoder: the byte offset of the
+	next chunk, the run still pending, px and the 64-entry index, so decoding
+	can start there. The sidecar is a 28-byte header ("qoix", width, height,
+	rows, number of checkpoints and the size of the QOI file, big-endian),
+	followed by the checkpoints; checkpoint k is at pixel k * rows * width.
+
+	qoi_seek_index_build decodes data once and returns its sidecar, whose size
+	is stored in *out_len, or NULL on failure (invalid or truncated data, or
+	malloc failed). rows is the distance between checkpoints, 0 for
+	QOI_SEEK_ROWS. The returned data should be free()d after use.
+
+	qoi_decode_indexed decodes the whole image like qoi_decode_parallel, and
+	qoi_decode_rows_indexed_into only rows y0 to y1 - 1 of it like
+	qoi_decode_rows_into, both from the checkpoints in parallel on num_threads
+	OpenMP threads. They fail if the sidecar does not belong to data. */
+
+	#define QOI_SEEK_ROWS 64
+
+	void* qoi_seek_index_build(const void* data, size_t size, unsigned int rows, size_t* out_len);
+
+	void* qoi_decode_indexed(const void* data, size_t size, const void* index, size_t index_size, qoi_desc* desc, int channels, int num_threads);
+
+	size_t qoi_decode_rows_indexed_into(const void* data, size_t size, const void* index, size_t index_size, unsigned int y0, unsigned int y1, qoi_desc* desc, void* pixels, size_t stride, size_t pixels_cap, int fmt, int num_threads);
 
 
 #ifdef __cplusplus
@@ -305,13 +806,23 @@ extern "C" {
 Implementation */
 
 #ifdef QOI_IMPLEMENTATION
+/* fseeko, ftello and posix_madvise are POSIX, which strict modes such as
+-std=c99 only declare when asked to. This only works if qoi.h comes before
+the first system header; otherwise define _POSIX_C_SOURCE yourself. */
+#if defined(__STRICT_ANSI__) && !defined(_WIN32) && !defined(_POSIX_C_SOURCE) && !defined(_GNU_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
 #ifndef QOI_MALLOC
 #define QOI_MALLOC(sz) malloc(sz)
 #define QOI_FREE(p)    free(p)
 #endif
+#ifndef QOI_REALLOC
+#define QOI_REALLOC(p, sz) realloc(p, sz)
+#endif
 #ifndef QOI_ZEROARR
 #define QOI_ZEROARR(a) memset((a),0,sizeof(a))
 #endif
@@ -331,11 +842,12 @@ Implementation */
 	 ((unsigned int)'i') <<  8 | ((unsigned int)'f'))
 #define QOI_HEADER_SIZE 14
 
-/* 2GB is the max file size that this implementation can safely handle. We guard
-against anything larger than that, assuming the worst case with 5 bytes per
-pixel, rounded down to a nice clean value. 400 million pixels ought to be
-enough for anybody. */
-#define QOI_PIXELS_MAX ((unsigned int)400000000)
+/* All sizes and positions are size_t, so the only limit is the address space.
+We guard against images whose worst case encoding (5 bytes per pixel plus
+header, padding and block table) would not fit into a size_t: on 64-bit builds
+that is far beyond anything malloc can return, on 32-bit builds it is about
+500 million pixels. */
+#define QOI_PIXELS_MAX (((size_t)-1) / 8)
 
 typedef union {
 	struct { unsigned char r, g, b, a; } rgba;
@@ -344,14 +856,14 @@ typedef union {
 
 static const unsigned char qoi_padding[8] = { 0,0,0,0,0,0,0,1 };
 
-static void qoi_write_32(unsigned char* bytes, int* p, unsigned int v) {
+static void qoi_write_32(unsigned char* bytes, size_t* p, unsigned int v) {
 	bytes[(*p)++] = (0xff000000 & v) >> 24;
 	bytes[(*p)++] = (0x00ff0000 & v) >> 16;
 	bytes[(*p)++] = (0x0000ff00 & v) >> 8;
 	bytes[(*p)++] = (0x000000ff & v);
 }
 
-static unsigned int qoi_read_32(const unsigned char* bytes, int* p) {
+static unsigned int qoi_read_32(const unsigned char* bytes, size_t* p) {
 	unsigned int a = bytes[(*p)++];
 	unsigned int b = bytes[(*p)++];
 	unsigned int c = bytes[(*p)++];
@@ -359,68 +871,153 @@ static unsigned int qoi_read_32(const unsigned char* bytes, int* p) {
 	return a << 24 | b << 16 | c << 8 | d;
 }
 
-void* qoi_encode(const void* data, const qoi_desc* desc, int* out_len) {
-	int i, max_size, p, run;
-	int px_len, px_end, px_pos, channels;
-	unsigned char* bytes;
-	const unsigned char* pixels;
-	qoi_rgba_t index[64];
-	qoi_rgba_t px, px_prev;
+/* Offset tables start right after the header and block geometry, so they are
+not 8-byte aligned. Their entries go through memcpy instead of an int64_t
+pointer, which the compiler turns into a plain unaligned load or store. */
+static int64_t qoi_read_offset(const unsigned char* table, size_t i) {
+	int64_t v;
+	memcpy(&v, table + i * sizeof(int64_t), sizeof(int64_t));
+	return v;
+}
 
-	if (
-		data == NULL || out_len == NULL || desc == NULL ||
-		desc->width == 0 || desc->height == 0 ||
-		desc->channels < 3 || desc->channels > 4 ||
-		desc->colorspace > 1 ||
-		desc->height >= QOI_PIXELS_MAX / desc->width
-		) {
-		return NULL;
-	}
+static void qoi_write_offset(unsigned char* table, size_t i, int64_t v) {
+	memcpy(table + i * sizeof(int64_t), &v, sizeof(int64_t));
+}
 
-	max_size =
-		desc->width * desc->height * (desc->channels + 1) +
-		QOI_HEADER_SIZE + sizeof(qoi_padding);
+/* The encode and decode kernels below take the pixel format (QOI_FMT_*) as an
+argument, but are always force-inlined into a dispatcher that passes a literal
+format. The compiler thus generates one specialized loop per format, and the
+hot loops contain no channel or swizzle checks. */
+#ifndef QOI_FORCEINLINE
+#if defined(_MSC_VER)
+#define QOI_FORCEINLINE __forceinline
+#elif defined(__GNUC__)
+#define QOI_FORCEINLINE inline __attribute__((always_inline))
+#else
+#define QOI_FORCEINLINE inline
+#endif
+#endif
 
-	p = 0;
-	bytes = (unsigned char*)QOI_MALLOC(max_size);
-	if (!bytes) {
-		return NULL;
+/* Load one pixel laid out as fmt; RGBA pixels are read as a single 32-bit
+word. For RGB and BGR the alpha of px is kept. */
+static QOI_FORCEINLINE qoi_rgba_t qoi_load_px(const unsigned char* pixels, qoi_rgba_t px, const int fmt) {
+	if (fmt == QOI_FMT_RGBA) {
+		memcpy(&px.v, pixels, 4);
 	}
+	else if (fmt == QOI_FMT_BGRA) {
+		px.rgba.r = pixels[2];
+		px.rgba.g = pixels[1];
+		px.rgba.b = pixels[0];
+		px.rgba.a = pixels[3];
+	}
+	else if (fmt == QOI_FMT_ARGB) {
+		px.rgba.r = pixels[1];
+		px.rgba.g = pixels[2];
+		px.rgba.b = pixels[3];
+		px.rgba.a = pixels[0];
+	}
+	else if (fmt == QOI_FMT_BGR) {
+		px.rgba.r = pixels[2];
+		px.rgba.g = pixels[1];
+		px.rgba.b = pixels[0];
+	}
+	else {
+		px.rgba.r = pixels[0];
+		px.rgba.g = pixels[1];
+		px.rgba.b = pixels[2];
+	}
+	return px;
+}
 
-	qoi_write_32(bytes, &p, QOI_MAGIC);
-	qoi_write_32(bytes, &p, desc->width);
-	qoi_write_32(bytes, &p, desc->height);
-	bytes[p++] = desc->channels;
-	bytes[p++] = desc->colorspace;
-
+/* Multiply a color value by alpha, rounded: c * a / 255 */
+static QOI_FORCEINLINE unsigned char qoi_premul(unsigned char c, unsigned char a) {
+	unsigned int t = c * a + 128;
+	return (unsigned char)((t + (t >> 8)) >> 8);
+}
 
-	pixels = (const unsigned char*)data;
+/* Store one pixel laid out as fmt; RGBA pixels are written as a single 32-bit
+word. */
+static QOI_FORCEINLINE void qoi_store_px(unsigned char* pixels, qoi_rgba_t px, const int fmt) {
+	if (fmt == QOI_FMT_RGBA) {
+		memcpy(pixels, &px.v, 4);
+	}
+	else if (fmt == QOI_FMT_BGRA) {
+		pixels[0] = px.rgba.b;
+		pixels[1] = px.rgba.g;
+		pixels[2] = px.rgba.r;
+		pixels[3] = px.rgba.a;
+	}
+	else if (fmt == QOI_FMT_ARGB) {
+		pixels[0] = px.rgba.a;
+		pixels[1] = px.rgba.r;
+		pixels[2] = px.rgba.g;
+		pixels[3] = px.rgba.b;
+	}
+	else if (fmt == QOI_FMT_RGBA_PREMUL) {
+		pixels[0] = qoi_premul(px.rgba.r, px.rgba.a);
+		pixels[1] = qoi_premul(px.rgba.g, px.rgba.a);
+		pixels[2] = qoi_premul(px.rgba.b, px.rgba.a);
+		pixels[3] = px.rgba.a;
+	}
+	else if (fmt == QOI_FMT_BGR) {
+		pixels[0] = px.rgba.b;
+		pixels[1] = px.rgba.g;
+		pixels[2] = px.rgba.r;
+	}
+	else {
+		pixels[0] = px.rgba.r;
+		pixels[1] = px.rgba.g;
+		pixels[2] = px.rgba.b;
+	}
+}
 
-	QOI_ZEROARR(index);
+/* Encoder state carried from one qoi_encode_chunks call to the next, so an
+image can be encoded in slices: the index, the previous pixel and the length
+of a run that has not been written yet. */
+typedef struct {
+	qoi_rgba_t index[64];
+	qoi_rgba_t px_prev;
+	int run;
+} qoi_enc_state_t;
+
+static void qoi_enc_state_init(qoi_enc_state_t* state, qoi_rgba_t px_prev) {
+	QOI_ZEROARR(state->index);
+	state->px_prev = px_prev;
+	state->run = 0;
+}
 
-	run = 0;
-	px_prev.rgba.r = 0;
-	px_prev.rgba.g = 0;
-	px_prev.rgba.b = 0;
-	px_prev.rgba.a = 255;
-	px = px_prev;
+/* Write the run still pending in state, if any. Must be called after the last
+pixel of an image (or block) has been passed to qoi_encode_chunks. */
+static size_t qoi_enc_state_flush(qoi_enc_state_t* state, unsigned char* bytes, size_t p) {
+	if (state->run > 0) {
+		bytes[p++] = QOI_OP_RUN | (state->run - 1);
+		state->run = 0;
+	}
+	return p;
+}
 
-	px_len = desc->width * desc->height * desc->channels;
-	px_end = px_len - desc->channels;
-	channels = desc->channels;
+/* Encode the pixels from px_pos up to px_len into bytes at position p,
+continuing from state. A run reaching up to px_len is left in state. The index
+is worked on as a local copy, so the byte stores cannot alias it. Returns the
+new write position. */
+static QOI_FORCEINLINE size_t qoi_encode_chunks(
+	const unsigned char* pixels, size_t px_pos, size_t px_len, qoi_enc_state_t* state,
+	unsigned char* bytes, size_t p, const int fmt
+) {
+	const int channels = QOI_FMT_CHANNELS(fmt);
+	qoi_rgba_t index[64];
+	qoi_rgba_t px_prev = state->px_prev;
+	qoi_rgba_t px = px_prev;
+	int run = state->run;
 
-	for (px_pos = 0; px_pos < px_len; px_pos += channels) {
-		px.rgba.r = pixels[px_pos + 0];
-		px.rgba.g = pixels[px_pos + 1];
-		px.rgba.b = pixels[px_pos + 2];
+	memcpy(index, state->index, sizeof(index));
 
-		if (channels == 4) {
-			px.rgba.a = pixels[px_pos + 3];
-		}
+	for (; px_pos < px_len; px_pos += channels) {
+		px = qoi_load_px(pixels + px_pos, px, fmt);
 
 		if (px.v == px_prev.v) {
 			run++;
-			if (run == 62 || px_pos == px_end) {
+			if (run == 62) {
 				bytes[p++] = QOI_OP_RUN | (run - 1);
 				run = 0;
 			}
@@ -483,67 +1080,121 @@ void* qoi_encode(const void* data, const qoi_desc* desc, int* out_len) {
 		px_prev = px;
 	}
 
-	for (i = 0; i < (int)sizeof(qoi_padding); i++) {
-		bytes[p++] = qoi_padding[i];
+	memcpy(state->index, index, sizeof(index));
+	state->px_prev = px_prev;
+	state->run = run;
+	return p;
+}
+
+/* Decode one chunk at bytes[p] into px and index, write the decoded pixel
+(or the whole run) to pixels[px_pos] and return the number of bytes of pixel
+data written. Performs no bounds checks; the caller guarantees that 5 bytes
+of input and 62 pixels of output are available. */
+static QOI_FORCEINLINE size_t qoi_decode_op_unchecked(
+	const unsigned char* bytes, size_t* p, qoi_rgba_t* index, qoi_rgba_t* px,
+	unsigned char* pixels, const int fmt
+) {
+	const int channels = QOI_FMT_CHANNELS(fmt);
+	int b1 = bytes[(*p)++];
+	int run = 0;
+
+	if (b1 == QOI_OP_RGB) {
+		px->rgba.r = bytes[(*p)++];
+		px->rgba.g = bytes[(*p)++];
+		px->rgba.b = bytes[(*p)++];
+	}
+	else if (b1 == QOI_OP_RGBA) {
+		px->rgba.r = bytes[(*p)++];
+		px->rgba.g = bytes[(*p)++];
+		px->rgba.b = bytes[(*p)++];
+		px->rgba.a = bytes[(*p)++];
+	}
+	else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+		*px = index[b1];
+	}
+	else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+		px->rgba.r += ((b1 >> 4) & 0x03) - 2;
+		px->rgba.g += ((b1 >> 2) & 0x03) - 2;
+		px->rgba.b += (b1 & 0x03) - 2;
+	}
+	else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+		int b2 = bytes[(*p)++];
+		int vg = (b1 & 0x3f) - 32;
+		px->rgba.r += vg - 8 + ((b2 >> 4) & 0x0f);
+		px->rgba.g += vg;
+		px->rgba.b += vg - 8 + (b2 & 0x0f);
+	}
+	else {
+		run = b1 & 0x3f;
 	}
 
-	*out_len = p;
-	return bytes;
+	index[QOI_COLOR_HASH((*px)) % 64] = *px;
+
+	qoi_store_px(pixels, *px, fmt);
+	for (b1 = 1; b1 <= run; b1++) {
+		qoi_store_px(pixels + b1 * channels, *px, fmt);
+	}
+	return (run + 1) * channels;
 }
 
-void* qoi_decode(const void* data, int size, qoi_desc* desc, int channels) {
-	const unsigned char* bytes;
-	unsigned int header_magic;
-	unsigned char* pixels;
+/* Decoder state carried from one qoi_decode_chunks call to the next, so an
+image can be decoded in slices: the index, the previous pixel and how many
+more times it has to be repeated for a run that was cut off. */
+typedef struct {
 	qoi_rgba_t index[64];
 	qoi_rgba_t px;
-	int px_len, chunks_len, px_pos;
-	int p = 0, run = 0;
-
-	if (
-		data == NULL || desc == NULL ||
-		(channels != 0 && channels != 3 && channels != 4) ||
-		size < QOI_HEADER_SIZE + (int)sizeof(qoi_padding)
-		) {
-		return NULL;
-	}
-
-	bytes = (const unsigned char*)data;
+	int run;
+} qoi_dec_state_t;
+
+static void qoi_dec_state_init(qoi_dec_state_t* state) {
+	QOI_ZEROARR(state->index);
+	state->px.rgba.r = 0;
+	state->px.rgba.g = 0;
+	state->px.rgba.b = 0;
+	state->px.rgba.a = 255;
+	state->run = 0;
+}
 
-	header_magic = qoi_read_32(bytes, &p);
-	desc->width = qoi_read_32(bytes, &p);
-	desc->height = qoi_read_32(bytes, &p);
-	desc->channels = bytes[p++];
-	desc->colorspace = bytes[p++];
+/* Decode chunks from bytes at position p (never reading a tag at or past
+chunks_len) into px_len bytes of pixels, continuing from state. The index is
+worked on as a local copy, so the pixel stores cannot alias it. Returns the
+new read position.
+
+Decoding runs in two phases. As long as 4 whole chunks (20 bytes) of input
+and 4 maximal runs (248 pixels) of output are left, 4 chunks are decoded per
+iteration without any bounds checks. The remaining few chunks go through the
+fully checked loop. Both phases produce the same output for any input, so
+truncated or malformed data is handled exactly as before.
+
+The chunk stream does not depend on the channel count in the file header, so
+decoding a 3 or 4 channel file into any format only needs a kernel per output
+format. */
+static QOI_FORCEINLINE size_t qoi_decode_chunks(
+	const unsigned char* bytes, size_t p, size_t chunks_len, qoi_dec_state_t* state,
+	unsigned char* pixels, size_t px_len, const int fmt
+) {
+	const int channels = QOI_FMT_CHANNELS(fmt);
+	qoi_rgba_t index[64];
+	qoi_rgba_t px = state->px;
+	size_t px_pos = 0;
+	int run = state->run;
 
-	if (
-		desc->width == 0 || desc->height == 0 ||
-		desc->channels < 3 || desc->channels > 4 ||
-		desc->colorspace > 1 ||
-		header_magic != QOI_MAGIC ||
-		desc->height >= QOI_PIXELS_MAX / desc->width
-		) {
-		return NULL;
-	}
+	memcpy(index, state->index, sizeof(index));
 
-	if (channels == 0) {
-		channels = desc->channels;
+	/* Finish a run that was cut off at the end of the previous slice */
+	for (; run > 0 && px_pos < px_len; px_pos += channels) {
+		qoi_store_px(pixels + px_pos, px, fmt);
+		run--;
 	}
 
-	px_len = desc->width * desc->height * channels;
-	pixels = (unsigned char*)QOI_MALLOC(px_len);
-	if (!pixels) {
-		return NULL;
+	while (p + 4 * 5 <= chunks_len && px_pos + 4 * 62 * channels <= px_len) {
+		px_pos += qoi_decode_op_unchecked(bytes, &p, index, &px, pixels + px_pos, fmt);
+		px_pos += qoi_decode_op_unchecked(bytes, &p, index, &px, pixels + px_pos, fmt);
+		px_pos += qoi_decode_op_unchecked(bytes, &p, index, &px, pixels + px_pos, fmt);
+		px_pos += qoi_decode_op_unchecked(bytes, &p, index, &px, pixels + px_pos, fmt);
 	}
 
-	QOI_ZEROARR(index);
-	px.rgba.r = 0;
-	px.rgba.g = 0;
-	px.rgba.b = 0;
-	px.rgba.a = 255;
-
-	chunks_len = size - (int)sizeof(qoi_padding);
-	for (px_pos = 0; px_pos < px_len; px_pos += channels) {
+	for (; px_pos < px_len; px_pos += channels) {
 		if (run > 0) {
 			run--;
 		}
@@ -583,646 +1234,4180 @@ void* qoi_decode(const void* data, int size, qoi_desc* desc, int channels) {
 			index[QOI_COLOR_HASH(px) % 64] = px;
 		}
 
-		pixels[px_pos + 0] = px.rgba.r;
-		pixels[px_pos + 1] = px.rgba.g;
-		pixels[px_pos + 2] = px.rgba.b;
-
-		if (channels == 4) {
-			pixels[px_pos + 3] = px.rgba.a;
-		}
+		qoi_store_px(pixels + px_pos, px, fmt);
 	}
 
-	return pixels;
+	memcpy(state->index, index, sizeof(index));
+	state->px = px;
+	state->run = run;
+	return p;
 }
 
-void* qoi_encode_modify(const void* data, const qoi_desc* desc, int* out_len) {
-	if (data == NULL || out_len == NULL || desc == NULL ||
-		desc->width == 0 || desc->height == 0 ||
-		desc->channels < 3 || desc->channels > 4 ||
-		desc->colorspace > 1 ||
+/* Decode chunks from bytes[p] up to end into pixels, continuing from state and
+from *px_pos, like qoi_decode_chunks, but stop in front of a chunk that is not
+completely in the input instead of repeating the last pixel, so a streaming
+decoder can wait for more input and resume. *px_pos is advanced past the
+pixels written. Returns the new read position. */
+static QOI_FORCEINLINE size_t qoi_decode_chunks_partial(
+	const unsigned char* bytes, size_t p, size_t end, qoi_dec_state_t* state,
+	unsigned char* pixels, size_t* px_pos_io, size_t px_len, const int fmt
+) {
+	const int channels = QOI_FMT_CHANNELS(fmt);
+	qoi_rgba_t index[64];
+	qoi_rgba_t px = state->px;
+	size_t px_pos = *px_pos_io;
+	int run = state->run;
+
+	memcpy(index, state->index, sizeof(index));
+
+	for (; run > 0 && px_pos < px_len; px_pos += channels) {
+		qoi_store_px(pixels + px_pos, px, fmt);
+		run--;
+	}
+
+	while (p + 4 * 5 <= end && px_pos + 4 * 62 * channels <= px_len) {
+		px_pos += qoi_decode_op_unchecked(bytes, &p, index, &px, pixels + px_pos, fmt);
+		px_pos += qoi_decode_op_unchecked(bytes, &p, index, &px, pixels + px_pos, fmt);
+		px_pos += qoi_decode_op_unchecked(bytes, &p, index, &px, pixels + px_pos, fmt);
+		px_pos += qoi_decode_op_unchecked(bytes, &p, index, &px, pixels + px_pos, fmt);
+	}
+
+	for (; px_pos < px_len; px_pos += channels) {
+		if (run > 0) {
+			run--;
+		}
+		else {
+			int b1;
+
+			if (p >= end) {
+				break;
+			}
+			b1 = bytes[p];
+			if (
+				p + (b1 == QOI_OP_RGBA ? 5 : b1 == QOI_OP_RGB ? 4 :
+				(b1 & QOI_MASK_2) == QOI_OP_LUMA ? 2 : 1) > end
+				) {
+				break;
+			}
+			p++;
+
+			if (b1 == QOI_OP_RGB) {
+				px.rgba.r = bytes[p++];
+				px.rgba.g = bytes[p++];
+				px.rgba.b = bytes[p++];
+			}
+			else if (b1 == QOI_OP_RGBA) {
+				px.rgba.r = bytes[p++];
+				px.rgba.g = bytes[p++];
+				px.rgba.b = bytes[p++];
+				px.rgba.a = bytes[p++];
+			}
+			else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+				px = index[b1];
+			}
+			else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+				px.rgba.r += ((b1 >> 4) & 0x03) - 2;
+				px.rgba.g += ((b1 >> 2) & 0x03) - 2;
+				px.rgba.b += (b1 & 0x03) - 2;
+			}
+			else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+				int b2 = bytes[p++];
+				int vg = (b1 & 0x3f) - 32;
+				px.rgba.r += vg - 8 + ((b2 >> 4) & 0x0f);
+				px.rgba.g += vg;
+				px.rgba.b += vg - 8 + (b2 & 0x0f);
+			}
+			else {
+				run = (b1 & 0x3f);
+			}
+
+			index[QOI_COLOR_HASH(px) % 64] = px;
+		}
+
+		qoi_store_px(pixels + px_pos, px, fmt);
+	}
+
+	memcpy(state->index, index, sizeof(index));
+	state->px = px;
+	state->run = run;
+	*px_pos_io = px_pos;
+	return p;
+}
+
+/* Encode rows pixel rows of row_len bytes each, whose starts are stride bytes
+apart, continuing from state. Densely packed rows go through in one call. */
+static QOI_FORCEINLINE size_t qoi_encode_lines(
+	const unsigned char* pixels, size_t stride, size_t row_len, size_t rows,
+	qoi_enc_state_t* state, unsigned char* bytes, size_t p, const int fmt
+) {
+	size_t y;
+
+	if (stride == row_len) {
+		return qoi_encode_chunks(pixels, 0, row_len * rows, state, bytes, p, fmt);
+	}
+	for (y = 0; y < rows; y++) {
+		p = qoi_encode_chunks(pixels + y * stride, 0, row_len, state, bytes, p, fmt);
+	}
+	return p;
+}
+
+/* Decode rows pixel rows of row_len bytes each, whose starts are stride bytes
+apart, continuing from state. Densely packed rows go through in one call. With
+a stride of 0 every row lands on the same row of pixels, which skips rows that
+are not wanted without a scratch buffer. */
+static QOI_FORCEINLINE size_t qoi_decode_lines(
+	const unsigned char* bytes, size_t p, size_t chunks_len, qoi_dec_state_t* state,
+	unsigned char* pixels, size_t stride, size_t row_len, size_t rows, const int fmt
+) {
+	size_t y;
+
+	if (stride == row_len) {
+		return qoi_decode_chunks(bytes, p, chunks_len, state, pixels, row_len * rows, fmt);
+	}
+	for (y = 0; y < rows; y++) {
+		p = qoi_decode_chunks(bytes, p, chunks_len, state, pixels + y * stride, row_len, fmt);
+	}
+	return p;
+}
+
+/* Encode one block of a block-parallel image (rows rows of row_len bytes,
+stride bytes apart) into out and return its size. Every block starts with its
+first pixel as a full QOI_OP_RGB(A) chunk, followed by the remaining pixels
+encoded with a fresh index. */
+static QOI_FORCEINLINE size_t qoi_encode_block(
+	const unsigned char* pixels, size_t stride, size_t row_len, size_t rows,
+	unsigned char* out, const int fmt
+) {
+	const int channels = QOI_FMT_CHANNELS(fmt);
+	qoi_rgba_t px = { { 0, 0, 0, 255 } };
+	qoi_enc_state_t state;
+	size_t size = 0;
+
+	px = qoi_load_px(pixels, px, fmt);
+	out[size++] = channels == 4 ? QOI_OP_RGBA : QOI_OP_RGB;
+	out[size++] = px.rgba.r;
+	out[size++] = px.rgba.g;
+	out[size++] = px.rgba.b;
+	if (channels == 4) {
+		out[size++] = px.rgba.a;
+	}
+
+	qoi_enc_state_init(&state, px);
+	if (stride == row_len) {
+		size = qoi_encode_chunks(pixels, channels, row_len * rows, &state, out, size, fmt);
+	}
+	else {
+		size = qoi_encode_chunks(pixels, channels, row_len, &state, out, size, fmt);
+		size = qoi_encode_lines(pixels + stride, stride, row_len, rows - 1, &state, out, size, fmt);
+	}
+	return qoi_enc_state_flush(&state, out, size);
+}
+
+/* Start state for a strip of a standard QOI stream that is encoded on its
+own. px_prev is the true previous pixel, but which colors the decoder's index
+holds at this point is unknown. Every entry gets a color that hashes to a
+different entry, so it never matches a pixel and QOI_OP_INDEX is only emitted
+for entries the strip has written itself. */
+static void qoi_enc_state_init_strip(qoi_enc_state_t* state, qoi_rgba_t px_prev) {
+	int i;
+
+	/* rgba(0, 0, 0, 0) hashes to entry 0, rgba(1, 0, 0, 0) to entry 3 */
+	for (i = 0; i < 64; i++) {
+		state->index[i].rgba.r = i == 0 ? 1 : 0;
+		state->index[i].rgba.g = 0;
+		state->index[i].rgba.b = 0;
+		state->index[i].rgba.a = 0;
+	}
+	state->px_prev = px_prev;
+	state->run = 0;
+}
+
+/* Encode the rows rows from start_row on (row_len bytes each, stride bytes
+apart) as one strip of a standard QOI stream into out and return its size.
+The strip continues from the last pixel of the row above, so DIFF, LUMA and
+RUN chunks stay valid across the seam. The first strip is encoded exactly
+like qoi_encode does. */
+static QOI_FORCEINLINE size_t qoi_encode_strip(
+	const unsigned char* pixels, size_t stride, size_t row_len, size_t start_row, size_t rows,
+	unsigned char* out, const int fmt
+) {
+	const int channels = QOI_FMT_CHANNELS(fmt);
+	qoi_rgba_t px_prev = { { 0, 0, 0, 255 } };
+	qoi_enc_state_t state;
+	size_t size;
+
+	if (start_row == 0) {
+		qoi_enc_state_init(&state, px_prev);
+	}
+	else {
+		px_prev = qoi_load_px(pixels + (start_row - 1) * stride + row_len - channels, px_prev, fmt);
+		qoi_enc_state_init_strip(&state, px_prev);
+	}
+	size = qoi_encode_lines(pixels + start_row * stride, stride, row_len, rows, &state, out, 0, fmt);
+	return qoi_enc_state_flush(&state, out, size);
+}
+
+/* Walk the chunk tags from bytes[p] up to limit without decoding them, the
+way the decoder steps through them, and return the first chunk start at or
+past limit. The pixels of the chunks passed are added to *pixels, and
+*checkpoint is set to the last chunk start at or before checkpoint_at. If
+px_at is given, px_at[i] is set to the pixel count so far for every chunk
+that starts at px_base + i, for i below QOI_SEG_SYNC. */
+#define QOI_SEG_SYNC 64
+
+/* Length in bytes and number of pixels of a chunk, from its tag alone */
+static QOI_FORCEINLINE size_t qoi_chunk_len(int b1) {
+	return b1 == QOI_OP_RGBA ? 5 : b1 == QOI_OP_RGB ? 4 : (b1 & QOI_MASK_2) == QOI_OP_LUMA ? 2 : 1;
+}
+
+static QOI_FORCEINLINE size_t qoi_chunk_pixels(int b1) {
+	return b1 >= QOI_OP_RUN && b1 < QOI_OP_RGB ? (b1 & 0x3f) + 1 : 1;
+}
+
+static size_t qoi_scan_chunks(
+	const unsigned char* bytes, size_t p, size_t limit, size_t* pixels,
+	size_t checkpoint_at, size_t* checkpoint, int* px_at, size_t px_base
+) {
+	size_t n = 0;
+	size_t cp = *checkpoint;
+
+	// The chunks in reach of px_at, then those up to the checkpoint, then the
+	// rest, so most of the walk does no more than step through the tags
+	while (px_at != NULL && p < limit && p - px_base < QOI_SEG_SYNC) {
+		int b1 = bytes[p];
+		px_at[p - px_base] = (int)n;
+		if (p <= checkpoint_at) {
+			cp = p;
+		}
+		n += qoi_chunk_pixels(b1);
+		p += qoi_chunk_len(b1);
+	}
+	while (p < limit && p <= checkpoint_at) {
+		int b1 = bytes[p];
+		cp = p;
+		n += qoi_chunk_pixels(b1);
+		p += qoi_chunk_len(b1);
+	}
+	while (p < limit) {
+		int b1 = bytes[p];
+		n += qoi_chunk_pixels(b1);
+		p += qoi_chunk_len(b1);
+	}
+	*pixels += n;
+	*checkpoint = cp;
+	return p;
+}
+
+/* Decode chunks like the checked loop of qoi_decode_chunks, continuing from a
+state that is only a guess, and record which parts of the guess the output
+depends on: *px_read gets QOI_READ_RGB if a chunk used the color of px before
+any chunk replaced it, and QOI_READ_ALPHA if one used its alpha before that
+was replaced (QOI_OP_RGB keeps it), and read_mask gets a bit for every index
+entry read before it was written here. written_mask collects the entries
+written. Stops at px_len, or as soon as nothing more can be recorded (px
+replaced and all 64 entries written), so the rest can go through
+qoi_decode_chunks. *px_pos_io is
+advanced past the pixels written. Returns the new read position. */
+#define QOI_READ_RGB   1
+#define QOI_READ_ALPHA 2
+
+static QOI_FORCEINLINE size_t qoi_decode_chunks_tracked(
+	const unsigned char* bytes, size_t p, size_t chunks_len, qoi_dec_state_t* state,
+	unsigned char* pixels, size_t* px_pos_io, size_t px_len,
+	int* px_read, uint64_t* read_mask, uint64_t* written_mask, const int fmt
+) {
+	const int channels = QOI_FMT_CHANNELS(fmt);
+	qoi_rgba_t index[64];
+	qoi_rgba_t px = state->px;
+	size_t px_pos = *px_pos_io;
+	int run = state->run;
+	int px_set = 0;
+	uint64_t read = 0, written = 0;
+
+	memcpy(index, state->index, sizeof(index));
+
+	for (; px_pos < px_len && !(px_set == (QOI_READ_RGB | QOI_READ_ALPHA) && written == ~(uint64_t)0); px_pos += channels) {
+		if (run > 0) {
+			run--;
+		}
+		else if (p < chunks_len) {
+			int b1 = bytes[p++];
+			int index_pos;
+
+			if (b1 == QOI_OP_RGB) {
+				*px_read |= QOI_READ_ALPHA & ~px_set;
+				px_set |= QOI_READ_RGB;
+				px.rgba.r = bytes[p++];
+				px.rgba.g = bytes[p++];
+				px.rgba.b = bytes[p++];
+			}
+			else if (b1 == QOI_OP_RGBA) {
+				px.rgba.r = bytes[p++];
+				px.rgba.g = bytes[p++];
+				px.rgba.b = bytes[p++];
+				px.rgba.a = bytes[p++];
+				px_set = QOI_READ_RGB | QOI_READ_ALPHA;
+			}
+			else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+				read |= ~written & ((uint64_t)1 << b1);
+				px = index[b1];
+				px_set = QOI_READ_RGB | QOI_READ_ALPHA;
+			}
+			else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+				*px_read |= (QOI_READ_RGB | QOI_READ_ALPHA) & ~px_set;
+				px.rgba.r += ((b1 >> 4) & 0x03) - 2;
+				px.rgba.g += ((b1 >> 2) & 0x03) - 2;
+				px.rgba.b += (b1 & 0x03) - 2;
+			}
+			else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+				int b2 = bytes[p++];
+				int vg = (b1 & 0x3f) - 32;
+				*px_read |= (QOI_READ_RGB | QOI_READ_ALPHA) & ~px_set;
+				px.rgba.r += vg - 8 + ((b2 >> 4) & 0x0f);
+				px.rgba.g += vg;
+				px.rgba.b += vg - 8 + (b2 & 0x0f);
+			}
+			else {
+				*px_read |= (QOI_READ_RGB | QOI_READ_ALPHA) & ~px_set;
+				run = (b1 & 0x3f);
+			}
+
+			index_pos = QOI_COLOR_HASH(px) % 64;
+			index[index_pos] = px;
+			written |= (uint64_t)1 << index_pos;
+		}
+		else {
+			*px_read |= (QOI_READ_RGB | QOI_READ_ALPHA) & ~px_set;
+		}
+
+		qoi_store_px(pixels + px_pos, px, fmt);
+	}
+
+	memcpy(state->index, index, sizeof(index));
+	state->px = px;
+	state->run = run;
+	*px_pos_io = px_pos;
+	*read_mask |= read;
+	*written_mask |= written;
+	return p;
+}
+
+/* Decode from bytes[p], continuing from state, with the chunks ending at
+chunks_len: the first skip rows are decoded but dropped, the next rows rows
+are stored to pixels, stride bytes apart, and anything after them is left
+alone. */
+static QOI_FORCEINLINE void qoi_decode_rows_from(
+	const unsigned char* bytes, size_t p, size_t chunks_len, qoi_dec_state_t* state,
+	unsigned char* pixels, size_t stride, size_t row_len, size_t skip, size_t rows, const int fmt
+) {
+	p = qoi_decode_lines(bytes, p, chunks_len, state, pixels, 0, row_len, skip, fmt);
+	qoi_decode_lines(bytes, p, chunks_len, state, pixels, stride, row_len, rows, fmt);
+}
+
+/* Decode one block of a block-parallel image whose chunks run from bytes[p]
+to chunks_len, like qoi_decode_rows_from from a fresh state */
+static QOI_FORCEINLINE void qoi_decode_block(
+	const unsigned char* bytes, size_t p, size_t chunks_len,
+	unsigned char* pixels, size_t stride, size_t row_len, size_t skip, size_t rows, const int fmt
+) {
+	qoi_dec_state_t state;
+
+	qoi_dec_state_init(&state);
+	qoi_decode_rows_from(bytes, p, chunks_len, &state, pixels, stride, row_len, skip, rows, fmt);
+}
+
+/* Decode one tile like qoi_decode_block, but only keep cols_len bytes of every
+row, starting col bytes in. Rows are decoded one at a time into row, which
+holds row_len bytes, and the kept part is copied to pixels. */
+static QOI_FORCEINLINE void qoi_decode_tile_cropped(
+	const unsigned char* bytes, size_t p, size_t chunks_len, unsigned char* row,
+	unsigned char* pixels, size_t stride, size_t row_len, size_t skip, size_t rows,
+	size_t col, size_t cols_len, const int fmt
+) {
+	qoi_dec_state_t state;
+	size_t y;
+
+	qoi_dec_state_init(&state);
+	p = qoi_decode_lines(bytes, p, chunks_len, &state, row, 0, row_len, skip, fmt);
+	for (y = 0; y < rows; y++) {
+		p = qoi_decode_chunks(bytes, p, chunks_len, &state, row, row_len, fmt);
+		memcpy(pixels + y * stride, row + col, cols_len);
+	}
+}
+
+/* Decode rows rows of one block of a block-parallel image one at a time into
+row and average every box of (1 << shift) x (1 << shift) pixels into one pixel
+of out, whose rows are stride bytes apart. The rows of a box are first summed
+column by column into acc, which holds four 16-bit sums per 64-bit word so
+four bytes are added at once, and the columns are only summed once per output
+row; the full-size rows never leave the cache. Boxes cut off by the right or
+bottom edge are averaged over the pixels they cover. */
+static QOI_FORCEINLINE void qoi_decode_block_thumbnail(
+	const unsigned char* bytes, size_t p, size_t chunks_len, unsigned char* row, uint64_t* acc,
+	unsigned char* out, size_t stride, size_t width, size_t rows, int shift, const int fmt
+) {
+	const int channels = QOI_FMT_CHANNELS(fmt);
+	const size_t factor = (size_t)1 << shift;
+	size_t row_len = width * channels;
+	size_t acc_len = (row_len + 3) / 4;
+	size_t out_w = (width + factor - 1) >> shift;
+	size_t y, x, i, c;
+	qoi_dec_state_t state;
+
+	qoi_dec_state_init(&state);
+	for (y = 0; y < rows; y += factor) {
+		size_t box_h = rows - y < factor ? rows - y : factor;
+		unsigned char* out_row = out + (y >> shift) * stride;
+
+		memset(acc, 0, acc_len * sizeof(uint64_t));
+		for (i = 0; i < box_h; i++) {
+			p = qoi_decode_chunks(bytes, p, chunks_len, &state, row, row_len, fmt);
+
+			// Spread bytes 0-3 of each word to bits 0, 16, 32 and 48; the
+			// 8 x 8 x 255 sums of the largest box cannot carry into the next
+			for (x = 0; x < acc_len; x++) {
+				uint64_t w =
+					(uint64_t)row[x * 4 + 0] | (uint64_t)row[x * 4 + 1] << 16 |
+					(uint64_t)row[x * 4 + 2] << 32 | (uint64_t)row[x * 4 + 3] << 48;
+				acc[x] += w;
+			}
+		}
+
+		for (x = 0; x < out_w; x++) {
+			size_t box_w = width - (x << shift) < factor ? width - (x << shift) : factor;
+			unsigned int n = (unsigned int)(box_w * box_h);
+			for (c = 0; c < (size_t)channels; c++) {
+				unsigned int sum = 0;
+				for (i = 0; i < box_w; i++) {
+					size_t col = ((x << shift) + i) * channels + c;
+					sum += (unsigned int)(acc[col / 4] >> (col % 4 * 16)) & 0xffff;
+				}
+				out_row[x * channels + c] = (unsigned char)((sum + n / 2) / n);
+			}
+		}
+	}
+}
+
+static int qoi_valid_desc(const qoi_desc* desc) {
+	return
+		desc != NULL &&
+		desc->width != 0 && desc->height != 0 &&
+		desc->channels >= 3 && desc->channels <= 4 &&
+		desc->colorspace <= 1 &&
+		desc->height < QOI_PIXELS_MAX / desc->width;
+}
+
+/* Read and validate the 14 byte header at bytes into desc. Returns 0 if the
+header is invalid. */
+static int qoi_parse_header(const unsigned char* bytes, qoi_desc* desc) {
+	size_t p = 0;
+	unsigned int header_magic;
+
+	header_magic = qoi_read_32(bytes, &p);
+	desc->width = qoi_read_32(bytes, &p);
+	desc->height = qoi_read_32(bytes, &p);
+	desc->channels = bytes[p++];
+	desc->colorspace = bytes[p++];
+
+	return header_magic == QOI_MAGIC && qoi_valid_desc(desc);
+}
+
+/* Read and validate the header of size bytes of QOI data into desc. Returns
+0 if the data is too short to be a QOI image or the header is invalid. */
+static int qoi_read_header(const unsigned char* bytes, size_t size, qoi_desc* desc) {
+	if (size < QOI_HEADER_SIZE + sizeof(qoi_padding)) {
+		return 0;
+	}
+	return qoi_parse_header(bytes, desc);
+}
+
+size_t qoi_max_encoded_size(const qoi_desc* desc) {
+	if (!qoi_valid_desc(desc)) {
+		return 0;
+	}
+	return
+		(size_t)desc->width * desc->height * (desc->channels + 1) +
+		QOI_HEADER_SIZE + sizeof(qoi_padding);
+}
+
+size_t qoi_encode_into_fmt(const void* data, size_t stride, int fmt, const qoi_desc* desc, void* out, size_t out_cap) {
+	size_t i, p;
+	size_t row_len;
+	unsigned char* bytes;
+	const unsigned char* pixels;
+	qoi_rgba_t px_prev;
+	qoi_enc_state_t state;
+
+	if (
+		data == NULL || out == NULL ||
+		!qoi_valid_desc(desc) ||
+		out_cap < qoi_max_encoded_size(desc)
+		) {
+		return 0;
+	}
+
+	if (fmt == 0) {
+		fmt = desc->channels;
+	}
+	if (
+		fmt < QOI_FMT_RGB || fmt > QOI_FMT_ARGB ||
+		QOI_FMT_CHANNELS(fmt) != desc->channels
+		) {
+		return 0;
+	}
+
+	row_len = (size_t)desc->width * desc->channels;
+	if (stride == 0) {
+		stride = row_len;
+	}
+	if (stride < row_len) {
+		return 0;
+	}
+
+	p = 0;
+	bytes = (unsigned char*)out;
+
+	qoi_write_32(bytes, &p, QOI_MAGIC);
+	qoi_write_32(bytes, &p, desc->width);
+	qoi_write_32(bytes, &p, desc->height);
+	bytes[p++] = desc->channels;
+	bytes[p++] = desc->colorspace;
+
+
+	pixels = (const unsigned char*)data;
+
+	px_prev.rgba.r = 0;
+	px_prev.rgba.g = 0;
+	px_prev.rgba.b = 0;
+	px_prev.rgba.a = 255;
+
+	qoi_enc_state_init(&state, px_prev);
+
+	switch (fmt) {
+		case QOI_FMT_RGBA: p = qoi_encode_lines(pixels, stride, row_len, desc->height, &state, bytes, p, QOI_FMT_RGBA); break;
+		case QOI_FMT_BGRA: p = qoi_encode_lines(pixels, stride, row_len, desc->height, &state, bytes, p, QOI_FMT_BGRA); break;
+		case QOI_FMT_ARGB: p = qoi_encode_lines(pixels, stride, row_len, desc->height, &state, bytes, p, QOI_FMT_ARGB); break;
+		case QOI_FMT_BGR:  p = qoi_encode_lines(pixels, stride, row_len, desc->height, &state, bytes, p, QOI_FMT_BGR);  break;
+		default:           p = qoi_encode_lines(pixels, stride, row_len, desc->height, &state, bytes, p, QOI_FMT_RGB);  break;
+	}
+	p = qoi_enc_state_flush(&state, bytes, p);
+
+	for (i = 0; i < sizeof(qoi_padding); i++) {
+		bytes[p++] = qoi_padding[i];
+	}
+
+	return p;
+}
+
+size_t qoi_encode_into_stride(const void* data, size_t stride, const qoi_desc* desc, void* out, size_t out_cap) {
+	return qoi_encode_into_fmt(data, stride, 0, desc, out, out_cap);
+}
+
+size_t qoi_encode_into(const void* data, const qoi_desc* desc, void* out, size_t out_cap) {
+	return qoi_encode_into_stride(data, 0, desc, out, out_cap);
+}
+
+void* qoi_encode_fmt(const void* data, size_t stride, int fmt, const qoi_desc* desc, size_t* out_len) {
+	size_t max_size;
+	void* bytes;
+
+	if (data == NULL || out_len == NULL || !qoi_valid_desc(desc)) {
+		return NULL;
+	}
+
+	max_size = qoi_max_encoded_size(desc);
+	bytes = QOI_MALLOC(max_size);
+	if (!bytes) {
+		return NULL;
+	}
+
+	*out_len = qoi_encode_into_fmt(data, stride, fmt, desc, bytes, max_size);
+	if (*out_len == 0) {
+		QOI_FREE(bytes);
+		return NULL;
+	}
+	return bytes;
+}
+
+void* qoi_encode_stride(const void* data, size_t stride, const qoi_desc* desc, size_t* out_len) {
+	return qoi_encode_fmt(data, stride, 0, desc, out_len);
+}
+
+void* qoi_encode(const void* data, const qoi_desc* desc, size_t* out_len) {
+	size_t max_size;
+	void* bytes;
+
+	if (data == NULL || out_len == NULL || !qoi_valid_desc(desc)) {
+		return NULL;
+	}
+
+	max_size = qoi_max_encoded_size(desc);
+	bytes = QOI_MALLOC(max_size);
+	if (!bytes) {
+		return NULL;
+	}
+
+	*out_len = qoi_encode_into(data, desc, bytes, max_size);
+	return bytes;
+}
+
+/* qoi_encode_lean encodes this many pixels at a time, so its buffer only
+ever needs room for one worst-case slice past what has been written: one byte
+for a run carried over from the slice before, channels + 1 bytes per pixel
+and the padding. */
+#ifndef QOI_LEAN_SLICE
+#define QOI_LEAN_SLICE 65536
+#endif
+
+void* qoi_encode_lean(const void* data, const qoi_desc* desc, size_t* out_len) {
+	size_t i, cap, max_size, p;
+	size_t px_pos, px_len, slice_len, slice_max;
+	unsigned char* bytes;
+	unsigned char* grown;
+	const unsigned char* pixels;
+	qoi_rgba_t px_prev;
+	qoi_enc_state_t state;
+
+	if (data == NULL || out_len == NULL || !qoi_valid_desc(desc)) {
+		return NULL;
+	}
+
+	px_len = (size_t)desc->width * desc->height * desc->channels;
+	slice_len = (size_t)QOI_LEAN_SLICE * desc->channels;
+	slice_max = 1 + (size_t)QOI_LEAN_SLICE * (desc->channels + 1) + sizeof(qoi_padding);
+
+	/* Start from a quarter of the raw size, about what photos compress to */
+	max_size = qoi_max_encoded_size(desc);
+	cap = QOI_HEADER_SIZE + px_len / 4 + slice_max;
+	if (cap > max_size) {
+		cap = max_size;
+	}
+
+	p = 0;
+	bytes = (unsigned char*)QOI_MALLOC(cap);
+	if (!bytes) {
+		return NULL;
+	}
+
+	qoi_write_32(bytes, &p, QOI_MAGIC);
+	qoi_write_32(bytes, &p, desc->width);
+	qoi_write_32(bytes, &p, desc->height);
+	bytes[p++] = desc->channels;
+	bytes[p++] = desc->colorspace;
+
+	pixels = (const unsigned char*)data;
+
+	px_prev.rgba.r = 0;
+	px_prev.rgba.g = 0;
+	px_prev.rgba.b = 0;
+	px_prev.rgba.a = 255;
+	qoi_enc_state_init(&state, px_prev);
+
+	for (px_pos = 0; px_pos < px_len; px_pos += slice_len) {
+		size_t slice_end = px_len - px_pos > slice_len ? px_pos + slice_len : px_len;
+
+		/* Grow by half when the next slice might not fit */
+		if (cap - p < slice_max) {
+			cap += cap / 2;
+			if (cap < p + slice_max) {
+				cap = p + slice_max;
+			}
+			grown = (unsigned char*)QOI_REALLOC(bytes, cap);
+			if (!grown) {
+				QOI_FREE(bytes);
+				return NULL;
+			}
+			bytes = grown;
+		}
+
+		if (desc->channels == 4) {
+			p = qoi_encode_chunks(pixels, px_pos, slice_end, &state, bytes, p, 4);
+		}
+		else {
+			p = qoi_encode_chunks(pixels, px_pos, slice_end, &state, bytes, p, 3);
+		}
+	}
+	p = qoi_enc_state_flush(&state, bytes, p);
+
+	for (i = 0; i < sizeof(qoi_padding); i++) {
+		bytes[p++] = qoi_padding[i];
+	}
+
+	/* Hand back the slack, so the result is exactly out_len bytes */
+	grown = (unsigned char*)QOI_REALLOC(bytes, p);
+	if (grown) {
+		bytes = grown;
+	}
+
+	*out_len = p;
+	return bytes;
+}
+
+/* Hand the buffered bytes of a streaming encoder to its write callback. Fails
+if there is no callback, i.e. the buffer that holds the whole image is full. */
+static int qoi_encoder_flush(qoi_encoder_t* enc) {
+	if (enc->write == NULL || !enc->write(enc->user, enc->buf, enc->buf_len)) {
+		enc->failed = 1;
+		return 0;
+	}
+	enc->written += enc->buf_len;
+	enc->buf_len = 0;
+	return 1;
+}
+
+/* Pixels a streaming encoder without write callback encodes aside at a time
+once its buffer is nearly full */
+#define QOI_STREAM_SPILL_PX 16
+
+/* Encode n rows into the buffer of a streaming encoder. Every row is cut into
+pieces small enough for the space that is left, flushing in between: a piece
+of k pixels takes at most k * (channels + 1) bytes, plus one for a run left
+over from the piece before. Without a callback there is nothing to flush to,
+so the last pixels go through a small spill buffer and are kept if they fit,
+and encoding fails only once the image really outgrows the buffer. */
+static QOI_FORCEINLINE int qoi_encoder_rows(
+	qoi_encoder_t* enc, qoi_enc_state_t* state, const unsigned char* pixels,
+	size_t stride, size_t row_len, unsigned int n, const int fmt
+) {
+	const int channels = QOI_FMT_CHANNELS(fmt);
+	unsigned int y;
+
+	for (y = 0; y < n; y++) {
+		const unsigned char* row = pixels + y * stride;
+		size_t px_pos = 0;
+
+		while (px_pos < row_len) {
+			size_t avail = enc->buf_cap - enc->buf_len;
+			size_t piece;
+
+			if (avail < (size_t)channels + 2 && enc->write == NULL) {
+				unsigned char spill[QOI_STREAM_SPILL_PX * 5 + 1];
+				size_t len;
+
+				piece = (size_t)QOI_STREAM_SPILL_PX * channels;
+				if (piece > row_len - px_pos) {
+					piece = row_len - px_pos;
+				}
+				len = qoi_encode_chunks(row + px_pos, 0, piece, state, spill, 0, fmt);
+				if (len > avail) {
+					enc->failed = 1;
+					return 0;
+				}
+				memcpy(enc->buf + enc->buf_len, spill, len);
+				enc->buf_len += len;
+				px_pos += piece;
+				continue;
+			}
+			if (avail < (size_t)channels + 2) {
+				if (!qoi_encoder_flush(enc)) {
+					return 0;
+				}
+				continue;
+			}
+			piece = (avail - 1) / (channels + 1) * channels;
+			if (piece > row_len - px_pos) {
+				piece = row_len - px_pos;
+			}
+			enc->buf_len = qoi_encode_chunks(row + px_pos, 0, piece, state, enc->buf, enc->buf_len, fmt);
+			px_pos += piece;
+		}
+	}
+	return 1;
+}
+
+int qoi_encoder_begin(qoi_encoder_t* enc, const qoi_desc* desc, int fmt, void* buf, size_t buf_cap, qoi_write_func write, void* user) {
+	size_t p = 0;
+	qoi_rgba_t px_prev;
+
+	if (enc == NULL || buf == NULL || buf_cap < QOI_STREAM_BUF_MIN || !qoi_valid_desc(desc)) {
+		return 0;
+	}
+
+	if (fmt == 0) {
+		fmt = desc->channels;
+	}
+	if (
+		fmt < QOI_FMT_RGB || fmt > QOI_FMT_ARGB ||
+		QOI_FMT_CHANNELS(fmt) != desc->channels
+		) {
+		return 0;
+	}
+
+	enc->desc = *desc;
+	enc->fmt = fmt;
+	enc->failed = 0;
+	enc->rows_left = desc->height;
+	enc->buf = (unsigned char*)buf;
+	enc->buf_cap = buf_cap;
+	enc->written = 0;
+	enc->write = write;
+	enc->user = user;
+	QOI_ZEROARR(enc->index);
+	px_prev.rgba.r = 0;
+	px_prev.rgba.g = 0;
+	px_prev.rgba.b = 0;
+	px_prev.rgba.a = 255;
+	enc->px_prev = px_prev.v;
+	enc->run = 0;
+
+	qoi_write_32(enc->buf, &p, QOI_MAGIC);
+	qoi_write_32(enc->buf, &p, desc->width);
+	qoi_write_32(enc->buf, &p, desc->height);
+	enc->buf[p++] = desc->channels;
+	enc->buf[p++] = desc->colorspace;
+	enc->buf_len = p;
+	return 1;
+}
+
+int qoi_encoder_push_rows(qoi_encoder_t* enc, const void* rows, size_t stride, unsigned int n) {
+	const unsigned char* pixels = (const unsigned char*)rows;
+	size_t row_len;
+	qoi_enc_state_t state;
+	int ok;
+
+	if (enc == NULL || enc->failed || rows == NULL || n > enc->rows_left) {
+		if (enc != NULL) {
+			enc->failed = 1;
+		}
+		return 0;
+	}
+
+	row_len = (size_t)enc->desc.width * enc->desc.channels;
+	if (stride == 0) {
+		stride = row_len;
+	}
+	if (stride < row_len) {
+		enc->failed = 1;
+		return 0;
+	}
+
+	memcpy(state.index, enc->index, sizeof(enc->index));
+	state.px_prev.v = enc->px_prev;
+	state.run = enc->run;
+
+	switch (enc->fmt) {
+		case QOI_FMT_RGBA: ok = qoi_encoder_rows(enc, &state, pixels, stride, row_len, n, QOI_FMT_RGBA); break;
+		case QOI_FMT_BGRA: ok = qoi_encoder_rows(enc, &state, pixels, stride, row_len, n, QOI_FMT_BGRA); break;
+		case QOI_FMT_ARGB: ok = qoi_encoder_rows(enc, &state, pixels, stride, row_len, n, QOI_FMT_ARGB); break;
+		case QOI_FMT_BGR:  ok = qoi_encoder_rows(enc, &state, pixels, stride, row_len, n, QOI_FMT_BGR);  break;
+		default:           ok = qoi_encoder_rows(enc, &state, pixels, stride, row_len, n, QOI_FMT_RGB);  break;
+	}
+
+	memcpy(enc->index, state.index, sizeof(enc->index));
+	enc->px_prev = state.px_prev.v;
+	enc->run = state.run;
+	enc->rows_left -= n;
+	return ok;
+}
+
+size_t qoi_encoder_finish(qoi_encoder_t* enc) {
+	qoi_enc_state_t state;
+	size_t i;
+
+	if (enc == NULL || enc->failed || enc->rows_left > 0) {
+		return 0;
+	}
+
+	/* The last run, if there is one, and the padding */
+	if (enc->buf_cap - enc->buf_len < (enc->run > 0) + sizeof(qoi_padding) && !qoi_encoder_flush(enc)) {
+		return 0;
+	}
+	state.run = enc->run;
+	enc->buf_len = qoi_enc_state_flush(&state, enc->buf, enc->buf_len);
+	enc->run = 0;
+	for (i = 0; i < sizeof(qoi_padding); i++) {
+		enc->buf[enc->buf_len++] = qoi_padding[i];
+	}
+
+	if (enc->write != NULL && !qoi_encoder_flush(enc)) {
+		return 0;
+	}
+
+	/* The image is complete, nothing more can be pushed */
+	enc->failed = 1;
+	return enc->written + enc->buf_len;
+}
+
+/* Decode the chunks in bytes[0..end) into the row of a streaming decoder,
+with its state copied in and out around the kernel. Returns the number of
+bytes used. */
+static size_t qoi_decoder_chunks(qoi_decoder_t* dec, const unsigned char* bytes, size_t end) {
+	qoi_dec_state_t state;
+	size_t p;
+
+	memcpy(state.index, dec->index, sizeof(dec->index));
+	state.px.v = dec->px;
+	state.run = dec->run;
+
+	switch (dec->fmt) {
+		case QOI_FMT_RGBA:        p = qoi_decode_chunks_partial(bytes, 0, end, &state, dec->row, &dec->px_pos, dec->row_len, QOI_FMT_RGBA);        break;
+		case QOI_FMT_BGRA:        p = qoi_decode_chunks_partial(bytes, 0, end, &state, dec->row, &dec->px_pos, dec->row_len, QOI_FMT_BGRA);        break;
+		case QOI_FMT_ARGB:        p = qoi_decode_chunks_partial(bytes, 0, end, &state, dec->row, &dec->px_pos, dec->row_len, QOI_FMT_ARGB);        break;
+		case QOI_FMT_RGBA_PREMUL: p = qoi_decode_chunks_partial(bytes, 0, end, &state, dec->row, &dec->px_pos, dec->row_len, QOI_FMT_RGBA_PREMUL); break;
+		case QOI_FMT_BGR:         p = qoi_decode_chunks_partial(bytes, 0, end, &state, dec->row, &dec->px_pos, dec->row_len, QOI_FMT_BGR);         break;
+		default:                  p = qoi_decode_chunks_partial(bytes, 0, end, &state, dec->row, &dec->px_pos, dec->row_len, QOI_FMT_RGB);         break;
+	}
+
+	memcpy(dec->index, state.index, sizeof(dec->index));
+	dec->px = state.px.v;
+	dec->run = state.run;
+	return p;
+}
+
+int qoi_decoder_begin(qoi_decoder_t* dec, int fmt) {
+	qoi_rgba_t px;
+
+	if (dec == NULL || (fmt != 0 && (fmt < QOI_FMT_RGB || fmt > QOI_FMT_RGBA_PREMUL))) {
+		return 0;
+	}
+
+	memset(&dec->desc, 0, sizeof(dec->desc));
+	dec->fmt = fmt;
+	dec->failed = 0;
+	dec->rows_left = 0;
+	dec->row = NULL;
+	dec->row_len = 0;
+	dec->px_pos = 0;
+	dec->carry_len = 0;
+	QOI_ZEROARR(dec->index);
+	px.rgba.r = 0;
+	px.rgba.g = 0;
+	px.rgba.b = 0;
+	px.rgba.a = 255;
+	dec->px = px.v;
+	dec->run = 0;
+	return 1;
+}
+
+int qoi_decoder_pull_row(qoi_decoder_t* dec, const void** data, size_t* size, const void** row) {
+	const unsigned char* bytes;
+	size_t len, take, used;
+
+	if (dec == NULL || data == NULL || size == NULL || row == NULL || dec->failed) {
+		return QOI_STREAM_ERROR;
+	}
+	bytes = (const unsigned char*)*data;
+	len = bytes != NULL ? *size : 0;
+
+	if (dec->row == NULL) {
+		take = QOI_HEADER_SIZE - dec->carry_len < len ? QOI_HEADER_SIZE - dec->carry_len : len;
+		if (take > 0) {
+			memcpy(dec->carry + dec->carry_len, bytes, take);
+		}
+		dec->carry_len += take;
+		bytes += take;
+		len -= take;
+		*data = bytes;
+		*size = len;
+		if (dec->carry_len < QOI_HEADER_SIZE) {
+			return QOI_STREAM_MORE;
+		}
+
+		if (!qoi_parse_header(dec->carry, &dec->desc)) {
+			dec->failed = 1;
+			return QOI_STREAM_ERROR;
+		}
+		if (dec->fmt == 0) {
+			dec->fmt = dec->desc.channels;
+		}
+		dec->row_len = (size_t)dec->desc.width * QOI_FMT_CHANNELS(dec->fmt);
+		dec->row = (unsigned char*)QOI_MALLOC(dec->row_len);
+		if (!dec->row) {
+			dec->failed = 1;
+			return QOI_STREAM_ERROR;
+		}
+		dec->rows_left = dec->desc.height;
+		dec->carry_len = 0;
+	}
+
+	if (dec->rows_left == 0) {
+		return QOI_STREAM_DONE;
+	}
+
+	/* Complete a chunk that was cut off at the end of the previous input. It
+	is at most 5 bytes long, so it is decoded from the carry buffer. */
+	if (dec->carry_len > 0) {
+		size_t kept = dec->carry_len;
+		take = 5 - kept < len ? 5 - kept : len;
+		if (take > 0) {
+			memcpy(dec->carry + kept, bytes, take);
+		}
+		used = qoi_decoder_chunks(dec, dec->carry, kept + take);
+		if (used > 0) {
+			bytes += used - kept;
+			len -= used - kept;
+			dec->carry_len = 0;
+		}
+		else if (dec->px_pos < dec->row_len) {
+			/* Still not a whole chunk: keep all of the input */
+			bytes += take;
+			len -= take;
+			dec->carry_len += take;
+		}
+	}
+
+	if (dec->carry_len == 0 && dec->px_pos < dec->row_len) {
+		used = qoi_decoder_chunks(dec, bytes, len);
+		bytes += used;
+		len -= used;
+
+		/* The input ended inside a chunk, at most 4 bytes are left */
+		if (dec->px_pos < dec->row_len && len > 0) {
+			memcpy(dec->carry, bytes, len);
+			dec->carry_len = len;
+			bytes += len;
+			len = 0;
+		}
+	}
+
+	*data = bytes;
+	*size = len;
+	if (dec->px_pos < dec->row_len) {
+		return QOI_STREAM_MORE;
+	}
+
+	dec->px_pos = 0;
+	dec->rows_left--;
+	*row = dec->row;
+	return QOI_STREAM_ROW;
+}
+
+void qoi_decoder_end(qoi_decoder_t* dec) {
+	if (dec != NULL) {
+		QOI_FREE(dec->row);
+		dec->row = NULL;
+		dec->failed = 1;
+	}
+}
+
+
+size_t qoi_decode_into_fmt(const void* data, size_t size, qoi_desc* desc, void* pixels, size_t stride, size_t pixels_cap, int fmt) {
+	const unsigned char* bytes;
+	size_t row_len, span, chunks_len;
+	int channels;
+	qoi_dec_state_t state;
+
+	if (
+		data == NULL || desc == NULL || pixels == NULL ||
+		(fmt != 0 && (fmt < QOI_FMT_RGB || fmt > QOI_FMT_RGBA_PREMUL))
+		) {
+		return 0;
+	}
+
+	bytes = (const unsigned char*)data;
+	if (!qoi_read_header(bytes, size, desc)) {
+		return 0;
+	}
+
+	if (fmt == 0) {
+		fmt = desc->channels;
+	}
+	channels = QOI_FMT_CHANNELS(fmt);
+
+	row_len = (size_t)desc->width * channels;
+	if (stride == 0) {
+		stride = row_len;
+	}
+	if (
+		stride < row_len ||
+		(size_t)(desc->height - 1) > (((size_t)-1) - row_len) / stride
+		) {
+		return 0;
+	}
+
+	/* The last row does not need the padding that follows it */
+	span = (size_t)(desc->height - 1) * stride + row_len;
+	if (pixels_cap < span) {
+		return 0;
+	}
+
+	chunks_len = size - sizeof(qoi_padding);
+	qoi_dec_state_init(&state);
+	switch (fmt) {
+		case QOI_FMT_RGBA:        qoi_decode_lines(bytes, QOI_HEADER_SIZE, chunks_len, &state, (unsigned char*)pixels, stride, row_len, desc->height, QOI_FMT_RGBA);        break;
+		case QOI_FMT_BGRA:        qoi_decode_lines(bytes, QOI_HEADER_SIZE, chunks_len, &state, (unsigned char*)pixels, stride, row_len, desc->height, QOI_FMT_BGRA);        break;
+		case QOI_FMT_ARGB:        qoi_decode_lines(bytes, QOI_HEADER_SIZE, chunks_len, &state, (unsigned char*)pixels, stride, row_len, desc->height, QOI_FMT_ARGB);        break;
+		case QOI_FMT_RGBA_PREMUL: qoi_decode_lines(bytes, QOI_HEADER_SIZE, chunks_len, &state, (unsigned char*)pixels, stride, row_len, desc->height, QOI_FMT_RGBA_PREMUL); break;
+		case QOI_FMT_BGR:         qoi_decode_lines(bytes, QOI_HEADER_SIZE, chunks_len, &state, (unsigned char*)pixels, stride, row_len, desc->height, QOI_FMT_BGR);         break;
+		default:                  qoi_decode_lines(bytes, QOI_HEADER_SIZE, chunks_len, &state, (unsigned char*)pixels, stride, row_len, desc->height, QOI_FMT_RGB);         break;
+	}
+
+	return span;
+}
+
+size_t qoi_decode_into_stride(const void* data, size_t size, qoi_desc* desc, void* pixels, size_t stride, size_t pixels_cap, int channels) {
+	if (channels != 0 && channels != 3 && channels != 4) {
+		return 0;
+	}
+	return qoi_decode_into_fmt(data, size, desc, pixels, stride, pixels_cap, channels);
+}
+
+size_t qoi_decode_into(const void* data, size_t size, qoi_desc* desc, void* pixels, size_t pixels_cap, int channels) {
+	return qoi_decode_into_stride(data, size, desc, pixels, 0, pixels_cap, channels);
+}
+
+void* qoi_decode_fmt(const void* data, size_t size, qoi_desc* desc, int fmt) {
+	unsigned char* pixels;
+	size_t px_len;
+
+	if (
+		data == NULL || desc == NULL ||
+		(fmt != 0 && (fmt < QOI_FMT_RGB || fmt > QOI_FMT_RGBA_PREMUL)) ||
+		!qoi_read_header((const unsigned char*)data, size, desc)
+		) {
+		return NULL;
+	}
+
+	px_len = (size_t)desc->width * desc->height * QOI_FMT_CHANNELS(fmt == 0 ? desc->channels : fmt);
+	pixels = (unsigned char*)QOI_MALLOC(px_len);
+	if (!pixels) {
+		return NULL;
+	}
+
+	qoi_decode_into_fmt(data, size, desc, pixels, 0, px_len, fmt);
+	return pixels;
+}
+
+void* qoi_decode(const void* data, size_t size, qoi_desc* desc, int channels) {
+	if (channels != 0 && channels != 3 && channels != 4) {
+		return NULL;
+	}
+	return qoi_decode_fmt(data, size, desc, channels);
+}
+
+/* Opcodes of the table-driven decoder */
+#define QOI_DT_INDEX 0
+#define QOI_DT_DIFF  1
+#define QOI_DT_LUMA  2
+#define QOI_DT_RUN   3
+#define QOI_DT_RGB   4
+#define QOI_DT_RGBA  5
+
+typedef struct {
+	unsigned char op;  /* one of QOI_DT_* */
+	unsigned char arg; /* index position for INDEX, run length - 1 for RUN */
+	signed char dr, dg, db; /* deltas for DIFF; vg - 8, vg, vg - 8 for LUMA */
+} qoi_op_t;
+
+/* Entry of qoi_op_table for the first byte b of a chunk */
+#define QOI_DT_OP_INDEX(b) { QOI_DT_INDEX, (b) & 0x3f, 0, 0, 0 }
+#define QOI_DT_OP_DIFF(b)  { QOI_DT_DIFF, (b) & 0x3f, (((b) >> 4) & 0x03) - 2, (((b) >> 2) & 0x03) - 2, ((b) & 0x03) - 2 }
+#define QOI_DT_OP_LUMA(b)  { QOI_DT_LUMA, (b) & 0x3f, ((b) & 0x3f) - 40, ((b) & 0x3f) - 32, ((b) & 0x3f) - 40 }
+#define QOI_DT_OP_RUN(b)   { QOI_DT_RUN, (b) & 0x3f, 0, 0, 0 }
+#define QOI_DT_OPS_4(m, b)  m(b), m((b) + 1), m((b) + 2), m((b) + 3)
+#define QOI_DT_OPS_16(m, b) QOI_DT_OPS_4(m, b), QOI_DT_OPS_4(m, (b) + 4), QOI_DT_OPS_4(m, (b) + 8), QOI_DT_OPS_4(m, (b) + 12)
+#define QOI_DT_OPS_64(m, b) QOI_DT_OPS_16(m, b), QOI_DT_OPS_16(m, (b) + 16), QOI_DT_OPS_16(m, (b) + 32), QOI_DT_OPS_16(m, (b) + 48)
+
+/* Decoded form of every possible first byte of a chunk */
+static const qoi_op_t qoi_op_table[256] = {
+	QOI_DT_OPS_64(QOI_DT_OP_INDEX, 0x00),
+	QOI_DT_OPS_64(QOI_DT_OP_DIFF, 0x40),
+	QOI_DT_OPS_64(QOI_DT_OP_LUMA, 0x80),
+	QOI_DT_OPS_16(QOI_DT_OP_RUN, 0xc0),
+	QOI_DT_OPS_16(QOI_DT_OP_RUN, 0xd0),
+	QOI_DT_OPS_16(QOI_DT_OP_RUN, 0xe0),
+	QOI_DT_OPS_4(QOI_DT_OP_RUN, 0xf0),
+	QOI_DT_OPS_4(QOI_DT_OP_RUN, 0xf4),
+	QOI_DT_OPS_4(QOI_DT_OP_RUN, 0xf8),
+	QOI_DT_OP_RUN(0xfc),
+	QOI_DT_OP_RUN(0xfd),
+	{ QOI_DT_RGB, 0x3e, 0, 0, 0 },
+	{ QOI_DT_RGBA, 0x3f, 0, 0, 0 }
+};
+
+void* qoi_decode_table(const void* data, size_t size, qoi_desc* desc, int channels) {
+	const unsigned char* bytes;
+	unsigned char* pixels;
+	qoi_rgba_t index[64];
+	qoi_rgba_t px;
+	size_t px_len, chunks_len, px_pos;
+	size_t p = QOI_HEADER_SIZE;
+	int run = 0;
+
+	if (
+		data == NULL || desc == NULL ||
+		(channels != 0 && channels != 3 && channels != 4)
+		) {
+		return NULL;
+	}
+
+	bytes = (const unsigned char*)data;
+	if (!qoi_read_header(bytes, size, desc)) {
+		return NULL;
+	}
+
+	if (channels == 0) {
+		channels = desc->channels;
+	}
+
+	px_len = (size_t)desc->width * desc->height * channels;
+	pixels = (unsigned char*)QOI_MALLOC(px_len);
+	if (!pixels) {
+		return NULL;
+	}
+
+	QOI_ZEROARR(index);
+	px.rgba.r = 0;
+	px.rgba.g = 0;
+	px.rgba.b = 0;
+	px.rgba.a = 255;
+
+	chunks_len = size - sizeof(qoi_padding);
+	for (px_pos = 0; px_pos < px_len; px_pos += channels) {
+		if (run > 0) {
+			run--;
+		}
+		else if (p < chunks_len) {
+			const qoi_op_t* op = &qoi_op_table[bytes[p++]];
+
+			switch (op->op) {
+			case QOI_DT_INDEX:
+				px = index[op->arg];
+				break;
+			case QOI_DT_DIFF:
+				px.rgba.r += op->dr;
+				px.rgba.g += op->dg;
+				px.rgba.b += op->db;
+				break;
+			case QOI_DT_LUMA: {
+				int b2 = bytes[p++];
+				px.rgba.r += op->dr + (b2 >> 4);
+				px.rgba.g += op->dg;
+				px.rgba.b += op->db + (b2 & 0x0f);
+				break;
+			}
+			case QOI_DT_RUN:
+				run = op->arg;
+				break;
+			case QOI_DT_RGB:
+				px.rgba.r = bytes[p++];
+				px.rgba.g = bytes[p++];
+				px.rgba.b = bytes[p++];
+				break;
+			default:
+				px.rgba.r = bytes[p++];
+				px.rgba.g = bytes[p++];
+				px.rgba.b = bytes[p++];
+				px.rgba.a = bytes[p++];
+				break;
+			}
+
+			index[QOI_COLOR_HASH(px) % 64] = px;
+		}
+
+		pixels[px_pos + 0] = px.rgba.r;
+		pixels[px_pos + 1] = px.rgba.g;
+		pixels[px_pos + 2] = px.rgba.b;
+
+		if (channels == 4) {
+			pixels[px_pos + 3] = px.rgba.a;
+		}
+	}
+
+	return pixels;
+}
+
+#include <omp.h>
+
+/* Check the block count and offset table of a block-parallel image whose
+table starts at bytes[p]. The count must match the expected_blocks the image
+size calls for, the table must fit into the data and the offsets must ascend
+within the chunk data. Returns 0 if the table is malformed. */
+static int qoi_valid_block_table(const unsigned char* bytes, size_t size, size_t p, unsigned int num_blocks, size_t expected_blocks) {
+	size_t chunks_len = size - sizeof(qoi_padding);
+	const unsigned char* block_offsets = (bytes + p);
+	unsigned int i;
+
+	if (
+		num_blocks != expected_blocks ||
+		chunks_len < p ||
+		num_blocks > (chunks_len - p) / sizeof(int64_t)
+		) {
+		return 0;
+	}
+
+	p += num_blocks * sizeof(int64_t);
+	for (i = 0; i < num_blocks; i++) {
+		if (
+			qoi_read_offset(block_offsets, i) < (i > 0 ? qoi_read_offset(block_offsets, i - 1) : 0) ||
+			(uint64_t)qoi_read_offset(block_offsets, i) > chunks_len - p
+			) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* The block count of a block-parallel image has QOI_BLOCK_GEOMETRY set when
+the block height follows it as another 32-bit BE word. Images written before
+the height was stored have blocks of 64 rows. */
+#define QOI_BLOCK_GEOMETRY      0x80000000u
+#define QOI_BLOCK_HEIGHT_LEGACY 64
+
+static void qoi_write_block_geometry(unsigned char* bytes, size_t* p, int num_blocks, int block_height) {
+	qoi_write_32(bytes, p, QOI_BLOCK_GEOMETRY | (unsigned int)num_blocks);
+	qoi_write_32(bytes, p, (unsigned int)block_height);
+}
+
+/* Read the block count and block height of a block-parallel image from
+bytes[*p], leaving *p at the offset table, and check the table with
+qoi_valid_block_table. Returns 0 if either is malformed. */
+static int qoi_read_block_geometry(const unsigned char* bytes, size_t size, size_t* p, unsigned int height, int* num_blocks, int* block_height) {
+	unsigned int count = qoi_read_32(bytes, p);
+	unsigned int rows = QOI_BLOCK_HEIGHT_LEGACY;
+
+	if (count & QOI_BLOCK_GEOMETRY) {
+		if (*p + 4 > size - sizeof(qoi_padding)) {
+			return 0;
+		}
+		count &= ~QOI_BLOCK_GEOMETRY;
+		rows = qoi_read_32(bytes, p);
+		if (rows == 0 || rows > 0x7fffffff) {
+			return 0;
+		}
+	}
+
+	*num_blocks = (int)count;
+	*block_height = (int)rows;
+	return qoi_valid_block_table(bytes, size, *p, count, ((size_t)height + rows - 1) / rows);
+}
+
+/* Tiled images flag their tile count with QOI_BLOCK_TILES as well, which
+qoi_read_block_geometry rejects, and follow it with the tile height and tile
+width. */
+#define QOI_BLOCK_TILES 0x40000000u
+
+/* Read the tile geometry of a tiled or block-parallel image from bytes[*p]
+like qoi_read_block_geometry; the blocks of the latter are tiles as wide as
+the image. */
+static int qoi_read_tile_geometry(const unsigned char* bytes, size_t size, size_t* p, const qoi_desc* desc, int* tiles_x, int* tiles_y, int* tile_width, int* tile_height) {
+	size_t q = *p;
+	unsigned int count = qoi_read_32(bytes, &q);
+	unsigned int rows, cols;
+
+	if ((count & (QOI_BLOCK_GEOMETRY | QOI_BLOCK_TILES)) != (QOI_BLOCK_GEOMETRY | QOI_BLOCK_TILES)) {
+		*tiles_x = 1;
+		*tile_width = (int)desc->width;
+		return qoi_read_block_geometry(bytes, size, p, desc->height, tiles_y, tile_height);
+	}
+	if (q + 8 > size - sizeof(qoi_padding)) {
+		return 0;
+	}
+
+	count &= ~(QOI_BLOCK_GEOMETRY | QOI_BLOCK_TILES);
+	rows = qoi_read_32(bytes, &q);
+	cols = qoi_read_32(bytes, &q);
+	if (rows == 0 || rows > 0x7fffffff || cols == 0 || cols > 0x7fffffff) {
+		return 0;
+	}
+
+	/* qoi_encode_tiled_into never makes a tile larger than the image rounded
+	up to QOI_BLOCK_HEIGHT_MIN, and the decoders size their buffers by it */
+	if (
+		cols > ((size_t)desc->width + QOI_BLOCK_HEIGHT_MIN - 1) / QOI_BLOCK_HEIGHT_MIN * QOI_BLOCK_HEIGHT_MIN ||
+		rows > ((size_t)desc->height + QOI_BLOCK_HEIGHT_MIN - 1) / QOI_BLOCK_HEIGHT_MIN * QOI_BLOCK_HEIGHT_MIN
+		) {
+		return 0;
+	}
+
+	*p = q;
+	*tiles_x = (int)(((size_t)desc->width + cols - 1) / cols);
+	*tiles_y = (int)(((size_t)desc->height + rows - 1) / rows);
+	*tile_width = (int)cols;
+	*tile_height = (int)rows;
+	return qoi_valid_block_table(bytes, size, q, count,
+		(((size_t)desc->width + cols - 1) / cols) * (((size_t)desc->height + rows - 1) / rows));
+}
+
+/* Round a block height up to a multiple of QOI_BLOCK_HEIGHT_MIN, but no
+further than needed to cover height rows in one block */
+static int qoi_round_block_height(size_t rows, size_t height) {
+	size_t max_rows = (height + QOI_BLOCK_HEIGHT_MIN - 1) / QOI_BLOCK_HEIGHT_MIN * QOI_BLOCK_HEIGHT_MIN;
+
+	rows = (rows + QOI_BLOCK_HEIGHT_MIN - 1) / QOI_BLOCK_HEIGHT_MIN * QOI_BLOCK_HEIGHT_MIN;
+	rows = rows < QOI_BLOCK_HEIGHT_MIN ? QOI_BLOCK_HEIGHT_MIN : rows;
+	return (int)(rows < max_rows ? rows : max_rows);
+}
+
+int qoi_block_height(const qoi_desc* desc, int num_threads) {
+	size_t width, height, rows, min_rows, max_rows;
+
+	if (!qoi_valid_desc(desc)) {
+		return 0;
+	}
+	if (num_threads < 1) {
+		num_threads = 1;
+	}
+
+	// About four blocks per thread for load balance; the pixel bounds win
+	width = desc->width;
+	height = desc->height;
+	rows = (height + (size_t)num_threads * 4 - 1) / ((size_t)num_threads * 4);
+	max_rows = QOI_BLOCK_PIXELS_MAX / width;
+	min_rows = (QOI_BLOCK_PIXELS_MIN + width - 1) / width;
+	rows = rows > max_rows ? max_rows : rows;
+	rows = rows < min_rows ? min_rows : rows;
+	return qoi_round_block_height(rows, height);
+}
+
+/* Block-parallel images start with the regular 14 byte header, followed by
+the number of blocks (32-bit BE) and a table of native-endian 64-bit offsets
+of each block, relative to the end of the table; the block count is flagged
+with QOI_BLOCK_GEOMETRY and followed by the block height. Each block covers
+that many rows and is encoded independently, then comes the usual 8 byte
+padding. */
+void* qoi_encode_modify(const void* data, const qoi_desc* desc, size_t* out_len) {
+	if (data == NULL || out_len == NULL || desc == NULL ||
+		desc->width == 0 || desc->height == 0 ||
+		desc->channels < 3 || desc->channels > 4 ||
+		desc->colorspace > 1 ||
+		desc->height >= QOI_PIXELS_MAX / desc->width) {
+		return NULL;
+	}
+	
+	size_t width = desc->width;
+	size_t height = desc->height;
+	int channels = desc->channels;
+	int block_height = qoi_block_height(desc, omp_get_max_threads());
+	int num_blocks = (int)((height + block_height - 1) / block_height);
+
+	// Calculate max size including block geometry and block offset table
+	size_t max_size = width * height * (channels + 1) +
+		QOI_HEADER_SIZE + sizeof(qoi_padding) + 8 + (num_blocks * sizeof(int64_t));
+
+	unsigned char* bytes = (unsigned char*)QOI_MALLOC(max_size);
+	if (!bytes) return NULL;
+
+	// Write header
+	size_t p = 0;
+	qoi_write_32(bytes, &p, QOI_MAGIC);
+	qoi_write_32(bytes, &p, (unsigned int)width);
+	qoi_write_32(bytes, &p, (unsigned int)height);
+	bytes[p++] = channels;
+	bytes[p++] = desc->colorspace;
+	qoi_write_block_geometry(bytes, &p, num_blocks, block_height);
+
+	// Reserve space for block offsets
+	unsigned char* block_offsets = (bytes + p);
+	p += num_blocks * sizeof(int64_t);
+
+	const unsigned char* pixels = (const unsigned char*)data;
+
+	// Arrays to track block output positions and sizes
+	size_t* block_sizes = (size_t*)QOI_MALLOC(num_blocks * sizeof(size_t));
+	unsigned char** block_outputs = (unsigned char**)QOI_MALLOC(num_blocks * sizeof(unsigned char*));
+	if (!block_sizes || !block_outputs) {
+		QOI_FREE(bytes);
+		QOI_FREE(block_sizes);
+		QOI_FREE(block_outputs);
+		return NULL;
+	}
+
+	for (int block = 0; block < num_blocks; block++) {
+		size_t start_row = (size_t)block * block_height;
+		size_t end_row = min(start_row + block_height, height);
+		size_t block_px_len = width * (end_row - start_row) * channels;
+
+		unsigned char* local_buffer = (unsigned char*)QOI_MALLOC(block_px_len * 2);
+		if (!local_buffer) continue;
+
+		const unsigned char* block_pixels = pixels + (start_row * width) * channels;
+		size_t local_size = channels == 4 ?
+			qoi_encode_block(block_pixels, width * channels, width * channels, end_row - start_row, local_buffer, 4) :
+			qoi_encode_block(block_pixels, width * channels, width * channels, end_row - start_row, local_buffer, 3);
+
+		block_sizes[block] = local_size;
+		block_outputs[block] = local_buffer;
+	}
+
+	// Write blocks and store their offsets
+	size_t write_pos = p;
+	for (int i = 0; i < num_blocks; i++) {
+		qoi_write_offset(block_offsets, i, (int64_t)(write_pos - p));  // Store relative offset
+		memcpy(bytes + write_pos, block_outputs[i], block_sizes[i]);
+		write_pos += block_sizes[i];
+		QOI_FREE(block_outputs[i]);
+	}
+
+	// Write padding
+	memcpy(bytes + write_pos, qoi_padding, sizeof(qoi_padding));
+	write_pos += sizeof(qoi_padding);
+
+	QOI_FREE(block_sizes);
+	QOI_FREE(block_outputs);
+
+	*out_len = write_pos;
+	return bytes;
+}
+
+void* qoi_decode_modify(const void* data, size_t size, qoi_desc* desc, int channels) {
+	if (data == NULL || desc == NULL ||
+		(channels != 0 && channels != 3 && channels != 4) ||
+		size < QOI_HEADER_SIZE + sizeof(qoi_padding)) {
+		return NULL;
+	}
+
+	const unsigned char* bytes = (const unsigned char*)data;
+	size_t p = 0;
+
+	// Read header
+	unsigned int header_magic = qoi_read_32(bytes, &p);
+	desc->width = qoi_read_32(bytes, &p);
+	desc->height = qoi_read_32(bytes, &p);
+	desc->channels = bytes[p++];
+	desc->colorspace = bytes[p++];
+
+	// Validate header
+	if (desc->width == 0 || desc->height == 0 ||
+		desc->channels < 3 || desc->channels > 4 ||
+		desc->colorspace > 1 ||
+		header_magic != QOI_MAGIC ||
 		desc->height >= QOI_PIXELS_MAX / desc->width) {
 		return NULL;
 	}
-	
-	int width = desc->width;
-	int height = desc->height;
-	int channels = desc->channels;
-	const int BLOCK_HEIGHT = 64;
-	int num_blocks = (height + BLOCK_HEIGHT - 1) / BLOCK_HEIGHT;
 
-	// Calculate max size including block offset table
-	int max_size = width * height * (channels + 1) +
-		QOI_HEADER_SIZE + sizeof(qoi_padding) + (num_blocks * sizeof(int));
+	if (channels == 0) {
+		channels = desc->channels;
+	}
+
+	// Read number of blocks and block height
+	int num_blocks, block_height;
+	if (!qoi_read_block_geometry(bytes, size, &p, desc->height, &num_blocks, &block_height)) {
+		return NULL;
+	}
+
+	// Read block offsets table   
+	const unsigned char* block_offsets = (bytes + p); 
+	p += num_blocks * sizeof(int64_t); 
+
+	size_t width = desc->width;
+	size_t height = desc->height;
+	size_t px_len = width * height * channels;
+	size_t chunks_len = size - sizeof(qoi_padding);
+
+	unsigned char* pixels = (unsigned char*)QOI_MALLOC(px_len);
+	if (!pixels) {
+		return NULL;
+	}
+		for (int block = 0; block < num_blocks; block++) {
+			// Direct access to block data using offset
+			size_t local_p = p + (size_t)qoi_read_offset(block_offsets, block); // use array read 
+			size_t start_row = (size_t)block * block_height;
+			size_t end_row = min(start_row + block_height, height);
+			unsigned char* block_pixels = pixels + (start_row * width) * channels;
+			size_t block_px_len = width * (end_row - start_row) * channels;
+
+			// A block never reads chunks past the start of the next one
+			size_t block_end = block + 1 < num_blocks ? p + (size_t)qoi_read_offset(block_offsets, block + 1) : chunks_len;
+
+			qoi_dec_state_t state;
+			qoi_dec_state_init(&state);
+			if (channels == 4) {
+				qoi_decode_chunks(bytes, local_p, block_end, &state, block_pixels, block_px_len, 4);
+			}
+			else {
+				qoi_decode_chunks(bytes, local_p, block_end, &state, block_pixels, block_px_len, 3);
+			}
+		}
+	return pixels;
+}
+
+/* Worst-case size of a block-parallel image: the regular worst case plus the
+block geometry and the offset table at the smallest block height. Returns 0
+if the description is invalid. */
+size_t qoi_max_encoded_size_block(const qoi_desc* desc) {
+	size_t num_blocks;
+
+	if (!qoi_valid_desc(desc)) {
+		return 0;
+	}
+	num_blocks = ((size_t)desc->height + QOI_BLOCK_HEIGHT_MIN - 1) / QOI_BLOCK_HEIGHT_MIN;
+	return qoi_max_encoded_size(desc) + 8 + num_blocks * sizeof(int64_t);
+}
+
+/* Encode the tiles of tile_width x tile_height pixels of an image, row by
+row, to bytes[p], behind their offset table, and write the padding; the blocks
+of a block-parallel image are tiles as wide as the image. Every thread encodes
+its tiles one after the other into an arena of its own: chunks with room for
+the worst case of an even share of the tiles, chained together when a thread
+gets more than that. Once all tiles are done, a scan over their sizes gives
+every tile its offset, and the threads copy the tiles out of the arenas into
+place concurrently. Returns the size of the image, or 0 if malloc failed. */
+static size_t qoi_encode_tiles(
+	const unsigned char* pixels, size_t stride, int fmt, const qoi_desc* desc,
+	size_t tile_width, size_t tile_height, unsigned char* bytes, size_t p, int num_threads
+) {
+	size_t width = desc->width;
+	size_t height = desc->height;
+	int channels = desc->channels;
+	int tiles_x = (int)((width + tile_width - 1) / tile_width);
+	int num_tiles = tiles_x * (int)((height + tile_height - 1) / tile_height);
+	size_t tile_cap = tile_width * tile_height * (channels + 1);
+	if (num_threads < 1) {
+		num_threads = 1;
+	}
+	size_t chunk_cap = sizeof(unsigned char*) + tile_cap * ((num_tiles + num_threads - 1) / num_threads);
+	size_t write_pos = 0;
+	int failed = 0;
+
+	unsigned char* tile_offsets = (bytes + p);
+	p += num_tiles * sizeof(int64_t);
+
+	// Where in the arenas every tile ended up
+	size_t* tile_sizes = (size_t*)QOI_MALLOC(num_tiles * sizeof(size_t));
+	unsigned char** tile_data = (unsigned char**)QOI_MALLOC(num_tiles * sizeof(unsigned char*));
+	if (!tile_sizes || !tile_data) {
+		QOI_FREE(tile_sizes);
+		QOI_FREE(tile_data);
+		return 0;
+	}
+
+#pragma omp parallel num_threads(num_threads)
+	{
+		// The newest chunk, which starts with a pointer to the one before
+		unsigned char* arena = NULL;
+		size_t arena_len = 0, arena_cap = 0;
+
+#pragma omp for schedule(dynamic)
+		for (int tile = 0; tile < num_tiles; tile++) {
+			if (arena_cap - arena_len < tile_cap) {
+				unsigned char* chunk = (unsigned char*)QOI_MALLOC(chunk_cap);
+				if (!chunk) {
+#pragma omp atomic
+					failed |= 1;
+					continue;
+				}
+				memcpy(chunk, &arena, sizeof(arena));
+				arena = chunk;
+				arena_len = sizeof(arena);
+				arena_cap = chunk_cap;
+			}
+
+			size_t start_row = (size_t)(tile / tiles_x) * tile_height;
+			size_t start_col = (size_t)(tile % tiles_x) * tile_width;
+			size_t rows = min(start_row + tile_height, height) - start_row;
+			size_t tile_row_len = (min(start_col + tile_width, width) - start_col) * channels;
+			const unsigned char* tile_pixels = pixels + start_row * stride + start_col * channels;
+			unsigned char* tile_out = arena + arena_len;
+			size_t local_size;
+			switch (fmt) {
+				case QOI_FMT_RGBA: local_size = qoi_encode_block(tile_pixels, stride, tile_row_len, rows, tile_out, QOI_FMT_RGBA); break;
+				case QOI_FMT_BGRA: local_size = qoi_encode_block(tile_pixels, stride, tile_row_len, rows, tile_out, QOI_FMT_BGRA); break;
+				case QOI_FMT_ARGB: local_size = qoi_encode_block(tile_pixels, stride, tile_row_len, rows, tile_out, QOI_FMT_ARGB); break;
+				case QOI_FMT_BGR:  local_size = qoi_encode_block(tile_pixels, stride, tile_row_len, rows, tile_out, QOI_FMT_BGR);  break;
+				default:           local_size = qoi_encode_block(tile_pixels, stride, tile_row_len, rows, tile_out, QOI_FMT_RGB);  break;
+			}
+
+			tile_sizes[tile] = local_size;
+			tile_data[tile] = tile_out;
+			arena_len += local_size;
+		}
+
+		// A few hundred sizes: the scan is not worth splitting up
+#pragma omp single
+		if (!failed) {
+			for (int i = 0; i < num_tiles; i++) {
+				qoi_write_offset(tile_offsets, i, (int64_t)write_pos);  // Store relative offset
+				write_pos += tile_sizes[i];
+			}
+		}
+
+		if (!failed) {
+#pragma omp for schedule(dynamic)
+			for (int tile = 0; tile < num_tiles; tile++) {
+				memcpy(bytes + p + (size_t)qoi_read_offset(tile_offsets, tile), tile_data[tile], tile_sizes[tile]);
+			}
+		}
+
+		while (arena) {
+			unsigned char* chunk = arena;
+			memcpy(&arena, chunk, sizeof(arena));
+			QOI_FREE(chunk);
+		}
+	}
+
+	QOI_FREE(tile_sizes);
+	QOI_FREE(tile_data);
+	if (failed) {
+		return 0;
+	}
+
+	// Write padding
+	memcpy(bytes + p + write_pos, qoi_padding, sizeof(qoi_padding));
+	return p + write_pos + sizeof(qoi_padding);
+}
+
+size_t qoi_encode_parallel_block_height_into(const void* data, size_t stride, int fmt, const qoi_desc* desc, void* out, size_t out_cap, int block_height, int num_threads) {
+	if (data == NULL || out == NULL ||
+		!qoi_valid_desc(desc) ||
+		out_cap < qoi_max_encoded_size_block(desc)) {
+		return 0;
+	}
+
+	if (fmt == 0) {
+		fmt = desc->channels;
+	}
+	if (fmt < QOI_FMT_RGB || fmt > QOI_FMT_ARGB || QOI_FMT_CHANNELS(fmt) != desc->channels) {
+		return 0;
+	}
+
+	size_t width = desc->width;
+	size_t height = desc->height;
+	int channels = desc->channels;
+	if (block_height < 0) {
+		return 0;
+	}
+	block_height = block_height == 0 ? qoi_block_height(desc, num_threads) : qoi_round_block_height(block_height, height);
+	int num_blocks = (int)((height + block_height - 1) / block_height);
+
+	size_t row_len = width * channels;
+	if (stride == 0) {
+		stride = row_len;
+	}
+	if (stride < row_len) {
+		return 0;
+	}
+
+	unsigned char* bytes = (unsigned char*)out;
+
+	// Write header
+	size_t p = 0;
+	qoi_write_32(bytes, &p, QOI_MAGIC);
+	qoi_write_32(bytes, &p, (unsigned int)width);
+	qoi_write_32(bytes, &p, (unsigned int)height);
+	bytes[p++] = channels;
+	bytes[p++] = desc->colorspace;
+	qoi_write_block_geometry(bytes, &p, num_blocks, block_height);
+
+	return qoi_encode_tiles((const unsigned char*)data, stride, fmt, desc, width, block_height, bytes, p, num_threads);
+}
+
+size_t qoi_encode_parallel_block_fmt_into(const void* data, size_t stride, int fmt, const qoi_desc* desc, void* out, size_t out_cap, int num_threads) {
+	return qoi_encode_parallel_block_height_into(data, stride, fmt, desc, out, out_cap, 0, num_threads);
+}
+
+size_t qoi_encode_parallel_block_stride_into(const void* data, size_t stride, const qoi_desc* desc, void* out, size_t out_cap, int num_threads) {
+	return qoi_encode_parallel_block_fmt_into(data, stride, 0, desc, out, out_cap, num_threads);
+}
+
+size_t qoi_encode_parallel_block_simple_into(const void* data, const qoi_desc* desc, void* out, size_t out_cap, int num_threads) {
+	return qoi_encode_parallel_block_fmt_into(data, 0, 0, desc, out, out_cap, num_threads);
+}
+
+void* qoi_encode_parallel_block_simple(const void* data, const qoi_desc* desc, size_t* out_len, int num_threads) {
+	if (data == NULL || out_len == NULL || !qoi_valid_desc(desc)) {
+		return NULL;
+	}
+
+	size_t max_size = qoi_max_encoded_size_block(desc);
+	void* bytes = QOI_MALLOC(max_size);
+	if (!bytes) return NULL;
+
+	*out_len = qoi_encode_parallel_block_simple_into(data, desc, bytes, max_size, num_threads);
+	if (*out_len == 0) {
+		QOI_FREE(bytes);
+		return NULL;
+	}
+	return bytes;
+}
+
+size_t qoi_encode_parallel_fmt_into(const void* data, size_t stride, int fmt, const qoi_desc* desc, void* out, size_t out_cap, int num_threads) {
+	if (data == NULL || out == NULL ||
+		!qoi_valid_desc(desc) ||
+		out_cap < qoi_max_encoded_size(desc)) {
+		return 0;
+	}
+
+	if (fmt == 0) {
+		fmt = desc->channels;
+	}
+	if (fmt < QOI_FMT_RGB || fmt > QOI_FMT_ARGB || QOI_FMT_CHANNELS(fmt) != desc->channels) {
+		return 0;
+	}
+
+	const int STRIP_HEIGHT = 64;
+	size_t width = desc->width;
+	size_t height = desc->height;
+	int channels = desc->channels;
+	int num_strips = (int)((height + STRIP_HEIGHT - 1) / STRIP_HEIGHT);
+	int failed = 0;
+
+	size_t row_len = width * channels;
+	if (stride == 0) {
+		stride = row_len;
+	}
+	if (stride < row_len) {
+		return 0;
+	}
+
+	unsigned char* bytes = (unsigned char*)out;
+
+	// Write header
+	size_t p = 0;
+	qoi_write_32(bytes, &p, QOI_MAGIC);
+	qoi_write_32(bytes, &p, (unsigned int)width);
+	qoi_write_32(bytes, &p, (unsigned int)height);
+	bytes[p++] = channels;
+	bytes[p++] = desc->colorspace;
+
+	const unsigned char* pixels = (const unsigned char*)data;
+
+	// Arrays to track strip outputs and sizes
+	size_t* strip_sizes = (size_t*)QOI_MALLOC(num_strips * sizeof(size_t));
+	unsigned char** strip_outputs = (unsigned char**)QOI_MALLOC(num_strips * sizeof(unsigned char*));
+	if (!strip_sizes || !strip_outputs) {
+		QOI_FREE(strip_sizes);
+		QOI_FREE(strip_outputs);
+		return 0;
+	}
+
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+	for (int strip = 0; strip < num_strips; strip++) {
+		size_t start_row = (size_t)strip * STRIP_HEIGHT;
+		size_t rows = min(height - start_row, (size_t)STRIP_HEIGHT);
+
+		// At most channels + 1 bytes per pixel
+		unsigned char* local_buffer = (unsigned char*)QOI_MALLOC(width * rows * (channels + 1));
+		strip_outputs[strip] = local_buffer;
+		strip_sizes[strip] = 0;
+		if (!local_buffer) {
+#pragma omp atomic
+			failed |= 1;
+			continue;
+		}
+
+		switch (fmt) {
+			case QOI_FMT_RGBA: strip_sizes[strip] = qoi_encode_strip(pixels, stride, row_len, start_row, rows, local_buffer, QOI_FMT_RGBA); break;
+			case QOI_FMT_BGRA: strip_sizes[strip] = qoi_encode_strip(pixels, stride, row_len, start_row, rows, local_buffer, QOI_FMT_BGRA); break;
+			case QOI_FMT_ARGB: strip_sizes[strip] = qoi_encode_strip(pixels, stride, row_len, start_row, rows, local_buffer, QOI_FMT_ARGB); break;
+			case QOI_FMT_BGR:  strip_sizes[strip] = qoi_encode_strip(pixels, stride, row_len, start_row, rows, local_buffer, QOI_FMT_BGR);  break;
+			default:           strip_sizes[strip] = qoi_encode_strip(pixels, stride, row_len, start_row, rows, local_buffer, QOI_FMT_RGB);  break;
+		}
+	}
+
+	// Join the strips in order
+	for (int i = 0; i < num_strips; i++) {
+		if (!failed) {
+			memcpy(bytes + p, strip_outputs[i], strip_sizes[i]);
+			p += strip_sizes[i];
+		}
+		QOI_FREE(strip_outputs[i]);
+	}
+
+	QOI_FREE(strip_sizes);
+	QOI_FREE(strip_outputs);
+	if (failed) {
+		return 0;
+	}
+
+	// Write padding
+	memcpy(bytes + p, qoi_padding, sizeof(qoi_padding));
+	p += sizeof(qoi_padding);
+
+	return p;
+}
+
+void* qoi_encode_parallel(const void* data, const qoi_desc* desc, size_t* out_len) {
+	if (data == NULL || out_len == NULL || !qoi_valid_desc(desc)) {
+		return NULL;
+	}
+
+	size_t max_size = qoi_max_encoded_size(desc);
+	void* bytes = QOI_MALLOC(max_size);
+	if (!bytes) return NULL;
+
+	*out_len = qoi_encode_parallel_fmt_into(data, 0, 0, desc, bytes, max_size, omp_get_max_threads());
+	if (*out_len == 0) {
+		QOI_FREE(bytes);
+		return NULL;
+	}
+	return bytes;
+}
+
+/* One byte segment of a standard QOI stream decoded by
+qoi_decode_parallel_fmt_into */
+typedef struct {
+	size_t start;      /* where the pre-scan started, maybe inside a chunk */
+	size_t end;        /* first chunk start at or past the next segment's start */
+	size_t pixels;     /* pixels of the segment's chunks */
+	size_t checkpoint; /* chunk start to begin the next segment's warm-up at */
+	int px_at[QOI_SEG_SYNC];
+	size_t chunks;     /* first chunk start of the segment */
+	size_t px_start;   /* pixels before the segment */
+	size_t px_end;
+	qoi_dec_state_t guess;
+	qoi_dec_state_t state;
+	int px_read;
+	uint64_t read_mask;
+	uint64_t written_mask;
+	int redo;
+} qoi_segment_t;
+
+/* Decode pixels px_start to px_end of segment seg from the chunks starting at
+chunks, continuing from state */
+static QOI_FORCEINLINE void qoi_decode_segment(
+	const unsigned char* bytes, size_t chunks_len, qoi_segment_t* seg, qoi_dec_state_t* state,
+	unsigned char* pixels, int tracked, const int fmt
+) {
+	const int channels = QOI_FMT_CHANNELS(fmt);
+	size_t px_len = (seg->px_end - seg->px_start) * channels;
+	size_t px_pos = 0;
+	size_t p = seg->chunks;
+
+	pixels += seg->px_start * channels;
+	if (tracked) {
+		p = qoi_decode_chunks_tracked(bytes, p, chunks_len, state, pixels, &px_pos, px_len,
+			&seg->px_read, &seg->read_mask, &seg->written_mask, fmt);
+	}
+	if (px_pos < px_len) {
+		qoi_decode_chunks(bytes, p, chunks_len, state, pixels + px_pos, px_len - px_pos, fmt);
+	}
+}
+
+/* Decode segment seg from its guessed start state, recording in seg which parts
+of the guess were used, and the state it ends with */
+static void qoi_decode_segment_guess(
+	const unsigned char* bytes, size_t chunks_len, qoi_segment_t* seg,
+	unsigned char* pixels, int fmt
+) {
+	size_t seg_len = min(seg->end, chunks_len);
+	qoi_dec_state_t state = seg->guess;
+
+	seg->px_read = 0;
+	seg->read_mask = 0;
+	seg->written_mask = 0;
+	switch (fmt) {
+		case QOI_FMT_RGBA:        qoi_decode_segment(bytes, seg_len, seg, &state, pixels, 1, QOI_FMT_RGBA);        break;
+		case QOI_FMT_BGRA:        qoi_decode_segment(bytes, seg_len, seg, &state, pixels, 1, QOI_FMT_BGRA);        break;
+		case QOI_FMT_ARGB:        qoi_decode_segment(bytes, seg_len, seg, &state, pixels, 1, QOI_FMT_ARGB);        break;
+		case QOI_FMT_RGBA_PREMUL: qoi_decode_segment(bytes, seg_len, seg, &state, pixels, 1, QOI_FMT_RGBA_PREMUL); break;
+		case QOI_FMT_BGR:         qoi_decode_segment(bytes, seg_len, seg, &state, pixels, 1, QOI_FMT_BGR);         break;
+		default:                  qoi_decode_segment(bytes, seg_len, seg, &state, pixels, 1, QOI_FMT_RGB);         break;
+	}
+	seg->state = state;
+}
+
+/* Whether the parts of seg's guessed start state its decoding used match state */
+static int qoi_segment_matches(const qoi_segment_t* seg, const qoi_dec_state_t* state) {
+	const qoi_rgba_t* g = &seg->guess.px;
+	const qoi_rgba_t* px = &state->px;
+
+	if ((seg->px_read & QOI_READ_RGB) && (g->rgba.r != px->rgba.r || g->rgba.g != px->rgba.g || g->rgba.b != px->rgba.b)) {
+		return 0;
+	}
+	if ((seg->px_read & QOI_READ_ALPHA) && g->rgba.a != px->rgba.a) {
+		return 0;
+	}
+	for (int i = 0; i < 64; i++) {
+		if (((seg->read_mask >> i) & 1) && seg->guess.index[i].v != state->index[i].v) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+size_t qoi_decode_parallel_fmt_into(const void* data, size_t size, qoi_desc* desc, void* pixels, size_t pixels_cap, int fmt, int num_threads) {
+	if (data == NULL || desc == NULL || pixels == NULL ||
+		(fmt != 0 && (fmt < QOI_FMT_RGB || fmt > QOI_FMT_RGBA_PREMUL))) {
+		return 0;
+	}
+
+	const unsigned char* bytes = (const unsigned char*)data;
+	if (!qoi_read_header(bytes, size, desc)) {
+		return 0;
+	}
+	if (fmt == 0) {
+		fmt = desc->channels;
+	}
+
+	// Segments of at least 128 KB, each warmed up on the last 8 KB before it
+	const size_t SEGMENT_MIN = 1 << 17;
+	const size_t WARMUP = 1 << 13;
+	int channels = QOI_FMT_CHANNELS(fmt);
+	size_t total = (size_t)desc->width * desc->height;
+	size_t chunks_len = size - sizeof(qoi_padding);
+	size_t segment_bytes = chunks_len - QOI_HEADER_SIZE;
+	int num_segments = (int)min((size_t)num_threads * 4, segment_bytes / SEGMENT_MIN);
+
+	if (pixels_cap < total * channels) {
+		return 0;
+	}
+	if (num_segments < 2) {
+		return qoi_decode_into_fmt(data, size, desc, pixels, 0, pixels_cap, fmt);
+	}
+
+	qoi_segment_t* segs = (qoi_segment_t*)QOI_MALLOC(num_segments * sizeof(qoi_segment_t));
+	if (!segs) {
+		return 0;
+	}
+	for (int k = 0; k < num_segments; k++) {
+		segs[k].start = QOI_HEADER_SIZE + segment_bytes / num_segments * k;
+	}
+
+	// Pass 1: walk the tags of every segment, starting at a guessed chunk start
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+	for (int k = 0; k < num_segments; k++) {
+		qoi_segment_t* seg = &segs[k];
+		size_t limit = k + 1 < num_segments ? segs[k + 1].start : chunks_len;
+
+		for (int i = 0; i < QOI_SEG_SYNC; i++) {
+			seg->px_at[i] = -1;
+		}
+		seg->pixels = 0;
+		seg->checkpoint = seg->start;
+		seg->end = qoi_scan_chunks(bytes, seg->start, limit, &seg->pixels,
+			limit - WARMUP, &seg->checkpoint, seg->px_at, seg->start);
+	}
+
+	// The true chunk starts: follow the chunks from the end of the segment before
+	// until they meet the walk of pass 1, which then went the same way
+	size_t p = QOI_HEADER_SIZE;
+	size_t px_start = 0;
+	for (int k = 0; k < num_segments; k++) {
+		qoi_segment_t* seg = &segs[k];
+		size_t limit = k + 1 < num_segments ? segs[k + 1].start : chunks_len;
+		size_t n = 0, q = p;
+
+		seg->chunks = p;
+		seg->px_start = min(px_start, total);
+		if (p >= chunks_len) {
+			// No chunks left for this segment
+			seg->end = p;
+			seg->px_start = seg->px_end = total;
+			continue;
+		}
+
+		while (q < chunks_len && q - seg->start < QOI_SEG_SYNC && seg->px_at[q - seg->start] < 0) {
+			n += qoi_chunk_pixels(bytes[q]);
+			q += qoi_chunk_len(bytes[q]);
+		}
+		if (q < chunks_len && q - seg->start < QOI_SEG_SYNC) {
+			seg->pixels += n - seg->px_at[q - seg->start];
+			if (seg->checkpoint < q) {
+				seg->checkpoint = q;
+			}
+		}
+		else {
+			// No meeting point: walk the whole segment again
+			seg->pixels = 0;
+			seg->checkpoint = p;
+			seg->end = qoi_scan_chunks(bytes, p, limit, &seg->pixels,
+				limit - WARMUP, &seg->checkpoint, NULL, 0);
+		}
+
+		// The segment with the last chunk also repeats the last pixel up to the end
+		px_start += seg->pixels;
+		seg->px_end = seg->end >= chunks_len ? total : min(px_start, total);
+		p = seg->end;
+	}
+
+	int live = 1;
+	while (live < num_segments && segs[live].px_start < segs[live].px_end) {
+		live++;
+	}
+
+	// Pass 2: decode every segment from the state after decoding the last few KB
+	// of the segment before it
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+	for (int k = 0; k < live; k++) {
+		qoi_segment_t* seg = &segs[k];
+
+		qoi_dec_state_init(&seg->guess);
+		if (k > 0) {
+			unsigned char scratch[1024];
+			size_t q = segs[k - 1].checkpoint;
+
+			// Index entries the warm-up does not reach are guessed opaque black
+			// rather than zero, as QOI_OP_RGB would keep a wrong alpha for good
+			for (int i = 0; i < 64; i++) {
+				seg->guess.index[i] = seg->guess.px;
+			}
+			while (q < seg->chunks) {
+				size_t scratch_pos = 0;
+				q = qoi_decode_chunks_partial(bytes, q, seg->chunks, &seg->guess, scratch, &scratch_pos, sizeof(scratch), QOI_FMT_RGBA);
+			}
+			seg->guess.run = 0;
+		}
+		qoi_decode_segment_guess(bytes, chunks_len, seg, (unsigned char*)pixels, fmt);
+	}
+
+	// Pass 3: in order, check the parts of the guessed state each segment used
+	// against the true state the segment before it ended with, as far as they
+	// match. The first segment that does not is decoded again from the true
+	// state, and alongside it every later segment whose guess does not match the
+	// end state of the one before it, from that end state. Once that has cost as
+	// much as pass 2, the segments that fail are only decoded again one by one.
+	qoi_dec_state_t state = segs[0].state;
+	int redone = 0;
+	for (int k = 1; k < live; ) {
+		qoi_segment_t* seg = &segs[k];
+
+		state.run = 0;
+		if (qoi_segment_matches(seg, &state)) {
+			for (int i = 0; i < 64; i++) {
+				if ((seg->written_mask >> i) & 1) {
+					state.index[i] = seg->state.index[i];
+				}
+			}
+			state.px = seg->state.px;
+			k++;
+			continue;
+		}
+
+		seg->guess = state;
+		seg->redo = 1;
+		for (int j = k + 1; j < live; j++) {
+			segs[j].redo = redone < live && !qoi_segment_matches(&segs[j], &segs[j - 1].state);
+			if (segs[j].redo) {
+				segs[j].guess = segs[j - 1].state;
+				segs[j].guess.run = 0;
+			}
+		}
+
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads) reduction(+:redone)
+		for (int j = k; j < live; j++) {
+			if (segs[j].redo) {
+				qoi_decode_segment_guess(bytes, chunks_len, &segs[j], (unsigned char*)pixels, fmt);
+				redone++;
+			}
+		}
+	}
+
+	QOI_FREE(segs);
+	return total * channels;
+}
+
+void* qoi_decode_parallel(const void* data, size_t size, qoi_desc* desc, int channels) {
+	size_t px_len;
+	void* pixels;
+
+	if (data == NULL || desc == NULL || (channels != 0 && channels != 3 && channels != 4) ||
+		!qoi_read_header((const unsigned char*)data, size, desc)) {
+		return NULL;
+	}
+	if (channels == 0) {
+		channels = desc->channels;
+	}
+
+	px_len = (size_t)desc->width * desc->height * channels;
+	pixels = QOI_MALLOC(px_len);
+	if (!pixels) {
+		return NULL;
+	}
+
+	if (!qoi_decode_parallel_fmt_into(data, size, desc, pixels, px_len, channels, omp_get_max_threads())) {
+		QOI_FREE(pixels);
+		return NULL;
+	}
+	return pixels;
+}
+
+/* Seek index: the sidecar header and one checkpoint (offset, run, px, index) */
+#define QOI_SEEK_MAGIC \
+	(((unsigned int)'q') << 24 | ((unsigned int)'o') << 16 | \
+	 ((unsigned int)'i') <<  8 | ((unsigned int)'x'))
+#define QOI_SEEK_HEADER_SIZE 28
+#define QOI_SEEK_ENTRY_SIZE (8 + 4 + 4 + 64 * 4)
+
+/* A streaming decoder run over a whole QOI file, and the sidecar it fills with
+a checkpoint in front of every rows-th row */
+typedef struct {
+	qoi_decoder_t dec;
+	unsigned int rows;
+	unsigned char* index;
+	size_t index_len;
+	size_t offset; /* file position of the input fed next */
+} qoi_seek_builder_t;
+
+static void qoi_seek_put(unsigned char* entry, size_t offset, const unsigned int* index, unsigned int px, int run) {
+	size_t p = 0;
+	qoi_rgba_t c;
+
+	qoi_write_32(entry, &p, (unsigned int)((unsigned long long)offset >> 32));
+	qoi_write_32(entry, &p, (unsigned int)offset);
+	qoi_write_32(entry, &p, (unsigned int)run);
+	for (int i = -1; i < 64; i++) {
+		c.v = i < 0 ? px : index[i];
+		entry[p++] = c.rgba.r;
+		entry[p++] = c.rgba.g;
+		entry[p++] = c.rgba.b;
+		entry[p++] = c.rgba.a;
+	}
+}
+
+static size_t qoi_seek_load(const unsigned char* entry, qoi_dec_state_t* state) {
+	size_t p = 0;
+	unsigned long long offset = (unsigned long long)qoi_read_32(entry, &p) << 32;
+
+	offset |= qoi_read_32(entry, &p);
+	state->run = (int)qoi_read_32(entry, &p);
+	for (int i = -1; i < 64; i++) {
+		qoi_rgba_t* c = i < 0 ? &state->px : &state->index[i];
+		c->rgba.r = entry[p++];
+		c->rgba.g = entry[p++];
+		c->rgba.b = entry[p++];
+		c->rgba.a = entry[p++];
+	}
+	return (size_t)offset;
+}
+
+static int qoi_seek_builder_begin(qoi_seek_builder_t* b, unsigned int rows) {
+	b->rows = rows == 0 ? QOI_SEEK_ROWS : rows;
+	b->index = NULL;
+	b->index_len = 0;
+	b->offset = 0;
+	return qoi_decoder_begin(&b->dec, 0);
+}
+
+/* Feed the next size bytes of the QOI file to b. Returns QOI_STREAM_MORE when
+all of them were used, QOI_STREAM_DONE once every row is decoded, or
+QOI_STREAM_ERROR. */
+static int qoi_seek_builder_feed(qoi_seek_builder_t* b, const void* data, size_t size) {
+	const unsigned char* start = (const unsigned char*)data;
+	const void* row;
+
+	for (;;) {
+		int ret = qoi_decoder_pull_row(&b->dec, &data, &size, &row);
+		size_t used = (const unsigned char*)data - start;
+		unsigned int y;
+
+		if (ret != QOI_STREAM_ROW) {
+			b->offset += used;
+			return ret;
+		}
+
+		if (b->index == NULL) {
+			size_t count = ((size_t)b->dec.desc.height + b->rows - 1) / b->rows;
+			qoi_dec_state_t state;
+
+			b->index_len = QOI_SEEK_HEADER_SIZE + count * QOI_SEEK_ENTRY_SIZE;
+			b->index = (unsigned char*)QOI_MALLOC(b->index_len);
+			if (!b->index) {
+				return QOI_STREAM_ERROR;
+			}
+			qoi_dec_state_init(&state);
+			qoi_seek_put(b->index + QOI_SEEK_HEADER_SIZE, QOI_HEADER_SIZE, (const unsigned int*)state.index, state.px.v, 0);
+		}
+
+		/* Bytes of a chunk cut off at the end of the input are held by the
+		decoder, so that chunk starts before them */
+		y = b->dec.desc.height - b->dec.rows_left;
+		if (y % b->rows == 0 && y < b->dec.desc.height) {
+			qoi_seek_put(b->index + QOI_SEEK_HEADER_SIZE + (size_t)(y / b->rows) * QOI_SEEK_ENTRY_SIZE,
+				b->offset + used - b->dec.carry_len, b->dec.index, b->dec.px, b->dec.run);
+		}
+	}
+}
+
+/* Fill in the header once the whole file of file_size bytes is fed, and
+return the sidecar, or NULL if the chunks ran into the padding */
+static void* qoi_seek_builder_finish(qoi_seek_builder_t* b, size_t file_size, size_t* out_len) {
+	size_t p = 0;
+
+	qoi_decoder_end(&b->dec);
+	if (b->offset > file_size - sizeof(qoi_padding)) {
+		QOI_FREE(b->index);
+		return NULL;
+	}
+	qoi_write_32(b->index, &p, QOI_SEEK_MAGIC);
+	qoi_write_32(b->index, &p, b->dec.desc.width);
+	qoi_write_32(b->index, &p, b->dec.desc.height);
+	qoi_write_32(b->index, &p, b->rows);
+	qoi_write_32(b->index, &p, (unsigned int)((b->index_len - QOI_SEEK_HEADER_SIZE) / QOI_SEEK_ENTRY_SIZE));
+	qoi_write_32(b->index, &p, (unsigned int)((unsigned long long)file_size >> 32));
+	qoi_write_32(b->index, &p, (unsigned int)file_size);
+	*out_len = b->index_len;
+	return b->index;
+}
+
+void* qoi_seek_index_build(const void* data, size_t size, unsigned int rows, size_t* out_len) {
+	qoi_seek_builder_t b;
+
+	if (data == NULL || out_len == NULL || !qoi_seek_builder_begin(&b, rows)) {
+		return NULL;
+	}
+	if (qoi_seek_builder_feed(&b, data, size) != QOI_STREAM_DONE) {
+		qoi_decoder_end(&b.dec);
+		QOI_FREE(b.index);
+		return NULL;
+	}
+	return qoi_seek_builder_finish(&b, size, out_len);
+}
+
+/* Check that index is the sidecar of the QOI data of size bytes described by
+desc, with every checkpoint inside the chunks. Returns the number of rows
+between checkpoints, or 0. */
+static unsigned int qoi_seek_index_check(const unsigned char* index, size_t index_size, const qoi_desc* desc, size_t size) {
+	size_t p = 0;
+	unsigned int rows, count;
+	unsigned long long file_size;
+
+	if (index == NULL || index_size < QOI_SEEK_HEADER_SIZE ||
+		qoi_read_32(index, &p) != QOI_SEEK_MAGIC ||
+		qoi_read_32(index, &p) != desc->width ||
+		qoi_read_32(index, &p) != desc->height) {
+		return 0;
+	}
+	rows = qoi_read_32(index, &p);
+	count = qoi_read_32(index, &p);
+	file_size = (unsigned long long)qoi_read_32(index, &p) << 32;
+	file_size |= qoi_read_32(index, &p);
+
+	if (rows == 0 || count != ((size_t)desc->height + rows - 1) / rows || file_size != size ||
+		(index_size - QOI_SEEK_HEADER_SIZE) / QOI_SEEK_ENTRY_SIZE != count ||
+		(index_size - QOI_SEEK_HEADER_SIZE) % QOI_SEEK_ENTRY_SIZE != 0) {
+		return 0;
+	}
+	for (unsigned int k = 0; k < count; k++) {
+		qoi_dec_state_t state;
+		size_t offset = qoi_seek_load(index + p + (size_t)k * QOI_SEEK_ENTRY_SIZE, &state);
+		if (offset < QOI_HEADER_SIZE || offset > size - sizeof(qoi_padding) || state.run < 0 || state.run > 61) {
+			return 0;
+		}
+	}
+	return rows;
+}
+
+/* Decode only rows y0 to y1 - 1 of a standard image from the checkpoints of its
+seek index, each covering rows rows. Rows of the first checkpoint above y0 are
+decoded without being stored. */
+size_t qoi_decode_rows_indexed_into(const void* data, size_t size, const void* index, size_t index_size, unsigned int y0, unsigned int y1, qoi_desc* desc, void* pixels, size_t stride, size_t pixels_cap, int fmt, int num_threads) {
+	if (data == NULL || desc == NULL || pixels == NULL ||
+		(fmt != 0 && (fmt < QOI_FMT_RGB || fmt > QOI_FMT_RGBA_PREMUL))) {
+		return 0;
+	}
+
+	const unsigned char* bytes = (const unsigned char*)data;
+	if (!qoi_read_header(bytes, size, desc) || y0 >= y1 || y1 > desc->height) {
+		return 0;
+	}
+	unsigned int rows = qoi_seek_index_check((const unsigned char*)index, index_size, desc, size);
+	if (rows == 0) {
+		return 0;
+	}
+
+	if (fmt == 0) {
+		fmt = desc->channels;
+	}
+	int channels = QOI_FMT_CHANNELS(fmt);
+
+	size_t row_len = (size_t)desc->width * channels;
+	size_t num_rows = (size_t)y1 - y0;
+	if (stride == 0) {
+		stride = row_len;
+	}
+	if (stride < row_len || num_rows - 1 > (((size_t)-1) - row_len) / stride) {
+		return 0;
+	}
+
+	size_t span = (num_rows - 1) * stride + row_len;
+	if (pixels_cap < span) {
+		return 0;
+	}
+
+	const unsigned char* entries = (const unsigned char*)index + QOI_SEEK_HEADER_SIZE;
+	size_t chunks_len = size - sizeof(qoi_padding);
+	unsigned char* out = (unsigned char*)pixels;
+	int first = (int)(y0 / rows);
+	int last = (int)((y1 - 1) / rows);
+
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+	for (int k = first; k <= last; k++) {
+		qoi_dec_state_t state;
+		size_t p = qoi_seek_load(entries + (size_t)k * QOI_SEEK_ENTRY_SIZE, &state);
+		size_t start_row = (size_t)k * rows;
+		size_t end_row = min(start_row + rows, (size_t)y1);
+
+		// Only the first checkpoint can be above the requested rows
+		size_t skip = start_row < y0 ? y0 - start_row : 0;
+		size_t n = end_row - start_row - skip;
+		unsigned char* seg_pixels = out + (start_row + skip - y0) * stride;
+
+		switch (fmt) {
+			case QOI_FMT_RGBA:        qoi_decode_rows_from(bytes, p, chunks_len, &state, seg_pixels, stride, row_len, skip, n, QOI_FMT_RGBA);        break;
+			case QOI_FMT_BGRA:        qoi_decode_rows_from(bytes, p, chunks_len, &state, seg_pixels, stride, row_len, skip, n, QOI_FMT_BGRA);        break;
+			case QOI_FMT_ARGB:        qoi_decode_rows_from(bytes, p, chunks_len, &state, seg_pixels, stride, row_len, skip, n, QOI_FMT_ARGB);        break;
+			case QOI_FMT_RGBA_PREMUL: qoi_decode_rows_from(bytes, p, chunks_len, &state, seg_pixels, stride, row_len, skip, n, QOI_FMT_RGBA_PREMUL); break;
+			case QOI_FMT_BGR:         qoi_decode_rows_from(bytes, p, chunks_len, &state, seg_pixels, stride, row_len, skip, n, QOI_FMT_BGR);         break;
+			default:                  qoi_decode_rows_from(bytes, p, chunks_len, &state, seg_pixels, stride, row_len, skip, n, QOI_FMT_RGB);         break;
+		}
+	}
+	return span;
+}
+
+void* qoi_decode_indexed(const void* data, size_t size, const void* index, size_t index_size, qoi_desc* desc, int channels, int num_threads) {
+	size_t px_len;
+	void* pixels;
+
+	if (data == NULL || desc == NULL || (channels != 0 && channels != 3 && channels != 4) ||
+		!qoi_read_header((const unsigned char*)data, size, desc)) {
+		return NULL;
+	}
+	if (channels == 0) {
+		channels = desc->channels;
+	}
+
+	px_len = (size_t)desc->width * desc->height * channels;
+	pixels = QOI_MALLOC(px_len);
+	if (!pixels) {
+		return NULL;
+	}
+
+	if (!qoi_decode_rows_indexed_into(data, size, index, index_size, 0, desc->height, desc, pixels, 0, px_len, channels, num_threads)) {
+		QOI_FREE(pixels);
+		return NULL;
+	}
+	return pixels;
+}
+
+/* Decode block number block of a block-parallel image into its rows of out */
+static void qoi_decode_block_rows(const unsigned char* bytes, size_t p, const unsigned char* block_offsets, int num_blocks, int block, int block_height, size_t height, size_t chunks_len, unsigned char* out, size_t stride, size_t row_len, int fmt) {
+	// Direct access to block data using offset
+	size_t local_p = p + (size_t)qoi_read_offset(block_offsets, block); // use array read 
+	size_t start_row = (size_t)block * block_height;
+	size_t end_row = min(start_row + block_height, height);
+	unsigned char* block_pixels = out + start_row * stride;
+
+	// A block never reads chunks past the start of the next one
+	size_t block_end = block + 1 < num_blocks ? p + (size_t)qoi_read_offset(block_offsets, block + 1) : chunks_len;
+
+	size_t rows = end_row - start_row;
+	switch (fmt) {
+		case QOI_FMT_RGBA:        qoi_decode_block(bytes, local_p, block_end, block_pixels, stride, row_len, 0, rows, QOI_FMT_RGBA);        break;
+		case QOI_FMT_BGRA:        qoi_decode_block(bytes, local_p, block_end, block_pixels, stride, row_len, 0, rows, QOI_FMT_BGRA);        break;
+		case QOI_FMT_ARGB:        qoi_decode_block(bytes, local_p, block_end, block_pixels, stride, row_len, 0, rows, QOI_FMT_ARGB);        break;
+		case QOI_FMT_RGBA_PREMUL: qoi_decode_block(bytes, local_p, block_end, block_pixels, stride, row_len, 0, rows, QOI_FMT_RGBA_PREMUL); break;
+		case QOI_FMT_BGR:         qoi_decode_block(bytes, local_p, block_end, block_pixels, stride, row_len, 0, rows, QOI_FMT_BGR);         break;
+		default:                  qoi_decode_block(bytes, local_p, block_end, block_pixels, stride, row_len, 0, rows, QOI_FMT_RGB);         break;
+	}
+}
+
+/* NUMA placement of the block decoders. Threads are bound to a node with
+SetThreadGroupAffinity, which only Windows has; everywhere else there is one
+node and the plain dynamic schedule is used. */
+#ifndef QOI_NUMA_MAX_NODES
+#define QOI_NUMA_MAX_NODES 64
+#endif
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+typedef GROUP_AFFINITY qoi_numa_affinity_t;
+#else
+typedef int qoi_numa_affinity_t;
+#endif
+
+/* Store the numbers of the nodes that have processors in nodes and return
+how many there are, at least 1 */
+static int qoi_numa_node_list(unsigned short* nodes) {
+	int count = 0;
+#ifdef _WIN32
+	ULONG highest;
+	GROUP_AFFINITY affinity;
+	if (GetNumaHighestNodeNumber(&highest)) {
+		for (ULONG n = 0; n <= highest && count < QOI_NUMA_MAX_NODES; n++) {
+			if (GetNumaNodeProcessorMaskEx((USHORT)n, &affinity) && affinity.Mask != 0) {
+				nodes[count++] = (unsigned short)n;
+			}
+		}
+	}
+#endif
+	if (count == 0) {
+		nodes[0] = 0;
+		count = 1;
+	}
+	return count;
+}
+
+/* Move the calling thread onto the processors of node. The pages it touches
+first are then taken from that node. Returns 0 if it stays where it is. */
+static int qoi_numa_bind(unsigned short node, qoi_numa_affinity_t* previous) {
+#ifdef _WIN32
+	GROUP_AFFINITY affinity;
+	return GetNumaNodeProcessorMaskEx(node, &affinity) &&
+		SetThreadGroupAffinity(GetCurrentThread(), &affinity, previous);
+#else
+	(void)node;
+	(void)previous;
+	return 0;
+#endif
+}
+
+static void qoi_numa_unbind(const qoi_numa_affinity_t* previous) {
+#ifdef _WIN32
+	SetThreadGroupAffinity(GetCurrentThread(), previous, NULL);
+#else
+	(void)previous;
+#endif
+}
+
+int qoi_numa_nodes(void) {
+	unsigned short nodes[QOI_NUMA_MAX_NODES];
+	return qoi_numa_node_list(nodes);
+}
+
+/* Decode a block-parallel image, with a dynamic schedule over all blocks if
+num_nodes is 1, or with the blocks split into one band per node of nodes */
+static size_t qoi_decode_block_table_into(const void* data, size_t size, qoi_desc* desc, void* pixels, size_t stride, size_t pixels_cap, int fmt, const unsigned short* nodes, int num_nodes, int num_threads) {
+	if (data == NULL || desc == NULL || pixels == NULL ||
+		(fmt != 0 && (fmt < QOI_FMT_RGB || fmt > QOI_FMT_RGBA_PREMUL))) {
+		return 0;
+	}
+
+	const unsigned char* bytes = (const unsigned char*)data;
+	if (!qoi_read_header(bytes, size, desc)) {
+		return 0;
+	}
+	size_t p = QOI_HEADER_SIZE;
+
+	if (fmt == 0) {
+		fmt = desc->channels;
+	}
+	int channels = QOI_FMT_CHANNELS(fmt);
+
+	size_t width = desc->width;
+	size_t height = desc->height;
+	size_t row_len = width * channels;
+	if (stride == 0) {
+		stride = row_len;
+	}
+	if (stride < row_len || height - 1 > (((size_t)-1) - row_len) / stride) {
+		return 0;
+	}
+
+	// The last row does not need the padding that follows it
+	size_t span = (height - 1) * stride + row_len;
+	if (pixels_cap < span) {
+		return 0;
+	}
+
+	// Read number of blocks and block height
+	int num_blocks, block_height;
+	if (!qoi_read_block_geometry(bytes, size, &p, desc->height, &num_blocks, &block_height)) {
+		return 0;
+	}
+
+	// Read block offsets table   //16 - 30 is offset
+	const unsigned char* block_offsets = (bytes + p); //get 16 only, then store in block_offsets (16 address) when need then p++, but this is used address to read
+	p += num_blocks * sizeof(int64_t); //skip the header (30)
+
+	size_t chunks_len = size - sizeof(qoi_padding);
+	unsigned char* out = (unsigned char*)pixels;
+
+	if (num_nodes < 2) {
+#pragma omp parallel num_threads(num_threads)
+		{
+#pragma omp for schedule(dynamic)
+			for (int block = 0; block < num_blocks; block++) {
+				qoi_decode_block_rows(bytes, p, block_offsets, num_blocks, block, block_height, height, chunks_len, out, stride, row_len, fmt);
+			}
+		}
+		return span;
+	}
+
+	/* Node n owns the blocks from first[n] to first[n + 1] - 1, one band of
+	rows, and its threads take them in order under the node's lock. A thread
+	that runs out moves on to the bands of the next nodes, so a team smaller
+	than the node count still decodes every block. */
+	int first[QOI_NUMA_MAX_NODES + 1], next[QOI_NUMA_MAX_NODES];
+	omp_lock_t locks[QOI_NUMA_MAX_NODES];
+	for (int n = 0; n <= num_nodes; n++) {
+		first[n] = (int)((int64_t)num_blocks * n / num_nodes);
+	}
+	for (int n = 0; n < num_nodes; n++) {
+		next[n] = first[n];
+		omp_init_lock(&locks[n]);
+	}
+
+#pragma omp parallel num_threads(num_threads)
+	{
+		int node = (int)((int64_t)omp_get_thread_num() * num_nodes / omp_get_num_threads());
+		qoi_numa_affinity_t previous;
+		int bound = qoi_numa_bind(nodes[node], &previous);
+
+		for (int k = 0; k < num_nodes; k++) {
+			int n = (node + k) % num_nodes;
+			for (;;) {
+				omp_set_lock(&locks[n]);
+				int block = next[n] < first[n + 1] ? next[n]++ : -1;
+				omp_unset_lock(&locks[n]);
+				if (block < 0) {
+					break;
+				}
+				qoi_decode_block_rows(bytes, p, block_offsets, num_blocks, block, block_height, height, chunks_len, out, stride, row_len, fmt);
+			}
+		}
+
+		if (bound) {
+			qoi_numa_unbind(&previous);
+		}
+	}
+
+	for (int n = 0; n < num_nodes; n++) {
+		omp_destroy_lock(&locks[n]);
+	}
+	return span;
+}
+
+size_t qoi_decode_parallel_block_fmt_into(const void* data, size_t size, qoi_desc* desc, void* pixels, size_t stride, size_t pixels_cap, int fmt, int num_threads) {
+	return qoi_decode_block_table_into(data, size, desc, pixels, stride, pixels_cap, fmt, NULL, 1, num_threads);
+}
+
+size_t qoi_decode_parallel_block_stride_into(const void* data, size_t size, qoi_desc* desc, void* pixels, size_t stride, size_t pixels_cap, int channels, int num_threads) {
+	if (channels != 0 && channels != 3 && channels != 4) {
+		return 0;
+	}
+	return qoi_decode_parallel_block_fmt_into(data, size, desc, pixels, stride, pixels_cap, channels, num_threads);
+}
+
+size_t qoi_decode_parallel_block_simple_into(const void* data, size_t size, qoi_desc* desc, void* pixels, size_t pixels_cap, int channels, int num_threads) {
+	return qoi_decode_parallel_block_stride_into(data, size, desc, pixels, 0, pixels_cap, channels, num_threads);
+}
+
+void* qoi_decode_parallel_block_simple(const void* data, size_t size, qoi_desc* desc, int channels, int num_threads) {
+	if (data == NULL || desc == NULL ||
+		(channels != 0 && channels != 3 && channels != 4) ||
+		!qoi_read_header((const unsigned char*)data, size, desc)) {
+		return NULL;
+	}
+
+	size_t px_len = (size_t)desc->width * desc->height * (channels == 0 ? desc->channels : channels);
+	void* pixels = QOI_MALLOC(px_len);
+	if (!pixels) {
+		return NULL;
+	}
+
+	if (!qoi_decode_parallel_block_simple_into(data, size, desc, pixels, px_len, channels, num_threads)) {
+		QOI_FREE(pixels);
+		return NULL;
+	}
+	return pixels;
+}
+
+size_t qoi_decode_parallel_block_numa_into(const void* data, size_t size, qoi_desc* desc, void* pixels, size_t stride, size_t pixels_cap, int fmt, int num_threads) {
+	unsigned short nodes[QOI_NUMA_MAX_NODES];
+	int num_nodes = qoi_numa_node_list(nodes);
+	if (num_threads > 0 && num_nodes > num_threads) {
+		num_nodes = num_threads;
+	}
+	return qoi_decode_block_table_into(data, size, desc, pixels, stride, pixels_cap, fmt, nodes, num_nodes, num_threads);
+}
+
+void* qoi_decode_parallel_block_numa(const void* data, size_t size, qoi_desc* desc, int channels, int num_threads) {
+	if (data == NULL || desc == NULL ||
+		(channels != 0 && channels != 3 && channels != 4) ||
+		!qoi_read_header((const unsigned char*)data, size, desc)) {
+		return NULL;
+	}
+
+	size_t px_len = (size_t)desc->width * desc->height * (channels == 0 ? desc->channels : channels);
+	void* pixels = QOI_MALLOC(px_len);
+	if (!pixels) {
+		return NULL;
+	}
+
+	if (!qoi_decode_parallel_block_numa_into(data, size, desc, pixels, 0, px_len, channels, num_threads)) {
+		QOI_FREE(pixels);
+		return NULL;
+	}
+	return pixels;
+}
+
+/* Decode only rows y0 to y1 - 1 of a block-parallel image. The offset table
+gives the start of every block, so only the blocks covering the rows are
+decoded; rows of the first block above y0 are decoded without being stored. */
+size_t qoi_decode_rows_into(const void* data, size_t size, unsigned int y0, unsigned int y1, qoi_desc* desc, void* pixels, size_t stride, size_t pixels_cap, int fmt, int num_threads) {
+	if (data == NULL || desc == NULL || pixels == NULL ||
+		(fmt != 0 && (fmt < QOI_FMT_RGB || fmt > QOI_FMT_RGBA_PREMUL))) {
+		return 0;
+	}
+
+	const unsigned char* bytes = (const unsigned char*)data;
+	if (!qoi_read_header(bytes, size, desc) || y0 >= y1 || y1 > desc->height) {
+		return 0;
+	}
+	size_t p = QOI_HEADER_SIZE;
+
+	if (fmt == 0) {
+		fmt = desc->channels;
+	}
+	int channels = QOI_FMT_CHANNELS(fmt);
+
+	size_t height = desc->height;
+	size_t row_len = (size_t)desc->width * channels;
+	size_t num_rows = (size_t)y1 - y0;
+	if (stride == 0) {
+		stride = row_len;
+	}
+	if (stride < row_len || num_rows - 1 > (((size_t)-1) - row_len) / stride) {
+		return 0;
+	}
+
+	size_t span = (num_rows - 1) * stride + row_len;
+	if (pixels_cap < span) {
+		return 0;
+	}
+
+	int num_blocks, block_height;
+	if (!qoi_read_block_geometry(bytes, size, &p, desc->height, &num_blocks, &block_height)) {
+		return 0;
+	}
+
+	const unsigned char* block_offsets = (bytes + p);
+	p += num_blocks * sizeof(int64_t);
+
+	size_t chunks_len = size - sizeof(qoi_padding);
+	unsigned char* out = (unsigned char*)pixels;
+	int first_block = (int)(y0 / block_height);
+	int last_block = (int)((y1 - 1) / block_height);
+
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+	for (int block = first_block; block <= last_block; block++) {
+		size_t local_p = p + (size_t)qoi_read_offset(block_offsets, block);
+		size_t block_end = block + 1 < num_blocks ? p + (size_t)qoi_read_offset(block_offsets, block + 1) : chunks_len;
+		size_t start_row = (size_t)block * block_height;
+		size_t end_row = min(min(start_row + block_height, height), (size_t)y1);
+
+		// Only the first block can start above the requested rows
+		size_t skip = start_row < y0 ? y0 - start_row : 0;
+		size_t rows = end_row - start_row - skip;
+		unsigned char* block_pixels = out + (start_row + skip - y0) * stride;
+
+		switch (fmt) {
+			case QOI_FMT_RGBA:        qoi_decode_block(bytes, local_p, block_end, block_pixels, stride, row_len, skip, rows, QOI_FMT_RGBA);        break;
+			case QOI_FMT_BGRA:        qoi_decode_block(bytes, local_p, block_end, block_pixels, stride, row_len, skip, rows, QOI_FMT_BGRA);        break;
+			case QOI_FMT_ARGB:        qoi_decode_block(bytes, local_p, block_end, block_pixels, stride, row_len, skip, rows, QOI_FMT_ARGB);        break;
+			case QOI_FMT_RGBA_PREMUL: qoi_decode_block(bytes, local_p, block_end, block_pixels, stride, row_len, skip, rows, QOI_FMT_RGBA_PREMUL); break;
+			case QOI_FMT_BGR:         qoi_decode_block(bytes, local_p, block_end, block_pixels, stride, row_len, skip, rows, QOI_FMT_BGR);         break;
+			default:                  qoi_decode_block(bytes, local_p, block_end, block_pixels, stride, row_len, skip, rows, QOI_FMT_RGB);         break;
+		}
+	}
+	return span;
+}
+
+void* qoi_decode_rows(const void* data, size_t size, unsigned int y0, unsigned int y1, qoi_desc* desc, int channels, int num_threads) {
+	if (data == NULL || desc == NULL ||
+		(channels != 0 && channels != 3 && channels != 4) ||
+		!qoi_read_header((const unsigned char*)data, size, desc) ||
+		y0 >= y1 || y1 > desc->height) {
+		return NULL;
+	}
+
+	size_t px_len = (size_t)desc->width * (y1 - y0) * (channels == 0 ? desc->channels : channels);
+	void* pixels = QOI_MALLOC(px_len);
+	if (!pixels) {
+		return NULL;
+	}
+
+	if (!qoi_decode_rows_into(data, size, y0, y1, desc, pixels, 0, px_len, channels, num_threads)) {
+		QOI_FREE(pixels);
+		return NULL;
+	}
+	return pixels;
+}
+
+/* Thumbnail decode of a block-parallel image. The block height is a multiple
+of every supported factor, so no box straddles two blocks and each block is
+reduced on its own, with one row buffer and one row of column sums per
+thread. */
+size_t qoi_decode_thumbnail_into(const void* data, size_t size, qoi_desc* desc, void* pixels, size_t stride, size_t pixels_cap, int fmt, int factor, int num_threads) {
+	if (data == NULL || desc == NULL || pixels == NULL ||
+		(factor != 2 && factor != 4 && factor != 8) ||
+		(fmt != 0 && (fmt < QOI_FMT_RGB || fmt > QOI_FMT_RGBA_PREMUL))) {
+		return 0;
+	}
+
+	const unsigned char* bytes = (const unsigned char*)data;
+	if (!qoi_read_header(bytes, size, desc)) {
+		return 0;
+	}
+	size_t p = QOI_HEADER_SIZE;
+
+	if (fmt == 0) {
+		fmt = desc->channels;
+	}
+	int channels = QOI_FMT_CHANNELS(fmt);
+	int shift = factor == 2 ? 1 : factor == 4 ? 2 : 3;
+
+	size_t width = desc->width;
+	size_t height = desc->height;
+	size_t row_len = width * channels;
+
+	// From here on desc describes the thumbnail
+	desc->width = (unsigned int)((width + factor - 1) >> shift);
+	desc->height = (unsigned int)((height + factor - 1) >> shift);
+
+	size_t out_row_len = (size_t)desc->width * channels;
+	if (stride == 0) {
+		stride = out_row_len;
+	}
+	if (stride < out_row_len || desc->height - 1 > (((size_t)-1) - out_row_len) / stride) {
+		return 0;
+	}
+
+	size_t span = (desc->height - 1) * stride + out_row_len;
+	if (pixels_cap < span) {
+		return 0;
+	}
+
+	// A box must not straddle two blocks
+	int num_blocks, block_height;
+	if (!qoi_read_block_geometry(bytes, size, &p, (unsigned int)height, &num_blocks, &block_height) ||
+		(block_height % factor != 0 && num_blocks > 1)) {
+		return 0;
+	}
+
+	const unsigned char* block_offsets = (bytes + p);
+	p += num_blocks * sizeof(int64_t);
+
+	size_t chunks_len = size - sizeof(qoi_padding);
+	unsigned char* out = (unsigned char*)pixels;
+	int failed = 0;
+
+#pragma omp parallel num_threads(num_threads)
+	{
+		// The row is read in whole words of 4 bytes, so round it up
+		unsigned char* row = (unsigned char*)QOI_MALLOC((row_len + 3) & ~(size_t)3);
+		uint64_t* acc = (uint64_t*)QOI_MALLOC((row_len + 3) / 4 * sizeof(uint64_t));
+		if (!row || !acc) {
+#pragma omp atomic
+			failed |= 1;
+		}
+		else {
+			memset(row + row_len, 0, ((row_len + 3) & ~(size_t)3) - row_len);
+		}
+
+#pragma omp for schedule(dynamic)
+		for (int block = 0; block < num_blocks; block++) {
+			if (!row || !acc) continue;
+
+			size_t local_p = p + (size_t)qoi_read_offset(block_offsets, block);
+			size_t block_end = block + 1 < num_blocks ? p + (size_t)qoi_read_offset(block_offsets, block + 1) : chunks_len;
+			size_t start_row = (size_t)block * block_height;
+			size_t end_row = min(start_row + block_height, height);
+			unsigned char* block_out = out + (start_row >> shift) * stride;
+			size_t rows = end_row - start_row;
+
+			switch (fmt) {
+				case QOI_FMT_RGBA:        qoi_decode_block_thumbnail(bytes, local_p, block_end, row, acc, block_out, stride, width, rows, shift, QOI_FMT_RGBA);        break;
+				case QOI_FMT_BGRA:        qoi_decode_block_thumbnail(bytes, local_p, block_end, row, acc, block_out, stride, width, rows, shift, QOI_FMT_BGRA);        break;
+				case QOI_FMT_ARGB:        qoi_decode_block_thumbnail(bytes, local_p, block_end, row, acc, block_out, stride, width, rows, shift, QOI_FMT_ARGB);        break;
+				case QOI_FMT_RGBA_PREMUL: qoi_decode_block_thumbnail(bytes, local_p, block_end, row, acc, block_out, stride, width, rows, shift, QOI_FMT_RGBA_PREMUL); break;
+				case QOI_FMT_BGR:         qoi_decode_block_thumbnail(bytes, local_p, block_end, row, acc, block_out, stride, width, rows, shift, QOI_FMT_BGR);         break;
+				default:                  qoi_decode_block_thumbnail(bytes, local_p, block_end, row, acc, block_out, stride, width, rows, shift, QOI_FMT_RGB);         break;
+			}
+		}
+
+		QOI_FREE(row);
+		QOI_FREE(acc);
+	}
+	return failed ? 0 : span;
+}
+
+void* qoi_decode_thumbnail(const void* data, size_t size, qoi_desc* desc, int channels, int factor, int num_threads) {
+	if (data == NULL || desc == NULL ||
+		(channels != 0 && channels != 3 && channels != 4) ||
+		(factor != 2 && factor != 4 && factor != 8) ||
+		!qoi_read_header((const unsigned char*)data, size, desc)) {
+		return NULL;
+	}
+
+	size_t px_len = (size_t)((desc->width + factor - 1) / factor) * ((desc->height + factor - 1) / factor) *
+		(channels == 0 ? desc->channels : channels);
+	void* pixels = QOI_MALLOC(px_len);
+	if (!pixels) {
+		return NULL;
+	}
+
+	if (!qoi_decode_thumbnail_into(data, size, desc, pixels, 0, px_len, channels, factor, num_threads)) {
+		QOI_FREE(pixels);
+		return NULL;
+	}
+	return pixels;
+}
 
-	unsigned char* bytes = (unsigned char*)QOI_MALLOC(max_size);
-	if (!bytes) return NULL;
+/* Worst-case size of a tiled image: the regular worst case plus the tile
+geometry and one offset per tile. Returns 0 if the description is invalid or
+there would be too many tiles to count. */
+size_t qoi_max_encoded_size_tiled(const qoi_desc* desc, int tile_width, int tile_height) {
+	size_t num_tiles;
+
+	if (!qoi_valid_desc(desc) || tile_width < 0 || tile_height < 0) {
+		return 0;
+	}
+	tile_width = qoi_round_block_height(tile_width ? tile_width : QOI_TILE_SIZE, desc->width);
+	tile_height = qoi_round_block_height(tile_height ? tile_height : QOI_TILE_SIZE, desc->height);
+	num_tiles = (((size_t)desc->width + tile_width - 1) / tile_width) * (((size_t)desc->height + tile_height - 1) / tile_height);
+	if (num_tiles >= QOI_BLOCK_TILES) {
+		return 0;
+	}
+	return qoi_max_encoded_size(desc) + 12 + num_tiles * sizeof(int64_t);
+}
+
+/* Tiled images have the layout of block-parallel images, with the tile count
+flagged by QOI_BLOCK_GEOMETRY and QOI_BLOCK_TILES, followed by the tile height
+and width. Tiles are stored row by row, each encoded like a block. */
+size_t qoi_encode_tiled_into(const void* data, size_t stride, int fmt, const qoi_desc* desc, void* out, size_t out_cap, int tile_width, int tile_height, int num_threads) {
+	size_t max_size = qoi_max_encoded_size_tiled(desc, tile_width, tile_height);
+	if (data == NULL || out == NULL || max_size == 0 || out_cap < max_size) {
+		return 0;
+	}
+
+	if (fmt == 0) {
+		fmt = desc->channels;
+	}
+	if (fmt < QOI_FMT_RGB || fmt > QOI_FMT_ARGB || QOI_FMT_CHANNELS(fmt) != desc->channels) {
+		return 0;
+	}
+
+	size_t width = desc->width;
+	size_t height = desc->height;
+	int channels = desc->channels;
+	tile_width = qoi_round_block_height(tile_width ? tile_width : QOI_TILE_SIZE, width);
+	tile_height = qoi_round_block_height(tile_height ? tile_height : QOI_TILE_SIZE, height);
+	int tiles_x = (int)((width + tile_width - 1) / tile_width);
+	int tiles_y = (int)((height + tile_height - 1) / tile_height);
+	int num_tiles = tiles_x * tiles_y;
+
+	size_t row_len = width * channels;
+	if (stride == 0) {
+		stride = row_len;
+	}
+	if (stride < row_len) {
+		return 0;
+	}
+
+	unsigned char* bytes = (unsigned char*)out;
 
 	// Write header
-	int p = 0;
+	size_t p = 0;
 	qoi_write_32(bytes, &p, QOI_MAGIC);
-	qoi_write_32(bytes, &p, width);
-	qoi_write_32(bytes, &p, height);
+	qoi_write_32(bytes, &p, (unsigned int)width);
+	qoi_write_32(bytes, &p, (unsigned int)height);
 	bytes[p++] = channels;
 	bytes[p++] = desc->colorspace;
-	qoi_write_32(bytes, &p, num_blocks);  // Write number of blocks
+	qoi_write_32(bytes, &p, QOI_BLOCK_GEOMETRY | QOI_BLOCK_TILES | (unsigned int)num_tiles);
+	qoi_write_32(bytes, &p, (unsigned int)tile_height);
+	qoi_write_32(bytes, &p, (unsigned int)tile_width);
 
-	// Reserve space for block offsets
-	int* block_offsets = (int*)(bytes + p);
-	p += num_blocks * sizeof(int);
+	return qoi_encode_tiles((const unsigned char*)data, stride, fmt, desc, tile_width, tile_height, bytes, p, num_threads);
+}
 
-	const unsigned char* pixels = (const unsigned char*)data;
+void* qoi_encode_tiled(const void* data, const qoi_desc* desc, int tile_width, int tile_height, size_t* out_len, int num_threads) {
+	size_t max_size = qoi_max_encoded_size_tiled(desc, tile_width, tile_height);
+	if (out_len == NULL || max_size == 0) {
+		return NULL;
+	}
 
-	// Arrays to track block output positions and sizes
-	int* block_sizes = (int*)QOI_MALLOC(num_blocks * sizeof(int));
-	unsigned char** block_outputs = (unsigned char**)QOI_MALLOC(num_blocks * sizeof(unsigned char*));
-	if (!block_sizes || !block_outputs) {
+	void* bytes = QOI_MALLOC(max_size);
+	if (!bytes) {
+		return NULL;
+	}
+
+	*out_len = qoi_encode_tiled_into(data, 0, 0, desc, bytes, max_size, tile_width, tile_height, num_threads);
+	if (!*out_len) {
 		QOI_FREE(bytes);
-		QOI_FREE(block_sizes);
-		QOI_FREE(block_outputs);
 		return NULL;
 	}
+	return bytes;
+}
 
-	for (int block = 0; block < num_blocks; block++) {
-		int start_row = block * BLOCK_HEIGHT;
-		int end_row = min(start_row + BLOCK_HEIGHT, height);
-		int block_px_len = width * (end_row - start_row) * channels;
+/* Decode the rectangle x0, y0 to x1, y1 of a tiled or block-parallel image.
+Tiles that lie inside it horizontally are decoded straight into pixels; the
+ones cut by its left or right edge go through a row buffer per thread. */
+size_t qoi_decode_rect_into(const void* data, size_t size, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, qoi_desc* desc, void* pixels, size_t stride, size_t pixels_cap, int fmt, int num_threads) {
+	if (data == NULL || desc == NULL || pixels == NULL ||
+		(fmt != 0 && (fmt < QOI_FMT_RGB || fmt > QOI_FMT_RGBA_PREMUL))) {
+		return 0;
+	}
 
-		qoi_rgba_t index[64] = { 0 };
-		qoi_rgba_t px = { 0, 0, 0, 255 };
-		qoi_rgba_t px_prev = { 0, 0, 0, 255 };
-		int run = 0;
-		int local_size = 0;
+	const unsigned char* bytes = (const unsigned char*)data;
+	if (!qoi_read_header(bytes, size, desc) ||
+		x0 >= x1 || x1 > desc->width || y0 >= y1 || y1 > desc->height) {
+		return 0;
+	}
+	size_t p = QOI_HEADER_SIZE;
 
-		unsigned char* local_buffer = (unsigned char*)QOI_MALLOC(block_px_len * 2);
-		if (!local_buffer) continue;
+	if (fmt == 0) {
+		fmt = desc->channels;
+	}
+	int channels = QOI_FMT_CHANNELS(fmt);
+
+	size_t width = desc->width;
+	size_t height = desc->height;
+	size_t rect_row_len = ((size_t)x1 - x0) * channels;
+	size_t num_rows = (size_t)y1 - y0;
+	if (stride == 0) {
+		stride = rect_row_len;
+	}
+	if (stride < rect_row_len || num_rows - 1 > (((size_t)-1) - rect_row_len) / stride) {
+		return 0;
+	}
 
-		// Start each block with full pixel
-		int first_px = (start_row * width) * channels;
-		px.rgba.r = pixels[first_px + 0];
-		px.rgba.g = pixels[first_px + 1];
-		px.rgba.b = pixels[first_px + 2];
-		if (channels == 4) {
-			px.rgba.a = pixels[first_px + 3];
-			local_buffer[local_size++] = QOI_OP_RGBA;
-		}
-		else {
-			local_buffer[local_size++] = QOI_OP_RGB;
-		}
-		local_buffer[local_size++] = px.rgba.r;
-		local_buffer[local_size++] = px.rgba.g;
-		local_buffer[local_size++] = px.rgba.b;
-		if (channels == 4) {
-			local_buffer[local_size++] = px.rgba.a;
-		}
-		px_prev = px;
+	size_t span = (num_rows - 1) * stride + rect_row_len;
+	if (pixels_cap < span) {
+		return 0;
+	}
 
-		for (int y = start_row; y < end_row; y++) {
-			for (int x = 0; x < width; x++) {
-				// Skip first pixel as already encoded
-				if (y == start_row && x == 0) continue;
-
-				int px_pos = (y * width + x) * channels;
-				px.rgba.r = pixels[px_pos + 0];
-				px.rgba.g = pixels[px_pos + 1];
-				px.rgba.b = pixels[px_pos + 2];
-				if (channels == 4) {
-					px.rgba.a = pixels[px_pos + 3];
-				}
+	int tiles_x, tiles_y, tile_width, tile_height;
+	if (!qoi_read_tile_geometry(bytes, size, &p, desc, &tiles_x, &tiles_y, &tile_width, &tile_height)) {
+		return 0;
+	}
+	int num_tiles = tiles_x * tiles_y;
 
-				if (px.v == px_prev.v) {
-					run++;
-					if (run == 62 || (y == end_row - 1 && x == width - 1)) {
-						local_buffer[local_size++] = QOI_OP_RUN | (run - 1);
-						run = 0;
-					}
+	const unsigned char* tile_offsets = (bytes + p);
+	p += num_tiles * sizeof(int64_t);
+
+	size_t chunks_len = size - sizeof(qoi_padding);
+	unsigned char* out = (unsigned char*)pixels;
+	int first_x = (int)(x0 / tile_width);
+	int first_y = (int)(y0 / tile_height);
+	int span_x = (int)((x1 - 1) / tile_width) - first_x + 1;
+	int span_y = (int)((y1 - 1) / tile_height) - first_y + 1;
+	int failed = 0;
+
+#pragma omp parallel num_threads(num_threads)
+	{
+		unsigned char* row = NULL;
+
+#pragma omp for schedule(dynamic)
+		for (int i = 0; i < span_x * span_y; i++) {
+			int tile = (first_y + i / span_x) * tiles_x + first_x + i % span_x;
+			size_t local_p = p + (size_t)qoi_read_offset(tile_offsets, tile);
+			size_t tile_end = tile + 1 < num_tiles ? p + (size_t)qoi_read_offset(tile_offsets, tile + 1) : chunks_len;
+			size_t start_row = (size_t)(tile / tiles_x) * tile_height;
+			size_t start_col = (size_t)(tile % tiles_x) * tile_width;
+			size_t end_row = min(min(start_row + tile_height, height), (size_t)y1);
+			size_t end_col = min(start_col + tile_width, width);
+			size_t tile_row_len = (end_col - start_col) * channels;
+
+			// Only the tiles along the top edge start above the rectangle
+			size_t skip = start_row < y0 ? y0 - start_row : 0;
+			size_t rows = end_row - start_row - skip;
+			size_t col = start_col < x0 ? x0 - start_col : 0;
+			size_t cols = min(end_col, (size_t)x1) - start_col - col;
+			unsigned char* tile_pixels = out + (start_row + skip - y0) * stride + (start_col + col - x0) * channels;
+
+			if (col == 0 && start_col + cols == end_col) {
+				switch (fmt) {
+					case QOI_FMT_RGBA:        qoi_decode_block(bytes, local_p, tile_end, tile_pixels, stride, tile_row_len, skip, rows, QOI_FMT_RGBA);        break;
+					case QOI_FMT_BGRA:        qoi_decode_block(bytes, local_p, tile_end, tile_pixels, stride, tile_row_len, skip, rows, QOI_FMT_BGRA);        break;
+					case QOI_FMT_ARGB:        qoi_decode_block(bytes, local_p, tile_end, tile_pixels, stride, tile_row_len, skip, rows, QOI_FMT_ARGB);        break;
+					case QOI_FMT_RGBA_PREMUL: qoi_decode_block(bytes, local_p, tile_end, tile_pixels, stride, tile_row_len, skip, rows, QOI_FMT_RGBA_PREMUL); break;
+					case QOI_FMT_BGR:         qoi_decode_block(bytes, local_p, tile_end, tile_pixels, stride, tile_row_len, skip, rows, QOI_FMT_BGR);         break;
+					default:                  qoi_decode_block(bytes, local_p, tile_end, tile_pixels, stride, tile_row_len, skip, rows, QOI_FMT_RGB);         break;
 				}
-				else {
-					if (run > 0) {
-						local_buffer[local_size++] = QOI_OP_RUN | (run - 1);
-						run = 0;
-					}
+				continue;
+			}
 
-					int index_pos = QOI_COLOR_HASH(px) % 64;
-					if (index[index_pos].v == px.v) {
-						local_buffer[local_size++] = QOI_OP_INDEX | index_pos;
-					}
-					else {
-						index[index_pos] = px;
-						if (px.rgba.a == px_prev.rgba.a) {
-							signed char vr = px.rgba.r - px_prev.rgba.r;
-							signed char vg = px.rgba.g - px_prev.rgba.g;
-							signed char vb = px.rgba.b - px_prev.rgba.b;
-							signed char vg_r = vr - vg;
-							signed char vg_b = vb - vg;
-
-							if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
-								local_buffer[local_size++] = QOI_OP_DIFF |
-									(vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
-							}
-							else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 &&
-								vg_b > -9 && vg_b < 8) {
-								local_buffer[local_size++] = QOI_OP_LUMA | (vg + 32);
-								local_buffer[local_size++] = (vg_r + 8) << 4 | (vg_b + 8);
-							}
-							else {
-								local_buffer[local_size++] = QOI_OP_RGB;
-								local_buffer[local_size++] = px.rgba.r;
-								local_buffer[local_size++] = px.rgba.g;
-								local_buffer[local_size++] = px.rgba.b;
-							}
-						}
-						else {
-							local_buffer[local_size++] = QOI_OP_RGBA;
-							local_buffer[local_size++] = px.rgba.r;
-							local_buffer[local_size++] = px.rgba.g;
-							local_buffer[local_size++] = px.rgba.b;
-							local_buffer[local_size++] = px.rgba.a;
-						}
-					}
+			// Every thread allocates its row buffer when it first needs one
+			if (!row) {
+				row = (unsigned char*)QOI_MALLOC(min((size_t)tile_width, width) * channels);
+				if (!row) {
+#pragma omp atomic
+					failed |= 1;
+					continue;
 				}
-				px_prev = px;
+			}
+
+			size_t col_len = col * channels;
+			size_t cols_len = cols * channels;
+			switch (fmt) {
+				case QOI_FMT_RGBA:        qoi_decode_tile_cropped(bytes, local_p, tile_end, row, tile_pixels, stride, tile_row_len, skip, rows, col_len, cols_len, QOI_FMT_RGBA);        break;
+				case QOI_FMT_BGRA:        qoi_decode_tile_cropped(bytes, local_p, tile_end, row, tile_pixels, stride, tile_row_len, skip, rows, col_len, cols_len, QOI_FMT_BGRA);        break;
+				case QOI_FMT_ARGB:        qoi_decode_tile_cropped(bytes, local_p, tile_end, row, tile_pixels, stride, tile_row_len, skip, rows, col_len, cols_len, QOI_FMT_ARGB);        break;
+				case QOI_FMT_RGBA_PREMUL: qoi_decode_tile_cropped(bytes, local_p, tile_end, row, tile_pixels, stride, tile_row_len, skip, rows, col_len, cols_len, QOI_FMT_RGBA_PREMUL); break;
+				case QOI_FMT_BGR:         qoi_decode_tile_cropped(bytes, local_p, tile_end, row, tile_pixels, stride, tile_row_len, skip, rows, col_len, cols_len, QOI_FMT_BGR);         break;
+				default:                  qoi_decode_tile_cropped(bytes, local_p, tile_end, row, tile_pixels, stride, tile_row_len, skip, rows, col_len, cols_len, QOI_FMT_RGB);         break;
 			}
 		}
 
-		block_sizes[block] = local_size;
-		block_outputs[block] = local_buffer;
+		QOI_FREE(row);
 	}
+	return failed ? 0 : span;
+}
 
-	// Write blocks and store their offsets
-	int write_pos = p;
-	for (int i = 0; i < num_blocks; i++) {
-		block_offsets[i] = write_pos - p;  // Store relative offset
-		memcpy(bytes + write_pos, block_outputs[i], block_sizes[i]);
-		write_pos += block_sizes[i];
-		QOI_FREE(block_outputs[i]);
+void* qoi_decode_rect(const void* data, size_t size, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, qoi_desc* desc, int channels, int num_threads) {
+	if (data == NULL || desc == NULL ||
+		(channels != 0 && channels != 3 && channels != 4) ||
+		!qoi_read_header((const unsigned char*)data, size, desc) ||
+		x0 >= x1 || x1 > desc->width || y0 >= y1 || y1 > desc->height) {
+		return NULL;
 	}
 
-	// Write padding
-	memcpy(bytes + write_pos, qoi_padding, sizeof(qoi_padding));
-	write_pos += sizeof(qoi_padding);
+	size_t px_len = (size_t)(x1 - x0) * (y1 - y0) * (channels == 0 ? desc->channels : channels);
+	void* pixels = QOI_MALLOC(px_len);
+	if (!pixels) {
+		return NULL;
+	}
 
-	QOI_FREE(block_sizes);
-	QOI_FREE(block_outputs);
+	if (!qoi_decode_rect_into(data, size, x0, y0, x1, y1, desc, pixels, 0, px_len, channels, num_threads)) {
+		QOI_FREE(pixels);
+		return NULL;
+	}
+	return pixels;
+}
 
-	*out_len = write_pos;
-	return bytes;
+/* The pool's tasks: encoding a tile into the worker's arena, copying an
+encoded tile into place once every tile of its image is done, and decoding a
+tile. Only the first and last are queued up front; the worker that finishes
+the last tile of an image queues its copies. */
+#define QOI_POOL_ENCODE 0
+#define QOI_POOL_COPY   1
+#define QOI_POOL_DECODE 2
+
+/* Size of the chunks of the workers' arenas, unless a tile needs more */
+#ifndef QOI_POOL_CHUNK
+#define QOI_POOL_CHUNK (1 << 23)
+#endif
+
+typedef struct {
+	int job;
+	int kind;
+	int tile;
+} qoi_pool_task_t;
+
+/* A worker's tasks, taken from the bottom by the worker and from the top by
+thieves, and its arena: a chain of chunks, each starting with a pointer to
+the next one and its size, kept for the next run. */
+typedef struct {
+	omp_lock_t lock;
+	qoi_pool_task_t* tasks;
+	int top, bottom, cap;
+	unsigned char* chunks;
+	unsigned char* chunk;
+	size_t chunk_len, chunk_cap;
+	char pad[64]; /* the next worker's lock goes on another cache line */
+} qoi_pool_worker_t;
+
+#define QOI_POOL_CHUNK_HEADER (sizeof(unsigned char*) + sizeof(size_t))
+
+typedef struct {
+	int encode;
+	const unsigned char* in;
+	unsigned char* out;
+	size_t stride;
+	int fmt;
+	qoi_desc desc;
+	size_t* out_len;
+	size_t p;              /* the end of the offset table */
+	size_t size;           /* of the encoded image: the input, or the output once known */
+	int tiles_x, num_tiles;
+	size_t tile_width, tile_height;
+	int pending;           /* tiles still to encode */
+	int failed;
+	size_t* tile_sizes;
+	unsigned char** tile_data;
+} qoi_pool_job_t;
+
+struct qoi_pool_t {
+	int num_threads;
+	qoi_pool_worker_t* workers;
+	qoi_pool_job_t* jobs;
+	int num_jobs, jobs_cap;
+	int num_tasks;         /* copies included */
+	int remaining;         /* tasks of the current run not done yet */
+	omp_lock_t lock;       /* guards pending and failed of the jobs */
+};
+
+qoi_pool_t* qoi_pool_create(int num_threads) {
+	qoi_pool_t* pool;
+	int i;
+
+	if (num_threads < 1) {
+		num_threads = omp_get_max_threads();
+	}
+	pool = (qoi_pool_t*)QOI_MALLOC(sizeof(qoi_pool_t));
+	if (!pool) {
+		return NULL;
+	}
+	memset(pool, 0, sizeof(qoi_pool_t));
+	pool->num_threads = num_threads;
+	pool->workers = (qoi_pool_worker_t*)QOI_MALLOC(num_threads * sizeof(qoi_pool_worker_t));
+	if (!pool->workers) {
+		QOI_FREE(pool);
+		return NULL;
+	}
+	memset(pool->workers, 0, num_threads * sizeof(qoi_pool_worker_t));
+	for (i = 0; i < num_threads; i++) {
+		omp_init_lock(&pool->workers[i].lock);
+	}
+	omp_init_lock(&pool->lock);
+	return pool;
 }
 
-void* qoi_decode_modify(const void* data, int size, qoi_desc* desc, int channels) {
-	if (data == NULL || desc == NULL ||
-		(channels != 0 && channels != 3 && channels != 4) ||
-		size < QOI_HEADER_SIZE + (int)sizeof(qoi_padding)) {
+static qoi_pool_job_t* qoi_pool_new_job(qoi_pool_t* pool, int num_tiles) {
+	qoi_pool_job_t* job;
+
+	if (num_tiles > (0x7fffffff - pool->num_tasks) / 2) {
 		return NULL;
 	}
+	if (pool->num_jobs == pool->jobs_cap) {
+		int cap = pool->jobs_cap ? pool->jobs_cap * 2 : 16;
+		qoi_pool_job_t* jobs = (qoi_pool_job_t*)QOI_REALLOC(pool->jobs, cap * sizeof(qoi_pool_job_t));
+		if (!jobs) {
+			return NULL;
+		}
+		pool->jobs = jobs;
+		pool->jobs_cap = cap;
+	}
+	job = &pool->jobs[pool->num_jobs];
+	memset(job, 0, sizeof(qoi_pool_job_t));
+	job->num_tiles = num_tiles;
+	job->pending = num_tiles;
+	return job;
+}
+
+int qoi_pool_add_encode(qoi_pool_t* pool, const void* data, size_t stride, int fmt, const qoi_desc* desc, void* out, size_t out_cap, size_t* out_len) {
+	if (pool == NULL || data == NULL || out == NULL || out_len == NULL ||
+		!qoi_valid_desc(desc) ||
+		out_cap < qoi_max_encoded_size_block(desc)) {
+		return 0;
+	}
+
+	if (fmt == 0) {
+		fmt = desc->channels;
+	}
+	if (fmt < QOI_FMT_RGB || fmt > QOI_FMT_ARGB || QOI_FMT_CHANNELS(fmt) != desc->channels) {
+		return 0;
+	}
+
+	size_t width = desc->width;
+	size_t height = desc->height;
+	size_t row_len = width * desc->channels;
+	if (stride == 0) {
+		stride = row_len;
+	}
+	if (stride < row_len) {
+		return 0;
+	}
+
+	int block_height = qoi_block_height(desc, pool->num_threads);
+	int num_blocks = (int)((height + block_height - 1) / block_height);
+	qoi_pool_job_t* job = qoi_pool_new_job(pool, num_blocks);
+	if (!job) {
+		return 0;
+	}
+	job->tile_sizes = (size_t*)QOI_MALLOC(num_blocks * sizeof(size_t));
+	job->tile_data = (unsigned char**)QOI_MALLOC(num_blocks * sizeof(unsigned char*));
+	if (!job->tile_sizes || !job->tile_data) {
+		QOI_FREE(job->tile_sizes);
+		QOI_FREE(job->tile_data);
+		return 0;
+	}
+
+	unsigned char* bytes = (unsigned char*)out;
+
+	// Write header
+	size_t p = 0;
+	qoi_write_32(bytes, &p, QOI_MAGIC);
+	qoi_write_32(bytes, &p, (unsigned int)width);
+	qoi_write_32(bytes, &p, (unsigned int)height);
+	bytes[p++] = desc->channels;
+	bytes[p++] = desc->colorspace;
+	qoi_write_block_geometry(bytes, &p, num_blocks, block_height);
+
+	job->encode = 1;
+	job->in = (const unsigned char*)data;
+	job->out = bytes;
+	job->stride = stride;
+	job->fmt = fmt;
+	job->desc = *desc;
+	job->out_len = out_len;
+	job->p = p + num_blocks * sizeof(int64_t);
+	job->tiles_x = 1;
+	job->tile_width = width;
+	job->tile_height = block_height;
+	*out_len = 0;
+
+	pool->num_jobs++;
+	pool->num_tasks += 2 * num_blocks;
+	return 1;
+}
+
+int qoi_pool_add_decode(qoi_pool_t* pool, const void* data, size_t size, qoi_desc* desc, void* pixels, size_t stride, size_t pixels_cap, int fmt, size_t* out_len) {
+	if (pool == NULL || data == NULL || desc == NULL || pixels == NULL || out_len == NULL ||
+		(fmt != 0 && (fmt < QOI_FMT_RGB || fmt > QOI_FMT_RGBA_PREMUL))) {
+		return 0;
+	}
 
 	const unsigned char* bytes = (const unsigned char*)data;
-	int p = 0;
+	if (!qoi_read_header(bytes, size, desc)) {
+		return 0;
+	}
+	size_t p = QOI_HEADER_SIZE;
 
-	// Read header
-	unsigned int header_magic = qoi_read_32(bytes, &p);
-	desc->width = qoi_read_32(bytes, &p);
-	desc->height = qoi_read_32(bytes, &p);
-	desc->channels = bytes[p++];
-	desc->colorspace = bytes[p++];
+	if (fmt == 0) {
+		fmt = desc->channels;
+	}
 
-	// Validate header
-	if (desc->width == 0 || desc->height == 0 ||
-		desc->channels < 3 || desc->channels > 4 ||
-		desc->colorspace > 1 ||
-		header_magic != QOI_MAGIC ||
-		desc->height >= QOI_PIXELS_MAX / desc->width) {
-		return NULL;
+	size_t height = desc->height;
+	size_t row_len = (size_t)desc->width * QOI_FMT_CHANNELS(fmt);
+	if (stride == 0) {
+		stride = row_len;
+	}
+	if (stride < row_len || height - 1 > (((size_t)-1) - row_len) / stride) {
+		return 0;
+	}
+
+	size_t span = (height - 1) * stride + row_len;
+	if (pixels_cap < span) {
+		return 0;
+	}
+
+	int tiles_x, tiles_y, tile_width, tile_height;
+	if (!qoi_read_tile_geometry(bytes, size, &p, desc, &tiles_x, &tiles_y, &tile_width, &tile_height)) {
+		return 0;
+	}
+	qoi_pool_job_t* job = qoi_pool_new_job(pool, tiles_x * tiles_y);
+	if (!job) {
+		return 0;
+	}
+
+	job->in = bytes;
+	job->out = (unsigned char*)pixels;
+	job->stride = stride;
+	job->fmt = fmt;
+	job->desc = *desc;
+	job->out_len = out_len;
+	job->p = p;
+	job->size = size;
+	job->tiles_x = tiles_x;
+	job->tile_width = tile_width;
+	job->tile_height = tile_height;
+	*out_len = span;
+
+	pool->num_jobs++;
+	pool->num_tasks += tiles_x * tiles_y;
+	return 1;
+}
+
+static void qoi_pool_push(qoi_pool_worker_t* worker, qoi_pool_task_t task) {
+	omp_set_lock(&worker->lock);
+	worker->tasks[worker->bottom++] = task;
+	omp_unset_lock(&worker->lock);
+}
+
+/* Take a task from the bottom of the worker's own queue, or failing that from
+the top of another worker's, the oldest and so usually the biggest piece of
+work left there */
+static int qoi_pool_take(qoi_pool_t* pool, int self, int team, qoi_pool_task_t* task) {
+	int i;
+
+	for (i = 0; i < team; i++) {
+		qoi_pool_worker_t* worker = &pool->workers[(self + i) % team];
+		int found = 0;
+
+		omp_set_lock(&worker->lock);
+		if (worker->bottom > worker->top) {
+			*task = i == 0 ? worker->tasks[--worker->bottom] : worker->tasks[worker->top++];
+			found = 1;
+		}
+		omp_unset_lock(&worker->lock);
+		if (found) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Room for len more bytes in the worker's arena: the current chunk, the next
+one in the chain if it is big enough, or a new one put after the current */
+static unsigned char* qoi_pool_alloc(qoi_pool_worker_t* worker, size_t len) {
+	unsigned char* next;
+	size_t cap;
+
+	if (worker->chunk && worker->chunk_cap - worker->chunk_len >= len) {
+		return worker->chunk + worker->chunk_len;
+	}
+
+	next = worker->chunks;
+	if (worker->chunk) {
+		memcpy(&next, worker->chunk, sizeof(next));
+	}
+	if (next) {
+		memcpy(&cap, next + sizeof(next), sizeof(cap));
+	}
+	if (!next || cap - QOI_POOL_CHUNK_HEADER < len) {
+		unsigned char* chunk;
+
+		cap = QOI_POOL_CHUNK_HEADER + (len > QOI_POOL_CHUNK ? len : QOI_POOL_CHUNK);
+		chunk = (unsigned char*)QOI_MALLOC(cap);
+		if (!chunk) {
+			return NULL;
+		}
+		memcpy(chunk, &next, sizeof(next));
+		memcpy(chunk + sizeof(next), &cap, sizeof(cap));
+		if (worker->chunk) {
+			memcpy(worker->chunk, &chunk, sizeof(chunk));
+		}
+		else {
+			worker->chunks = chunk;
+		}
+		next = chunk;
+	}
+
+	worker->chunk = next;
+	worker->chunk_len = QOI_POOL_CHUNK_HEADER;
+	worker->chunk_cap = cap;
+	return next + QOI_POOL_CHUNK_HEADER;
+}
+
+/* Encode a tile into the worker's arena. The worker that finishes the last
+tile of an image fills in its offset table and padding and queues the copies,
+or drops them if a tile failed. */
+static void qoi_pool_encode_tile(qoi_pool_t* pool, qoi_pool_worker_t* worker, qoi_pool_job_t* job, int tile) {
+	size_t width = job->desc.width;
+	size_t height = job->desc.height;
+	int channels = job->desc.channels;
+	size_t start_row = (size_t)(tile / job->tiles_x) * job->tile_height;
+	size_t start_col = (size_t)(tile % job->tiles_x) * job->tile_width;
+	size_t rows = min(start_row + job->tile_height, height) - start_row;
+	size_t tile_row_len = (min(start_col + job->tile_width, width) - start_col) * channels;
+	const unsigned char* tile_pixels = job->in + start_row * job->stride + start_col * channels;
+	unsigned char* tile_out = qoi_pool_alloc(worker, rows * tile_row_len / channels * (channels + 1));
+	size_t local_size = 0;
+	int last, failed, i;
+
+	if (tile_out) {
+		switch (job->fmt) {
+			case QOI_FMT_RGBA: local_size = qoi_encode_block(tile_pixels, job->stride, tile_row_len, rows, tile_out, QOI_FMT_RGBA); break;
+			case QOI_FMT_BGRA: local_size = qoi_encode_block(tile_pixels, job->stride, tile_row_len, rows, tile_out, QOI_FMT_BGRA); break;
+			case QOI_FMT_ARGB: local_size = qoi_encode_block(tile_pixels, job->stride, tile_row_len, rows, tile_out, QOI_FMT_ARGB); break;
+			case QOI_FMT_BGR:  local_size = qoi_encode_block(tile_pixels, job->stride, tile_row_len, rows, tile_out, QOI_FMT_BGR);  break;
+			default:           local_size = qoi_encode_block(tile_pixels, job->stride, tile_row_len, rows, tile_out, QOI_FMT_RGB);  break;
+		}
+		worker->chunk_len += local_size;
+	}
+	job->tile_sizes[tile] = local_size;
+	job->tile_data[tile] = tile_out;
+
+	omp_set_lock(&pool->lock);
+	if (!tile_out) {
+		job->failed = 1;
+	}
+	last = --job->pending == 0;
+	failed = job->failed;
+	omp_unset_lock(&pool->lock);
+
+	if (!last) {
+		return;
+	}
+	if (failed) {
+#pragma omp atomic
+		pool->remaining -= job->num_tiles;
+		return;
+	}
+
+	unsigned char* tile_offsets = (job->out + job->p - job->num_tiles * sizeof(int64_t));
+	size_t write_pos = 0;
+	for (i = 0; i < job->num_tiles; i++) {
+		qoi_write_offset(tile_offsets, i, (int64_t)write_pos);  // Store relative offset
+		write_pos += job->tile_sizes[i];
+	}
+	memcpy(job->out + job->p + write_pos, qoi_padding, sizeof(qoi_padding));
+	job->size = job->p + write_pos + sizeof(qoi_padding);
+
+	for (i = job->num_tiles - 1; i >= 0; i--) {
+		qoi_pool_task_t copy = { (int)(job - pool->jobs), QOI_POOL_COPY, i };
+		qoi_pool_push(worker, copy);
+	}
+}
+
+static void qoi_pool_copy_tile(qoi_pool_job_t* job, int tile) {
+	const unsigned char* tile_offsets = (job->out + job->p - job->num_tiles * sizeof(int64_t));
+	memcpy(job->out + job->p + (size_t)qoi_read_offset(tile_offsets, tile), job->tile_data[tile], job->tile_sizes[tile]);
+}
+
+static void qoi_pool_decode_tile(qoi_pool_job_t* job, int tile) {
+	const unsigned char* tile_offsets = (job->in + job->p);
+	size_t p = job->p + job->num_tiles * sizeof(int64_t);
+	size_t chunks_len = job->size - sizeof(qoi_padding);
+	size_t local_p = p + (size_t)qoi_read_offset(tile_offsets, tile);
+	size_t tile_end = tile + 1 < job->num_tiles ? p + (size_t)qoi_read_offset(tile_offsets, tile + 1) : chunks_len;
+	int channels = QOI_FMT_CHANNELS(job->fmt);
+	size_t start_row = (size_t)(tile / job->tiles_x) * job->tile_height;
+	size_t start_col = (size_t)(tile % job->tiles_x) * job->tile_width;
+	size_t rows = min(start_row + job->tile_height, (size_t)job->desc.height) - start_row;
+	size_t tile_row_len = (min(start_col + job->tile_width, (size_t)job->desc.width) - start_col) * channels;
+	unsigned char* tile_pixels = job->out + start_row * job->stride + start_col * channels;
+	size_t stride = job->stride;
+
+	switch (job->fmt) {
+		case QOI_FMT_RGBA:        qoi_decode_block(job->in, local_p, tile_end, tile_pixels, stride, tile_row_len, 0, rows, QOI_FMT_RGBA);        break;
+		case QOI_FMT_BGRA:        qoi_decode_block(job->in, local_p, tile_end, tile_pixels, stride, tile_row_len, 0, rows, QOI_FMT_BGRA);        break;
+		case QOI_FMT_ARGB:        qoi_decode_block(job->in, local_p, tile_end, tile_pixels, stride, tile_row_len, 0, rows, QOI_FMT_ARGB);        break;
+		case QOI_FMT_RGBA_PREMUL: qoi_decode_block(job->in, local_p, tile_end, tile_pixels, stride, tile_row_len, 0, rows, QOI_FMT_RGBA_PREMUL); break;
+		case QOI_FMT_BGR:         qoi_decode_block(job->in, local_p, tile_end, tile_pixels, stride, tile_row_len, 0, rows, QOI_FMT_BGR);         break;
+		default:                  qoi_decode_block(job->in, local_p, tile_end, tile_pixels, stride, tile_row_len, 0, rows, QOI_FMT_RGB);         break;
+	}
+}
+
+static size_t qoi_pool_tile_pixels(const qoi_pool_job_t* job, int tile) {
+	size_t start_row = (size_t)(tile / job->tiles_x) * job->tile_height;
+	size_t start_col = (size_t)(tile % job->tiles_x) * job->tile_width;
+	return (min(start_row + job->tile_height, (size_t)job->desc.height) - start_row) *
+		(min(start_col + job->tile_width, (size_t)job->desc.width) - start_col);
+}
+
+int qoi_pool_run(qoi_pool_t* pool) {
+	int i, failed = 0;
+	uint64_t total_pixels = 0;
+
+	if (pool == NULL) {
+		return 0;
+	}
+
+	// Every worker's queue must be able to take all tasks of the run
+	for (i = 0; i < pool->num_threads && !failed; i++) {
+		qoi_pool_worker_t* worker = &pool->workers[i];
+		if (worker->cap < pool->num_tasks) {
+			qoi_pool_task_t* tasks = (qoi_pool_task_t*)QOI_REALLOC(worker->tasks, pool->num_tasks * sizeof(qoi_pool_task_t));
+			if (!tasks) {
+				failed = 1;
+				break;
+			}
+			worker->tasks = tasks;
+			worker->cap = pool->num_tasks;
+		}
+	}
+	for (i = 0; i < pool->num_jobs; i++) {
+		total_pixels += (uint64_t)pool->jobs[i].desc.width * pool->jobs[i].desc.height;
+	}
+	pool->remaining = pool->num_tasks;
+
+	if (!failed && pool->num_tasks > 0) {
+#pragma omp parallel num_threads(pool->num_threads)
+		{
+			int self = omp_get_thread_num();
+			int team = omp_get_num_threads();
+			qoi_pool_worker_t* worker = &pool->workers[self];
+			qoi_pool_task_t task;
+			uint64_t begin = total_pixels * self / team;
+			uint64_t end = total_pixels * (self + 1) / team;
+			uint64_t pos = 0;
+			int job, tile, n;
+
+			// The first tasks that start within an even share of all pixels,
+			// in order, the first of them at the bottom, where the worker
+			// takes from
+			worker->top = 0;
+			worker->bottom = 0;
+			for (job = 0; job < pool->num_jobs && pos < end; job++) {
+				for (tile = 0; tile < pool->jobs[job].num_tiles && pos < end; tile++) {
+					if (pos >= begin) {
+						task.job = job;
+						task.kind = pool->jobs[job].encode ? QOI_POOL_ENCODE : QOI_POOL_DECODE;
+						task.tile = tile;
+						worker->tasks[worker->bottom++] = task;
+					}
+					pos += qoi_pool_tile_pixels(&pool->jobs[job], tile);
+				}
+			}
+			for (n = 0; n < worker->bottom / 2; n++) {
+				task = worker->tasks[n];
+				worker->tasks[n] = worker->tasks[worker->bottom - 1 - n];
+				worker->tasks[worker->bottom - 1 - n] = task;
+			}
+
+#pragma omp barrier
+
+			for (;;) {
+				if (qoi_pool_take(pool, self, team, &task)) {
+					qoi_pool_job_t* j = &pool->jobs[task.job];
+					switch (task.kind) {
+						case QOI_POOL_ENCODE: qoi_pool_encode_tile(pool, worker, j, task.tile); break;
+						case QOI_POOL_COPY:   qoi_pool_copy_tile(j, task.tile);                  break;
+						default:              qoi_pool_decode_tile(j, task.tile);                break;
+					}
+#pragma omp atomic
+					pool->remaining--;
+					continue;
+				}
+
+				// Nothing left to take: done once the copies still to come are done
+#pragma omp flush
+				if (pool->remaining == 0) {
+					break;
+				}
+			}
+		}
+	}
+
+	for (i = 0; i < pool->num_jobs; i++) {
+		qoi_pool_job_t* job = &pool->jobs[i];
+		if (job->encode) {
+			*job->out_len = failed || job->failed ? 0 : job->size;
+		}
+		else if (failed) {
+			*job->out_len = 0;
+		}
+		QOI_FREE(job->tile_sizes);
+		QOI_FREE(job->tile_data);
+		failed |= *job->out_len == 0;
+	}
+
+	// Keep the arenas for the next run
+	for (i = 0; i < pool->num_threads; i++) {
+		pool->workers[i].chunk = NULL;
+		pool->workers[i].chunk_len = 0;
+		pool->workers[i].chunk_cap = 0;
+	}
+	pool->num_jobs = 0;
+	pool->num_tasks = 0;
+	return !failed;
+}
+
+void qoi_pool_destroy(qoi_pool_t* pool) {
+	int i;
+
+	if (pool == NULL) {
+		return;
+	}
+	for (i = 0; i < pool->num_jobs; i++) {
+		QOI_FREE(pool->jobs[i].tile_sizes);
+		QOI_FREE(pool->jobs[i].tile_data);
+	}
+	for (i = 0; i < pool->num_threads; i++) {
+		unsigned char* chunk = pool->workers[i].chunks;
+		while (chunk) {
+			unsigned char* next;
+			memcpy(&next, chunk, sizeof(next));
+			QOI_FREE(chunk);
+			chunk = next;
+		}
+		QOI_FREE(pool->workers[i].tasks);
+		omp_destroy_lock(&pool->workers[i].lock);
 	}
+	omp_destroy_lock(&pool->lock);
+	QOI_FREE(pool->workers);
+	QOI_FREE(pool->jobs);
+	QOI_FREE(pool);
+}
 
-	if (channels == 0) {
-		channels = desc->channels;
+/* Batches are queued largest image first; equal sizes keep their order */
+typedef struct {
+	uint64_t pixels;
+	int item;
+} qoi_batch_order_t;
+
+static int qoi_batch_compare(const void* a, const void* b) {
+	const qoi_batch_order_t* oa = (const qoi_batch_order_t*)a;
+	const qoi_batch_order_t* ob = (const qoi_batch_order_t*)b;
+	if (oa->pixels != ob->pixels) {
+		return oa->pixels > ob->pixels ? -1 : 1;
 	}
+	return oa->item - ob->item;
+}
 
-	// Read number of blocks
-	int num_blocks = qoi_read_32(bytes, &p); 
-
-	// Read block offsets table   
-	const int* block_offsets = (const int*)(bytes + p); 
-	p += num_blocks * sizeof(int); 
+static int qoi_batch_run(qoi_batch_item_t* items, int count, int num_threads, int encode, qoi_batch_stats_t* stats) {
+	double start = omp_get_wtime();
+	qoi_batch_order_t* order = NULL;
+	qoi_pool_t* pool = NULL;
+	int i, done = 0;
 
-	int width = desc->width;
-	int height = desc->height;
-	const int BLOCK_HEIGHT = 64;
-	int px_len = width * height * channels;
-	int chunks_len = size - (int)sizeof(qoi_padding);
+	if (stats) {
+		memset(stats, 0, sizeof(qoi_batch_stats_t));
+	}
+	if (items == NULL || count <= 0) {
+		return 0;
+	}
+	for (i = 0; i < count; i++) {
+		items[i].result = NULL;
+		items[i].result_len = 0;
+	}
 
-	unsigned char* pixels = (unsigned char*)QOI_MALLOC(px_len);
-	if (!pixels) {
-		return NULL;
+	// Encoded images are sorted by the size in their header
+	order = (qoi_batch_order_t*)QOI_MALLOC(count * sizeof(qoi_batch_order_t));
+	pool = order ? qoi_pool_create(num_threads) : NULL;
+	if (!pool) {
+		QOI_FREE(order);
+		return 0;
 	}
-		for (int block = 0; block < num_blocks; block++) {
-			qoi_rgba_t index[64] = { 0 };
-			qoi_rgba_t px = { 0, 0, 0, 255 };
-			int run = 0;
+	for (i = 0; i < count; i++) {
+		qoi_batch_item_t* item = &items[i];
+		int valid = encode ? item->data != NULL && qoi_valid_desc(&item->desc) :
+			item->data != NULL && qoi_read_header((const unsigned char*)item->data, item->size, &item->desc);
+		order[i].pixels = valid ? (uint64_t)item->desc.width * item->desc.height : 0;
+		order[i].item = i;
+	}
+	qsort(order, count, sizeof(qoi_batch_order_t), qoi_batch_compare);
 
-			// Direct access to block data using offset
-			int local_p = p + block_offsets[block]; // use array read 
-			int start_row = block * BLOCK_HEIGHT;
-			int end_row = min(start_row + BLOCK_HEIGHT, height);
+	for (i = 0; i < count && order[i].pixels; i++) {
+		qoi_batch_item_t* item = &items[order[i].item];
+		size_t len;
+		int added;
 
-			for (int y = start_row; y < end_row; y++) {
-				for (int x = 0; x < width; x++) {
-					int px_pos = (y * width + x) * channels;
+		if (encode) {
+			len = qoi_max_encoded_size_block(&item->desc);
+		}
+		else if (item->channels != 0 && item->channels != 3 && item->channels != 4) {
+			continue;
+		}
+		else {
+			len = (size_t)item->desc.width * item->desc.height * (item->channels ? item->channels : item->desc.channels);
+		}
 
-					if (run > 0) {
-						run--;
-					}
-					else if (local_p < chunks_len) {
-						int b1 = bytes[local_p++];
-						if (b1 == QOI_OP_RGB) {
-							px.rgba.r = bytes[local_p++];
-							px.rgba.g = bytes[local_p++];
-							px.rgba.b = bytes[local_p++];
-						}
-						else if (b1 == QOI_OP_RGBA) {
-							px.rgba.r = bytes[local_p++];
-							px.rgba.g = bytes[local_p++];
-							px.rgba.b = bytes[local_p++];
-							px.rgba.a = bytes[local_p++];
-						}
-						else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
-							px = index[b1];
-						}
-						else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
-							px.rgba.r += ((b1 >> 4) & 0x03) - 2;
-							px.rgba.g += ((b1 >> 2) & 0x03) - 2;
-							px.rgba.b += (b1 & 0x03) - 2;
-						}
-						else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
-							int b2 = bytes[local_p++];
-							int vg = (b1 & 0x3f) - 32;
-							px.rgba.r += vg - 8 + ((b2 >> 4) & 0x0f);
-							px.rgba.g += vg;
-							px.rgba.b += vg - 8 + (b2 & 0x0f);
-						}
-						else if ((b1 & QOI_MASK_2) == QOI_OP_RUN) {
-							run = (b1 & 0x3f);
-						}
-						index[QOI_COLOR_HASH(px) % 64] = px;
-					}
+		item->result = QOI_MALLOC(len);
+		if (!item->result) {
+			continue;
+		}
+		added = encode ?
+			qoi_pool_add_encode(pool, item->data, 0, 0, &item->desc, item->result, len, &item->result_len) :
+			qoi_pool_add_decode(pool, item->data, item->size, &item->desc, item->result, 0, len, item->channels, &item->result_len);
+		if (!added) {
+			QOI_FREE(item->result);
+			item->result = NULL;
+			item->result_len = 0;
+		}
+	}
 
-					pixels[px_pos + 0] = px.rgba.r;
-					pixels[px_pos + 1] = px.rgba.g;
-					pixels[px_pos + 2] = px.rgba.b;
-					if (channels == 4) {
-						pixels[px_pos + 3] = px.rgba.a;
-					}
-				}
-			}
+	qoi_pool_run(pool);
+	qoi_pool_destroy(pool);
+	QOI_FREE(order);
+
+	for (i = 0; i < count; i++) {
+		qoi_batch_item_t* item = &items[i];
+		if (item->result && item->result_len == 0) {
+			QOI_FREE(item->result);
+			item->result = NULL;
 		}
-	return pixels;
+		if (!item->result) {
+			continue;
+		}
+		done++;
+		if (stats) {
+			stats->raw_bytes += encode ? (size_t)item->desc.width * item->desc.height * item->desc.channels : item->result_len;
+			stats->encoded_bytes += encode ? item->result_len : item->size;
+		}
+	}
+
+	if (stats) {
+		stats->images = done;
+		stats->seconds = omp_get_wtime() - start;
+		if (stats->seconds > 0) {
+			stats->images_per_sec = done / stats->seconds;
+			stats->mb_per_sec = stats->raw_bytes / (1024.0 * 1024.0) / stats->seconds;
+		}
+	}
+	return done;
 }
 
-#include <omp.h>
+int qoi_encode_batch(qoi_batch_item_t* items, int count, int num_threads, qoi_batch_stats_t* stats) {
+	return qoi_batch_run(items, count, num_threads, 1, stats);
+}
 
-void* qoi_encode_parallel_block_simple(const void* data, const qoi_desc* desc, int* out_len, int num_threads) {
-	if (data == NULL || out_len == NULL || desc == NULL ||
-		desc->width == 0 || desc->height == 0 ||
-		desc->channels < 3 || desc->channels > 4 ||
-		desc->colorspace > 1 ||
-		desc->height >= QOI_PIXELS_MAX / desc->width) {
-		return NULL;
-	}
+int qoi_decode_batch(qoi_batch_item_t* items, int count, int num_threads, qoi_batch_stats_t* stats) {
+	return qoi_batch_run(items, count, num_threads, 0, stats);
+}
 
-	const int BLOCK_HEIGHT = 64;
-	int width = desc->width;
-	int height = desc->height;
-	int channels = desc->channels;
-	int num_blocks = (height + BLOCK_HEIGHT - 1) / BLOCK_HEIGHT;
+#ifndef QOI_NO_STDIO
+#include <stdio.h>
 
-	// Calculate max size including block offset table
-	int max_size = width * height * (channels + 1) +
-		QOI_HEADER_SIZE + sizeof(qoi_padding) + (num_blocks * sizeof(int));
+/* 64-bit file positions, so files larger than 2GB can be sized */
+#ifdef _MSC_VER
+#define QOI_FSEEK64 _fseeki64
+#define QOI_FTELL64 _ftelli64
+#else
+#define QOI_FSEEK64 fseeko
+#define QOI_FTELL64 ftello
+#endif
 
-	unsigned char* bytes = (unsigned char*)QOI_MALLOC(max_size);
-	if (!bytes) return NULL;
+/* Size of the buffer qoi_write streams the encoded image through */
+#ifndef QOI_WRITE_BUF_SIZE
+#define QOI_WRITE_BUF_SIZE 65536
+#endif
 
-	// Write header
-	int p = 0;
-	qoi_write_32(bytes, &p, QOI_MAGIC);
-	qoi_write_32(bytes, &p, width);
-	qoi_write_32(bytes, &p, height);
-	bytes[p++] = channels;
-	bytes[p++] = desc->colorspace;
-	qoi_write_32(bytes, &p, num_blocks);  // Write number of blocks
+/* qoi_write_func that appends to a FILE* */
+static int qoi_fwrite_func(void* user, const void* data, size_t len) {
+	return fwrite(data, 1, len, (FILE*)user) == len;
+}
 
-	// Reserve space for block offsets
-	int* block_offsets = (int*)(bytes + p);
-	p += num_blocks * sizeof(int);
+size_t qoi_write(const char* filename, const void* data, const qoi_desc* desc) {
+	FILE* f;
+	qoi_encoder_t enc;
+	size_t size;
+	int err;
+	void* buf;
 
-	const unsigned char* pixels = (const unsigned char*)data;
+	if (data == NULL || !qoi_valid_desc(desc)) {
+		return 0;
+	}
 
-	// Arrays to track block output positions and sizes
-	int* block_sizes = (int*)QOI_MALLOC(num_blocks * sizeof(int));
-	unsigned char** block_outputs = (unsigned char**)QOI_MALLOC(num_blocks * sizeof(unsigned char*));
-	if (!block_sizes || !block_outputs) {
-		QOI_FREE(bytes);
-		QOI_FREE(block_sizes);
-		QOI_FREE(block_outputs);
-		return NULL;
+	buf = QOI_MALLOC(QOI_WRITE_BUF_SIZE);
+	if (!buf) {
+		return 0;
 	}
 
-#pragma omp parallel for schedule(dynamic) num_threads(num_threads)
-	for (int block = 0; block < num_blocks; block++) {
-		int start_row = block * BLOCK_HEIGHT;
-		int end_row = min(start_row + BLOCK_HEIGHT, height);
-		int block_px_len = width * (end_row - start_row) * channels;
+	f = fopen(filename, "wb");
+	if (!f) {
+		QOI_FREE(buf);
+		return 0;
+	}
 
-		qoi_rgba_t index[64] = { 0 };
-		qoi_rgba_t px = { 0, 0, 0, 255 };
-		qoi_rgba_t px_prev = { 0, 0, 0, 255 };
-		int run = 0;
-		int local_size = 0;
+	/* Stream the encoded image to the file instead of encoding it whole in
+	memory first */
+	qoi_encoder_begin(&enc, desc, desc->channels, buf, QOI_WRITE_BUF_SIZE, qoi_fwrite_func, f);
+	qoi_encoder_push_rows(&enc, data, 0, desc->height);
+	size = qoi_encoder_finish(&enc);
 
-		unsigned char* local_buffer = (unsigned char*)QOI_MALLOC(block_px_len * 2);
-		if (!local_buffer) continue;
+	fflush(f);
+	err = ferror(f);
+	fclose(f);
 
-		// Start each block with full pixel
-		int first_px = (start_row * width) * channels;
-		px.rgba.r = pixels[first_px + 0];
-		px.rgba.g = pixels[first_px + 1];
-		px.rgba.b = pixels[first_px + 2];
-		if (channels == 4) {
-			px.rgba.a = pixels[first_px + 3];
-			local_buffer[local_size++] = QOI_OP_RGBA;
-		}
-		else {
-			local_buffer[local_size++] = QOI_OP_RGB;
-		}
-		local_buffer[local_size++] = px.rgba.r;
-		local_buffer[local_size++] = px.rgba.g;
-		local_buffer[local_size++] = px.rgba.b;
-		if (channels == 4) {
-			local_buffer[local_size++] = px.rgba.a;
-		}
-		px_prev = px;
+	QOI_FREE(buf);
+	return err ? 0 : size;
+}
 
-		for (int y = start_row; y < end_row; y++) {
-			for (int x = 0; x < width; x++) {
-				// Skip first pixel as already encoded
-				if (y == start_row && x == 0) continue;
-
-				int px_pos = (y * width + x) * channels;
-				px.rgba.r = pixels[px_pos + 0];
-				px.rgba.g = pixels[px_pos + 1];
-				px.rgba.b = pixels[px_pos + 2];
-				if (channels == 4) {
-					px.rgba.a = pixels[px_pos + 3];
-				}
+/* Memory-mapped input: CreateFileMapping on Windows, mmap everywhere else.
+Define QOI_NO_MMAP to always read files with fread. */
+#ifndef QOI_NO_MMAP
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#endif
 
-				if (px.v == px_prev.v) {
-					run++;
-					if (run == 62 || (y == end_row - 1 && x == width - 1)) {
-						local_buffer[local_size++] = QOI_OP_RUN | (run - 1);
-						run = 0;
-					}
-				}
-				else {
-					if (run > 0) {
-						local_buffer[local_size++] = QOI_OP_RUN | (run - 1);
-						run = 0;
-					}
+const void* qoi_map_file(const char* filename, size_t* size, int flags) {
+#if defined(QOI_NO_MMAP)
+	(void)filename;
+	(void)size;
+	(void)flags;
+	return NULL;
+#elif defined(_WIN32)
+	HANDLE file, mapping;
+	LARGE_INTEGER file_size;
+	const unsigned char* data;
+	size_t i;
+
+	file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		(flags & QOI_MAP_SEQUENTIAL) ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return NULL;
+	}
+	if (
+		!GetFileSizeEx(file, &file_size) || file_size.QuadPart <= 0 ||
+		(unsigned long long)file_size.QuadPart > (size_t)-1
+		) {
+		CloseHandle(file);
+		return NULL;
+	}
 
-					int index_pos = QOI_COLOR_HASH(px) % 64;
-					if (index[index_pos].v == px.v) {
-						local_buffer[local_size++] = QOI_OP_INDEX | index_pos;
-					}
-					else {
-						index[index_pos] = px;
-						if (px.rgba.a == px_prev.rgba.a) {
-							signed char vr = px.rgba.r - px_prev.rgba.r;
-							signed char vg = px.rgba.g - px_prev.rgba.g;
-							signed char vb = px.rgba.b - px_prev.rgba.b;
-							signed char vg_r = vr - vg;
-							signed char vg_b = vb - vg;
-
-							if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
-								local_buffer[local_size++] = QOI_OP_DIFF |
-									(vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
-							}
-							else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 &&
-								vg_b > -9 && vg_b < 8) {
-								local_buffer[local_size++] = QOI_OP_LUMA | (vg + 32);
-								local_buffer[local_size++] = (vg_r + 8) << 4 | (vg_b + 8);
-							}
-							else {
-								local_buffer[local_size++] = QOI_OP_RGB;
-								local_buffer[local_size++] = px.rgba.r;
-								local_buffer[local_size++] = px.rgba.g;
-								local_buffer[local_size++] = px.rgba.b;
-							}
-						}
-						else {
-							local_buffer[local_size++] = QOI_OP_RGBA;
-							local_buffer[local_size++] = px.rgba.r;
-							local_buffer[local_size++] = px.rgba.g;
-							local_buffer[local_size++] = px.rgba.b;
-							local_buffer[local_size++] = px.rgba.a;
-						}
-					}
-				}
-				px_prev = px;
-			}
+	/* The view keeps the file and the mapping open by itself */
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (mapping == NULL) {
+		return NULL;
+	}
+	data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (data == NULL) {
+		return NULL;
+	}
+	*size = (size_t)file_size.QuadPart;
+
+	/* There is no MAP_POPULATE, so touch every page once */
+	if (flags & QOI_MAP_POPULATE) {
+		volatile unsigned char sink = 0;
+		for (i = 0; i < *size; i += 4096) {
+			sink ^= data[i];
 		}
+		(void)sink;
+	}
+	return data;
+#else
+	int fd = open(filename, O_RDONLY);
+	int map_flags = MAP_PRIVATE;
+	struct stat st;
+	void* data;
+
+	/* Both flags are hints that not every system has */
+	(void)flags;
+	if (fd < 0) {
+		return NULL;
+	}
+	if (fstat(fd, &st) != 0 || st.st_size <= 0 || (unsigned long long)st.st_size > (size_t)-1) {
+		close(fd);
+		return NULL;
+	}
 
-		block_sizes[block] = local_size;
-		block_outputs[block] = local_buffer;
+#ifdef MAP_POPULATE
+	if (flags & QOI_MAP_POPULATE) {
+		map_flags |= MAP_POPULATE;
+	}
+#endif
+	data = mmap(NULL, (size_t)st.st_size, PROT_READ, map_flags, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return NULL;
+	}
+#ifdef POSIX_MADV_SEQUENTIAL
+	if (flags & QOI_MAP_SEQUENTIAL) {
+		posix_madvise(data, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+	}
+#endif
+	*size = (size_t)st.st_size;
+	return data;
+#endif
+}
+
+void qoi_unmap_file(const void* data, size_t size) {
+#if defined(QOI_NO_MMAP)
+	(void)data;
+	(void)size;
+#elif defined(_WIN32)
+	(void)size;
+	if (data != NULL) {
+		UnmapViewOfFile(data);
+	}
+#else
+	if (data != NULL) {
+		munmap((void*)data, size);
 	}
+#endif
+}
 
-	// Write blocks and store their offsets
-	int write_pos = p;
-	for (int i = 0; i < num_blocks; i++) {
-		block_offsets[i] = write_pos - p;  // Store relative offset
-		memcpy(bytes + write_pos, block_outputs[i], block_sizes[i]);
-		write_pos += block_sizes[i];
-		QOI_FREE(block_outputs[i]);
+/* Read a whole file into a malloc()ed buffer, for files that cannot be
+mapped. Returns NULL on failure. */
+static void* qoi_read_file(const char* filename, size_t* size) {
+	FILE* f = fopen(filename, "rb");
+	long long file_size;
+	size_t bytes_read;
+	void* data;
+
+	if (!f) {
+		return NULL;
 	}
 
-	// Write padding
-	memcpy(bytes + write_pos, qoi_padding, sizeof(qoi_padding));
-	write_pos += sizeof(qoi_padding);
+	QOI_FSEEK64(f, 0, SEEK_END);
+	file_size = QOI_FTELL64(f);
+	if (file_size <= 0 || (unsigned long long)file_size > (size_t)-1 || QOI_FSEEK64(f, 0, SEEK_SET) != 0) {
+		fclose(f);
+		return NULL;
+	}
+	*size = (size_t)file_size;
 
-	QOI_FREE(block_sizes);
-	QOI_FREE(block_outputs);
+	data = QOI_MALLOC(*size);
+	if (!data) {
+		fclose(f);
+		return NULL;
+	}
 
-	*out_len = write_pos;
-	return bytes;
+	bytes_read = fread(data, 1, *size, f);
+	fclose(f);
+	if (bytes_read != *size) {
+		QOI_FREE(data);
+		return NULL;
+	}
+	return data;
 }
 
-void* qoi_decode_parallel_block_simple(const void* data, int size, qoi_desc* desc, int channels, int num_threads) {
-	if (data == NULL || desc == NULL ||
-		(channels != 0 && channels != 3 && channels != 4) ||
-		size < QOI_HEADER_SIZE + (int)sizeof(qoi_padding)) {
+void* qoi_read(const char* filename, qoi_desc* desc, int channels) {
+	size_t size;
+	const void* mapped = qoi_map_file(filename, &size, QOI_MAP_SEQUENTIAL);
+	void* pixels, * data;
+
+	if (mapped) {
+		pixels = qoi_decode(mapped, size, desc, channels);
+		qoi_unmap_file(mapped, size);
+		return pixels;
+	}
+
+	data = qoi_read_file(filename, &size);
+	if (!data) {
 		return NULL;
 	}
+	pixels = qoi_decode(data, size, desc, channels);
+	QOI_FREE(data);
+	return pixels;
+}
 
-	const unsigned char* bytes = (const unsigned char*)data;
-	int p = 0;
+void* qoi_read_parallel_block(const char* filename, qoi_desc* desc, int channels, int num_threads) {
+	size_t size;
+	/* Fault the whole file in up front: every thread starts in a different
+	block, and concurrent page faults on one mapping serialize in the kernel */
+	const void* mapped = qoi_map_file(filename, &size, QOI_MAP_POPULATE);
+	void* pixels, * data;
 
-	// Read header
-	unsigned int header_magic = qoi_read_32(bytes, &p);
-	desc->width = qoi_read_32(bytes, &p);
-	desc->height = qoi_read_32(bytes, &p);
-	desc->channels = bytes[p++];
-	desc->colorspace = bytes[p++];
+	if (mapped) {
+		pixels = qoi_decode_parallel_block_simple(mapped, size, desc, channels, num_threads);
+		qoi_unmap_file(mapped, size);
+		return pixels;
+	}
 
-	// Validate header
-	if (desc->width == 0 || desc->height == 0 ||
-		desc->channels < 3 || desc->channels > 4 ||
-		desc->colorspace > 1 ||
-		header_magic != QOI_MAGIC ||
-		desc->height >= QOI_PIXELS_MAX / desc->width) {
+	data = qoi_read_file(filename, &size);
+	if (!data) {
 		return NULL;
 	}
+	pixels = qoi_decode_parallel_block_simple(data, size, desc, channels, num_threads);
+	QOI_FREE(data);
+	return pixels;
+}
 
-	if (channels == 0) {
-		channels = desc->channels;
-	}
+size_t qoi_write_parallel_block(const char* filename, const void* data, const qoi_desc* desc, int num_threads) {
+	unsigned char header[QOI_HEADER_SIZE + 8];
+	const unsigned char* pixels = (const unsigned char*)data;
+	size_t p = 0, row_len, block_cap, write_pos = 0, height;
+	int64_t* block_offsets;
+	int block_height, num_blocks, failed = 0, err;
+	FILE* f;
 
-	// Read number of blocks
-	int num_blocks = qoi_read_32(bytes, &p); // 15 is number of block
+	if (data == NULL || !qoi_valid_desc(desc)) {
+		return 0;
+	}
 
-	// Read block offsets table   //16 - 30 is offset
-	const int* block_offsets = (const int*)(bytes + p); //get 16 only, then store in block_offsets (16 address) when need then p++, but this is used address to read
-	p += num_blocks * sizeof(int); //skip the header (30)
+	height = desc->height;
+	row_len = (size_t)desc->width * desc->channels;
+	block_height = qoi_block_height(desc, num_threads);
+	num_blocks = (int)((height + block_height - 1) / block_height);
+	/* Same per-block bound as qoi_encode_parallel_block_fmt_into */
+	block_cap = row_len * block_height * 2;
 
-	int width = desc->width;
-	int height = desc->height;
-	const int BLOCK_HEIGHT = 64;
-	int px_len = width * height * channels;
-	int chunks_len = size - (int)sizeof(qoi_padding);
+	block_offsets = (int64_t*)QOI_MALLOC(num_blocks * sizeof(int64_t));
+	if (!block_offsets) {
+		return 0;
+	}
+	memset(block_offsets, 0, num_blocks * sizeof(int64_t));
 
-	unsigned char* pixels = (unsigned char*)QOI_MALLOC(px_len);
-	if (!pixels) {
-		return NULL;
+	f = fopen(filename, "wb");
+	if (!f) {
+		QOI_FREE(block_offsets);
+		return 0;
 	}
 
+	/* Header, block geometry and a zeroed offset table to be patched below */
+	qoi_write_32(header, &p, QOI_MAGIC);
+	qoi_write_32(header, &p, desc->width);
+	qoi_write_32(header, &p, desc->height);
+	header[p++] = desc->channels;
+	header[p++] = desc->colorspace;
+	qoi_write_block_geometry(header, &p, num_blocks, block_height);
+	fwrite(header, 1, p, f);
+	fwrite(block_offsets, sizeof(int64_t), num_blocks, f);
+
 #pragma omp parallel num_threads(num_threads)
 	{
-#pragma omp for schedule(dynamic)
-		for (int block = 0; block < num_blocks; block++) {
-			qoi_rgba_t index[64] = { 0 };
-			qoi_rgba_t px = { 0, 0, 0, 255 };
-			int run = 0;
-
-			// Direct access to block data using offset
-			int local_p = p + block_offsets[block]; // use array read 
-			int start_row = block * BLOCK_HEIGHT;
-			int end_row = min(start_row + BLOCK_HEIGHT, height);
+		unsigned char* local_buffer = (unsigned char*)QOI_MALLOC(block_cap);
+		if (!local_buffer) {
+#pragma omp atomic
+			failed |= 1;
+		}
 
-			for (int y = start_row; y < end_row; y++) {
-				for (int x = 0; x < width; x++) {
-					int px_pos = (y * width + x) * channels;
+		/* Blocks are handed out round-robin and written in order: one thread
+		writes its finished block while the others encode the next ones */
+#pragma omp for ordered schedule(static, 1)
+		for (int block = 0; block < num_blocks; block++) {
+			size_t start_row = (size_t)block * block_height;
+			size_t rows = height - start_row < (size_t)block_height ? height - start_row : (size_t)block_height;
+			size_t local_size = 0;
 
-					if (run > 0) {
-						run--;
-					}
-					else if (local_p < chunks_len) {
-						int b1 = bytes[local_p++];
-						if (b1 == QOI_OP_RGB) {
-							px.rgba.r = bytes[local_p++];
-							px.rgba.g = bytes[local_p++];
-							px.rgba.b = bytes[local_p++];
-						}
-						else if (b1 == QOI_OP_RGBA) {
-							px.rgba.r = bytes[local_p++];
-							px.rgba.g = bytes[local_p++];
-							px.rgba.b = bytes[local_p++];
-							px.rgba.a = bytes[local_p++];
-						}
-						else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
-							px = index[b1];
-						}
-						else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
-							px.rgba.r += ((b1 >> 4) & 0x03) - 2;
-							px.rgba.g += ((b1 >> 2) & 0x03) - 2;
-							px.rgba.b += (b1 & 0x03) - 2;
-						}
-						else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
-							int b2 = bytes[local_p++];
-							int vg = (b1 & 0x3f) - 32;
-							px.rgba.r += vg - 8 + ((b2 >> 4) & 0x0f);
-							px.rgba.g += vg;
-							px.rgba.b += vg - 8 + (b2 & 0x0f);
-						}
-						else if ((b1 & QOI_MASK_2) == QOI_OP_RUN) {
-							run = (b1 & 0x3f);
-						}
-						index[QOI_COLOR_HASH(px) % 64] = px;
-					}
+			if (local_buffer) {
+				if (desc->channels == 4) {
+					local_size = qoi_encode_block(pixels + start_row * row_len, row_len, row_len, rows, local_buffer, QOI_FMT_RGBA);
+				}
+				else {
+					local_size = qoi_encode_block(pixels + start_row * row_len, row_len, row_len, rows, local_buffer, QOI_FMT_RGB);
+				}
+			}
 
-					pixels[px_pos + 0] = px.rgba.r;
-					pixels[px_pos + 1] = px.rgba.g;
-					pixels[px_pos + 2] = px.rgba.b;
-					if (channels == 4) {
-						pixels[px_pos + 3] = px.rgba.a;
-					}
+#pragma omp ordered
+			{
+				block_offsets[block] = (int64_t)write_pos;
+				if (local_buffer && fwrite(local_buffer, 1, local_size, f) != local_size) {
+#pragma omp atomic
+					failed |= 1;
 				}
+				write_pos += local_size;
 			}
 		}
-	}
-	return pixels;
-}
-
-#ifndef QOI_NO_STDIO
-#include <stdio.h>
 
-int qoi_write(const char* filename, const void* data, const qoi_desc* desc) {
-	FILE* f = fopen(filename, "wb");
-	int size, err;
-	void* encoded;
-
-	if (!f) {
-		return 0;
+		QOI_FREE(local_buffer);
 	}
 
-	encoded = qoi_encode(data, desc, &size);
-	if (!encoded) {
-		fclose(f);
-		return 0;
+	fwrite(qoi_padding, 1, sizeof(qoi_padding), f);
+
+	/* Patch in the offset table */
+	if (QOI_FSEEK64(f, p, SEEK_SET) != 0) {
+		failed = 1;
 	}
+	fwrite(block_offsets, sizeof(int64_t), num_blocks, f);
 
-	fwrite(encoded, 1, size, f);
 	fflush(f);
 	err = ferror(f);
 	fclose(f);
 
-	QOI_FREE(encoded);
-	return err ? 0 : size;
+	QOI_FREE(block_offsets);
+	if (err || failed) {
+		return 0;
+	}
+	return p + num_blocks * sizeof(int64_t) + write_pos + sizeof(qoi_padding);
 }
 
-void* qoi_read(const char* filename, qoi_desc* desc, int channels) {
+size_t qoi_write_seek_index(const char* filename, const char* index_filename, unsigned int rows) {
+	qoi_seek_builder_t b;
+	unsigned char* buf;
+	void* index;
+	size_t len, file_size = 0, index_len, written;
+	int ret = QOI_STREAM_MORE;
 	FILE* f = fopen(filename, "rb");
-	int size, bytes_read;
-	void* pixels, * data;
 
 	if (!f) {
-		return NULL;
+		return 0;
 	}
-
-	fseek(f, 0, SEEK_END);
-	size = ftell(f);
-	if (size <= 0 || fseek(f, 0, SEEK_SET) != 0) {
+	buf = (unsigned char*)QOI_MALLOC(QOI_WRITE_BUF_SIZE);
+	if (!buf || !qoi_seek_builder_begin(&b, rows)) {
+		QOI_FREE(buf);
 		fclose(f);
-		return NULL;
+		return 0;
 	}
 
-	data = QOI_MALLOC(size);
-	if (!data) {
-		fclose(f);
-		return NULL;
+	/* Read to the end, so the padding is counted in the file size */
+	while ((len = fread(buf, 1, QOI_WRITE_BUF_SIZE, f)) > 0) {
+		if (ret == QOI_STREAM_MORE) {
+			ret = qoi_seek_builder_feed(&b, buf, len);
+		}
+		file_size += len;
+	}
+	QOI_FREE(buf);
+	fclose(f);
+	if (ret != QOI_STREAM_DONE) {
+		qoi_decoder_end(&b.dec);
+		QOI_FREE(b.index);
+		return 0;
 	}
 
-	bytes_read = fread(data, 1, size, f);
+	index = qoi_seek_builder_finish(&b, file_size, &index_len);
+	if (!index) {
+		return 0;
+	}
+	f = fopen(index_filename, "wb");
+	if (!f) {
+		QOI_FREE(index);
+		return 0;
+	}
+	written = fwrite(index, 1, index_len, f);
+	fflush(f);
+	if (ferror(f)) {
+		written = 0;
+	}
 	fclose(f);
-	pixels = (bytes_read != size) ? NULL : qoi_decode(data, bytes_read, desc, channels);
-	QOI_FREE(data);
-	return pixels;
+	QOI_FREE(index);
+	return written == index_len ? written : 0;
 }
 
 #endif /* QOI_NO_STDIO */
@@ -0,0 +1,266 @@
+// Fuzz target for the decoders in qoi.h, built by QOIFuzz.vcxproj or on its own:
+//
+//   libFuzzer:   clang++ -g -O1 -fopenmp -fsanitize=fuzzer,address,undefined -DQOI_FUZZ_LIBFUZZER qoi_fuzz.cpp
+//                ./a.out corpus_dir
+//   standalone:  cl /O2 /openmp /fsanitize=address qoi_fuzz.cpp
+//                qoi_fuzz.exe <iterations> output\seq_kodim23.qoi output\par_4_kodim23.qoi ...
+//
+// The standalone build mutates the given files at random (byte flips, truncation, header and
+// offset table damage) and runs every mutant through the same checks as libFuzzer does. It
+// also encodes 16 random images per iteration.
+// qoi_decode and qoi_decode_table must agree on every input, and the block-parallel
+// decoders must reject malformed input without reading or writing out of bounds.
+// The streaming decoder is fed the input in pieces of a few bytes and has to return the
+// same rows as qoi_decode. The seek index decoders get a sidecar built from the input,
+// the same sidecar with a damaged checkpoint, and the input itself as the sidecar.
+// Every decoded image is encoded again by qoi_encode and qoi_encode_lean, which must
+// agree as well. Add -DQOI_LEAN_SLICE=4 so that the lean encoder crosses a slice
+// boundary every few pixels.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+#define QOI_IMPLEMENTATION
+#include "qoi.h"
+
+// Images claiming more pixels than this are skipped, so huge headers do not just test malloc
+#define QOI_FUZZ_MAX_PIXELS (1 << 22)
+
+// qoi_encode_lean has to produce the same bytes as qoi_encode
+static void check_encode(const void* pixels, const qoi_desc* desc) {
+    size_t len, lean_len;
+    void* encoded = qoi_encode(pixels, desc, &len);
+    void* lean = qoi_encode_lean(pixels, desc, &lean_len);
+    if (!encoded || !lean || len != lean_len || memcmp(encoded, lean, len) != 0) {
+        fprintf(stderr, "qoi_encode and qoi_encode_lean disagree (%ux%u, %d channels)\n", desc->width, desc->height, desc->channels);
+        abort();
+    }
+    free(encoded);
+    free(lean);
+}
+
+// Feed data to qoi_decoder_pull_row in pieces of 1 to 13 bytes, so that chunks and the
+// header are cut off at every possible point. qoi_decode never reads the last 8 bytes, so
+// the rows only have to match its output if the chunks ended before them.
+static void check_stream(const unsigned char* data, size_t size) {
+    qoi_decoder_t dec;
+    qoi_decoder_begin(&dec, 0);
+    std::vector<unsigned char> rows;
+    size_t pos = 0;
+    int status = QOI_STREAM_MORE;
+    while (status == QOI_STREAM_MORE && pos < size) {
+        const void* next = data + pos;
+        size_t left = min((size_t)(1 + (pos * 7 + size) % 13), size - pos);
+        size_t given = left;
+        const void* row;
+        while ((status = qoi_decoder_pull_row(&dec, &next, &left, &row)) == QOI_STREAM_ROW) {
+            rows.insert(rows.end(), (const unsigned char*)row, (const unsigned char*)row + (size_t)dec.desc.width * dec.desc.channels);
+        }
+        pos += given - left;
+    }
+    qoi_decoder_end(&dec);
+
+    if (status == QOI_STREAM_DONE && size - pos >= sizeof(qoi_padding)) {
+        qoi_desc desc;
+        void* pixels = qoi_decode(data, size, &desc, 0);
+        if (!pixels || rows.size() != (size_t)desc.width * desc.height * desc.channels ||
+            memcmp(rows.data(), pixels, rows.size()) != 0) {
+            fprintf(stderr, "qoi_decoder_pull_row and qoi_decode disagree\n");
+            abort();
+        }
+        free(pixels);
+    }
+}
+
+// The indexed decoders have to match qoi_decode with a valid sidecar and fail cleanly
+// with a damaged one
+static void check_indexed(const unsigned char* data, size_t size) {
+    qoi_desc desc;
+    free(qoi_decode_indexed(data, size, data, size, &desc, 0, 2));
+
+    unsigned char* pixels = (unsigned char*)qoi_decode(data, size, &desc, 0);
+    size_t index_len;
+    unsigned char* index = (unsigned char*)qoi_seek_index_build(data, size, 1 + (unsigned int)(size % 5), &index_len);
+    if (!pixels || !index) {
+        free(pixels);
+        free(index);
+        return;
+    }
+
+    size_t len = (size_t)desc.width * desc.height * desc.channels;
+    size_t row_len = (size_t)desc.width * desc.channels;
+    unsigned int y0 = desc.height / 3;
+    unsigned int y1 = desc.height - desc.height / 4;
+    std::vector<unsigned char> rows((size_t)(y1 - y0) * row_len + 1);
+    qoi_desc indexed_desc;
+    unsigned char* indexed = (unsigned char*)qoi_decode_indexed(data, size, index, index_len, &indexed_desc, 0, 2);
+    size_t rows_len = qoi_decode_rows_indexed_into(data, size, index, index_len, y0, y1, &indexed_desc, rows.data(), row_len, rows.size(), 0, 2);
+    if (!indexed || memcmp(indexed, pixels, len) != 0 ||
+        rows_len != (size_t)(y1 - y0) * row_len || memcmp(rows.data(), pixels + y0 * row_len, rows_len) != 0) {
+        fprintf(stderr, "qoi_decode_indexed and qoi_decode disagree\n");
+        abort();
+    }
+    free(indexed);
+
+    // Damage one byte of the sidecar, header and checkpoints alike
+    index[(size * 31) % index_len] ^= (unsigned char)(1 + size % 255);
+    free(qoi_decode_indexed(data, size, index, index_len, &indexed_desc, 0, 2));
+    qoi_decode_rows_indexed_into(data, size, index, index_len, y0, y1, &indexed_desc, rows.data(), row_len, rows.size(), 0, 2);
+    qoi_decode_rows_indexed_into(data, size, index, index_len / 2, 0, desc.height, &indexed_desc, rows.data(), row_len, rows.size(), 0, 2);
+
+    free(index);
+    free(pixels);
+}
+
+static void check_input(const unsigned char* data, size_t size) {
+    if (size >= QOI_HEADER_SIZE) {
+        size_t p = 4;
+        uint64_t width = qoi_read_32(data, &p);
+        uint64_t height = qoi_read_32(data, &p);
+        if (width * height > QOI_FUZZ_MAX_PIXELS) {
+            return;
+        }
+    }
+
+    // The table-driven decoder is the reference for the fast path of qoi_decode
+    const int channels[] = { 0, 3, 4 };
+    for (int c = 0; c < 3; c++) {
+        qoi_desc desc, table_desc;
+        void* pixels = qoi_decode(data, size, &desc, channels[c]);
+        void* table = qoi_decode_table(data, size, &table_desc, channels[c]);
+        if (!pixels != !table ||
+            (pixels && memcmp(pixels, table, (size_t)desc.width * desc.height * (channels[c] ? channels[c] : desc.channels)) != 0)) {
+            fprintf(stderr, "qoi_decode and qoi_decode_table disagree (channels %d)\n", channels[c]);
+            abort();
+        }
+        // Whatever decodes has to encode the same in one go and slice by slice
+        if (pixels && channels[c] == 0) {
+            check_encode(pixels, &desc);
+        }
+        free(pixels);
+        free(table);
+    }
+
+    // The block-parallel decoders only have to fail cleanly
+    qoi_desc desc;
+    free(qoi_decode_parallel_block_simple(data, size, &desc, 0, 2));
+    free(qoi_decode_parallel_block_numa(data, size, &desc, 4, 2));
+    free(qoi_decode_parallel(data, size, &desc, 3));
+    free(qoi_decode_thumbnail(data, size, &desc, 0, 2, 2));
+    if (qoi_read_header(data, size, &desc)) {
+        free(qoi_decode_rows(data, size, desc.height / 3, desc.height, &desc, 0, 2));
+        free(qoi_decode_rect(data, size, desc.width / 4, desc.height / 4, desc.width, desc.height, &desc, 4, 2));
+    }
+
+    check_stream(data, size);
+    check_indexed(data, size);
+}
+
+#ifdef QOI_FUZZ_LIBFUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    check_input(data, size);
+    return 0;
+}
+
+#else
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static uint64_t rng() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// Damage a copy of a valid image. Half of the edits land in the first 64 bytes, where the
+// header, block geometry and offset table are.
+static void mutate(std::vector<unsigned char>& bytes) {
+    int edits = 1 + (int)(rng() % 8);
+    for (int i = 0; i < edits && !bytes.empty(); i++) {
+        // min() may be a macro, so draw the random numbers before using them
+        size_t span = (rng() & 1) ? min(bytes.size(), (size_t)64) : bytes.size();
+        size_t pos = (size_t)(rng() % span);
+        size_t len = 1 + (size_t)(rng() % 16);
+        unsigned char value = (unsigned char)rng();
+        switch (rng() % 5) {
+            case 0: bytes[pos] ^= (unsigned char)(1 << (value % 8)); break;
+            case 1: bytes[pos] = value; break;
+            case 2: bytes.resize(pos); break;
+            case 3: bytes.erase(bytes.begin() + pos, bytes.begin() + min(bytes.size(), pos + len)); break;
+            default: bytes.insert(bytes.begin() + pos, len, value); break;
+        }
+    }
+}
+
+// Encode a small random image of noise and runs. Noise costs the most bytes per pixel,
+// and runs that end right after a slice boundary of qoi_encode_lean cost one more. Small
+// images make it likely that the last slice starts right at the end of the lean buffer.
+static void check_random_image() {
+    qoi_desc desc;
+    desc.width = 1 + (unsigned int)(rng() % 32);
+    desc.height = 1 + (unsigned int)(rng() % 8);
+    desc.channels = (rng() & 1) ? 4 : 3;
+    desc.colorspace = QOI_SRGB;
+
+    size_t px_len = (size_t)desc.width * desc.height * desc.channels;
+    std::vector<unsigned char> pixels(px_len);
+    int run_odds = 1 + (int)(rng() % 8);
+    for (size_t i = 0; i < px_len; i += desc.channels) {
+        int repeat = i > 0 && rng() % run_odds == 0;
+        for (int c = 0; c < desc.channels; c++) {
+            pixels[i + c] = repeat ? pixels[i + c - desc.channels] : (unsigned char)rng();
+        }
+    }
+    check_encode(pixels.data(), &desc);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        printf("Usage: %s <iterations> <file.qoi>...\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<std::vector<unsigned char>> seeds;
+    for (int i = 2; i < argc; i++) {
+        FILE* f = fopen(argv[i], "rb");
+        if (!f) {
+            printf("Failed to open: %s\n", argv[i]);
+            continue;
+        }
+        std::vector<unsigned char> bytes;
+        unsigned char buffer[65536];
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+            bytes.insert(bytes.end(), buffer, buffer + n);
+        }
+        fclose(f);
+        check_input(bytes.data(), bytes.size());
+        seeds.push_back(bytes);
+    }
+    if (seeds.empty()) {
+        return 1;
+    }
+
+    long iterations = atol(argv[1]);
+    for (long i = 0; i < iterations; i++) {
+        std::vector<unsigned char> bytes = seeds[rng() % seeds.size()];
+        mutate(bytes);
+        check_input(bytes.data(), bytes.size());
+        for (int j = 0; j < 16; j++) {
+            check_random_image();
+        }
+    }
+    printf("%ld mutants of %zu files, no failures\n", iterations, seeds.size());
+    return 0;
+}
+
+#endif
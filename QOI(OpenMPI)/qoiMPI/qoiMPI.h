@@ -29,6 +29,10 @@ extern "C" {
 	void* qoi_encode(const void* data, const qoi_desc* desc, int* out_len);
 	void* qoi_decode(const void* data, int size, qoi_desc* desc, int channels);
 
+	/* Decode like qoi_decode_serial, but dispatch every chunk through a table
+	indexed by its first byte instead of testing the opcodes one by one. */
+	void* qoi_decode_table(const void* data, int size, qoi_desc* desc, int channels);
+
 
 #ifdef __cplusplus
 }
@@ -63,7 +67,9 @@ extern "C" {
 	 ((unsigned int)'i') <<  8 | ((unsigned int)'f'))
 #define QOI_HEADER_SIZE 14
 
-
+/* Sizes, offsets and the MPI counts are int, so no buffer may reach 2GB.
+At 5 bytes per pixel in the worst case, 400 million pixels stay below it.
+Only the serial and OpenMP qoi.h lift this cap. */
 #define QOI_PIXELS_MAX ((unsigned int)400000000)
 
 typedef union {
@@ -88,6 +94,30 @@ static unsigned int qoi_read_32(const unsigned char* bytes, int* p) {
 	return a << 24 | b << 16 | c << 8 | d;
 }
 
+/* Read and check the header of a QOI image of size bytes into desc. Returns 0
+if the image is too short or the header is invalid. */
+static int qoi_read_header(const unsigned char* bytes, int size, qoi_desc* desc) {
+	unsigned int header_magic;
+	int p = 0;
+
+	if (size < QOI_HEADER_SIZE + (int)sizeof(qoi_padding)) {
+		return 0;
+	}
+
+	header_magic = qoi_read_32(bytes, &p);
+	desc->width = qoi_read_32(bytes, &p);
+	desc->height = qoi_read_32(bytes, &p);
+	desc->channels = bytes[p++];
+	desc->colorspace = bytes[p++];
+
+	return
+		desc->width != 0 && desc->height != 0 &&
+		desc->channels >= 3 && desc->channels <= 4 &&
+		desc->colorspace <= 1 &&
+		header_magic == QOI_MAGIC &&
+		desc->height < QOI_PIXELS_MAX / desc->width;
+}
+
 void* qoi_encode(const void* data, const qoi_desc* desc, int* out_len) {
 	int rank, numProcess;
 	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
@@ -1004,36 +1034,22 @@ void* qoi_encode_serial(const void* data, const qoi_desc* desc, int* out_len) {
 
 void* qoi_decode_serial(const void* data, int size, qoi_desc* desc, int channels) {
 	const unsigned char* bytes;
-	unsigned int header_magic;
 	unsigned char* pixels;
 	qoi_rgba_t index[64];
 	qoi_rgba_t px;
 	int px_len, chunks_len, px_pos;
-	int p = 0, run = 0;
+	int p = QOI_HEADER_SIZE, run = 0;
 
 	if (
 		data == NULL || desc == NULL ||
-		(channels != 0 && channels != 3 && channels != 4) ||
-		size < QOI_HEADER_SIZE + (int)sizeof(qoi_padding)
+		(channels != 0 && channels != 3 && channels != 4)
 		) {
 		return NULL;
 	}
 
 	bytes = (const unsigned char*)data;
 
-	header_magic = qoi_read_32(bytes, &p);
-	desc->width = qoi_read_32(bytes, &p);
-	desc->height = qoi_read_32(bytes, &p);
-	desc->channels = bytes[p++];
-	desc->colorspace = bytes[p++];
-
-	if (
-		desc->width == 0 || desc->height == 0 ||
-		desc->channels < 3 || desc->channels > 4 ||
-		desc->colorspace > 1 ||
-		header_magic != QOI_MAGIC ||
-		desc->height >= QOI_PIXELS_MAX / desc->width
-		) {
+	if (!qoi_read_header(bytes, size, desc)) {
 		return NULL;
 	}
 
@@ -1106,6 +1122,138 @@ void* qoi_decode_serial(const void* data, int size, qoi_desc* desc, int channels
 	return pixels;
 }
 
+/* Opcodes of the table-driven decoder */
+#define QOI_DT_INDEX 0
+#define QOI_DT_DIFF  1
+#define QOI_DT_LUMA  2
+#define QOI_DT_RUN   3
+#define QOI_DT_RGB   4
+#define QOI_DT_RGBA  5
+
+typedef struct {
+	unsigned char op;  /* one of QOI_DT_* */
+	unsigned char arg; /* index position for INDEX, run length - 1 for RUN */
+	signed char dr, dg, db; /* deltas for DIFF; vg - 8, vg, vg - 8 for LUMA */
+} qoi_op_t;
+
+/* Entry of qoi_op_table for the first byte b of a chunk */
+#define QOI_DT_OP_INDEX(b) { QOI_DT_INDEX, (b) & 0x3f, 0, 0, 0 }
+#define QOI_DT_OP_DIFF(b)  { QOI_DT_DIFF, (b) & 0x3f, (((b) >> 4) & 0x03) - 2, (((b) >> 2) & 0x03) - 2, ((b) & 0x03) - 2 }
+#define QOI_DT_OP_LUMA(b)  { QOI_DT_LUMA, (b) & 0x3f, ((b) & 0x3f) - 40, ((b) & 0x3f) - 32, ((b) & 0x3f) - 40 }
+#define QOI_DT_OP_RUN(b)   { QOI_DT_RUN, (b) & 0x3f, 0, 0, 0 }
+#define QOI_DT_OPS_4(m, b)  m(b), m((b) + 1), m((b) + 2), m((b) + 3)
+#define QOI_DT_OPS_16(m, b) QOI_DT_OPS_4(m, b), QOI_DT_OPS_4(m, (b) + 4), QOI_DT_OPS_4(m, (b) + 8), QOI_DT_OPS_4(m, (b) + 12)
+#define QOI_DT_OPS_64(m, b) QOI_DT_OPS_16(m, b), QOI_DT_OPS_16(m, (b) + 16), QOI_DT_OPS_16(m, (b) + 32), QOI_DT_OPS_16(m, (b) + 48)
+
+/* Decoded form of every possible first byte of a chunk */
+static const qoi_op_t qoi_op_table[256] = {
+	QOI_DT_OPS_64(QOI_DT_OP_INDEX, 0x00),
+	QOI_DT_OPS_64(QOI_DT_OP_DIFF, 0x40),
+	QOI_DT_OPS_64(QOI_DT_OP_LUMA, 0x80),
+	QOI_DT_OPS_16(QOI_DT_OP_RUN, 0xc0),
+	QOI_DT_OPS_16(QOI_DT_OP_RUN, 0xd0),
+	QOI_DT_OPS_16(QOI_DT_OP_RUN, 0xe0),
+	QOI_DT_OPS_4(QOI_DT_OP_RUN, 0xf0),
+	QOI_DT_OPS_4(QOI_DT_OP_RUN, 0xf4),
+	QOI_DT_OPS_4(QOI_DT_OP_RUN, 0xf8),
+	QOI_DT_OP_RUN(0xfc),
+	QOI_DT_OP_RUN(0xfd),
+	{ QOI_DT_RGB, 0x3e, 0, 0, 0 },
+	{ QOI_DT_RGBA, 0x3f, 0, 0, 0 }
+};
+
+void* qoi_decode_table(const void* data, int size, qoi_desc* desc, int channels) {
+	const unsigned char* bytes;
+	unsigned char* pixels;
+	qoi_rgba_t index[64];
+	qoi_rgba_t px;
+	int px_len, chunks_len, px_pos;
+	int p = QOI_HEADER_SIZE, run = 0;
+
+	if (
+		data == NULL || desc == NULL ||
+		(channels != 0 && channels != 3 && channels != 4)
+		) {
+		return NULL;
+	}
+
+	bytes = (const unsigned char*)data;
+
+	if (!qoi_read_header(bytes, size, desc)) {
+		return NULL;
+	}
+
+	if (channels == 0) {
+		channels = desc->channels;
+	}
+
+	px_len = desc->width * desc->height * channels;
+	pixels = (unsigned char*)QOI_MALLOC(px_len);
+	if (!pixels) {
+		return NULL;
+	}
+
+	QOI_ZEROARR(index);
+	px.rgba.r = 0;
+	px.rgba.g = 0;
+	px.rgba.b = 0;
+	px.rgba.a = 255;
+
+	chunks_len = size - (int)sizeof(qoi_padding);
+	for (px_pos = 0; px_pos < px_len; px_pos += channels) {
+		if (run > 0) {
+			run--;
+		}
+		else if (p < chunks_len) {
+			const qoi_op_t* op = &qoi_op_table[bytes[p++]];
+
+			switch (op->op) {
+			case QOI_DT_INDEX:
+				px = index[op->arg];
+				break;
+			case QOI_DT_DIFF:
+				px.rgba.r += op->dr;
+				px.rgba.g += op->dg;
+				px.rgba.b += op->db;
+				break;
+			case QOI_DT_LUMA: {
+				int b2 = bytes[p++];
+				px.rgba.r += op->dr + (b2 >> 4);
+				px.rgba.g += op->dg;
+				px.rgba.b += op->db + (b2 & 0x0f);
+				break;
+			}
+			case QOI_DT_RUN:
+				run = op->arg;
+				break;
+			case QOI_DT_RGB:
+				px.rgba.r = bytes[p++];
+				px.rgba.g = bytes[p++];
+				px.rgba.b = bytes[p++];
+				break;
+			default:
+				px.rgba.r = bytes[p++];
+				px.rgba.g = bytes[p++];
+				px.rgba.b = bytes[p++];
+				px.rgba.a = bytes[p++];
+				break;
+			}
+
+			index[QOI_COLOR_HASH(px) % 64] = px;
+		}
+
+		pixels[px_pos + 0] = px.rgba.r;
+		pixels[px_pos + 1] = px.rgba.g;
+		pixels[px_pos + 2] = px.rgba.b;
+
+		if (channels == 4) {
+			pixels[px_pos + 3] = px.rgba.a;
+		}
+	}
+
+	return pixels;
+}
+
 
 
 
@@ -3,10 +3,14 @@
 #include <string.h>
 #include <time.h>
 #include <Windows.h>
+#include <Psapi.h>
 #include <string>
 #include <chrono>
 #include <iomanip>
 #include <sstream>
+#include <vector>
+#include <atomic>
+#include <thread>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -30,13 +34,18 @@ std::string format_duration(double milliseconds) {
 }
 
 // Helper function to format file size
-std::string format_size(int size) {
+std::string format_size(size_t size) {
     if (size < 1024) return std::to_string(size) + " B";
     if (size < 1024 * 1024) return std::to_string(size / 1024) + " KB";
     return std::to_string(size / (1024 * 1024)) + " MB";
 }
 
-void encode_file(const std::string& input_path, const std::string& output_path) {
+// qoi_write_func that appends the encoded bytes to a FILE*
+int write_to_file(void* user, const void* data, size_t len) {
+    return fwrite(data, 1, len, (FILE*)user) == len;
+}
+
+void encode_file(const std::string& input_path, const std::string& output_path, const std::string& mode) {
     int64_t start_time, load_time, process_time, save_time;
 
     // Load image
@@ -54,27 +63,52 @@ void encode_file(const std::string& input_path, const std::string& output_path)
 
     // Encode image
     start_time = get_time_ns();
-    int encoded_size;
-    void* encoded_data = qoi_encode(data, &desc, &encoded_size);
+    size_t encoded_size = 0;
+    void* encoded_data = NULL;
+    if (mode == "stream") {
+        // Push 16 rows at a time through a 64 KB buffer straight into the file,
+        // as if the rows were still being produced
+        static unsigned char buffer[65536];
+        FILE* f = fopen(output_path.c_str(), "wb");
+        qoi_encoder_t encoder;
+        bool ok = f && qoi_encoder_begin(&encoder, &desc, 0, buffer, sizeof(buffer), write_to_file, f);
+        for (int y = 0; ok && y < height; y += 16) {
+            ok = qoi_encoder_push_rows(&encoder, data + (size_t)y * width * channels, 0, min(16, height - y)) != 0;
+        }
+        if (ok) {
+            encoded_size = qoi_encoder_finish(&encoder);
+        }
+        if (f) {
+            fclose(f);
+        }
+    }
+    else {
+        encoded_data = mode == "lean" ?
+            qoi_encode_lean(data, &desc, &encoded_size) :
+            qoi_encode(data, &desc, &encoded_size);
+    }
     process_time = get_time_ns() - start_time;
 
-    if (!encoded_data) {
+    if (encoded_size == 0) {
         printf("Failed to encode image: %s\n", input_path.c_str());
+        free(encoded_data);
         stbi_image_free(data);
         return;
     }
 
     // Save image
     start_time = get_time_ns();
-    FILE* f = fopen(output_path.c_str(), "wb");
-    if (f) {
-        fwrite(encoded_data, 1, encoded_size, f);
-        fclose(f);
+    if (encoded_data) {
+        FILE* f = fopen(output_path.c_str(), "wb");
+        if (f) {
+            fwrite(encoded_data, 1, encoded_size, f);
+            fclose(f);
+        }
     }
     save_time = get_time_ns() - start_time;
 
     // Calculate metrics
-    int original_size = width * height * channels;
+    size_t original_size = (size_t)width * height * channels;
     float compression_ratio = (1.0f - (float)encoded_size / original_size) * 100;
 
     // Format output
@@ -102,28 +136,21 @@ void encode_file(const std::string& input_path, const std::string& output_path)
 void decode_file(const std::string& input_path, const std::string& output_path) {
     int64_t start_time, load_time, process_time, save_time;
 
-    // Load QOI file
+    // Map QOI file, the pages are read in as the decoder touches them
     start_time = get_time_ns();
-    FILE* f = fopen(input_path.c_str(), "rb");
-    if (!f) {
+    size_t file_size;
+    const void* raw_data = qoi_map_file(input_path.c_str(), &file_size, QOI_MAP_SEQUENTIAL);
+    if (!raw_data) {
         printf("Failed to open QOI file: %s\n", input_path.c_str());
         return;
     }
-
-    fseek(f, 0, SEEK_END);
-    int file_size = ftell(f);
-    fseek(f, 0, SEEK_SET);
-
-    void* raw_data = malloc(file_size);
-    fread(raw_data, 1, file_size, f);
-    fclose(f);
     load_time = get_time_ns() - start_time;
 
     // Decode QOI data
     start_time = get_time_ns();
     qoi_desc desc;
     void* decoded_data = qoi_decode(raw_data, file_size, &desc, 0);
-    free(raw_data);
+    qoi_unmap_file(raw_data, file_size);
     process_time = get_time_ns() - start_time;
 
     if (!decoded_data) {
@@ -143,7 +170,7 @@ void decode_file(const std::string& input_path, const std::string& output_path)
         return;
     }
 
-    int decoded_size = desc.width * desc.height * desc.channels;
+    size_t decoded_size = (size_t)desc.width * desc.height * desc.channels;
 
     // Format output
     printf("+==============================================================================+\n");
@@ -165,11 +192,444 @@ void decode_file(const std::string& input_path, const std::string& output_path)
     free(decoded_data);
 }
 
+// Decode one image with both qoi_decode and qoi_decode_table and compare them
+void bench_decode_file(const std::string& input_path, int repeats) {
+    int width, height, channels;
+    unsigned char* data = stbi_load(input_path.c_str(), &width, &height, &channels, 0);
+    if (!data) {
+        printf("Failed to load image: %s\n", input_path.c_str());
+        return;
+    }
+
+    qoi_desc desc = { width, height, channels, QOI_SRGB };
+    size_t encoded_size;
+    void* encoded_data = qoi_encode(data, &desc, &encoded_size);
+    stbi_image_free(data);
+    if (!encoded_data) {
+        printf("Failed to encode image: %s\n", input_path.c_str());
+        return;
+    }
+
+    // Keep the best of several runs for each decoder
+    int64_t branch_time = INT64_MAX, table_time = INT64_MAX;
+    bool identical = true;
+    size_t decoded_size = (size_t)width * height * channels;
+    for (int i = 0; i < repeats; i++) {
+        qoi_desc branch_desc, table_desc;
+
+        int64_t start_time = get_time_ns();
+        void* branch_data = qoi_decode(encoded_data, encoded_size, &branch_desc, 0);
+        int64_t elapsed = get_time_ns() - start_time;
+        if (elapsed < branch_time) branch_time = elapsed;
+
+        start_time = get_time_ns();
+        void* table_data = qoi_decode_table(encoded_data, encoded_size, &table_desc, 0);
+        elapsed = get_time_ns() - start_time;
+        if (elapsed < table_time) table_time = elapsed;
+
+        if (!branch_data || !table_data || memcmp(branch_data, table_data, decoded_size) != 0) {
+            identical = false;
+        }
+        free(branch_data);
+        free(table_data);
+    }
+    free(encoded_data);
+
+    printf("| %-20.20s | %5dx%-5d | %8s ms | %8s ms | %6.2fx | %-5s |\n",
+        input_path.substr(input_path.find_last_of("/\\") + 1).c_str(), width, height,
+        format_duration(branch_time / 1e6).c_str(), format_duration(table_time / 1e6).c_str(),
+        (double)branch_time / table_time, identical ? "yes" : "NO");
+}
+
+// Drop a file from the system file cache. Windows purges the cached pages of a file when
+// it is opened without buffering, as long as no other handle to it is open.
+void evict_file_cache(const std::string& path) {
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_FLAG_NO_BUFFERING, NULL);
+    if (file != INVALID_HANDLE_VALUE) {
+        CloseHandle(file);
+    }
+}
+
+// Read the whole file into a malloc()ed buffer and decode it, like decode_file used to
+void* read_and_decode(const std::string& input_path, qoi_desc* desc) {
+    FILE* f = fopen(input_path.c_str(), "rb");
+    if (!f) {
+        return NULL;
+    }
+    _fseeki64(f, 0, SEEK_END);
+    size_t file_size = (size_t)_ftelli64(f);
+    _fseeki64(f, 0, SEEK_SET);
+
+    void* raw_data = malloc(file_size);
+    size_t bytes_read = raw_data ? fread(raw_data, 1, file_size, f) : 0;
+    fclose(f);
+    void* decoded_data = bytes_read == file_size ? qoi_decode(raw_data, file_size, desc, 0) : NULL;
+    free(raw_data);
+    return decoded_data;
+}
+
+// Decode straight from a mapping of the file
+void* map_and_decode(const std::string& input_path, qoi_desc* desc) {
+    size_t file_size;
+    const void* raw_data = qoi_map_file(input_path.c_str(), &file_size, QOI_MAP_SEQUENTIAL);
+    if (!raw_data) {
+        return NULL;
+    }
+    void* decoded_data = qoi_decode(raw_data, file_size, desc, 0);
+    qoi_unmap_file(raw_data, file_size);
+    return decoded_data;
+}
+
+// Compare reading a file into a buffer and decoding it against decoding it from a mapping,
+// once with the file evicted from the cache and as the best of 5 runs with it cached.
+void bench_map_file(const std::string& input_path) {
+    qoi_desc read_desc, map_desc;
+
+    evict_file_cache(input_path);
+    int64_t start_time = get_time_ns();
+    void* read_data = read_and_decode(input_path, &read_desc);
+    int64_t read_cold = get_time_ns() - start_time;
+
+    evict_file_cache(input_path);
+    start_time = get_time_ns();
+    void* map_data = map_and_decode(input_path, &map_desc);
+    int64_t map_cold = get_time_ns() - start_time;
+
+    if (!read_data || !map_data) {
+        printf("Failed to decode QOI file: %s\n", input_path.c_str());
+        free(read_data);
+        free(map_data);
+        return;
+    }
+    size_t decoded_size = (size_t)read_desc.width * read_desc.height * read_desc.channels;
+    bool identical = memcmp(&read_desc, &map_desc, sizeof(qoi_desc)) == 0 &&
+        memcmp(read_data, map_data, decoded_size) == 0;
+    free(read_data);
+    free(map_data);
+
+    int64_t read_warm = INT64_MAX, map_warm = INT64_MAX;
+    for (int i = 0; i < 5; i++) {
+        qoi_desc desc;
+        start_time = get_time_ns();
+        free(read_and_decode(input_path, &desc));
+        int64_t elapsed = get_time_ns() - start_time;
+        if (elapsed < read_warm) read_warm = elapsed;
+
+        start_time = get_time_ns();
+        free(map_and_decode(input_path, &desc));
+        elapsed = get_time_ns() - start_time;
+        if (elapsed < map_warm) map_warm = elapsed;
+    }
+
+    printf("| %-20.20s | %5dx%-5d | %8s ms | %8s ms | %8s ms | %8s ms | %-5s |\n",
+        input_path.substr(input_path.find_last_of("/\\") + 1).c_str(), read_desc.width, read_desc.height,
+        format_duration(read_cold / 1e6).c_str(), format_duration(map_cold / 1e6).c_str(),
+        format_duration(read_warm / 1e6).c_str(), format_duration(map_warm / 1e6).c_str(),
+        identical ? "yes" : "NO");
+}
+
+// Compare when the first row is available: reading the whole file and decoding it with
+// qoi_decode, against feeding the file to qoi_decoder_t in 64 KB reads as it is read.
+void bench_first_row_file(const std::string& input_path) {
+    // Whole file, then qoi_decode: the first row is ready when everything is
+    int64_t start_time = get_time_ns();
+    size_t file_size;
+    const void* raw_data = qoi_map_file(input_path.c_str(), &file_size, QOI_MAP_POPULATE);
+    if (!raw_data) {
+        printf("Failed to open QOI file: %s\n", input_path.c_str());
+        return;
+    }
+    qoi_desc desc;
+    unsigned char* decoded_data = (unsigned char*)qoi_decode(raw_data, file_size, &desc, 0);
+    qoi_unmap_file(raw_data, file_size);
+    int64_t whole_time = get_time_ns() - start_time;
+    if (!decoded_data) {
+        printf("Failed to decode QOI file: %s\n", input_path.c_str());
+        return;
+    }
+
+    // Streaming: rows come out while the file is still being read
+    static unsigned char buffer[65536];
+    int64_t first_row_time = 0;
+    unsigned int rows = 0;
+    bool identical = true;
+    qoi_decoder_t decoder;
+    qoi_decoder_begin(&decoder, 0);
+    start_time = get_time_ns();
+    FILE* f = fopen(input_path.c_str(), "rb");
+    int status = QOI_STREAM_MORE;
+    while (f && status != QOI_STREAM_DONE && status != QOI_STREAM_ERROR) {
+        const void* input = buffer;
+        size_t input_size = fread(buffer, 1, sizeof(buffer), f);
+        if (input_size == 0) {
+            break;
+        }
+        const void* row;
+        while ((status = qoi_decoder_pull_row(&decoder, &input, &input_size, &row)) == QOI_STREAM_ROW) {
+            if (rows == 0) {
+                first_row_time = get_time_ns() - start_time;
+            }
+            size_t row_len = (size_t)desc.width * desc.channels;
+            if (memcmp(row, decoded_data + (size_t)rows * row_len, row_len) != 0) {
+                identical = false;
+            }
+            rows++;
+        }
+    }
+    int64_t stream_time = get_time_ns() - start_time;
+    if (f) {
+        fclose(f);
+    }
+    qoi_decoder_end(&decoder);
+    free(decoded_data);
+
+    printf("| %-20.20s | %5dx%-5d | %8s ms | %8s ms | %8s ms | %-5s |\n",
+        input_path.substr(input_path.find_last_of("/\\") + 1).c_str(), desc.width, desc.height,
+        format_duration(whole_time / 1e6).c_str(), format_duration(first_row_time / 1e6).c_str(),
+        format_duration(stream_time / 1e6).c_str(), identical && rows == desc.height ? "yes" : "NO");
+}
+
+// One image on its way through the pipeline modes
+struct PipelineItem {
+    std::string input_path;
+    std::string output_path;
+    void* input;            // stbi_load() pixels, or the mapped QOI file
+    size_t input_size;
+    void* output;           // encoded QOI data, or decoded pixels
+    size_t output_size;
+    size_t charged;         // bytes of this image counted against the budget
+    qoi_desc desc;
+};
+
+// Single-producer single-consumer ring between two pipeline stages. The producer only
+// moves tail and the consumer only moves head, so neither side takes a lock.
+struct PipelineQueue {
+    static const size_t capacity = 16;
+    PipelineItem* items[capacity];
+    std::atomic<size_t> head{ 0 };
+    std::atomic<size_t> tail{ 0 };
+
+    void push(PipelineItem* item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        while (t - head.load(std::memory_order_acquire) == capacity) {
+            std::this_thread::yield();
+        }
+        items[t % capacity] = item;
+        tail.store(t + 1, std::memory_order_release);
+    }
+
+    // NULL marks the end of the stream
+    PipelineItem* pop() {
+        size_t h = head.load(std::memory_order_relaxed);
+        while (tail.load(std::memory_order_acquire) == h) {
+            std::this_thread::yield();
+        }
+        PipelineItem* item = items[h % capacity];
+        head.store(h + 1, std::memory_order_release);
+        return item;
+    }
+};
+
+struct PipelineTimes {
+    double load_ms;
+    double process_ms;
+    double store_ms;
+    double wall_ms;
+    int failed;
+};
+
+// Loaded but not yet written images may hold at most this many bytes, unless a single
+// image is larger on its own
+static const size_t pipeline_budget = (size_t)256 << 20;
+
+// Bytes the image will take once loaded, known before it is read
+static size_t pipeline_input_size(const PipelineItem* item, bool decode) {
+    if (decode) {
+        struct stat file_status;
+        return stat(item->input_path.c_str(), &file_status) < 0 ? 0 : (size_t)file_status.st_size;
+    }
+    int width, height, channels;
+    if (!stbi_info(item->input_path.c_str(), &width, &height, &channels)) {
+        return 0;
+    }
+    return (size_t)width * height * channels;
+}
+
+static void pipeline_load(PipelineItem* item, bool decode) {
+    item->output = NULL;
+    item->output_size = 0;
+    if (decode) {
+        // Fault all pages in here, so the decoder does not wait on the disk
+        item->input = (void*)qoi_map_file(item->input_path.c_str(), &item->input_size, QOI_MAP_POPULATE);
+        return;
+    }
+    int width, height, channels;
+    item->input = stbi_load(item->input_path.c_str(), &width, &height, &channels, 0);
+    if (item->input) {
+        item->desc = { (unsigned int)width, (unsigned int)height, (unsigned char)channels, QOI_SRGB };
+        item->input_size = (size_t)width * height * channels;
+    }
+}
+
+static void pipeline_process(PipelineItem* item, bool decode) {
+    if (!item->input) {
+        return;
+    }
+    if (decode) {
+        item->output = qoi_decode(item->input, item->input_size, &item->desc, 0);
+        if (item->output) {
+            item->output_size = (size_t)item->desc.width * item->desc.height * item->desc.channels;
+        }
+        qoi_unmap_file(item->input, item->input_size);
+    }
+    else {
+        item->output = qoi_encode(item->input, &item->desc, &item->output_size);
+        stbi_image_free(item->input);
+    }
+    item->input = NULL;
+}
+
+static bool pipeline_store(PipelineItem* item, bool decode) {
+    if (!item->output) {
+        return false;
+    }
+    bool ok;
+    if (decode) {
+        ok = stbi_write_png(item->output_path.c_str(), item->desc.width, item->desc.height,
+            item->desc.channels, item->output, item->desc.width * item->desc.channels) != 0;
+    }
+    else {
+        FILE* f = fopen(item->output_path.c_str(), "wb");
+        ok = f && fwrite(item->output, 1, item->output_size, f) == item->output_size;
+        if (f) {
+            fclose(f);
+        }
+    }
+    free(item->output);
+    item->output = NULL;
+    return ok;
+}
+
+// Load, encode (or decode) and write every item, either one stage after another on this
+// thread or with the reader and the writer on threads of their own, handing the images
+// over through two PipelineQueues. Each stage adds up only the time it spends working.
+PipelineTimes run_pipeline(std::vector<PipelineItem>& items, bool decode, bool overlapped) {
+    PipelineTimes times = {};
+    int64_t start_time = get_time_ns();
+
+    if (!overlapped) {
+        for (auto& item : items) {
+            int64_t t0 = get_time_ns();
+            pipeline_load(&item, decode);
+            int64_t t1 = get_time_ns();
+            pipeline_process(&item, decode);
+            int64_t t2 = get_time_ns();
+            times.failed += !pipeline_store(&item, decode);
+            times.load_ms += (t1 - t0) / 1e6;
+            times.process_ms += (t2 - t1) / 1e6;
+            times.store_ms += (get_time_ns() - t2) / 1e6;
+        }
+        times.wall_ms = (get_time_ns() - start_time) / 1e6;
+        return times;
+    }
+
+    PipelineQueue loaded, processed;
+    std::atomic<size_t> in_flight{ 0 };
+
+    std::thread reader([&]() {
+        for (auto& item : items) {
+            // Wait for the writer to free enough of the budget
+            item.charged = pipeline_input_size(&item, decode);
+            while (in_flight.load() != 0 && in_flight.load() + item.charged > pipeline_budget) {
+                std::this_thread::yield();
+            }
+            in_flight += item.charged;
+
+            int64_t t0 = get_time_ns();
+            pipeline_load(&item, decode);
+            times.load_ms += (get_time_ns() - t0) / 1e6;
+            loaded.push(&item);
+        }
+        loaded.push(NULL);
+    });
+
+    std::thread writer([&]() {
+        while (PipelineItem* item = processed.pop()) {
+            int64_t t0 = get_time_ns();
+            times.failed += !pipeline_store(item, decode);
+            times.store_ms += (get_time_ns() - t0) / 1e6;
+            in_flight -= item->charged;
+        }
+    });
+
+    while (PipelineItem* item = loaded.pop()) {
+        int64_t t0 = get_time_ns();
+        pipeline_process(item, decode);
+        times.process_ms += (get_time_ns() - t0) / 1e6;
+
+        // The input is gone and the output waits for the writer
+        in_flight += item->output_size;
+        in_flight -= item->charged;
+        item->charged = item->output_size;
+        processed.push(item);
+    }
+    processed.push(NULL);
+
+    reader.join();
+    writer.join();
+    times.wall_ms = (get_time_ns() - start_time) / 1e6;
+    return times;
+}
+
+// Run a folder through load, encode and write (decode: map, decode and stbi_write_png) one
+// stage after another and then overlapped. The stage times come from the first run, so
+// the pipelined wall time can be set against the slowest stage on its own.
+void benchmark_pipeline(const char* input_dir, const char* output_dir, bool decode) {
+    WIN32_FIND_DATAA findData;
+    char search_path[MAX_PATH];
+    std::vector<PipelineItem> items;
+
+    sprintf_s(search_path, decode ? "%s\\*.qoi" : "%s\\*.*", input_dir);
+    HANDLE hFind = FindFirstFileA(search_path, &findData);
+    if (hFind != INVALID_HANDLE_VALUE) {
+        do {
+            if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+                char* ext = strrchr(findData.cFileName, '.');
+                if (ext && (decode || _stricmp(ext, ".png") == 0 || _stricmp(ext, ".jpg") == 0 || _stricmp(ext, ".jpeg") == 0)) {
+                    char input_path[MAX_PATH];
+                    char output_path[MAX_PATH];
+                    sprintf_s(input_path, "%s\\%s", input_dir, findData.cFileName);
+                    sprintf_s(output_path, decode ? "%s\\pipe_%.*s.png" : "%s\\pipe_%.*s.qoi", output_dir,
+                        (int)(ext - findData.cFileName), findData.cFileName);
+                    PipelineItem item = {};
+                    item.input_path = input_path;
+                    item.output_path = output_path;
+                    items.push_back(item);
+                }
+            }
+        } while (FindNextFileA(hFind, &findData));
+        FindClose(hFind);
+    }
+
+    printf("Pipeline %s: %zu images\n", decode ? "decode" : "encode", items.size());
+    PipelineTimes serial = run_pipeline(items, decode, false);
+    PipelineTimes overlapped = run_pipeline(items, decode, true);
+
+    printf("+-------------+-------------+-------------+-------------+-------------+--------+\n");
+    printf("| Load        | %-11s | Write       | One by one  | Pipelined   | Failed |\n", decode ? "Decode" : "Encode");
+    printf("+-------------+-------------+-------------+-------------+-------------+--------+\n");
+    printf("| %8.2f ms | %8.2f ms | %8.2f ms | %8.2f ms | %8.2f ms | %6d |\n",
+        serial.load_ms, serial.process_ms, serial.store_ms, serial.wall_ms, overlapped.wall_ms,
+        serial.failed + overlapped.failed);
+    printf("+-------------+-------------+-------------+-------------+-------------+--------+\n");
+}
+
 int main(int argc, char* argv[]) {
     setvbuf(stdout, NULL, _IONBF, 0);  // Disable output buffering
 
     if (argc != 4) {
-        printf("Usage: %s [encode|decode] <input_dir> <output_dir>\n", argv[0]);
+        printf("Usage: %s [encode|lean|stream|decode|firstrow|mapread|bench|pipeline|pipedecode] <input_dir> <output_dir>\n", argv[0]);
         return 1;
     }
 
@@ -184,7 +644,7 @@ int main(int argc, char* argv[]) {
     HANDLE hFind;
     char search_path[MAX_PATH];
 
-    if (strcmp(mode, "encode") == 0) {
+    if (strcmp(mode, "encode") == 0 || strcmp(mode, "lean") == 0 || strcmp(mode, "stream") == 0) {
         sprintf_s(search_path, "%s\\*.*", input_dir);
         hFind = FindFirstFileA(search_path, &findData);
         if (hFind != INVALID_HANDLE_VALUE) {
@@ -196,12 +656,19 @@ int main(int argc, char* argv[]) {
                         char output_path[MAX_PATH];
                         sprintf_s(input_path, "%s\\%s", input_dir, findData.cFileName);
                         sprintf_s(output_path, "%s\\%.*s.qoi", output_dir, (int)(ext - findData.cFileName), findData.cFileName);
-                        encode_file(input_path, output_path);
+                        encode_file(input_path, output_path, mode);
                     }
                 }
             } while (FindNextFileA(hFind, &findData));
             FindClose(hFind);
         }
+
+        // Compare the peaks of "encode" and "lean" runs over the same images
+        PROCESS_MEMORY_COUNTERS counters;
+        if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+            printf("Peak working set: %s, peak commit: %s\n",
+                format_size(counters.PeakWorkingSetSize).c_str(), format_size(counters.PeakPagefileUsage).c_str());
+        }
     }
     else if (strcmp(mode, "decode") == 0) {
         sprintf_s(search_path, "%s\\*.qoi", input_dir);
@@ -217,8 +684,68 @@ int main(int argc, char* argv[]) {
             FindClose(hFind);
         }
     }
+    else if (strcmp(mode, "firstrow") == 0) {
+        // Time to first row of qoi_decode against the streaming qoi_decoder_t
+        printf("+----------------------+-------------+-------------+-------------+-------------+-------+\n");
+        printf("| Image                | Dimensions  | Whole file  | First row   | Stream all  | Match |\n");
+        printf("+----------------------+-------------+-------------+-------------+-------------+-------+\n");
+        sprintf_s(search_path, "%s\\*.qoi", input_dir);
+        hFind = FindFirstFileA(search_path, &findData);
+        if (hFind != INVALID_HANDLE_VALUE) {
+            do {
+                char input_path[MAX_PATH];
+                sprintf_s(input_path, "%s\\%s", input_dir, findData.cFileName);
+                bench_first_row_file(input_path);
+            } while (FindNextFileA(hFind, &findData));
+            FindClose(hFind);
+        }
+        printf("+----------------------+-------------+-------------+-------------+-------------+-------+\n");
+    }
+    else if (strcmp(mode, "mapread") == 0) {
+        // Compare fread into a buffer with decoding from a mapping, with cold and warm cache
+        printf("+----------------------+-------------+-------------+-------------+-------------+-------------+-------+\n");
+        printf("| Image                | Dimensions  | Read cold   | Map cold    | Read warm   | Map warm    | Match |\n");
+        printf("+----------------------+-------------+-------------+-------------+-------------+-------------+-------+\n");
+        sprintf_s(search_path, "%s\\*.qoi", input_dir);
+        hFind = FindFirstFileA(search_path, &findData);
+        if (hFind != INVALID_HANDLE_VALUE) {
+            do {
+                char input_path[MAX_PATH];
+                sprintf_s(input_path, "%s\\%s", input_dir, findData.cFileName);
+                bench_map_file(input_path);
+            } while (FindNextFileA(hFind, &findData));
+            FindClose(hFind);
+        }
+        printf("+----------------------+-------------+-------------+-------------+-------------+-------------+-------+\n");
+    }
+    else if (strcmp(mode, "bench") == 0) {
+        // Compare the branching and the table-driven decoder on the input images
+        printf("+----------------------+-------------+-------------+-------------+---------+-------+\n");
+        printf("| Image                | Dimensions  | qoi_decode  | table       | Speedup | Match |\n");
+        printf("+----------------------+-------------+-------------+-------------+---------+-------+\n");
+        sprintf_s(search_path, "%s\\*.*", input_dir);
+        hFind = FindFirstFileA(search_path, &findData);
+        if (hFind != INVALID_HANDLE_VALUE) {
+            do {
+                if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+                    char* ext = strrchr(findData.cFileName, '.');
+                    if (ext && (_stricmp(ext, ".png") == 0 || _stricmp(ext, ".jpg") == 0 || _stricmp(ext, ".jpeg") == 0)) {
+                        char input_path[MAX_PATH];
+                        sprintf_s(input_path, "%s\\%s", input_dir, findData.cFileName);
+                        bench_decode_file(input_path, 5);
+                    }
+                }
+            } while (FindNextFileA(hFind, &findData));
+            FindClose(hFind);
+        }
+        printf("+----------------------+-------------+-------------+-------------+---------+-------+\n");
+    }
+    else if (strcmp(mode, "pipeline") == 0 || strcmp(mode, "pipedecode") == 0) {
+        // Load, codec and write one after another against the three stages overlapped
+        benchmark_pipeline(input_dir, output_dir, strcmp(mode, "pipedecode") == 0);
+    }
     else {
-        printf("Invalid mode. Use 'encode' or 'decode'.\n");
+        printf("Invalid mode. Use 'encode', 'lean', 'stream', 'decode', 'firstrow', 'mapread', 'bench', 'pipeline' or 'pipedecode'.\n");
         return 1;
     }
 
@@ -45,18 +45,25 @@ This library provides the following functions;
 - qoi_decode  -- decode the raw bytes of a QOI image from memory
 - qoi_write   -- encode and write a QOI file
 - qoi_encode  -- encode an rgba buffer into a QOI image in memory
+- qoi_encode_lean -- like qoi_encode, but grows an exactly sized result
 
 See the function declaration below for the signature and more information.
 
 If you don't want/need the qoi_read and qoi_write functions, you can define
 QOI_NO_STDIO before including this library.
 
-This library uses malloc() and free(). To supply your own malloc implementation
-you can define QOI_MALLOC and QOI_FREE before including this library.
+This library uses malloc(), realloc() and free(). To supply your own malloc
+implementation you can define QOI_MALLOC, QOI_REALLOC and QOI_FREE before
+including this library.
 
 This library uses memset() to zero-initialize the index. To supply your own
 implementation you can define QOI_ZEROARR before including this library.
 
+The encoder scans runs of identical pixels with SSE2 (or AVX2, when compiled
+with /arch:AVX2 or -mavx2) and emits the resulting QOI_OP_RUN chunks in
+batches. The output is byte-identical to the scalar encoder. To force the
+scalar path you can define QOI_NO_SIMD before including this library.
+
 
 -- Data Format
 
@@ -216,6 +223,8 @@ Header - Public functions */
 
 #define _CRT_SECURE_NO_WARNINGS
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -242,6 +251,24 @@ extern "C" {
 		unsigned char colorspace;
 	} qoi_desc;
 
+
+	/* Memory layouts of raw pixels for the _fmt functions. The swizzle is done
+	per pixel inside the encode and decode loops, so no separate pass over the
+	image is needed. QOI_FMT_RGB and QOI_FMT_RGBA equal the channel counts 3
+	and 4, so a channel count is also a valid format.
+
+	QOI_FMT_RGBA_PREMUL (RGBA with the colors multiplied by alpha) can only be
+	decoded to, since undoing the multiplication on encode would be lossy. */
+
+#define QOI_FMT_RGB         3
+#define QOI_FMT_RGBA        4
+#define QOI_FMT_BGR         5
+#define QOI_FMT_BGRA        6
+#define QOI_FMT_ARGB        7
+#define QOI_FMT_RGBA_PREMUL 8
+
+#define QOI_FMT_CHANNELS(fmt) ((fmt) == QOI_FMT_RGB || (fmt) == QOI_FMT_BGR ? 3 : 4)
+
 #ifndef QOI_NO_STDIO
 
 	/* Encode raw RGB or RGBA pixels into a QOI image and write it to the file
@@ -251,7 +278,7 @@ extern "C" {
 	The function returns 0 on failure (invalid parameters, or fopen or malloc
 	failed) or the number of bytes written on success. */
 
-	int qoi_write(const char* filename, const void* data, const qoi_desc* desc);
+	size_t qoi_write(const char* filename, const void* data, const qoi_desc* desc);
 
 
 	/* Read and decode a QOI image from the file system. If channels is 0, the
@@ -266,6 +293,25 @@ extern "C" {
 
 	void* qoi_read(const char* filename, qoi_desc* desc, int channels);
 
+
+	/* Map a whole file read-only into memory, so it can be decoded in place
+	without copying it into a buffer first; qoi_read does this itself. flags is
+	a combination of QOI_MAP_SEQUENTIAL, to hint that the file is read front to
+	back, and QOI_MAP_POPULATE, to fault in all pages up front instead of one
+	at a time during decoding.
+
+	qoi_map_file returns NULL on failure (no such file, empty file, or the
+	file cannot be mapped, e.g. a pipe, or QOI_NO_MMAP is defined) or the
+	mapped data, whose size is stored in *size. The mapping must be released
+	with qoi_unmap_file. */
+
+	#define QOI_MAP_SEQUENTIAL 1
+	#define QOI_MAP_POPULATE   2
+
+	const void* qoi_map_file(const char* filename, size_t* size, int flags);
+
+	void qoi_unmap_file(const void* data, size_t size);
+
 #endif /* QOI_NO_STDIO */
 
 
@@ -277,7 +323,7 @@ extern "C" {
 
 	The returned qoi data should be free()d after use. */
 
-	void* qoi_encode(const void* data, const qoi_desc* desc, int* out_len);
+	void* qoi_encode(const void* data, const qoi_desc* desc, size_t* out_len);
 
 
 	/* Decode a QOI image from memory.
@@ -288,7 +334,182 @@ extern "C" {
 
 	The returned pixel data should be free()d after use. */
 
-	void* qoi_decode(const void* data, int size, qoi_desc* desc, int channels);
+	void* qoi_decode(const void* data, size_t size, qoi_desc* desc, int channels);
+
+
+	/* Encode raw RGB or RGBA pixels into a QOI image in memory, like qoi_encode,
+	but without allocating the worst case up front. The image is encoded in
+	slices of QOI_LEAN_SLICE pixels into a buffer that starts at a quarter of
+	the raw size and grows by half when needed; it is shrunk to the encoded
+	size at the end. This trades a few reallocs for a much smaller peak
+	footprint on large images.
+
+	Arguments and return value are the same as for qoi_encode. */
+
+	void* qoi_encode_lean(const void* data, const qoi_desc* desc, size_t* out_len);
+
+
+	/* Return the worst-case size in bytes of the QOI image qoi_encode would
+	produce for the given qoi_desc, or 0 if the description is invalid. */
+
+	size_t qoi_max_encoded_size(const qoi_desc* desc);
+
+
+	/* Encode raw RGB or RGBA pixels into a caller-supplied buffer instead of a
+	freshly malloc()ed one. out_cap must be at least qoi_max_encoded_size(desc),
+	so one buffer of the largest expected size can be reused for many images.
+
+	The function returns 0 on failure (invalid parameters or out_cap too small)
+	or the size in bytes of the encoded data on success. */
+
+	size_t qoi_encode_into(const void* data, const qoi_desc* desc, void* out, size_t out_cap);
+
+
+	/* Decode a QOI image from memory into a caller-supplied pixel buffer of
+	pixels_cap bytes, which must hold width * height * channels bytes.
+
+	The function returns 0 on failure (invalid data or pixels_cap too small) or
+	the number of pixel bytes written on success. Whenever the header is valid,
+	the qoi_desc struct is filled, even if pixels_cap was too small, so the
+	caller can grow the buffer and try again. */
+
+	size_t qoi_decode_into(const void* data, size_t size, qoi_desc* desc, void* pixels, size_t pixels_cap, int channels);
+
+
+	/* Variants of the functions above for pixels that are not densely packed,
+	e.g. framebuffers, padded surfaces or a sub-rectangle of a larger image.
+	stride is the distance in bytes from the start of one row to the start of
+	the next; it must be at least width * channels, or 0 for densely packed
+	rows. The padding between rows is neither read nor written.
+
+	For qoi_decode_into_stride, pixels_cap must be at least
+	(height - 1) * stride + width * channels; that number of bytes is returned
+	on success. */
+
+	void* qoi_encode_stride(const void* data, size_t stride, const qoi_desc* desc, size_t* out_len);
+
+	size_t qoi_encode_into_stride(const void* data, size_t stride, const qoi_desc* desc, void* out, size_t out_cap);
+
+	size_t qoi_decode_into_stride(const void* data, size_t size, qoi_desc* desc, void* pixels, size_t stride, size_t pixels_cap, int channels);
+
+
+	/* Variants of the strided functions above that read or write pixels laid out
+	as one of the QOI_FMT_* formats, e.g. QOI_FMT_BGRA. For encoding, the
+	format must have desc->channels channels; 0 means RGB or RGBA as given by
+	desc->channels. For decoding, 0 means the channel count from the file
+	header. qoi_decode_fmt allocates a densely packed buffer. */
+
+	void* qoi_encode_fmt(const void* data, size_t stride, int fmt, const qoi_desc* desc, size_t* out_len);
+
+	size_t qoi_encode_into_fmt(const void* data, size_t stride, int fmt, const qoi_desc* desc, void* out, size_t out_cap);
+
+	void* qoi_decode_fmt(const void* data, size_t size, qoi_desc* desc, int fmt);
+
+	size_t qoi_decode_into_fmt(const void* data, size_t size, qoi_desc* desc, void* pixels, size_t stride, size_t pixels_cap, int fmt);
+
+
+	/* Push-style streaming encoder, for images that arrive a few rows at a time,
+	e.g. scanlines from a camera or renderer. qoi_encoder_begin writes the
+	header, every qoi_encoder_push_rows call encodes the next n rows (stride
+	and fmt as for qoi_encode_into_fmt) and qoi_encoder_finish ends the image
+	once all desc->height rows have been pushed. The index, previous pixel and
+	pending run are kept in the qoi_encoder_t between calls, so the output is
+	byte for byte the same as qoi_encode's.
+
+	The encoded bytes go to buf, which must hold at least QOI_STREAM_BUF_MIN
+	bytes. If write is NULL, buf receives the whole image, and pushing or
+	finishing fails only once the image does not fit into buf_cap bytes;
+	qoi_max_encoded_size(desc) bytes are always enough. Otherwise buf is only a staging area that is handed to
+	write(user, buf, len) whenever it fills up and at the end; write returns 0
+	to abort encoding. Either way memory stays at buf_cap plus the rows the
+	caller holds.
+
+	qoi_encoder_begin and qoi_encoder_push_rows return 1 on success and 0 on
+	failure; after a failure every further call fails. qoi_encoder_finish
+	returns the size in bytes of the encoded image, or 0 on failure. The
+	fields of qoi_encoder_t are private. */
+
+	#define QOI_STREAM_BUF_MIN 64
+
+	typedef int (*qoi_write_func)(void* user, const void* data, size_t len);
+
+	typedef struct {
+		qoi_desc desc;
+		int fmt;
+		int failed;
+		unsigned int rows_left;
+		unsigned char* buf;
+		size_t buf_cap;
+		size_t buf_len;
+		size_t written;
+		qoi_write_func write;
+		void* user;
+		unsigned int index[64];
+		unsigned int px_prev;
+		int run;
+	} qoi_encoder_t;
+
+	int qoi_encoder_begin(qoi_encoder_t* enc, const qoi_desc* desc, int fmt, void* buf, size_t buf_cap, qoi_write_func write, void* user);
+
+	int qoi_encoder_push_rows(qoi_encoder_t* enc, const void* rows, size_t stride, unsigned int n);
+
+	size_t qoi_encoder_finish(qoi_encoder_t* enc);
+
+
+	/* Pull-style streaming decoder, for QOI data that arrives in fragments of
+	any size, e.g. from a socket or pipe. After qoi_decoder_begin, call
+	qoi_decoder_pull_row with the input at hand: it consumes bytes from *data,
+	advancing *data and decreasing *size, until the next row is complete, and
+	returns it as soon as it is, without waiting for the rest of the image.
+	A chunk cut off at the end of a fragment is held back until the next one.
+
+	qoi_decoder_pull_row returns
+	  QOI_STREAM_ROW   a row was decoded; *row points to width * channels
+	                   bytes in the format fmt (0 = channels from the file),
+	                   valid until the next call. Unused input is left in
+	                   *data and *size for the next call.
+	  QOI_STREAM_MORE  all of the input was used up; call again with more.
+	  QOI_STREAM_DONE  all rows have been returned.
+	  QOI_STREAM_ERROR the header is invalid or malloc failed.
+
+	desc is filled in as soon as the header has been read. qoi_decoder_end
+	frees the row buffer. The other fields of qoi_decoder_t are private. */
+
+	#define QOI_STREAM_ERROR -1
+	#define QOI_STREAM_MORE   0
+	#define QOI_STREAM_ROW    1
+	#define QOI_STREAM_DONE   2
+
+	typedef struct {
+		qoi_desc desc;
+		int fmt;
+		int failed;
+		unsigned int rows_left;
+		unsigned char* row;
+		size_t row_len;
+		size_t px_pos;
+		unsigned char carry[14]; /* the header, then the start of a cut off chunk */
+		size_t carry_len;
+		unsigned int index[64];
+		unsigned int px;
+		int run;
+	} qoi_decoder_t;
+
+	int qoi_decoder_begin(qoi_decoder_t* dec, int fmt);
+
+	int qoi_decoder_pull_row(qoi_decoder_t* dec, const void** data, size_t* size, const void** row);
+
+	void qoi_decoder_end(qoi_decoder_t* dec);
+
+
+	/* Decode a QOI image from memory, like qoi_decode, but dispatch every chunk
+	through a 256-entry table indexed by its first byte instead of a chain of
+	tag compares. The table holds the opcode, the precomputed DIFF deltas, LUMA
+	green biases, index positions and run lengths.
+
+	Arguments, return value and output are the same as for qoi_decode. */
+
+	void* qoi_decode_table(const void* data, size_t size, qoi_desc* desc, int channels);
 
 
 #ifdef __cplusplus
@@ -301,6 +522,12 @@ extern "C" {
 Implementation */
 
 #ifdef QOI_IMPLEMENTATION
+/* fseeko, ftello and posix_madvise are POSIX, which strict modes such as
+-std=c99 only declare when asked to. This only works if qoi.h comes before
+the first system header; otherwise define _POSIX_C_SOURCE yourself. */
+#if defined(__STRICT_ANSI__) && !defined(_WIN32) && !defined(_POSIX_C_SOURCE) && !defined(_GNU_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
 #include <stdlib.h>
 #include <string.h>
 
@@ -308,10 +535,27 @@ Implementation */
 #define QOI_MALLOC(sz) malloc(sz)
 #define QOI_FREE(p)    free(p)
 #endif
+#ifndef QOI_REALLOC
+#define QOI_REALLOC(p, sz) realloc(p, sz)
+#endif
 #ifndef QOI_ZEROARR
 #define QOI_ZEROARR(a) memset((a),0,sizeof(a))
 #endif
 
+#ifndef QOI_NO_SIMD
+#if defined(__AVX2__)
+#define QOI_AVX2
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QOI_SSE2
+#include <emmintrin.h>
+#endif
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 #define QOI_OP_INDEX  0x00 /* 00xxxxxx */
 #define QOI_OP_DIFF   0x40 /* 01xxxxxx */
 #define QOI_OP_LUMA   0x80 /* 10xxxxxx */
@@ -327,11 +571,12 @@ Implementation */
 	 ((unsigned int)'i') <<  8 | ((unsigned int)'f'))
 #define QOI_HEADER_SIZE 14
 
-/* 2GB is the max file size that this implementation can safely handle. We guard
-against anything larger than that, assuming the worst case with 5 bytes per
-pixel, rounded down to a nice clean value. 400 million pixels ought to be
-enough for anybody. */
-#define QOI_PIXELS_MAX ((unsigned int)400000000)
+/* All sizes and positions are size_t, so the only limit is the address space.
+We guard against images whose worst case encoding (5 bytes per pixel plus
+header, padding and block table) would not fit into a size_t: on 64-bit builds
+that is far beyond anything malloc can return, on 32-bit builds it is about
+500 million pixels. */
+#define QOI_PIXELS_MAX (((size_t)-1) / 8)
 
 typedef union {
 	struct { unsigned char r, g, b, a; } rgba;
@@ -340,14 +585,14 @@ typedef union {
 
 static const unsigned char qoi_padding[8] = { 0,0,0,0,0,0,0,1 };
 
-static void qoi_write_32(unsigned char* bytes, int* p, unsigned int v) {
+static void qoi_write_32(unsigned char* bytes, size_t* p, unsigned int v) {
 	bytes[(*p)++] = (0xff000000 & v) >> 24;
 	bytes[(*p)++] = (0x00ff0000 & v) >> 16;
 	bytes[(*p)++] = (0x0000ff00 & v) >> 8;
 	bytes[(*p)++] = (0x000000ff & v);
 }
 
-static unsigned int qoi_read_32(const unsigned char* bytes, int* p) {
+static unsigned int qoi_read_32(const unsigned char* bytes, size_t* p) {
 	unsigned int a = bytes[(*p)++];
 	unsigned int b = bytes[(*p)++];
 	unsigned int c = bytes[(*p)++];
@@ -355,71 +600,234 @@ static unsigned int qoi_read_32(const unsigned char* bytes, int* p) {
 	return a << 24 | b << 16 | c << 8 | d;
 }
 
-void* qoi_encode(const void* data, const qoi_desc* desc, int* out_len) {
-	int i, max_size, p, run;
-	int px_len, px_end, px_pos, channels;
-	unsigned char* bytes;
-	const unsigned char* pixels;
-	qoi_rgba_t index[64];
-	qoi_rgba_t px, px_prev;
+#if defined(QOI_SSE2) || defined(QOI_AVX2)
+static int qoi_ctz(unsigned int v) {
+#ifdef _MSC_VER
+	unsigned long i;
+	_BitScanForward(&i, v);
+	return (int)i;
+#else
+	return __builtin_ctz(v);
+#endif
+}
+#endif
 
-	if (
-		data == NULL || out_len == NULL || desc == NULL ||
-		desc->width == 0 || desc->height == 0 ||
-		desc->channels < 3 || desc->channels > 4 ||
-		desc->colorspace > 1 ||
-		desc->height >= QOI_PIXELS_MAX / desc->width
-		) {
-		return NULL;
+/* Count how many pixels starting at px_pos are equal to px_prev. Only the
+channels present in the input are compared, so for RGB input the alpha of
+px_prev is ignored. With SSE2 this compares 4 RGBA or 5 RGB pixels per
+instruction, with AVX2 8 RGBA pixels. */
+static size_t qoi_run_length(const unsigned char* pixels, size_t px_pos, size_t px_len, int channels, qoi_rgba_t px_prev) {
+	size_t start = px_pos;
+
+	if (channels == 4) {
+#ifdef QOI_AVX2
+		__m256i ref8 = _mm256_set1_epi32((int)px_prev.v);
+		for (; px_pos + 32 <= px_len; px_pos += 32) {
+			__m256i v = _mm256_loadu_si256((const __m256i*)(pixels + px_pos));
+			unsigned int m = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi32(v, ref8));
+			if (m != 0xffffffffu) {
+				return (px_pos - start + qoi_ctz(~m)) / 4;
+			}
+		}
+#endif
+#ifdef QOI_SSE2
+		__m128i ref4 = _mm_set1_epi32((int)px_prev.v);
+		for (; px_pos + 16 <= px_len; px_pos += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i*)(pixels + px_pos));
+			unsigned int m = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi32(v, ref4));
+			if (m != 0xffff) {
+				return (px_pos - start + qoi_ctz(~m)) / 4;
+			}
+		}
+#endif
+		for (; px_pos < px_len; px_pos += 4) {
+			qoi_rgba_t px;
+			memcpy(&px, pixels + px_pos, 4);
+			if (px.v != px_prev.v) {
+				break;
+			}
+		}
+	}
+	else {
+#ifdef QOI_SSE2
+		/* 5 RGB pixels fit into 15 bytes; the 16th lane is masked off */
+		__m128i ref5 = _mm_setr_epi8(
+			px_prev.rgba.r, px_prev.rgba.g, px_prev.rgba.b,
+			px_prev.rgba.r, px_prev.rgba.g, px_prev.rgba.b,
+			px_prev.rgba.r, px_prev.rgba.g, px_prev.rgba.b,
+			px_prev.rgba.r, px_prev.rgba.g, px_prev.rgba.b,
+			px_prev.rgba.r, px_prev.rgba.g, px_prev.rgba.b, 0);
+		for (; px_pos + 16 <= px_len; px_pos += 15) {
+			__m128i v = _mm_loadu_si128((const __m128i*)(pixels + px_pos));
+			unsigned int m = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, ref5)) | 0x8000;
+			if (m != 0xffff) {
+				return (px_pos - start + qoi_ctz(~m)) / 3;
+			}
+		}
+#endif
+		for (; px_pos < px_len; px_pos += 3) {
+			if (
+				pixels[px_pos + 0] != px_prev.rgba.r ||
+				pixels[px_pos + 1] != px_prev.rgba.g ||
+				pixels[px_pos + 2] != px_prev.rgba.b
+				) {
+				break;
+			}
+		}
 	}
+	return (px_pos - start) / channels;
+}
 
-	max_size =
-		desc->width * desc->height * (desc->channels + 1) +
-		QOI_HEADER_SIZE + sizeof(qoi_padding);
+/* The encode and decode kernels below take the pixel format (QOI_FMT_*) as an
+argument, but are always force-inlined into a dispatcher that passes a literal
+format. The compiler thus generates one specialized loop per format, and the
+hot loops contain no channel or swizzle checks. */
+#ifndef QOI_FORCEINLINE
+#if defined(_MSC_VER)
+#define QOI_FORCEINLINE __forceinline
+#elif defined(__GNUC__)
+#define QOI_FORCEINLINE inline __attribute__((always_inline))
+#else
+#define QOI_FORCEINLINE inline
+#endif
+#endif
 
-	p = 0;
-	bytes = (unsigned char*)QOI_MALLOC(max_size);
-	if (!bytes) {
-		return NULL;
+/* Load one pixel laid out as fmt; RGBA pixels are read as a single 32-bit
+word. For RGB and BGR the alpha of px is kept. */
+static QOI_FORCEINLINE qoi_rgba_t qoi_load_px(const unsigned char* pixels, qoi_rgba_t px, const int fmt) {
+	if (fmt == QOI_FMT_RGBA) {
+		memcpy(&px.v, pixels, 4);
+	}
+	else if (fmt == QOI_FMT_BGRA) {
+		px.rgba.r = pixels[2];
+		px.rgba.g = pixels[1];
+		px.rgba.b = pixels[0];
+		px.rgba.a = pixels[3];
+	}
+	else if (fmt == QOI_FMT_ARGB) {
+		px.rgba.r = pixels[1];
+		px.rgba.g = pixels[2];
+		px.rgba.b = pixels[3];
+		px.rgba.a = pixels[0];
 	}
+	else if (fmt == QOI_FMT_BGR) {
+		px.rgba.r = pixels[2];
+		px.rgba.g = pixels[1];
+		px.rgba.b = pixels[0];
+	}
+	else {
+		px.rgba.r = pixels[0];
+		px.rgba.g = pixels[1];
+		px.rgba.b = pixels[2];
+	}
+	return px;
+}
 
-	qoi_write_32(bytes, &p, QOI_MAGIC);
-	qoi_write_32(bytes, &p, desc->width);
-	qoi_write_32(bytes, &p, desc->height);
-	bytes[p++] = desc->channels;
-	bytes[p++] = desc->colorspace;
+/* Multiply a color value by alpha, rounded: c * a / 255 */
+static QOI_FORCEINLINE unsigned char qoi_premul(unsigned char c, unsigned char a) {
+	unsigned int t = c * a + 128;
+	return (unsigned char)((t + (t >> 8)) >> 8);
+}
 
+/* Store one pixel laid out as fmt; RGBA pixels are written as a single 32-bit
+word. */
+static QOI_FORCEINLINE void qoi_store_px(unsigned char* pixels, qoi_rgba_t px, const int fmt) {
+	if (fmt == QOI_FMT_RGBA) {
+		memcpy(pixels, &px.v, 4);
+	}
+	else if (fmt == QOI_FMT_BGRA) {
+		pixels[0] = px.rgba.b;
+		pixels[1] = px.rgba.g;
+		pixels[2] = px.rgba.r;
+		pixels[3] = px.rgba.a;
+	}
+	else if (fmt == QOI_FMT_ARGB) {
+		pixels[0] = px.rgba.a;
+		pixels[1] = px.rgba.r;
+		pixels[2] = px.rgba.g;
+		pixels[3] = px.rgba.b;
+	}
+	else if (fmt == QOI_FMT_RGBA_PREMUL) {
+		pixels[0] = qoi_premul(px.rgba.r, px.rgba.a);
+		pixels[1] = qoi_premul(px.rgba.g, px.rgba.a);
+		pixels[2] = qoi_premul(px.rgba.b, px.rgba.a);
+		pixels[3] = px.rgba.a;
+	}
+	else if (fmt == QOI_FMT_BGR) {
+		pixels[0] = px.rgba.b;
+		pixels[1] = px.rgba.g;
+		pixels[2] = px.rgba.r;
+	}
+	else {
+		pixels[0] = px.rgba.r;
+		pixels[1] = px.rgba.g;
+		pixels[2] = px.rgba.b;
+	}
+}
 
-	pixels = (const unsigned char*)data;
+/* Return px with its bytes in the order of fmt, so it can be compared
+against raw input pixels by qoi_run_length. */
+static QOI_FORCEINLINE qoi_rgba_t qoi_px_to_fmt(qoi_rgba_t px, const int fmt) {
+	qoi_rgba_t out = px;
+	qoi_store_px((unsigned char*)&out, px, fmt);
+	return out;
+}
 
-	QOI_ZEROARR(index);
+/* Encoder state carried from one qoi_encode_chunks call to the next, so an
+image can be encoded in slices: the index, the previous pixel and the length
+of a run that has not been written yet. */
+typedef struct {
+	qoi_rgba_t index[64];
+	qoi_rgba_t px_prev;
+	int run;
+} qoi_enc_state_t;
+
+static void qoi_enc_state_init(qoi_enc_state_t* state, qoi_rgba_t px_prev) {
+	QOI_ZEROARR(state->index);
+	state->px_prev = px_prev;
+	state->run = 0;
+}
 
-	run = 0;
-	px_prev.rgba.r = 0;
-	px_prev.rgba.g = 0;
-	px_prev.rgba.b = 0;
-	px_prev.rgba.a = 255;
-	px = px_prev;
+/* Write the run still pending in state, if any. Must be called after the last
+pixel of an image (or block) has been passed to qoi_encode_chunks. */
+static size_t qoi_enc_state_flush(qoi_enc_state_t* state, unsigned char* bytes, size_t p) {
+	if (state->run > 0) {
+		bytes[p++] = QOI_OP_RUN | (state->run - 1);
+		state->run = 0;
+	}
+	return p;
+}
 
-	px_len = desc->width * desc->height * desc->channels;
-	px_end = px_len - desc->channels;
-	channels = desc->channels;
+/* Encode the pixels from px_pos up to px_len into bytes at position p,
+continuing from state. A run reaching up to px_len is left in state. The index
+is worked on as a local copy, so the byte stores cannot alias it. Returns the
+new write position. */
+static QOI_FORCEINLINE size_t qoi_encode_chunks(
+	const unsigned char* pixels, size_t px_pos, size_t px_len, qoi_enc_state_t* state,
+	unsigned char* bytes, size_t p, const int fmt
+) {
+	const int channels = QOI_FMT_CHANNELS(fmt);
+	qoi_rgba_t index[64];
+	qoi_rgba_t px_prev = state->px_prev;
+	qoi_rgba_t px = px_prev;
+	int run = state->run;
 
-	for (px_pos = 0; px_pos < px_len; px_pos += channels) {
-		px.rgba.r = pixels[px_pos + 0];
-		px.rgba.g = pixels[px_pos + 1];
-		px.rgba.b = pixels[px_pos + 2];
+	memcpy(index, state->index, sizeof(index));
 
-		if (channels == 4) {
-			px.rgba.a = pixels[px_pos + 3];
-		}
+	for (; px_pos < px_len; px_pos += channels) {
+		px = qoi_load_px(pixels + px_pos, px, fmt);
 
 		if (px.v == px_prev.v) {
-			run++;
-			if (run == 62 || px_pos == px_end) {
-				bytes[p++] = QOI_OP_RUN | (run - 1);
-				run = 0;
+			/* Jump over the whole matching span at once and emit the full
+			runs it contains; the remainder is carried like a scalar run. */
+			size_t span = qoi_run_length(pixels, px_pos + channels, px_len, channels, qoi_px_to_fmt(px_prev, fmt));
+			size_t total = (size_t)run + span + 1;
+			px_pos += span * channels;
+			/* A flat span can be longer than an int holds, so count in size_t */
+			for (; total >= 62; total -= 62) {
+				bytes[p++] = QOI_OP_RUN | 61;
 			}
+			run = (int)total;
 		}
 		else {
 			int index_pos;
@@ -479,67 +887,121 @@ void* qoi_encode(const void* data, const qoi_desc* desc, int* out_len) {
 		px_prev = px;
 	}
 
-	for (i = 0; i < (int)sizeof(qoi_padding); i++) {
-		bytes[p++] = qoi_padding[i];
+	memcpy(state->index, index, sizeof(index));
+	state->px_prev = px_prev;
+	state->run = run;
+	return p;
+}
+
+/* Decode one chunk at bytes[p] into px and index, write the decoded pixel
+(or the whole run) to pixels[px_pos] and return the number of bytes of pixel
+data written. Performs no bounds checks; the caller guarantees that 5 bytes
+of input and 62 pixels of output are available. */
+static QOI_FORCEINLINE size_t qoi_decode_op_unchecked(
+	const unsigned char* bytes, size_t* p, qoi_rgba_t* index, qoi_rgba_t* px,
+	unsigned char* pixels, const int fmt
+) {
+	const int channels = QOI_FMT_CHANNELS(fmt);
+	int b1 = bytes[(*p)++];
+	int run = 0;
+
+	if (b1 == QOI_OP_RGB) {
+		px->rgba.r = bytes[(*p)++];
+		px->rgba.g = bytes[(*p)++];
+		px->rgba.b = bytes[(*p)++];
+	}
+	else if (b1 == QOI_OP_RGBA) {
+		px->rgba.r = bytes[(*p)++];
+		px->rgba.g = bytes[(*p)++];
+		px->rgba.b = bytes[(*p)++];
+		px->rgba.a = bytes[(*p)++];
+	}
+	else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+		*px = index[b1];
+	}
+	else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+		px->rgba.r += ((b1 >> 4) & 0x03) - 2;
+		px->rgba.g += ((b1 >> 2) & 0x03) - 2;
+		px->rgba.b += (b1 & 0x03) - 2;
+	}
+	else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+		int b2 = bytes[(*p)++];
+		int vg = (b1 & 0x3f) - 32;
+		px->rgba.r += vg - 8 + ((b2 >> 4) & 0x0f);
+		px->rgba.g += vg;
+		px->rgba.b += vg - 8 + (b2 & 0x0f);
+	}
+	else {
+		run = b1 & 0x3f;
 	}
 
-	*out_len = p;
-	return bytes;
+	index[QOI_COLOR_HASH((*px)) % 64] = *px;
+
+	qoi_store_px(pixels, *px, fmt);
+	for (b1 = 1; b1 <= run; b1++) {
+		qoi_store_px(pixels + b1 * channels, *px, fmt);
+	}
+	return (run + 1) * channels;
 }
 
-void* qoi_decode(const void* data, int size, qoi_desc* desc, int channels) {
-	const unsigned char* bytes;
-	unsigned int header_magic;
-	unsigned char* pixels;
+/* Decoder state carried from one qoi_decode_chunks call to the next, so an
+image can be decoded in slices: the index, the previous pixel and how many
+more times it has to be repeated for a run that was cut off. */
+typedef struct {
 	qoi_rgba_t index[64];
 	qoi_rgba_t px;
-	int px_len, chunks_len, px_pos;
-	int p = 0, run = 0;
-
-	if (
-		data == NULL || desc == NULL ||
-		(channels != 0 && channels != 3 && channels != 4) ||
-		size < QOI_HEADER_SIZE + (int)sizeof(qoi_padding)
-		) {
-		return NULL;
-	}
-
-	bytes = (const unsigned char*)data;
+	int run;
+} qoi_dec_state_t;
+
+static void qoi_dec_state_init(qoi_dec_state_t* state) {
+	QOI_ZEROARR(state->index);
+	state->px.rgba.r = 0;
+	state->px.rgba.g = 0;
+	state->px.rgba.b = 0;
+	state->px.rgba.a = 255;
+	state->run = 0;
+}
 
-	header_magic = qoi_read_32(bytes, &p);
-	desc->width = qoi_read_32(bytes, &p);
-	desc->height = qoi_read_32(bytes, &p);
-	desc->channels = bytes[p++];
-	desc->colorspace = bytes[p++];
+/* Decode chunks from bytes at position p (never reading a tag at or past
+chunks_len) into px_len bytes of pixels, continuing from state. The index is
+worked on as a local copy, so the pixel stores cannot alias it. Returns the
+new read position.
+
+Decoding runs in two phases. As long as 4 whole chunks (20 bytes) of input
+and 4 maximal runs (248 pixels) of output are left, 4 chunks are decoded per
+iteration without any bounds checks. The remaining few chunks go through the
+fully checked loop. Both phases produce the same output for any input, so
+truncated or malformed data is handled exactly as before.
+
+The chunk stream does not depend on the channel count in the file header, so
+decoding a 3 or 4 channel file into any format only needs a kernel per output
+format. */
+static QOI_FORCEINLINE size_t qoi_decode_chunks(
+	const unsigned char* bytes, size_t p, size_t chunks_len, qoi_dec_state_t* state,
+	unsigned char* pixels, size_t px_len, const int fmt
+) {
+	const int channels = QOI_FMT_CHANNELS(fmt);
+	qoi_rgba_t index[64];
+	qoi_rgba_t px = state->px;
+	size_t px_pos = 0;
+	int run = state->run;
 
-	if (
-		desc->width == 0 || desc->height == 0 ||
-		desc->channels < 3 || desc->channels > 4 ||
-		desc->colorspace > 1 ||
-		header_magic != QOI_MAGIC ||
-		desc->height >= QOI_PIXELS_MAX / desc->width
-		) {
-		return NULL;
-	}
+	memcpy(index, state->index, sizeof(index));
 
-	if (channels == 0) {
-		channels = desc->channels;
+	/* Finish a run that was cut off at the end of the previous slice */
+	for (; run > 0 && px_pos < px_len; px_pos += channels) {
+		qoi_store_px(pixels + px_pos, px, fmt);
+		run--;
 	}
 
-	px_len = desc->width * desc->height * channels;
-	pixels = (unsigned char*)QOI_MALLOC(px_len);
-	if (!pixels) {
-		return NULL;
+	while (p + 4 * 5 <= chunks_len && px_pos + 4 * 62 * channels <= px_len) {
+		px_pos += qoi_decode_op_unchecked(bytes, &p, index, &px, pixels + px_pos, fmt);
+		px_pos += qoi_decode_op_unchecked(bytes, &p, index, &px, pixels + px_pos, fmt);
+		px_pos += qoi_decode_op_unchecked(bytes, &p, index, &px, pixels + px_pos, fmt);
+		px_pos += qoi_decode_op_unchecked(bytes, &p, index, &px, pixels + px_pos, fmt);
 	}
 
-	QOI_ZEROARR(index);
-	px.rgba.r = 0;
-	px.rgba.g = 0;
-	px.rgba.b = 0;
-	px.rgba.a = 255;
-
-	chunks_len = size - (int)sizeof(qoi_padding);
-	for (px_pos = 0; px_pos < px_len; px_pos += channels) {
+	for (; px_pos < px_len; px_pos += channels) {
 		if (run > 0) {
 			run--;
 		}
@@ -579,70 +1041,1188 @@ void* qoi_decode(const void* data, int size, qoi_desc* desc, int channels) {
 			index[QOI_COLOR_HASH(px) % 64] = px;
 		}
 
-		pixels[px_pos + 0] = px.rgba.r;
-		pixels[px_pos + 1] = px.rgba.g;
-		pixels[px_pos + 2] = px.rgba.b;
-
-		if (channels == 4) {
-			pixels[px_pos + 3] = px.rgba.a;
-		}
+		qoi_store_px(pixels + px_pos, px, fmt);
 	}
 
-	return pixels;
+	memcpy(state->index, index, sizeof(index));
+	state->px = px;
+	state->run = run;
+	return p;
 }
 
-#ifndef QOI_NO_STDIO
-#include <stdio.h>
+/* Decode chunks from bytes[p] up to end into pixels, continuing from state and
+from *px_pos, like qoi_decode_chunks, but stop in front of a chunk that is not
+completely in the input instead of repeating the last pixel, so a streaming
+decoder can wait for more input and resume. *px_pos is advanced past the
+pixels written. Returns the new read position. */
+static QOI_FORCEINLINE size_t qoi_decode_chunks_partial(
+	const unsigned char* bytes, size_t p, size_t end, qoi_dec_state_t* state,
+	unsigned char* pixels, size_t* px_pos_io, size_t px_len, const int fmt
+) {
+	const int channels = QOI_FMT_CHANNELS(fmt);
+	qoi_rgba_t index[64];
+	qoi_rgba_t px = state->px;
+	size_t px_pos = *px_pos_io;
+	int run = state->run;
 
-int qoi_write(const char* filename, const void* data, const qoi_desc* desc) {
-	FILE* f = fopen(filename, "wb");
-	int size, err;
-	void* encoded;
+	memcpy(index, state->index, sizeof(index));
 
-	if (!f) {
-		return 0;
+	for (; run > 0 && px_pos < px_len; px_pos += channels) {
+		qoi_store_px(pixels + px_pos, px, fmt);
+		run--;
 	}
 
-	encoded = qoi_encode(data, desc, &size);
-	if (!encoded) {
-		fclose(f);
-		return 0;
+	while (p + 4 * 5 <= end && px_pos + 4 * 62 * channels <= px_len) {
+		px_pos += qoi_decode_op_unchecked(bytes, &p, index, &px, pixels + px_pos, fmt);
+		px_pos += qoi_decode_op_unchecked(bytes, &p, index, &px, pixels + px_pos, fmt);
+		px_pos += qoi_decode_op_unchecked(bytes, &p, index, &px, pixels + px_pos, fmt);
+		px_pos += qoi_decode_op_unchecked(bytes, &p, index, &px, pixels + px_pos, fmt);
 	}
 
-	fwrite(encoded, 1, size, f);
-	fflush(f);
-	err = ferror(f);
-	fclose(f);
+	for (; px_pos < px_len; px_pos += channels) {
+		if (run > 0) {
+			run--;
+		}
+		else {
+			int b1;
 
-	QOI_FREE(encoded);
-	return err ? 0 : size;
-}
+			if (p >= end) {
+				break;
+			}
+			b1 = bytes[p];
+			if (
+				p + (b1 == QOI_OP_RGBA ? 5 : b1 == QOI_OP_RGB ? 4 :
+				(b1 & QOI_MASK_2) == QOI_OP_LUMA ? 2 : 1) > end
+				) {
+				break;
+			}
+			p++;
 
-void* qoi_read(const char* filename, qoi_desc* desc, int channels) {
-	FILE* f = fopen(filename, "rb");
-	int size, bytes_read;
-	void* pixels, * data;
+			if (b1 == QOI_OP_RGB) {
+				px.rgba.r = bytes[p++];
+				px.rgba.g = bytes[p++];
+				px.rgba.b = bytes[p++];
+			}
+			else if (b1 == QOI_OP_RGBA) {
+				px.rgba.r = bytes[p++];
+				px.rgba.g = bytes[p++];
+				px.rgba.b = bytes[p++];
+				px.rgba.a = bytes[p++];
+			}
+			else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+				px = index[b1];
+			}
+			else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+				px.rgba.r += ((b1 >> 4) & 0x03) - 2;
+				px.rgba.g += ((b1 >> 2) & 0x03) - 2;
+				px.rgba.b += (b1 & 0x03) - 2;
+			}
+			else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+				int b2 = bytes[p++];
+				int vg = (b1 & 0x3f) - 32;
+				px.rgba.r += vg - 8 + ((b2 >> 4) & 0x0f);
+				px.rgba.g += vg;
+				px.rgba.b += vg - 8 + (b2 & 0x0f);
+			}
+			else {
+				run = (b1 & 0x3f);
+			}
 
-	if (!f) {
-		return NULL;
+			index[QOI_COLOR_HASH(px) % 64] = px;
+		}
+
+		qoi_store_px(pixels + px_pos, px, fmt);
 	}
 
-	fseek(f, 0, SEEK_END);
-	size = ftell(f);
-	if (size <= 0 || fseek(f, 0, SEEK_SET) != 0) {
-		fclose(f);
-		return NULL;
+	memcpy(state->index, index, sizeof(index));
+	state->px = px;
+	state->run = run;
+	*px_pos_io = px_pos;
+	return p;
+}
+
+/* Encode rows pixel rows of row_len bytes each, whose starts are stride bytes
+apart, continuing from state. Densely packed rows go through in one call. */
+static QOI_FORCEINLINE size_t qoi_encode_lines(
+	const unsigned char* pixels, size_t stride, size_t row_len, size_t rows,
+	qoi_enc_state_t* state, unsigned char* bytes, size_t p, const int fmt
+) {
+	size_t y;
+
+	if (stride == row_len) {
+		return qoi_encode_chunks(pixels, 0, row_len * rows, state, bytes, p, fmt);
+	}
+	for (y = 0; y < rows; y++) {
+		p = qoi_encode_chunks(pixels + y * stride, 0, row_len, state, bytes, p, fmt);
 	}
+	return p;
+}
 
-	data = QOI_MALLOC(size);
-	if (!data) {
-		fclose(f);
-		return NULL;
+/* Decode rows pixel rows of row_len bytes each, whose starts are stride bytes
+apart, continuing from state. Densely packed rows go through in one call. With
+a stride of 0 every row lands on the same row of pixels, which skips rows that
+are not wanted without a scratch buffer. */
+static QOI_FORCEINLINE size_t qoi_decode_lines(
+	const unsigned char* bytes, size_t p, size_t chunks_len, qoi_dec_state_t* state,
+	unsigned char* pixels, size_t stride, size_t row_len, size_t rows, const int fmt
+) {
+	size_t y;
+
+	if (stride == row_len) {
+		return qoi_decode_chunks(bytes, p, chunks_len, state, pixels, row_len * rows, fmt);
 	}
+	for (y = 0; y < rows; y++) {
+		p = qoi_decode_chunks(bytes, p, chunks_len, state, pixels + y * stride, row_len, fmt);
+	}
+	return p;
+}
 
-	bytes_read = fread(data, 1, size, f);
-	fclose(f);
-	pixels = (bytes_read != size) ? NULL : qoi_decode(data, bytes_read, desc, channels);
+static int qoi_valid_desc(const qoi_desc* desc) {
+	return
+		desc != NULL &&
+		desc->width != 0 && desc->height != 0 &&
+		desc->channels >= 3 && desc->channels <= 4 &&
+		desc->colorspace <= 1 &&
+		desc->height < QOI_PIXELS_MAX / desc->width;
+}
+
+/* Read and validate the 14 byte header at bytes into desc. Returns 0 if the
+header is invalid. */
+static int qoi_parse_header(const unsigned char* bytes, qoi_desc* desc) {
+	size_t p = 0;
+	unsigned int header_magic;
+
+	header_magic = qoi_read_32(bytes, &p);
+	desc->width = qoi_read_32(bytes, &p);
+	desc->height = qoi_read_32(bytes, &p);
+	desc->channels = bytes[p++];
+	desc->colorspace = bytes[p++];
+
+	return header_magic == QOI_MAGIC && qoi_valid_desc(desc);
+}
+
+/* Read and validate the header of size bytes of QOI data into desc. Returns
+0 if the data is too short to be a QOI image or the header is invalid. */
+static int qoi_read_header(const unsigned char* bytes, size_t size, qoi_desc* desc) {
+	if (size < QOI_HEADER_SIZE + sizeof(qoi_padding)) {
+		return 0;
+	}
+	return qoi_parse_header(bytes, desc);
+}
+
+size_t qoi_max_encoded_size(const qoi_desc* desc) {
+	if (!qoi_valid_desc(desc)) {
+		return 0;
+	}
+	return
+		(size_t)desc->width * desc->height * (desc->channels + 1) +
+		QOI_HEADER_SIZE + sizeof(qoi_padding);
+}
+
+size_t qoi_encode_into_fmt(const void* data, size_t stride, int fmt, const qoi_desc* desc, void* out, size_t out_cap) {
+	size_t i, p;
+	size_t row_len;
+	unsigned char* bytes;
+	const unsigned char* pixels;
+	qoi_rgba_t px_prev;
+	qoi_enc_state_t state;
+
+	if (
+		data == NULL || out == NULL ||
+		!qoi_valid_desc(desc) ||
+		out_cap < qoi_max_encoded_size(desc)
+		) {
+		return 0;
+	}
+
+	if (fmt == 0) {
+		fmt = desc->channels;
+	}
+	if (
+		fmt < QOI_FMT_RGB || fmt > QOI_FMT_ARGB ||
+		QOI_FMT_CHANNELS(fmt) != desc->channels
+		) {
+		return 0;
+	}
+
+	row_len = (size_t)desc->width * desc->channels;
+	if (stride == 0) {
+		stride = row_len;
+	}
+	if (stride < row_len) {
+		return 0;
+	}
+
+	p = 0;
+	bytes = (unsigned char*)out;
+
+	qoi_write_32(bytes, &p, QOI_MAGIC);
+	qoi_write_32(bytes, &p, desc->width);
+	qoi_write_32(bytes, &p, desc->height);
+	bytes[p++] = desc->channels;
+	bytes[p++] = desc->colorspace;
+
+
+	pixels = (const unsigned char*)data;
+
+	px_prev.rgba.r = 0;
+	px_prev.rgba.g = 0;
+	px_prev.rgba.b = 0;
+	px_prev.rgba.a = 255;
+
+	qoi_enc_state_init(&state, px_prev);
+
+	switch (fmt) {
+		case QOI_FMT_RGBA: p = qoi_encode_lines(pixels, stride, row_len, desc->height, &state, bytes, p, QOI_FMT_RGBA); break;
+		case QOI_FMT_BGRA: p = qoi_encode_lines(pixels, stride, row_len, desc->height, &state, bytes, p, QOI_FMT_BGRA); break;
+		case QOI_FMT_ARGB: p = qoi_encode_lines(pixels, stride, row_len, desc->height, &state, bytes, p, QOI_FMT_ARGB); break;
+		case QOI_FMT_BGR:  p = qoi_encode_lines(pixels, stride, row_len, desc->height, &state, bytes, p, QOI_FMT_BGR);  break;
+		default:           p = qoi_encode_lines(pixels, stride, row_len, desc->height, &state, bytes, p, QOI_FMT_RGB);  break;
+	}
+	p = qoi_enc_state_flush(&state, bytes, p);
+
+	for (i = 0; i < sizeof(qoi_padding); i++) {
+		bytes[p++] = qoi_padding[i];
+	}
+
+	return p;
+}
+
+size_t qoi_encode_into_stride(const void* data, size_t stride, const qoi_desc* desc, void* out, size_t out_cap) {
+	return qoi_encode_into_fmt(data, stride, 0, desc, out, out_cap);
+}
+
+size_t qoi_encode_into(const void* data, const qoi_desc* desc, void* out, size_t out_cap) {
+	return qoi_encode_into_stride(data, 0, desc, out, out_cap);
+}
+
+void* qoi_encode_fmt(const void* data, size_t stride, int fmt, const qoi_desc* desc, size_t* out_len) {
+	size_t max_size;
+	void* bytes;
+
+	if (data == NULL || out_len == NULL || !qoi_valid_desc(desc)) {
+		return NULL;
+	}
+
+	max_size = qoi_max_encoded_size(desc);
+	bytes = QOI_MALLOC(max_size);
+	if (!bytes) {
+		return NULL;
+	}
+
+	*out_len = qoi_encode_into_fmt(data, stride, fmt, desc, bytes, max_size);
+	if (*out_len == 0) {
+		QOI_FREE(bytes);
+		return NULL;
+	}
+	return bytes;
+}
+
+void* qoi_encode_stride(const void* data, size_t stride, const qoi_desc* desc, size_t* out_len) {
+	return qoi_encode_fmt(data, stride, 0, desc, out_len);
+}
+
+void* qoi_encode(const void* data, const qoi_desc* desc, size_t* out_len) {
+	size_t max_size;
+	void* bytes;
+
+	if (data == NULL || out_len == NULL || !qoi_valid_desc(desc)) {
+		return NULL;
+	}
+
+	max_size = qoi_max_encoded_size(desc);
+	bytes = QOI_MALLOC(max_size);
+	if (!bytes) {
+		return NULL;
+	}
+
+	*out_len = qoi_encode_into(data, desc, bytes, max_size);
+	return bytes;
+}
+
+/* qoi_encode_lean encodes this many pixels at a time, so its buffer only
+ever needs room for one worst-case slice past what has been written: one byte
+for a run carried over from the slice before, channels + 1 bytes per pixel
+and the padding. */
+#ifndef QOI_LEAN_SLICE
+#define QOI_LEAN_SLICE 65536
+#endif
+
+void* qoi_encode_lean(const void* data, const qoi_desc* desc, size_t* out_len) {
+	size_t i, cap, max_size, p;
+	size_t px_pos, px_len, slice_len, slice_max;
+	unsigned char* bytes;
+	unsigned char* grown;
+	const unsigned char* pixels;
+	qoi_rgba_t px_prev;
+	qoi_enc_state_t state;
+
+	if (data == NULL || out_len == NULL || !qoi_valid_desc(desc)) {
+		return NULL;
+	}
+
+	px_len = (size_t)desc->width * desc->height * desc->channels;
+	slice_len = (size_t)QOI_LEAN_SLICE * desc->channels;
+	slice_max = 1 + (size_t)QOI_LEAN_SLICE * (desc->channels + 1) + sizeof(qoi_padding);
+
+	/* Start from a quarter of the raw size, about what photos compress to */
+	max_size = qoi_max_encoded_size(desc);
+	cap = QOI_HEADER_SIZE + px_len / 4 + slice_max;
+	if (cap > max_size) {
+		cap = max_size;
+	}
+
+	p = 0;
+	bytes = (unsigned char*)QOI_MALLOC(cap);
+	if (!bytes) {
+		return NULL;
+	}
+
+	qoi_write_32(bytes, &p, QOI_MAGIC);
+	qoi_write_32(bytes, &p, desc->width);
+	qoi_write_32(bytes, &p, desc->height);
+	bytes[p++] = desc->channels;
+	bytes[p++] = desc->colorspace;
+
+	pixels = (const unsigned char*)data;
+
+	px_prev.rgba.r = 0;
+	px_prev.rgba.g = 0;
+	px_prev.rgba.b = 0;
+	px_prev.rgba.a = 255;
+	qoi_enc_state_init(&state, px_prev);
+
+	for (px_pos = 0; px_pos < px_len; px_pos += slice_len) {
+		size_t slice_end = px_len - px_pos > slice_len ? px_pos + slice_len : px_len;
+
+		/* Grow by half when the next slice might not fit */
+		if (cap - p < slice_max) {
+			cap += cap / 2;
+			if (cap < p + slice_max) {
+				cap = p + slice_max;
+			}
+			grown = (unsigned char*)QOI_REALLOC(bytes, cap);
+			if (!grown) {
+				QOI_FREE(bytes);
+				return NULL;
+			}
+			bytes = grown;
+		}
+
+		if (desc->channels == 4) {
+			p = qoi_encode_chunks(pixels, px_pos, slice_end, &state, bytes, p, 4);
+		}
+		else {
+			p = qoi_encode_chunks(pixels, px_pos, slice_end, &state, bytes, p, 3);
+		}
+	}
+	p = qoi_enc_state_flush(&state, bytes, p);
+
+	for (i = 0; i < sizeof(qoi_padding); i++) {
+		bytes[p++] = qoi_padding[i];
+	}
+
+	/* Hand back the slack, so the result is exactly out_len bytes */
+	grown = (unsigned char*)QOI_REALLOC(bytes, p);
+	if (grown) {
+		bytes = grown;
+	}
+
+	*out_len = p;
+	return bytes;
+}
+
+/* Hand the buffered bytes of a streaming encoder to its write callback. Fails
+if there is no callback, i.e. the buffer that holds the whole image is full. */
+static int qoi_encoder_flush(qoi_encoder_t* enc) {
+	if (enc->write == NULL || !enc->write(enc->user, enc->buf, enc->buf_len)) {
+		enc->failed = 1;
+		return 0;
+	}
+	enc->written += enc->buf_len;
+	enc->buf_len = 0;
+	return 1;
+}
+
+/* Pixels a streaming encoder without write callback encodes aside at a time
+once its buffer is nearly full */
+#define QOI_STREAM_SPILL_PX 16
+
+/* Encode n rows into the buffer of a streaming encoder. Every row is cut into
+pieces small enough for the space that is left, flushing in between: a piece
+of k pixels takes at most k * (channels + 1) bytes, plus one for a run left
+over from the piece before. Without a callback there is nothing to flush to,
+so the last pixels go through a small spill buffer and are kept if they fit,
+and encoding fails only once the image really outgrows the buffer. */
+static QOI_FORCEINLINE int qoi_encoder_rows(
+	qoi_encoder_t* enc, qoi_enc_state_t* state, const unsigned char* pixels,
+	size_t stride, size_t row_len, unsigned int n, const int fmt
+) {
+	const int channels = QOI_FMT_CHANNELS(fmt);
+	unsigned int y;
+
+	for (y = 0; y < n; y++) {
+		const unsigned char* row = pixels + y * stride;
+		size_t px_pos = 0;
+
+		while (px_pos < row_len) {
+			size_t avail = enc->buf_cap - enc->buf_len;
+			size_t piece;
+
+			if (avail < (size_t)channels + 2 && enc->write == NULL) {
+				unsigned char spill[QOI_STREAM_SPILL_PX * 5 + 1];
+				size_t len;
+
+				piece = (size_t)QOI_STREAM_SPILL_PX * channels;
+				if (piece > row_len - px_pos) {
+					piece = row_len - px_pos;
+				}
+				len = qoi_encode_chunks(row + px_pos, 0, piece, state, spill, 0, fmt);
+				if (len > avail) {
+					enc->failed = 1;
+					return 0;
+				}
+				memcpy(enc->buf + enc->buf_len, spill, len);
+				enc->buf_len += len;
+				px_pos += piece;
+				continue;
+			}
+			if (avail < (size_t)channels + 2) {
+				if (!qoi_encoder_flush(enc)) {
+					return 0;
+				}
+				continue;
+			}
+			piece = (avail - 1) / (channels + 1) * channels;
+			if (piece > row_len - px_pos) {
+				piece = row_len - px_pos;
+			}
+			enc->buf_len = qoi_encode_chunks(row + px_pos, 0, piece, state, enc->buf, enc->buf_len, fmt);
+			px_pos += piece;
+		}
+	}
+	return 1;
+}
+
+int qoi_encoder_begin(qoi_encoder_t* enc, const qoi_desc* desc, int fmt, void* buf, size_t buf_cap, qoi_write_func write, void* user) {
+	size_t p = 0;
+	qoi_rgba_t px_prev;
+
+	if (enc == NULL || buf == NULL || buf_cap < QOI_STREAM_BUF_MIN || !qoi_valid_desc(desc)) {
+		return 0;
+	}
+
+	if (fmt == 0) {
+		fmt = desc->channels;
+	}
+	if (
+		fmt < QOI_FMT_RGB || fmt > QOI_FMT_ARGB ||
+		QOI_FMT_CHANNELS(fmt) != desc->channels
+		) {
+		return 0;
+	}
+
+	enc->desc = *desc;
+	enc->fmt = fmt;
+	enc->failed = 0;
+	enc->rows_left = desc->height;
+	enc->buf = (unsigned char*)buf;
+	enc->buf_cap = buf_cap;
+	enc->written = 0;
+	enc->write = write;
+	enc->user = user;
+	QOI_ZEROARR(enc->index);
+	px_prev.rgba.r = 0;
+	px_prev.rgba.g = 0;
+	px_prev.rgba.b = 0;
+	px_prev.rgba.a = 255;
+	enc->px_prev = px_prev.v;
+	enc->run = 0;
+
+	qoi_write_32(enc->buf, &p, QOI_MAGIC);
+	qoi_write_32(enc->buf, &p, desc->width);
+	qoi_write_32(enc->buf, &p, desc->height);
+	enc->buf[p++] = desc->channels;
+	enc->buf[p++] = desc->colorspace;
+	enc->buf_len = p;
+	return 1;
+}
+
+int qoi_encoder_push_rows(qoi_encoder_t* enc, const void* rows, size_t stride, unsigned int n) {
+	const unsigned char* pixels = (const unsigned char*)rows;
+	size_t row_len;
+	qoi_enc_state_t state;
+	int ok;
+
+	if (enc == NULL || enc->failed || rows == NULL || n > enc->rows_left) {
+		if (enc != NULL) {
+			enc->failed = 1;
+		}
+		return 0;
+	}
+
+	row_len = (size_t)enc->desc.width * enc->desc.channels;
+	if (stride == 0) {
+		stride = row_len;
+	}
+	if (stride < row_len) {
+		enc->failed = 1;
+		return 0;
+	}
+
+	memcpy(state.index, enc->index, sizeof(enc->index));
+	state.px_prev.v = enc->px_prev;
+	state.run = enc->run;
+
+	switch (enc->fmt) {
+		case QOI_FMT_RGBA: ok = qoi_encoder_rows(enc, &state, pixels, stride, row_len, n, QOI_FMT_RGBA); break;
+		case QOI_FMT_BGRA: ok = qoi_encoder_rows(enc, &state, pixels, stride, row_len, n, QOI_FMT_BGRA); break;
+		case QOI_FMT_ARGB: ok = qoi_encoder_rows(enc, &state, pixels, stride, row_len, n, QOI_FMT_ARGB); break;
+		case QOI_FMT_BGR:  ok = qoi_encoder_rows(enc, &state, pixels, stride, row_len, n, QOI_FMT_BGR);  break;
+		default:           ok = qoi_encoder_rows(enc, &state, pixels, stride, row_len, n, QOI_FMT_RGB);  break;
+	}
+
+	memcpy(enc->index, state.index, sizeof(enc->index));
+	enc->px_prev = state.px_prev.v;
+	enc->run = state.run;
+	enc->rows_left -= n;
+	return ok;
+}
+
+size_t qoi_encoder_finish(qoi_encoder_t* enc) {
+	qoi_enc_state_t state;
+	size_t i;
+
+	if (enc == NULL || enc->failed || enc->rows_left > 0) {
+		return 0;
+	}
+
+	/* The last run, if there is one, and the padding */
+	if (enc->buf_cap - enc->buf_len < (enc->run > 0) + sizeof(qoi_padding) && !qoi_encoder_flush(enc)) {
+		return 0;
+	}
+	state.run = enc->run;
+	enc->buf_len = qoi_enc_state_flush(&state, enc->buf, enc->buf_len);
+	enc->run = 0;
+	for (i = 0; i < sizeof(qoi_padding); i++) {
+		enc->buf[enc->buf_len++] = qoi_padding[i];
+	}
+
+	if (enc->write != NULL && !qoi_encoder_flush(enc)) {
+		return 0;
+	}
+
+	/* The image is complete, nothing more can be pushed */
+	enc->failed = 1;
+	return enc->written + enc->buf_len;
+}
+
+/* Decode the chunks in bytes[0..end) into the row of a streaming decoder,
+with its state copied in and out around the kernel. Returns the number of
+bytes used. */
+static size_t qoi_decoder_chunks(qoi_decoder_t* dec, const unsigned char* bytes, size_t end) {
+	qoi_dec_state_t state;
+	size_t p;
+
+	memcpy(state.index, dec->index, sizeof(dec->index));
+	state.px.v = dec->px;
+	state.run = dec->run;
+
+	switch (dec->fmt) {
+		case QOI_FMT_RGBA:        p = qoi_decode_chunks_partial(bytes, 0, end, &state, dec->row, &dec->px_pos, dec->row_len, QOI_FMT_RGBA);        break;
+		case QOI_FMT_BGRA:        p = qoi_decode_chunks_partial(bytes, 0, end, &state, dec->row, &dec->px_pos, dec->row_len, QOI_FMT_BGRA);        break;
+		case QOI_FMT_ARGB:        p = qoi_decode_chunks_partial(bytes, 0, end, &state, dec->row, &dec->px_pos, dec->row_len, QOI_FMT_ARGB);        break;
+		case QOI_FMT_RGBA_PREMUL: p = qoi_decode_chunks_partial(bytes, 0, end, &state, dec->row, &dec->px_pos, dec->row_len, QOI_FMT_RGBA_PREMUL); break;
+		case QOI_FMT_BGR:         p = qoi_decode_chunks_partial(bytes, 0, end, &state, dec->row, &dec->px_pos, dec->row_len, QOI_FMT_BGR);         break;
+		default:                  p = qoi_decode_chunks_partial(bytes, 0, end, &state, dec->row, &dec->px_pos, dec->row_len, QOI_FMT_RGB);         break;
+	}
+
+	memcpy(dec->index, state.index, sizeof(dec->index));
+	dec->px = state.px.v;
+	dec->run = state.run;
+	return p;
+}
+
+int qoi_decoder_begin(qoi_decoder_t* dec, int fmt) {
+	qoi_rgba_t px;
+
+	if (dec == NULL || (fmt != 0 && (fmt < QOI_FMT_RGB || fmt > QOI_FMT_RGBA_PREMUL))) {
+		return 0;
+	}
+
+	memset(&dec->desc, 0, sizeof(dec->desc));
+	dec->fmt = fmt;
+	dec->failed = 0;
+	dec->rows_left = 0;
+	dec->row = NULL;
+	dec->row_len = 0;
+	dec->px_pos = 0;
+	dec->carry_len = 0;
+	QOI_ZEROARR(dec->index);
+	px.rgba.r = 0;
+	px.rgba.g = 0;
+	px.rgba.b = 0;
+	px.rgba.a = 255;
+	dec->px = px.v;
+	dec->run = 0;
+	return 1;
+}
+
+int qoi_decoder_pull_row(qoi_decoder_t* dec, const void** data, size_t* size, const void** row) {
+	const unsigned char* bytes;
+	size_t len, take, used;
+
+	if (dec == NULL || data == NULL || size == NULL || row == NULL || dec->failed) {
+		return QOI_STREAM_ERROR;
+	}
+	bytes = (const unsigned char*)*data;
+	len = bytes != NULL ? *size : 0;
+
+	if (dec->row == NULL) {
+		take = QOI_HEADER_SIZE - dec->carry_len < len ? QOI_HEADER_SIZE - dec->carry_len : len;
+		if (take > 0) {
+			memcpy(dec->carry + dec->carry_len, bytes, take);
+		}
+		dec->carry_len += take;
+		bytes += take;
+		len -= take;
+		*data = bytes;
+		*size = len;
+		if (dec->carry_len < QOI_HEADER_SIZE) {
+			return QOI_STREAM_MORE;
+		}
+
+		if (!qoi_parse_header(dec->carry, &dec->desc)) {
+			dec->failed = 1;
+			return QOI_STREAM_ERROR;
+		}
+		if (dec->fmt == 0) {
+			dec->fmt = dec->desc.channels;
+		}
+		dec->row_len = (size_t)dec->desc.width * QOI_FMT_CHANNELS(dec->fmt);
+		dec->row = (unsigned char*)QOI_MALLOC(dec->row_len);
+		if (!dec->row) {
+			dec->failed = 1;
+			return QOI_STREAM_ERROR;
+		}
+		dec->rows_left = dec->desc.height;
+		dec->carry_len = 0;
+	}
+
+	if (dec->rows_left == 0) {
+		return QOI_STREAM_DONE;
+	}
+
+	/* Complete a chunk that was cut off at the end of the previous input. It
+	is at most 5 bytes long, so it is decoded from the carry buffer. */
+	if (dec->carry_len > 0) {
+		size_t kept = dec->carry_len;
+		take = 5 - kept < len ? 5 - kept : len;
+		if (take > 0) {
+			memcpy(dec->carry + kept, bytes, take);
+		}
+		used = qoi_decoder_chunks(dec, dec->carry, kept + take);
+		if (used > 0) {
+			bytes += used - kept;
+			len -= used - kept;
+			dec->carry_len = 0;
+		}
+		else if (dec->px_pos < dec->row_len) {
+			/* Still not a whole chunk: keep all of the input */
+			bytes += take;
+			len -= take;
+			dec->carry_len += take;
+		}
+	}
+
+	if (dec->carry_len == 0 && dec->px_pos < dec->row_len) {
+		used = qoi_decoder_chunks(dec, bytes, len);
+		bytes += used;
+		len -= used;
+
+		/* The input ended inside a chunk, at most 4 bytes are left */
+		if (dec->px_pos < dec->row_len && len > 0) {
+			memcpy(dec->carry, bytes, len);
+			dec->carry_len = len;
+			bytes += len;
+			len = 0;
+		}
+	}
+
+	*data = bytes;
+	*size = len;
+	if (dec->px_pos < dec->row_len) {
+		return QOI_STREAM_MORE;
+	}
+
+	dec->px_pos = 0;
+	dec->rows_left--;
+	*row = dec->row;
+	return QOI_STREAM_ROW;
+}
+
+void qoi_decoder_end(qoi_decoder_t* dec) {
+	if (dec != NULL) {
+		QOI_FREE(dec->row);
+		dec->row = NULL;
+		dec->failed = 1;
+	}
+}
+
+
+size_t qoi_decode_into_fmt(const void* data, size_t size, qoi_desc* desc, void* pixels, size_t stride, size_t pixels_cap, int fmt) {
+	const unsigned char* bytes;
+	size_t row_len, span, chunks_len;
+	int channels;
+	qoi_dec_state_t state;
+
+	if (
+		data == NULL || desc == NULL || pixels == NULL ||
+		(fmt != 0 && (fmt < QOI_FMT_RGB || fmt > QOI_FMT_RGBA_PREMUL))
+		) {
+		return 0;
+	}
+
+	bytes = (const unsigned char*)data;
+	if (!qoi_read_header(bytes, size, desc)) {
+		return 0;
+	}
+
+	if (fmt == 0) {
+		fmt = desc->channels;
+	}
+	channels = QOI_FMT_CHANNELS(fmt);
+
+	row_len = (size_t)desc->width * channels;
+	if (stride == 0) {
+		stride = row_len;
+	}
+	if (
+		stride < row_len ||
+		(size_t)(desc->height - 1) > (((size_t)-1) - row_len) / stride
+		) {
+		return 0;
+	}
+
+	/* The last row does not need the padding that follows it */
+	span = (size_t)(desc->height - 1) * stride + row_len;
+	if (pixels_cap < span) {
+		return 0;
+	}
+
+	chunks_len = size - sizeof(qoi_padding);
+	qoi_dec_state_init(&state);
+	switch (fmt) {
+		case QOI_FMT_RGBA:        qoi_decode_lines(bytes, QOI_HEADER_SIZE, chunks_len, &state, (unsigned char*)pixels, stride, row_len, desc->height, QOI_FMT_RGBA);        break;
+		case QOI_FMT_BGRA:        qoi_decode_lines(bytes, QOI_HEADER_SIZE, chunks_len, &state, (unsigned char*)pixels, stride, row_len, desc->height, QOI_FMT_BGRA);        break;
+		case QOI_FMT_ARGB:        qoi_decode_lines(bytes, QOI_HEADER_SIZE, chunks_len, &state, (unsigned char*)pixels, stride, row_len, desc->height, QOI_FMT_ARGB);        break;
+		case QOI_FMT_RGBA_PREMUL: qoi_decode_lines(bytes, QOI_HEADER_SIZE, chunks_len, &state, (unsigned char*)pixels, stride, row_len, desc->height, QOI_FMT_RGBA_PREMUL); break;
+		case QOI_FMT_BGR:         qoi_decode_lines(bytes, QOI_HEADER_SIZE, chunks_len, &state, (unsigned char*)pixels, stride, row_len, desc->height, QOI_FMT_BGR);         break;
+		default:                  qoi_decode_lines(bytes, QOI_HEADER_SIZE, chunks_len, &state, (unsigned char*)pixels, stride, row_len, desc->height, QOI_FMT_RGB);         break;
+	}
+
+	return span;
+}
+
+size_t qoi_decode_into_stride(const void* data, size_t size, qoi_desc* desc, void* pixels, size_t stride, size_t pixels_cap, int channels) {
+	if (channels != 0 && channels != 3 && channels != 4) {
+		return 0;
+	}
+	return qoi_decode_into_fmt(data, size, desc, pixels, stride, pixels_cap, channels);
+}
+
+size_t qoi_decode_into(const void* data, size_t size, qoi_desc* desc, void* pixels, size_t pixels_cap, int channels) {
+	return qoi_decode_into_stride(data, size, desc, pixels, 0, pixels_cap, channels);
+}
+
+void* qoi_decode_fmt(const void* data, size_t size, qoi_desc* desc, int fmt) {
+	unsigned char* pixels;
+	size_t px_len;
+
+	if (
+		data == NULL || desc == NULL ||
+		(fmt != 0 && (fmt < QOI_FMT_RGB || fmt > QOI_FMT_RGBA_PREMUL)) ||
+		!qoi_read_header((const unsigned char*)data, size, desc)
+		) {
+		return NULL;
+	}
+
+	px_len = (size_t)desc->width * desc->height * QOI_FMT_CHANNELS(fmt == 0 ? desc->channels : fmt);
+	pixels = (unsigned char*)QOI_MALLOC(px_len);
+	if (!pixels) {
+		return NULL;
+	}
+
+	qoi_decode_into_fmt(data, size, desc, pixels, 0, px_len, fmt);
+	return pixels;
+}
+
+void* qoi_decode(const void* data, size_t size, qoi_desc* desc, int channels) {
+	if (channels != 0 && channels != 3 && channels != 4) {
+		return NULL;
+	}
+	return qoi_decode_fmt(data, size, desc, channels);
+}
+
+/* Opcodes of the table-driven decoder */
+#define QOI_DT_INDEX 0
+#define QOI_DT_DIFF  1
+#define QOI_DT_LUMA  2
+#define QOI_DT_RUN   3
+#define QOI_DT_RGB   4
+#define QOI_DT_RGBA  5
+
+typedef struct {
+	unsigned char op;  /* one of QOI_DT_* */
+	unsigned char arg; /* index position for INDEX, run length - 1 for RUN */
+	signed char dr, dg, db; /* deltas for DIFF; vg - 8, vg, vg - 8 for LUMA */
+} qoi_op_t;
+
+/* Entry of qoi_op_table for the first byte b of a chunk */
+#define QOI_DT_OP_INDEX(b) { QOI_DT_INDEX, (b) & 0x3f, 0, 0, 0 }
+#define QOI_DT_OP_DIFF(b)  { QOI_DT_DIFF, (b) & 0x3f, (((b) >> 4) & 0x03) - 2, (((b) >> 2) & 0x03) - 2, ((b) & 0x03) - 2 }
+#define QOI_DT_OP_LUMA(b)  { QOI_DT_LUMA, (b) & 0x3f, ((b) & 0x3f) - 40, ((b) & 0x3f) - 32, ((b) & 0x3f) - 40 }
+#define QOI_DT_OP_RUN(b)   { QOI_DT_RUN, (b) & 0x3f, 0, 0, 0 }
+#define QOI_DT_OPS_4(m, b)  m(b), m((b) + 1), m((b) + 2), m((b) + 3)
+#define QOI_DT_OPS_16(m, b) QOI_DT_OPS_4(m, b), QOI_DT_OPS_4(m, (b) + 4), QOI_DT_OPS_4(m, (b) + 8), QOI_DT_OPS_4(m, (b) + 12)
+#define QOI_DT_OPS_64(m, b) QOI_DT_OPS_16(m, b), QOI_DT_OPS_16(m, (b) + 16), QOI_DT_OPS_16(m, (b) + 32), QOI_DT_OPS_16(m, (b) + 48)
+
+/* Decoded form of every possible first byte of a chunk */
+static const qoi_op_t qoi_op_table[256] = {
+	QOI_DT_OPS_64(QOI_DT_OP_INDEX, 0x00),
+	QOI_DT_OPS_64(QOI_DT_OP_DIFF, 0x40),
+	QOI_DT_OPS_64(QOI_DT_OP_LUMA, 0x80),
+	QOI_DT_OPS_16(QOI_DT_OP_RUN, 0xc0),
+	QOI_DT_OPS_16(QOI_DT_OP_RUN, 0xd0),
+	QOI_DT_OPS_16(QOI_DT_OP_RUN, 0xe0),
+	QOI_DT_OPS_4(QOI_DT_OP_RUN, 0xf0),
+	QOI_DT_OPS_4(QOI_DT_OP_RUN, 0xf4),
+	QOI_DT_OPS_4(QOI_DT_OP_RUN, 0xf8),
+	QOI_DT_OP_RUN(0xfc),
+	QOI_DT_OP_RUN(0xfd),
+	{ QOI_DT_RGB, 0x3e, 0, 0, 0 },
+	{ QOI_DT_RGBA, 0x3f, 0, 0, 0 }
+};
+
+void* qoi_decode_table(const void* data, size_t size, qoi_desc* desc, int channels) {
+	const unsigned char* bytes;
+	unsigned char* pixels;
+	qoi_rgba_t index[64];
+	qoi_rgba_t px;
+	size_t px_len, chunks_len, px_pos;
+	size_t p = QOI_HEADER_SIZE;
+	int run = 0;
+
+	if (
+		data == NULL || desc == NULL ||
+		(channels != 0 && channels != 3 && channels != 4)
+		) {
+		return NULL;
+	}
+
+	bytes = (const unsigned char*)data;
+	if (!qoi_read_header(bytes, size, desc)) {
+		return NULL;
+	}
+
+	if (channels == 0) {
+		channels = desc->channels;
+	}
+
+	px_len = (size_t)desc->width * desc->height * channels;
+	pixels = (unsigned char*)QOI_MALLOC(px_len);
+	if (!pixels) {
+		return NULL;
+	}
+
+	QOI_ZEROARR(index);
+	px.rgba.r = 0;
+	px.rgba.g = 0;
+	px.rgba.b = 0;
+	px.rgba.a = 255;
+
+	chunks_len = size - sizeof(qoi_padding);
+	for (px_pos = 0; px_pos < px_len; px_pos += channels) {
+		if (run > 0) {
+			run--;
+		}
+		else if (p < chunks_len) {
+			const qoi_op_t* op = &qoi_op_table[bytes[p++]];
+
+			switch (op->op) {
+			case QOI_DT_INDEX:
+				px = index[op->arg];
+				break;
+			case QOI_DT_DIFF:
+				px.rgba.r += op->dr;
+				px.rgba.g += op->dg;
+				px.rgba.b += op->db;
+				break;
+			case QOI_DT_LUMA: {
+				int b2 = bytes[p++];
+				px.rgba.r += op->dr + (b2 >> 4);
+				px.rgba.g += op->dg;
+				px.rgba.b += op->db + (b2 & 0x0f);
+				break;
+			}
+			case QOI_DT_RUN:
+				run = op->arg;
+				break;
+			case QOI_DT_RGB:
+				px.rgba.r = bytes[p++];
+				px.rgba.g = bytes[p++];
+				px.rgba.b = bytes[p++];
+				break;
+			default:
+				px.rgba.r = bytes[p++];
+				px.rgba.g = bytes[p++];
+				px.rgba.b = bytes[p++];
+				px.rgba.a = bytes[p++];
+				break;
+			}
+
+			index[QOI_COLOR_HASH(px) % 64] = px;
+		}
+
+		pixels[px_pos + 0] = px.rgba.r;
+		pixels[px_pos + 1] = px.rgba.g;
+		pixels[px_pos + 2] = px.rgba.b;
+
+		if (channels == 4) {
+			pixels[px_pos + 3] = px.rgba.a;
+		}
+	}
+
+	return pixels;
+}
+
+#ifndef QOI_NO_STDIO
+#include <stdio.h>
+
+/* 64-bit file positions, so files larger than 2GB can be sized */
+#ifdef _MSC_VER
+#define QOI_FSEEK64 _fseeki64
+#define QOI_FTELL64 _ftelli64
+#else
+#define QOI_FSEEK64 fseeko
+#define QOI_FTELL64 ftello
+#endif
+
+/* Size of the buffer qoi_write streams the encoded image through */
+#ifndef QOI_WRITE_BUF_SIZE
+#define QOI_WRITE_BUF_SIZE 65536
+#endif
+
+/* qoi_write_func that appends to a FILE* */
+static int qoi_fwrite_func(void* user, const void* data, size_t len) {
+	return fwrite(data, 1, len, (FILE*)user) == len;
+}
+
+size_t qoi_write(const char* filename, const void* data, const qoi_desc* desc) {
+	FILE* f;
+	qoi_encoder_t enc;
+	size_t size;
+	int err;
+	void* buf;
+
+	if (data == NULL || !qoi_valid_desc(desc)) {
+		return 0;
+	}
+
+	buf = QOI_MALLOC(QOI_WRITE_BUF_SIZE);
+	if (!buf) {
+		return 0;
+	}
+
+	f = fopen(filename, "wb");
+	if (!f) {
+		QOI_FREE(buf);
+		return 0;
+	}
+
+	/* Stream the encoded image to the file instead of encoding it whole in
+	memory first */
+	qoi_encoder_begin(&enc, desc, desc->channels, buf, QOI_WRITE_BUF_SIZE, qoi_fwrite_func, f);
+	qoi_encoder_push_rows(&enc, data, 0, desc->height);
+	size = qoi_encoder_finish(&enc);
+
+	fflush(f);
+	err = ferror(f);
+	fclose(f);
+
+	QOI_FREE(buf);
+	return err ? 0 : size;
+}
+
+/* Memory-mapped input: CreateFileMapping on Windows, mmap everywhere else.
+Define QOI_NO_MMAP to always read files with fread. */
+#ifndef QOI_NO_MMAP
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#endif
+
+const void* qoi_map_file(const char* filename, size_t* size, int flags) {
+#if defined(QOI_NO_MMAP)
+	(void)filename;
+	(void)size;
+	(void)flags;
+	return NULL;
+#elif defined(_WIN32)
+	HANDLE file, mapping;
+	LARGE_INTEGER file_size;
+	const unsigned char* data;
+	size_t i;
+
+	file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		(flags & QOI_MAP_SEQUENTIAL) ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return NULL;
+	}
+	if (
+		!GetFileSizeEx(file, &file_size) || file_size.QuadPart <= 0 ||
+		(unsigned long long)file_size.QuadPart > (size_t)-1
+		) {
+		CloseHandle(file);
+		return NULL;
+	}
+
+	/* The view keeps the file and the mapping open by itself */
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (mapping == NULL) {
+		return NULL;
+	}
+	data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (data == NULL) {
+		return NULL;
+	}
+	*size = (size_t)file_size.QuadPart;
+
+	/* There is no MAP_POPULATE, so touch every page once */
+	if (flags & QOI_MAP_POPULATE) {
+		volatile unsigned char sink = 0;
+		for (i = 0; i < *size; i += 4096) {
+			sink ^= data[i];
+		}
+		(void)sink;
+	}
+	return data;
+#else
+	int fd = open(filename, O_RDONLY);
+	int map_flags = MAP_PRIVATE;
+	struct stat st;
+	void* data;
+
+	/* Both flags are hints that not every system has */
+	(void)flags;
+	if (fd < 0) {
+		return NULL;
+	}
+	if (fstat(fd, &st) != 0 || st.st_size <= 0 || (unsigned long long)st.st_size > (size_t)-1) {
+		close(fd);
+		return NULL;
+	}
+
+#ifdef MAP_POPULATE
+	if (flags & QOI_MAP_POPULATE) {
+		map_flags |= MAP_POPULATE;
+	}
+#endif
+	data = mmap(NULL, (size_t)st.st_size, PROT_READ, map_flags, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return NULL;
+	}
+#ifdef POSIX_MADV_SEQUENTIAL
+	if (flags & QOI_MAP_SEQUENTIAL) {
+		posix_madvise(data, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+	}
+#endif
+	*size = (size_t)st.st_size;
+	return data;
+#endif
+}
+
+void qoi_unmap_file(const void* data, size_t size) {
+#if defined(QOI_NO_MMAP)
+	(void)data;
+	(void)size;
+#elif defined(_WIN32)
+	(void)size;
+	if (data != NULL) {
+		UnmapViewOfFile(data);
+	}
+#else
+	if (data != NULL) {
+		munmap((void*)data, size);
+	}
+#endif
+}
+
+/* Read a whole file into a malloc()ed buffer, for files that cannot be
+mapped. Returns NULL on failure. */
+static void* qoi_read_file(const char* filename, size_t* size) {
+	FILE* f = fopen(filename, "rb");
+	long long file_size;
+	size_t bytes_read;
+	void* data;
+
+	if (!f) {
+		return NULL;
+	}
+
+	QOI_FSEEK64(f, 0, SEEK_END);
+	file_size = QOI_FTELL64(f);
+	if (file_size <= 0 || (unsigned long long)file_size > (size_t)-1 || QOI_FSEEK64(f, 0, SEEK_SET) != 0) {
+		fclose(f);
+		return NULL;
+	}
+	*size = (size_t)file_size;
+
+	data = QOI_MALLOC(*size);
+	if (!data) {
+		fclose(f);
+		return NULL;
+	}
+
+	bytes_read = fread(data, 1, *size, f);
+	fclose(f);
+	if (bytes_read != *size) {
+		QOI_FREE(data);
+		return NULL;
+	}
+	return data;
+}
+
+void* qoi_read(const char* filename, qoi_desc* desc, int channels) {
+	size_t size;
+	const void* mapped = qoi_map_file(filename, &size, QOI_MAP_SEQUENTIAL);
+	void* pixels, * data;
+
+	if (mapped) {
+		pixels = qoi_decode(mapped, size, desc, channels);
+		qoi_unmap_file(mapped, size);
+		return pixels;
+	}
+
+	data = qoi_read_file(filename, &size);
+	if (!data) {
+		return NULL;
+	}
+	pixels = qoi_decode(data, size, desc, channels);
 	QOI_FREE(data);
 	return pixels;
 }